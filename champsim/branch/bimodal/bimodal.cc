@@ -1,32 +1,54 @@
-#include <map>
+#include <algorithm>
+#include <iostream>
+#include <vector>
 
+#include "modules.h"
 #include "ooo_cpu.h"
 
-constexpr std::size_t BIMODAL_TABLE_SIZE = 16384;
-constexpr std::size_t BIMODAL_PRIME = 16381;
-constexpr std::size_t COUNTER_BITS = 2;
-
-std::map<O3_CPU*, std::array<int, BIMODAL_TABLE_SIZE>> bimodal_table;
-
-void O3_CPU::initialize_branch_predictor()
-{
-  std::cout << "CPU " << cpu << " Bimodal branch predictor" << std::endl;
-  bimodal_table[this] = {};
-}
-
-uint8_t O3_CPU::predict_branch(uint64_t ip, uint64_t predicted_target, uint8_t always_taken, uint8_t branch_type)
+namespace
 {
-  uint32_t hash = ip % BIMODAL_PRIME;
-
-  return bimodal_table[this][hash] >= (1 << (COUNTER_BITS - 1));
-}
+constexpr std::size_t COUNTER_BITS = 2;
 
-void O3_CPU::last_branch_result(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type)
+class bimodal : public champsim::modules::branch_predictor
 {
-  uint32_t hash = ip % BIMODAL_PRIME;
-
-  if (taken)
-    bimodal_table[this][hash] = std::min(bimodal_table[this][hash] + 1, ((1 << COUNTER_BITS) - 1));
-  else
-    bimodal_table[this][hash] = std::max(bimodal_table[this][hash] - 1, 0);
-}
+  std::vector<int> bimodal_table;
+  std::size_t prime;
+
+public:
+  bimodal(O3_CPU* cpu, const champsim::json_value& params)
+      : branch_predictor(cpu), bimodal_table(champsim::modules::param<std::size_t>(params, "table_size", 16384))
+  {
+    // Hash by the largest prime that fits in the table
+    prime = std::size(bimodal_table);
+    auto is_prime = [](std::size_t n) {
+      for (std::size_t i = 2; i * i <= n; ++i)
+        if (n % i == 0)
+          return false;
+      return n >= 2;
+    };
+    while (prime > 2 && !is_prime(prime))
+      --prime;
+  }
+
+  void initialize() override { std::cout << "CPU " << intern_->cpu << " Bimodal branch predictor" << std::endl; }
+
+  uint8_t predict(uint64_t ip, uint64_t predicted_target, uint8_t always_taken, uint8_t branch_type, const champsim::modules::branch_context& context) override
+  {
+    uint32_t hash = ip % prime;
+
+    return bimodal_table[hash] >= (1 << (COUNTER_BITS - 1));
+  }
+
+  void last_result(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type, const champsim::modules::branch_context& context) override
+  {
+    uint32_t hash = ip % prime;
+
+    if (taken)
+      bimodal_table[hash] = std::min(bimodal_table[hash] + 1, ((1 << COUNTER_BITS) - 1));
+    else
+      bimodal_table[hash] = std::max(bimodal_table[hash] - 1, 0);
+  }
+};
+
+champsim::modules::registry<champsim::modules::branch_predictor>::add<bimodal> registered{"bimodal"};
+} // namespace
@@ -0,0 +1,506 @@
+/*
+ * This file implements a TAGE-SC-L conditional branch predictor, after
+ * Seznec, "TAGE-SC-L Branch Predictors Again," CBP-5, 2016, and the earlier
+ * "A New Case for the TAGE Branch Predictor," MICRO 2011.
+ *
+ * TAGE: a bimodal base table and a set of tagged tables indexed with global
+ * histories of geometrically increasing length. The longest matching table
+ * provides the prediction. Entries are allocated on mispredictions, and the
+ * useful bits that protect them from replacement are aged periodically.
+ *
+ * L: a small loop predictor, which overrides TAGE on loop exits once it has
+ * seen the same trip count several times in a row.
+ *
+ * SC: a statistical corrector, which sums counters indexed by the branch
+ * address, the TAGE prediction, and short global histories, and reverts
+ * TAGE predictions that are statistically biased the other way.
+ *
+ * All histories are folded incrementally (see inc/folded_history.h), so the
+ * cost per branch is proportional to the number of tables, not to the
+ * history length. Only conditional branches are predicted. Other branches
+ * are predicted taken, and only update the histories.
+ *
+ * The sizes are set with "branch_predictor_params": "tables",
+ * "log_table_size", "log_bimodal_size", "min_history", "max_history",
+ * "loop" and "sc". The defaults are 12 tagged tables of 1K entries, with
+ * histories from 4 to 640 branches. "loop": 0 and "sc": 0 remove the loop
+ * predictor and the statistical corrector, which leaves plain TAGE.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "folded_history.h"
+#include "modules.h"
+#include "ooo_cpu.h"
+
+namespace
+{
+// Saturating update of a signed counter of the given width
+template <typename T>
+void ctr_update(T& ctr, bool up, int nbits)
+{
+  if (up) {
+    if (ctr < (1 << (nbits - 1)) - 1)
+      ctr++;
+  } else {
+    if (ctr > -(1 << (nbits - 1)))
+      ctr--;
+  }
+}
+
+constexpr int TAGE_CTR_BITS = 3;
+constexpr int TAGE_U_MAX = 3;
+constexpr int BIMODAL_MAX = 3;
+constexpr int PATH_HISTORY_BITS = 27;
+constexpr int USE_ALT_BITS = 4;
+constexpr int U_RESET_PERIOD = 1024;
+
+// Loop predictor
+constexpr int LOOP_LOG_SIZE = 6;
+constexpr int LOOP_WAYS = 4;
+constexpr int LOOP_ITER_BITS = 10;
+constexpr int LOOP_TAG_BITS = 10;
+constexpr int LOOP_CONF_MAX = 15;
+constexpr int WITH_LOOP_BITS = 7;
+
+// Statistical corrector
+constexpr int SC_CTR_BITS = 6;
+constexpr int SC_LOG_SIZE = 10;
+constexpr int SC_CHOOSER_BITS = 7;
+constexpr int SC_THRESHOLD_INIT = 35 << 3;
+constexpr int SC_THRESHOLD_BITS = 12;
+constexpr unsigned SC_HISTORY[] = {40, 24, 16, 10, 6};
+
+struct tage_entry {
+  int8_t ctr = 0;
+  uint16_t tag = 0;
+  uint8_t u = 0;
+};
+
+struct loop_entry {
+  uint16_t nbiter = 0, currentiter = 0, tag = 0;
+  uint8_t confid = 0, age = 0;
+  bool dir = false;
+};
+
+class tage_sc_l : public champsim::modules::branch_predictor
+{
+  const std::size_t num_tables;
+  const unsigned log_table_size, log_bimodal_size;
+  const bool use_loop, use_sc;
+
+  std::vector<unsigned> history_length, tag_bits;
+  champsim::global_history ghist;
+  uint64_t phist = 0;
+
+  // TAGE
+  std::vector<int8_t> bimodal;
+  std::vector<std::vector<tage_entry>> tagged;
+  std::vector<champsim::folded_history> fold_index, fold_tag0, fold_tag1;
+  int use_alt_on_na = 0;
+  int tick = 0;
+  uint64_t rng = 0x2545F4914F6CDD1DULL;
+
+  // Loop predictor
+  std::vector<loop_entry> loops = std::vector<loop_entry>(1 << LOOP_LOG_SIZE);
+  int with_loop = -1;
+
+  // Statistical corrector
+  std::vector<int8_t> sc_bias = std::vector<int8_t>(1 << SC_LOG_SIZE), sc_bias_sk = std::vector<int8_t>(1 << SC_LOG_SIZE);
+  std::vector<std::vector<int8_t>> sc_gehl = std::vector<std::vector<int8_t>>(std::size(SC_HISTORY), std::vector<int8_t>(1 << SC_LOG_SIZE));
+  std::vector<champsim::folded_history> sc_fold;
+  int sc_threshold = SC_THRESHOLD_INIT;
+  int first_h = 0, second_h = 0;
+
+  // The state of the last prediction, kept for its update
+  struct {
+    uint64_t ip = 0;
+    std::vector<std::size_t> index;
+    std::vector<uint16_t> tag;
+    std::size_t hit_bank = 0, alt_bank = 0;
+    bool longest_pred = false, alt_pred = false, tage_pred = false, pseudo_new = false;
+    bool high_conf = false, med_conf = false;
+    int loop_hit = -1;
+    bool loop_valid = false, loop_pred = false;
+    bool pred_inter = false;
+    std::vector<std::size_t> sc_index;
+    int sc_sum = 0;
+    bool sc_pred = false;
+    bool prediction = false;
+  } last;
+
+  uint64_t next_random() { return rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17; }
+
+  std::size_t bimodal_index(uint64_t ip) const { return (ip ^ (ip >> 2)) & bitmask(log_bimodal_size); }
+
+  // Seznec's path history hash
+  uint64_t path_hash(uint64_t path, unsigned size, unsigned bank) const
+  {
+    const unsigned logg = log_table_size;
+    bank %= logg;
+    path &= bitmask(std::min(size, 63u));
+    uint64_t a1 = path & bitmask(logg);
+    uint64_t a2 = path >> logg;
+    if (bank != 0)
+      a2 = ((a2 << bank) & bitmask(logg)) + (a2 >> (logg - bank));
+    path = a1 ^ a2;
+    if (bank != 0)
+      path = ((path << bank) & bitmask(logg)) + (path >> (logg - bank));
+    return path;
+  }
+
+  std::size_t tagged_index(uint64_t ip, std::size_t i) const
+  {
+    uint64_t index = ip ^ (ip >> (std::abs(static_cast<int>(log_table_size) - static_cast<int>(i)) + 1)) ^ fold_index[i].value()
+                     ^ path_hash(phist, std::min<unsigned>(history_length[i], PATH_HISTORY_BITS), i);
+    return index & bitmask(log_table_size);
+  }
+
+  uint16_t tagged_tag(uint64_t ip, std::size_t i) const { return (ip ^ fold_tag0[i].value() ^ (fold_tag1[i].value() << 1)) & bitmask(tag_bits[i]); }
+
+  std::size_t loop_set(uint64_t ip) const { return ((ip ^ (ip >> 2)) & bitmask(LOOP_LOG_SIZE - 2)) * LOOP_WAYS; }
+  uint16_t loop_tag(uint64_t ip) const { return (ip >> (LOOP_LOG_SIZE - 2)) & bitmask(LOOP_TAG_BITS); }
+
+  void predict_tage(uint64_t ip);
+  void predict_loop(uint64_t ip);
+  void predict_sc(uint64_t ip);
+  void update_tage(bool taken);
+  void update_loop(uint64_t ip, bool taken);
+  void update_sc(bool taken);
+  void update_history(uint64_t ip, uint64_t branch_target, bool taken, uint8_t branch_type);
+
+public:
+  tage_sc_l(O3_CPU* cpu, const champsim::json_value& params)
+      : branch_predictor(cpu), num_tables(champsim::modules::param<std::size_t>(params, "tables", 12)),
+        log_table_size(champsim::modules::param<unsigned>(params, "log_table_size", 10)),
+        log_bimodal_size(champsim::modules::param<unsigned>(params, "log_bimodal_size", 13)),
+        use_loop(champsim::modules::param<int>(params, "loop", 1) != 0), use_sc(champsim::modules::param<int>(params, "sc", 1) != 0),
+        ghist(std::max(champsim::modules::param<unsigned>(params, "max_history", 640), *std::max_element(std::begin(SC_HISTORY), std::end(SC_HISTORY)))),
+        bimodal(std::size_t{1} << log_bimodal_size, BIMODAL_MAX / 2 + 1), tagged(num_tables, std::vector<tage_entry>(std::size_t{1} << log_table_size))
+  {
+    // Geometric history lengths, and longer tags for the longer histories
+    const double min_history = champsim::modules::param<unsigned>(params, "min_history", 4);
+    const double max_history = champsim::modules::param<unsigned>(params, "max_history", 640);
+    for (std::size_t i = 0; i < num_tables; ++i) {
+      double ratio = num_tables > 1 ? static_cast<double>(i) / (num_tables - 1) : 0;
+      history_length.push_back(static_cast<unsigned>(min_history * std::pow(max_history / min_history, ratio) + 0.5));
+      tag_bits.push_back(8 + static_cast<unsigned>(5 * ratio + 0.5));
+
+      fold_index.emplace_back(history_length[i], log_table_size);
+      fold_tag0.emplace_back(history_length[i], tag_bits[i]);
+      fold_tag1.emplace_back(history_length[i], tag_bits[i] - 1);
+    }
+
+    for (auto length : SC_HISTORY)
+      sc_fold.emplace_back(length, SC_LOG_SIZE);
+
+    last.index.resize(num_tables);
+    last.tag.resize(num_tables);
+    last.sc_index.resize(2 + std::size(SC_HISTORY));
+  }
+
+  void initialize() override
+  {
+    std::cout << "CPU " << intern_->cpu << " TAGE-SC-L branch predictor, " << num_tables << " tagged tables of " << (1 << log_table_size)
+              << " entries, histories " << history_length.front() << " to " << history_length.back() << (use_loop ? ", loop predictor" : "")
+              << (use_sc ? ", statistical corrector" : "") << std::endl;
+  }
+
+  uint8_t predict(uint64_t ip, uint64_t predicted_target, uint8_t always_taken, uint8_t branch_type, const champsim::modules::branch_context& context) override
+  {
+    last.ip = ip;
+    if (branch_type != BRANCH_CONDITIONAL)
+      return last.prediction = true;
+
+    predict_tage(ip);
+    last.pred_inter = last.tage_pred;
+
+    if (use_loop) {
+      predict_loop(ip);
+      if (last.loop_valid && with_loop >= 0)
+        last.pred_inter = last.loop_pred;
+    }
+
+    last.prediction = last.pred_inter;
+    if (use_sc)
+      predict_sc(ip);
+
+    return last.prediction;
+  }
+
+  void last_result(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type, const champsim::modules::branch_context& context) override
+  {
+    if (branch_type == BRANCH_CONDITIONAL) {
+      // The core predicts each branch just before its update, so the state of the last prediction is this branch's
+      if (ip != last.ip)
+        predict(ip, branch_target, false, branch_type, context);
+
+      if (use_sc)
+        update_sc(taken);
+      if (use_loop)
+        update_loop(ip, taken);
+      update_tage(taken);
+    }
+
+    update_history(ip, branch_target, taken, branch_type);
+  }
+};
+
+void tage_sc_l::predict_tage(uint64_t ip)
+{
+  last.hit_bank = 0;
+  last.alt_bank = 0;
+  for (std::size_t i = 0; i < num_tables; ++i) {
+    last.index[i] = tagged_index(ip, i);
+    last.tag[i] = tagged_tag(ip, i);
+  }
+
+  // Banks are numbered from 1, and 0 is the bimodal table
+  for (std::size_t i = num_tables; i > 0; --i) {
+    if (tagged[i - 1][last.index[i - 1]].tag == last.tag[i - 1]) {
+      if (last.hit_bank == 0) {
+        last.hit_bank = i;
+      } else {
+        last.alt_bank = i;
+        break;
+      }
+    }
+  }
+
+  const int8_t base_ctr = bimodal[bimodal_index(ip)];
+  const bool base_pred = base_ctr > BIMODAL_MAX / 2;
+
+  if (last.hit_bank > 0) {
+    const tage_entry& longest = tagged[last.hit_bank - 1][last.index[last.hit_bank - 1]];
+    last.longest_pred = longest.ctr >= 0;
+    last.alt_pred = last.alt_bank > 0 ? tagged[last.alt_bank - 1][last.index[last.alt_bank - 1]].ctr >= 0 : base_pred;
+    last.pseudo_new = (longest.ctr == 0 || longest.ctr == -1) && longest.u == 0;
+
+    last.tage_pred = (last.pseudo_new && use_alt_on_na >= 0) ? last.alt_pred : last.longest_pred;
+
+    int confidence = std::abs(2 * longest.ctr + 1);
+    last.high_conf = confidence >= (1 << TAGE_CTR_BITS) - 1;
+    last.med_conf = confidence == (1 << TAGE_CTR_BITS) - 3;
+  } else {
+    last.longest_pred = last.alt_pred = last.tage_pred = base_pred;
+    last.pseudo_new = false;
+    last.high_conf = base_ctr == 0 || base_ctr == BIMODAL_MAX;
+    last.med_conf = false;
+  }
+}
+
+void tage_sc_l::predict_loop(uint64_t ip)
+{
+  last.loop_hit = -1;
+  last.loop_valid = false;
+
+  const std::size_t set = loop_set(ip);
+  const uint16_t tag = loop_tag(ip);
+  for (int way = 0; way < LOOP_WAYS; ++way) {
+    const loop_entry& entry = loops[set + way];
+    if (entry.tag == tag) {
+      last.loop_hit = set + way;
+      last.loop_valid = entry.confid == LOOP_CONF_MAX || entry.confid * entry.nbiter > 128;
+      last.loop_pred = (entry.currentiter + 1 == entry.nbiter) ? !entry.dir : entry.dir;
+      return;
+    }
+  }
+}
+
+void tage_sc_l::predict_sc(uint64_t ip)
+{
+  const bool pred = last.pred_inter;
+  last.sc_index[0] = (((ip ^ (ip >> 2)) << 1) ^ pred) & bitmask(SC_LOG_SIZE);
+  last.sc_index[1] = (((ip ^ (ip >> (SC_LOG_SIZE - 2))) << 2) ^ (last.high_conf << 1) ^ pred) & bitmask(SC_LOG_SIZE);
+  for (std::size_t i = 0; i < std::size(SC_HISTORY); ++i)
+    last.sc_index[2 + i] = (ip ^ (ip >> (2 * i + 3)) ^ (sc_fold[i].value() << 1) ^ pred) & bitmask(SC_LOG_SIZE);
+
+  int sum = (2 * sc_bias[last.sc_index[0]] + 1) + (2 * sc_bias_sk[last.sc_index[1]] + 1);
+  for (std::size_t i = 0; i < std::size(SC_HISTORY); ++i)
+    sum += 2 * sc_gehl[i][last.sc_index[2 + i]] + 1;
+
+  last.sc_sum = sum;
+  last.sc_pred = sum >= 0;
+
+  // Revert the TAGE prediction only when the corrector disagrees with enough confidence
+  const int threshold = sc_threshold >> 3;
+  if (last.sc_pred != pred) {
+    last.prediction = last.sc_pred;
+    if (last.high_conf) {
+      if (std::abs(sum) < threshold / 4)
+        last.prediction = pred;
+      else if (std::abs(sum) < threshold / 2)
+        last.prediction = (second_h < 0) ? last.sc_pred : pred;
+    }
+    if (last.med_conf && std::abs(sum) < threshold / 4)
+      last.prediction = (first_h < 0) ? last.sc_pred : pred;
+  }
+}
+
+void tage_sc_l::update_sc(bool taken)
+{
+  const int threshold = sc_threshold >> 3;
+  const int sum = std::abs(last.sc_sum);
+
+  if (last.pred_inter != last.sc_pred) {
+    if (last.high_conf && sum < threshold / 2 && sum >= threshold / 4)
+      ctr_update(second_h, last.pred_inter == taken, SC_CHOOSER_BITS);
+    if (last.med_conf && sum < threshold / 4)
+      ctr_update(first_h, last.pred_inter == taken, SC_CHOOSER_BITS);
+  }
+
+  if (last.sc_pred != taken || sum < threshold) {
+    sc_threshold += (last.sc_pred != taken) ? 1 : -1;
+    sc_threshold = std::clamp(sc_threshold, 0, (1 << SC_THRESHOLD_BITS) - 1);
+
+    ctr_update(sc_bias[last.sc_index[0]], taken, SC_CTR_BITS);
+    ctr_update(sc_bias_sk[last.sc_index[1]], taken, SC_CTR_BITS);
+    for (std::size_t i = 0; i < std::size(SC_HISTORY); ++i)
+      ctr_update(sc_gehl[i][last.sc_index[2 + i]], taken, SC_CTR_BITS);
+  }
+}
+
+void tage_sc_l::update_loop(uint64_t ip, bool taken)
+{
+  if (last.loop_valid && last.tage_pred != last.loop_pred)
+    ctr_update(with_loop, taken == last.loop_pred, WITH_LOOP_BITS);
+
+  if (last.loop_hit >= 0) {
+    loop_entry& entry = loops[last.loop_hit];
+    if (last.loop_valid) {
+      if (taken != last.loop_pred) {
+        // Not a loop after all, free the entry
+        entry = loop_entry{};
+        return;
+      } else if (last.loop_pred != last.tage_pred && entry.age < UINT8_MAX) {
+        entry.age++;
+      }
+    }
+
+    entry.currentiter = (entry.currentiter + 1) & bitmask(LOOP_ITER_BITS);
+    if (entry.currentiter > entry.nbiter) {
+      entry.confid = 0;
+      entry.nbiter = 0;
+    }
+
+    if (taken != entry.dir) {
+      if (entry.currentiter == entry.nbiter) {
+        if (entry.confid < LOOP_CONF_MAX)
+          entry.confid++;
+        // Too short to be worth predicting
+        if (entry.nbiter < 3) {
+          entry.dir = taken;
+          entry.nbiter = 0;
+          entry.age = 0;
+          entry.confid = 0;
+        }
+      } else {
+        if (entry.nbiter == 0) {
+          // The first complete trip of the loop
+          entry.confid = 0;
+          entry.nbiter = entry.currentiter;
+        } else {
+          // The trip count changed
+          entry.nbiter = 0;
+          entry.confid = 0;
+        }
+      }
+      entry.currentiter = 0;
+    }
+  } else if (last.tage_pred != taken) {
+    // Allocate on a TAGE misprediction, to a random way that has aged out
+    loop_entry& entry = loops[loop_set(ip) + (next_random() % LOOP_WAYS)];
+    if (entry.age == 0) {
+      entry = loop_entry{};
+      entry.dir = !taken;
+      entry.tag = loop_tag(ip);
+      entry.age = 7;
+    } else {
+      entry.age--;
+    }
+  }
+}
+
+void tage_sc_l::update_tage(bool taken)
+{
+  const std::size_t hit_bank = last.hit_bank;
+  tage_entry* longest = hit_bank > 0 ? &tagged[hit_bank - 1][last.index[hit_bank - 1]] : nullptr;
+
+  bool alloc = (last.tage_pred != taken) && (hit_bank < num_tables);
+  if (longest != nullptr && last.pseudo_new) {
+    if (last.longest_pred == taken)
+      alloc = false;
+    if (last.longest_pred != last.alt_pred)
+      ctr_update(use_alt_on_na, last.alt_pred == taken, USE_ALT_BITS);
+  }
+
+  if (alloc) {
+    // Allocate one entry in a longer table, sometimes skipping the next one, and age the useful bits when the tables are full
+    std::size_t start = hit_bank + ((next_random() & 127) < 32 ? 2 : 1);
+    int penalty = 0, allocated = 0;
+    for (std::size_t i = start; i <= num_tables; ++i) {
+      tage_entry& entry = tagged[i - 1][last.index[i - 1]];
+      if (entry.u == 0) {
+        entry.tag = last.tag[i - 1];
+        entry.ctr = taken ? 0 : -1;
+        allocated++;
+        break;
+      }
+      penalty++;
+    }
+
+    tick = std::max(tick + penalty - 2 * allocated, 0);
+    if (tick >= U_RESET_PERIOD) {
+      for (auto& table : tagged)
+        for (auto& entry : table)
+          entry.u >>= 1;
+      tick = 0;
+    }
+  }
+
+  if (longest != nullptr) {
+    // A newly allocated entry has not learned yet, so train the alternate prediction too
+    if (longest->u == 0) {
+      if (last.alt_bank > 0)
+        ctr_update(tagged[last.alt_bank - 1][last.index[last.alt_bank - 1]].ctr, taken, TAGE_CTR_BITS);
+      else
+        bimodal[bimodal_index(last.ip)] = std::clamp(bimodal[bimodal_index(last.ip)] + (taken ? 1 : -1), 0, BIMODAL_MAX);
+    }
+
+    ctr_update(longest->ctr, taken, TAGE_CTR_BITS);
+
+    if (last.longest_pred != last.alt_pred) {
+      if (last.longest_pred == taken) {
+        if (longest->u < TAGE_U_MAX)
+          longest->u++;
+      } else if (longest->u > 0) {
+        longest->u--;
+      }
+    }
+  } else {
+    bimodal[bimodal_index(last.ip)] = std::clamp(bimodal[bimodal_index(last.ip)] + (taken ? 1 : -1), 0, BIMODAL_MAX);
+  }
+}
+
+void tage_sc_l::update_history(uint64_t ip, uint64_t branch_target, bool taken, uint8_t branch_type)
+{
+  // Conditional branches add their direction. Other branches add a bit of their address and target, so that the paths through them differ.
+  bool bit = (branch_type == BRANCH_CONDITIONAL) ? taken : ((ip ^ branch_target) * 0x9E3779B97F4A7C15ULL) >> 63;
+  ghist.push(bit);
+  phist = ((phist << 1) ^ ((ip ^ (ip >> 2)) & 1)) & bitmask(PATH_HISTORY_BITS);
+
+  for (std::size_t i = 0; i < num_tables; ++i) {
+    fold_index[i].update(ghist);
+    fold_tag0[i].update(ghist);
+    fold_tag1[i].update(ghist);
+  }
+  for (auto& fold : sc_fold)
+    fold.update(ghist);
+}
+
+champsim::modules::registry<champsim::modules::branch_predictor>::add<tage_sc_l> registered{"tage_sc_l"};
+} // namespace
@@ -1,43 +1,39 @@
-
 /*
  * This file implements a basic Branch Target Buffer (BTB) structure.
  * It uses a set-associative BTB to predict the targets of non-return branches,
  * and it uses a small Return Address Stack (RAS) to predict the target of
  * returns.
+ *
+ * The sizes are set with "btb_params": "sets", "ways", "indirect_size", and
+ * "ras_size". The sets and the indirect buffer are indexed by masking, so their
+ * sizes must be powers of two. With "asid_tags": 1, the BTB and the indirect
+ * buffer entries are tagged with the address space that wrote them, and only
+ * predict for that address space.
  */
 
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "modules.h"
 #include "ooo_cpu.h"
 
-#define BASIC_BTB_SETS 1024
-#define BASIC_BTB_WAYS 8
-#define BASIC_BTB_INDIRECT_SIZE 4096
-#define BASIC_BTB_RAS_SIZE 64
-#define BASIC_BTB_CALL_INSTR_SIZE_TRACKERS 1024
+namespace
+{
+constexpr std::size_t BASIC_BTB_CALL_INSTR_SIZE_TRACKERS = 1024;
 
 struct BASIC_BTB_ENTRY {
-  uint64_t ip_tag;
-  uint64_t target;
-  uint8_t always_taken;
-  uint64_t lru;
+  uint64_t ip_tag = 0;
+  uint64_t target = 0;
+  uint8_t always_taken = 0;
+  uint16_t asid = 0;
+  uint64_t lru = 0;
 };
 
-BASIC_BTB_ENTRY basic_btb[NUM_CPUS][BASIC_BTB_SETS][BASIC_BTB_WAYS];
-uint64_t basic_btb_lru_counter[NUM_CPUS];
-
-uint64_t basic_btb_indirect[NUM_CPUS][BASIC_BTB_INDIRECT_SIZE];
-uint64_t basic_btb_conditional_history[NUM_CPUS];
-
-uint64_t basic_btb_ras[NUM_CPUS][BASIC_BTB_RAS_SIZE];
-int basic_btb_ras_index[NUM_CPUS];
-/*
- * The following two variables are used to automatically identify the
- * size of call instructions, in bytes, which tells us the appropriate
- * target for a call's corresponding return.
- * They exist because ChampSim does not model a specific ISA, and
- * different ISAs could use different sizes for call instructions,
- * and even within the same ISA, calls can have different sizes.
- */
-uint64_t basic_btb_call_instr_sizes[NUM_CPUS][BASIC_BTB_CALL_INSTR_SIZE_TRACKERS];
+struct BASIC_BTB_INDIRECT_ENTRY {
+  uint64_t target = 0;
+  uint16_t asid = 0;
+};
 
 uint64_t basic_btb_abs_addr_dist(uint64_t addr1, uint64_t addr2)
 {
@@ -48,192 +44,191 @@ uint64_t basic_btb_abs_addr_dist(uint64_t addr1, uint64_t addr2)
   return addr2 - addr1;
 }
 
-uint64_t basic_btb_set_index(uint64_t ip) { return ((ip >> 2) & (BASIC_BTB_SETS - 1)); }
+uint64_t basic_btb_call_size_tracker_hash(uint64_t ip) { return (ip & (BASIC_BTB_CALL_INSTR_SIZE_TRACKERS - 1)); }
 
-BASIC_BTB_ENTRY* basic_btb_find_entry(uint8_t cpu, uint64_t ip)
+class basic_btb : public champsim::modules::btb
 {
-  uint64_t set = basic_btb_set_index(ip);
-  for (uint32_t i = 0; i < BASIC_BTB_WAYS; i++) {
-    if (basic_btb[cpu][set][i].ip_tag == ip) {
-      return &(basic_btb[cpu][set][i]);
-    }
+  const std::size_t sets, ways, indirect_size, ras_size;
+  const bool asid_tags;
+
+  std::vector<BASIC_BTB_ENTRY> entries;
+  uint64_t lru_counter = 0;
+
+  std::vector<BASIC_BTB_INDIRECT_ENTRY> indirect;
+  uint64_t conditional_history = 0;
+
+  std::vector<uint64_t> ras;
+  std::size_t ras_index = 0;
+  /*
+   * The following two variables are used to automatically identify the
+   * size of call instructions, in bytes, which tells us the appropriate
+   * target for a call's corresponding return.
+   * They exist because ChampSim does not model a specific ISA, and
+   * different ISAs could use different sizes for call instructions,
+   * and even within the same ISA, calls can have different sizes.
+   */
+  std::vector<uint64_t> call_instr_sizes = std::vector<uint64_t>(BASIC_BTB_CALL_INSTR_SIZE_TRACKERS, 4);
+
+  uint64_t set_index(uint64_t ip) const { return ((ip >> 2) & (sets - 1)); }
+
+  // Without ASID tags, all address spaces share entries under ASID 0
+  uint16_t asid_tag(const champsim::modules::branch_context& context) const { return asid_tags ? context.asid : 0; }
+
+  BASIC_BTB_ENTRY* find_entry(uint64_t ip, uint16_t asid)
+  {
+    auto begin = std::next(std::begin(entries), set_index(ip) * ways);
+    auto end = std::next(begin, ways);
+    auto found = std::find_if(begin, end, [ip, asid](const BASIC_BTB_ENTRY& x) { return x.ip_tag == ip && x.asid == asid; });
+    return found == end ? nullptr : &*found;
   }
 
-  return NULL;
-}
-
-BASIC_BTB_ENTRY* basic_btb_get_lru_entry(uint8_t cpu, uint64_t set)
-{
-  uint32_t lru_way = 0;
-  uint64_t lru_value = basic_btb[cpu][set][lru_way].lru;
-  for (uint32_t i = 0; i < BASIC_BTB_WAYS; i++) {
-    if (basic_btb[cpu][set][i].lru < lru_value) {
-      lru_way = i;
-      lru_value = basic_btb[cpu][set][lru_way].lru;
-    }
+  BASIC_BTB_ENTRY* get_lru_entry(uint64_t set)
+  {
+    auto begin = std::next(std::begin(entries), set * ways);
+    return &*std::min_element(begin, std::next(begin, ways), [](const BASIC_BTB_ENTRY& x, const BASIC_BTB_ENTRY& y) { return x.lru < y.lru; });
   }
 
-  return &(basic_btb[cpu][set][lru_way]);
-}
+  void update_lru(BASIC_BTB_ENTRY* btb_entry) { btb_entry->lru = lru_counter++; }
 
-void basic_btb_update_lru(uint8_t cpu, BASIC_BTB_ENTRY* btb_entry)
-{
-  btb_entry->lru = basic_btb_lru_counter[cpu];
-  basic_btb_lru_counter[cpu]++;
-}
-
-uint64_t basic_btb_indirect_hash(uint8_t cpu, uint64_t ip)
-{
-  uint64_t hash = (ip >> 2) ^ (basic_btb_conditional_history[cpu]);
-  return (hash & (BASIC_BTB_INDIRECT_SIZE - 1));
-}
-
-void push_basic_btb_ras(uint8_t cpu, uint64_t ip)
-{
-  basic_btb_ras_index[cpu]++;
-  if (basic_btb_ras_index[cpu] == BASIC_BTB_RAS_SIZE) {
-    basic_btb_ras_index[cpu] = 0;
+  uint64_t indirect_hash(uint64_t ip) const
+  {
+    uint64_t hash = (ip >> 2) ^ conditional_history;
+    return (hash & (indirect_size - 1));
   }
 
-  basic_btb_ras[cpu][basic_btb_ras_index[cpu]] = ip;
-}
-
-uint64_t peek_basic_btb_ras(uint8_t cpu) { return basic_btb_ras[cpu][basic_btb_ras_index[cpu]]; }
-
-uint64_t pop_basic_btb_ras(uint8_t cpu)
-{
-  uint64_t target = basic_btb_ras[cpu][basic_btb_ras_index[cpu]];
-  basic_btb_ras[cpu][basic_btb_ras_index[cpu]] = 0;
+  void push_ras(uint64_t ip)
+  {
+    ras_index++;
+    if (ras_index == ras_size) {
+      ras_index = 0;
+    }
 
-  basic_btb_ras_index[cpu]--;
-  if (basic_btb_ras_index[cpu] == -1) {
-    basic_btb_ras_index[cpu] += BASIC_BTB_RAS_SIZE;
+    ras[ras_index] = ip;
   }
 
-  return target;
-}
-
-uint64_t basic_btb_call_size_tracker_hash(uint64_t ip) { return (ip & (BASIC_BTB_CALL_INSTR_SIZE_TRACKERS - 1)); }
-
-uint64_t basic_btb_get_call_size(uint8_t cpu, uint64_t ip)
-{
-  uint64_t size = basic_btb_call_instr_sizes[cpu][basic_btb_call_size_tracker_hash(ip)];
+  uint64_t peek_ras() const { return ras[ras_index]; }
 
-  return size;
-}
+  uint64_t pop_ras()
+  {
+    uint64_t target = ras[ras_index];
+    ras[ras_index] = 0;
 
-void O3_CPU::initialize_btb()
-{
-  std::cout << "Basic BTB sets: " << BASIC_BTB_SETS << " ways: " << BASIC_BTB_WAYS << " indirect buffer size: " << BASIC_BTB_INDIRECT_SIZE
-            << " RAS size: " << BASIC_BTB_RAS_SIZE << std::endl;
-
-  for (uint32_t i = 0; i < BASIC_BTB_SETS; i++) {
-    for (uint32_t j = 0; j < BASIC_BTB_WAYS; j++) {
-      basic_btb[cpu][i][j].ip_tag = 0;
-      basic_btb[cpu][i][j].target = 0;
-      basic_btb[cpu][i][j].always_taken = 0;
-      basic_btb[cpu][i][j].lru = 0;
+    if (ras_index == 0) {
+      ras_index = ras_size;
     }
-  }
-  basic_btb_lru_counter[cpu] = 0;
+    ras_index--;
 
-  for (uint32_t i = 0; i < BASIC_BTB_INDIRECT_SIZE; i++) {
-    basic_btb_indirect[cpu][i] = 0;
+    return target;
   }
-  basic_btb_conditional_history[cpu] = 0;
 
-  for (uint32_t i = 0; i < BASIC_BTB_RAS_SIZE; i++) {
-    basic_btb_ras[cpu][i] = 0;
-  }
-  basic_btb_ras_index[cpu] = 0;
-  for (uint32_t i = 0; i < BASIC_BTB_CALL_INSTR_SIZE_TRACKERS; i++) {
-    basic_btb_call_instr_sizes[cpu][i] = 4;
-  }
-}
+  uint64_t get_call_size(uint64_t ip) const { return call_instr_sizes[basic_btb_call_size_tracker_hash(ip)]; }
 
-std::pair<uint64_t, uint8_t> O3_CPU::btb_prediction(uint64_t ip, uint8_t branch_type)
-{
-  uint8_t always_taken = false;
-  if (branch_type != BRANCH_CONDITIONAL) {
-    always_taken = true;
+public:
+  basic_btb(O3_CPU* cpu, const champsim::json_value& params)
+      : btb(cpu), sets(champsim::modules::param<std::size_t>(params, "sets", 1024)), ways(champsim::modules::param<std::size_t>(params, "ways", 8)),
+        indirect_size(champsim::modules::param<std::size_t>(params, "indirect_size", 4096)),
+        ras_size(champsim::modules::param<std::size_t>(params, "ras_size", 64)), asid_tags(champsim::modules::param<bool>(params, "asid_tags", false)), entries(sets * ways), indirect(indirect_size), ras(ras_size)
+  {
   }
 
-  if ((branch_type == BRANCH_DIRECT_CALL) || (branch_type == BRANCH_INDIRECT_CALL)) {
-    // add something to the RAS
-    push_basic_btb_ras(cpu, ip);
+  void initialize() override
+  {
+    std::cout << "Basic BTB sets: " << sets << " ways: " << ways << " indirect buffer size: " << indirect_size << " RAS size: " << ras_size
+              << (asid_tags ? " ASID tagged" : "") << std::endl;
   }
 
-  if (branch_type == BRANCH_RETURN) {
-    // peek at the top of the RAS
-    uint64_t target = peek_basic_btb_ras(cpu);
-    // and adjust for the size of the call instr
-    target += basic_btb_get_call_size(cpu, target);
-
-    return std::make_pair(target, always_taken);
-  } else if ((branch_type == BRANCH_INDIRECT) || (branch_type == BRANCH_INDIRECT_CALL)) {
-    return std::make_pair(basic_btb_indirect[cpu][basic_btb_indirect_hash(cpu, ip)], always_taken);
-  } else {
-    // use BTB for all other branches + direct calls
-    auto btb_entry = basic_btb_find_entry(cpu, ip);
-
-    if (btb_entry == NULL) {
-      // no prediction for this IP
+  std::pair<uint64_t, uint8_t> prediction(uint64_t ip, uint8_t branch_type, const champsim::modules::branch_context& context) override
+  {
+    const uint16_t asid = asid_tag(context);
+
+    uint8_t always_taken = false;
+    if (branch_type != BRANCH_CONDITIONAL) {
       always_taken = true;
-      return std::make_pair(0, always_taken);
     }
 
-    always_taken = btb_entry->always_taken;
-    basic_btb_update_lru(cpu, btb_entry);
+    if ((branch_type == BRANCH_DIRECT_CALL) || (branch_type == BRANCH_INDIRECT_CALL)) {
+      // add something to the RAS
+      push_ras(ip);
+    }
 
-    return std::make_pair(btb_entry->target, always_taken);
-  }
+    if (branch_type == BRANCH_RETURN) {
+      // peek at the top of the RAS
+      uint64_t target = peek_ras();
+      // and adjust for the size of the call instr
+      target += get_call_size(target);
 
-  return std::make_pair(0, always_taken);
-}
+      return std::make_pair(target, always_taken);
+    } else if ((branch_type == BRANCH_INDIRECT) || (branch_type == BRANCH_INDIRECT_CALL)) {
+      const auto& indirect_entry = indirect[indirect_hash(ip)];
+      return std::make_pair(indirect_entry.asid == asid ? indirect_entry.target : 0, always_taken);
+    } else {
+      // use BTB for all other branches + direct calls
+      auto btb_entry = find_entry(ip, asid);
 
-void O3_CPU::update_btb(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type)
-{
-  // updates for indirect branches
-  if ((branch_type == BRANCH_INDIRECT) || (branch_type == BRANCH_INDIRECT_CALL)) {
-    basic_btb_indirect[cpu][basic_btb_indirect_hash(cpu, ip)] = branch_target;
-  }
-  if (branch_type == BRANCH_CONDITIONAL) {
-    basic_btb_conditional_history[cpu] <<= 1;
-    if (taken) {
-      basic_btb_conditional_history[cpu] |= 1;
+      if (btb_entry == nullptr) {
+        // no prediction for this IP
+        always_taken = true;
+        return std::make_pair(0, always_taken);
+      }
+
+      always_taken = btb_entry->always_taken;
+      update_lru(btb_entry);
+
+      return std::make_pair(btb_entry->target, always_taken);
     }
+
+    return std::make_pair(0, always_taken);
   }
 
-  if (branch_type == BRANCH_RETURN) {
-    // recalibrate call-return offset
-    // if our return prediction got us into the right ball park, but not the
-    // exactly correct byte target, then adjust our call instr size tracker
-    uint64_t call_ip = pop_basic_btb_ras(cpu);
-    uint64_t estimated_call_instr_size = basic_btb_abs_addr_dist(call_ip, branch_target);
-    if (estimated_call_instr_size <= 10) {
-      basic_btb_call_instr_sizes[cpu][basic_btb_call_size_tracker_hash(call_ip)] = estimated_call_instr_size;
+  void update(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type, const champsim::modules::branch_context& context) override
+  {
+    const uint16_t asid = asid_tag(context);
+
+    // updates for indirect branches
+    if ((branch_type == BRANCH_INDIRECT) || (branch_type == BRANCH_INDIRECT_CALL)) {
+      indirect[indirect_hash(ip)] = {branch_target, asid};
     }
-  } else if ((branch_type != BRANCH_INDIRECT) && (branch_type != BRANCH_INDIRECT_CALL)) {
-    // use BTB
-    auto btb_entry = basic_btb_find_entry(cpu, ip);
-
-    if (btb_entry == NULL) {
-      if ((branch_target != 0) && taken) {
-        // no prediction for this entry so far, so allocate one
-        uint64_t set = basic_btb_set_index(ip);
-        auto repl_entry = basic_btb_get_lru_entry(cpu, set);
-
-        repl_entry->ip_tag = ip;
-        repl_entry->target = branch_target;
-        repl_entry->always_taken = 1;
-        basic_btb_update_lru(cpu, repl_entry);
+    if (branch_type == BRANCH_CONDITIONAL) {
+      conditional_history <<= 1;
+      if (taken) {
+        conditional_history |= 1;
       }
-    } else {
-      // update an existing entry
-      btb_entry->target = branch_target;
-      if (!taken) {
-        btb_entry->always_taken = 0;
+    }
+
+    if (branch_type == BRANCH_RETURN) {
+      // recalibrate call-return offset
+      // if our return prediction got us into the right ball park, but not the
+      // exactly correct byte target, then adjust our call instr size tracker
+      uint64_t call_ip = pop_ras();
+      uint64_t estimated_call_instr_size = basic_btb_abs_addr_dist(call_ip, branch_target);
+      if (estimated_call_instr_size <= 10) {
+        call_instr_sizes[basic_btb_call_size_tracker_hash(call_ip)] = estimated_call_instr_size;
+      }
+    } else if ((branch_type != BRANCH_INDIRECT) && (branch_type != BRANCH_INDIRECT_CALL)) {
+      // use BTB
+      auto btb_entry = find_entry(ip, asid);
+
+      if (btb_entry == nullptr) {
+        if ((branch_target != 0) && taken) {
+          // no prediction for this entry so far, so allocate one
+          auto repl_entry = get_lru_entry(set_index(ip));
+
+          repl_entry->ip_tag = ip;
+          repl_entry->target = branch_target;
+          repl_entry->always_taken = 1;
+          repl_entry->asid = asid;
+          update_lru(repl_entry);
+        }
+      } else {
+        // update an existing entry
+        btb_entry->target = branch_target;
+        if (!taken) {
+          btb_entry->always_taken = 0;
+        }
       }
     }
   }
-}
+};
+
+champsim::modules::registry<champsim::modules::btb>::add<basic_btb> registered{"basic_btb"};
+} // namespace
@@ -0,0 +1,398 @@
+/*
+ * This file implements a Branch Target Buffer that predicts the targets of
+ * indirect branches with ITTAGE, after Seznec, "A 64-Kbytes ITTAGE Indirect
+ * Branch Predictor," JWAC-2, 2011.
+ *
+ * Direct branches use a set-associative BTB and returns use a Return Address
+ * Stack, as in basic_btb. Indirect branches and indirect calls look up a
+ * target in a set of tagged tables indexed with global histories of
+ * geometrically increasing length. The longest matching table provides the
+ * target, and a table indexed by the address alone is used when none match.
+ * This predicts the dispatch branches of interpreters, whose targets follow
+ * the path that led to them.
+ *
+ * The sizes are set with "btb_params": "sets", "ways", "ras_size",
+ * "indirect_size", "tables", "log_table_size", "min_history" and
+ * "max_history". The defaults are 8 tagged tables of 512 entries, with
+ * histories from 4 to 640 branches. The sets and the indirect table are
+ * indexed by masking, so their sizes must be powers of two. With
+ * "asid_tags": 1, the entries are tagged with the address space that wrote
+ * them, and only predict for that address space.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "folded_history.h"
+#include "modules.h"
+#include "ooo_cpu.h"
+
+namespace
+{
+constexpr std::size_t CALL_INSTR_SIZE_TRACKERS = 1024;
+constexpr int ITTAGE_CTR_MAX = 3;
+constexpr int USE_ALT_MAX = 7;
+constexpr int U_RESET_PERIOD = 1024;
+constexpr int PATH_HISTORY_BITS = 16;
+constexpr int TARGET_HISTORY_BITS = 3;
+
+struct btb_entry {
+  uint64_t ip_tag = 0;
+  uint64_t target = 0;
+  uint8_t always_taken = 0;
+  uint16_t asid = 0;
+  uint64_t lru = 0;
+};
+
+struct ittage_entry {
+  uint64_t target = 0;
+  uint16_t tag = 0;
+  uint8_t ctr = 0, u = 0;
+};
+
+struct base_entry {
+  uint64_t target = 0;
+  uint8_t ctr = 0;
+  uint16_t asid = 0;
+};
+
+uint64_t abs_addr_dist(uint64_t addr1, uint64_t addr2) { return addr1 > addr2 ? addr1 - addr2 : addr2 - addr1; }
+
+uint64_t call_size_tracker_hash(uint64_t ip) { return (ip & (CALL_INSTR_SIZE_TRACKERS - 1)); }
+
+class ittage : public champsim::modules::btb
+{
+  const std::size_t sets, ways, ras_size, indirect_size, num_tables;
+  const unsigned log_table_size;
+  const bool asid_tags;
+
+  // The address space of the branch being looked up or updated, or 0 for all of them without ASID tags
+  uint16_t asid = 0;
+
+  std::vector<btb_entry> entries;
+  uint64_t lru_counter = 0;
+
+  std::vector<uint64_t> ras;
+  std::size_t ras_index = 0;
+  std::vector<uint64_t> call_instr_sizes = std::vector<uint64_t>(CALL_INSTR_SIZE_TRACKERS, 4);
+
+  // ITTAGE
+  std::vector<base_entry> base;
+  std::vector<std::vector<ittage_entry>> tagged;
+  std::vector<unsigned> history_length, tag_bits;
+  champsim::global_history ghist;
+  std::vector<champsim::folded_history> fold_index, fold_tag0, fold_tag1;
+  uint64_t phist = 0;
+  int use_alt = 0, tick = 0;
+  uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+  // The state of the last indirect lookup, kept for its update
+  struct {
+    uint64_t ip = 0;
+    std::vector<std::size_t> index;
+    std::vector<uint16_t> tag;
+    std::size_t hit_bank = 0, alt_bank = 0;
+    uint64_t provider_target = 0, alt_target = 0, prediction = 0;
+  } last;
+
+  uint64_t next_random() { return rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17; }
+
+  uint64_t set_index(uint64_t ip) const { return ((ip >> 2) & (sets - 1)); }
+
+  btb_entry* find_entry(uint64_t ip)
+  {
+    auto begin = std::next(std::begin(entries), set_index(ip) * ways);
+    auto end = std::next(begin, ways);
+    auto found = std::find_if(begin, end, [this, ip](const btb_entry& x) { return x.ip_tag == ip && x.asid == asid; });
+    return found == end ? nullptr : &*found;
+  }
+
+  btb_entry* get_lru_entry(uint64_t set)
+  {
+    auto begin = std::next(std::begin(entries), set * ways);
+    return &*std::min_element(begin, std::next(begin, ways), [](const btb_entry& x, const btb_entry& y) { return x.lru < y.lru; });
+  }
+
+  void update_lru(btb_entry* entry) { entry->lru = lru_counter++; }
+
+  void push_ras(uint64_t ip)
+  {
+    ras_index++;
+    if (ras_index == ras_size)
+      ras_index = 0;
+
+    ras[ras_index] = ip;
+  }
+
+  uint64_t peek_ras() const { return ras[ras_index]; }
+
+  uint64_t pop_ras()
+  {
+    uint64_t target = ras[ras_index];
+    ras[ras_index] = 0;
+
+    if (ras_index == 0)
+      ras_index = ras_size;
+    ras_index--;
+
+    return target;
+  }
+
+  uint64_t get_call_size(uint64_t ip) const { return call_instr_sizes[call_size_tracker_hash(ip)]; }
+
+  std::size_t base_index(uint64_t ip) const { return (ip >> 2) & (indirect_size - 1); }
+
+  std::size_t tagged_index(uint64_t ip, std::size_t i) const
+  {
+    uint64_t path = phist & bitmask(std::min<unsigned>(history_length[i], PATH_HISTORY_BITS));
+    return ((ip >> 2) ^ (ip >> (log_table_size + 2 - i % log_table_size)) ^ fold_index[i].value() ^ (path << (i % 4))) & bitmask(log_table_size);
+  }
+
+  uint16_t tagged_tag(uint64_t ip, std::size_t i) const
+  {
+    return ((ip >> 2) ^ fold_tag0[i].value() ^ (fold_tag1[i].value() << 1) ^ asid) & bitmask(tag_bits[i]);
+  }
+
+  uint64_t predict_indirect(uint64_t ip);
+  void update_indirect(uint64_t ip, uint64_t branch_target);
+  void update_history(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type);
+
+public:
+  ittage(O3_CPU* cpu, const champsim::json_value& params)
+      : btb(cpu), sets(champsim::modules::param<std::size_t>(params, "sets", 1024)), ways(champsim::modules::param<std::size_t>(params, "ways", 8)),
+        ras_size(champsim::modules::param<std::size_t>(params, "ras_size", 64)),
+        indirect_size(champsim::modules::param<std::size_t>(params, "indirect_size", 4096)),
+        num_tables(champsim::modules::param<std::size_t>(params, "tables", 8)),
+        log_table_size(champsim::modules::param<unsigned>(params, "log_table_size", 9)),
+        asid_tags(champsim::modules::param<bool>(params, "asid_tags", false)), entries(sets * ways), ras(ras_size), base(indirect_size),
+        tagged(num_tables, std::vector<ittage_entry>(std::size_t{1} << log_table_size)),
+        ghist(champsim::modules::param<unsigned>(params, "max_history", 640))
+  {
+    // Geometric history lengths, and longer tags for the longer histories
+    const double min_history = champsim::modules::param<unsigned>(params, "min_history", 4);
+    const double max_history = champsim::modules::param<unsigned>(params, "max_history", 640);
+    for (std::size_t i = 0; i < num_tables; ++i) {
+      double ratio = num_tables > 1 ? static_cast<double>(i) / (num_tables - 1) : 0;
+      history_length.push_back(static_cast<unsigned>(min_history * std::pow(max_history / min_history, ratio) + 0.5));
+      tag_bits.push_back(9 + static_cast<unsigned>(6 * ratio + 0.5));
+
+      fold_index.emplace_back(history_length[i], log_table_size);
+      fold_tag0.emplace_back(history_length[i], tag_bits[i]);
+      fold_tag1.emplace_back(history_length[i], tag_bits[i] - 1);
+    }
+
+    last.index.resize(num_tables);
+    last.tag.resize(num_tables);
+  }
+
+  void initialize() override
+  {
+    std::cout << "ITTAGE BTB sets: " << sets << " ways: " << ways << " RAS size: " << ras_size << " indirect tables: " << num_tables << " of "
+              << (1 << log_table_size) << " entries, histories " << history_length.front() << " to " << history_length.back()
+              << (asid_tags ? ", ASID tagged" : "") << std::endl;
+  }
+
+  std::pair<uint64_t, uint8_t> prediction(uint64_t ip, uint8_t branch_type, const champsim::modules::branch_context& context) override
+  {
+    asid = asid_tags ? context.asid : 0;
+
+    uint8_t always_taken = (branch_type != BRANCH_CONDITIONAL);
+
+    if ((branch_type == BRANCH_DIRECT_CALL) || (branch_type == BRANCH_INDIRECT_CALL)) {
+      // add something to the RAS
+      push_ras(ip);
+    }
+
+    if (branch_type == BRANCH_RETURN) {
+      // peek at the top of the RAS, and adjust for the size of the call instr
+      uint64_t target = peek_ras();
+      target += get_call_size(target);
+      return std::make_pair(target, always_taken);
+    }
+
+    if ((branch_type == BRANCH_INDIRECT) || (branch_type == BRANCH_INDIRECT_CALL))
+      return std::make_pair(predict_indirect(ip), always_taken);
+
+    // use BTB for all other branches + direct calls
+    auto entry = find_entry(ip);
+    if (entry == nullptr) {
+      // no prediction for this IP
+      return std::make_pair(0, true);
+    }
+
+    update_lru(entry);
+    return std::make_pair(entry->target, entry->always_taken);
+  }
+
+  void update(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type, const champsim::modules::branch_context& context) override
+  {
+    asid = asid_tags ? context.asid : 0;
+
+    if ((branch_type == BRANCH_INDIRECT) || (branch_type == BRANCH_INDIRECT_CALL)) {
+      update_indirect(ip, branch_target);
+    } else if (branch_type == BRANCH_RETURN) {
+      // recalibrate call-return offset
+      uint64_t call_ip = pop_ras();
+      uint64_t estimated_call_instr_size = abs_addr_dist(call_ip, branch_target);
+      if (estimated_call_instr_size <= 10)
+        call_instr_sizes[call_size_tracker_hash(call_ip)] = estimated_call_instr_size;
+    } else {
+      auto entry = find_entry(ip);
+      if (entry == nullptr) {
+        if ((branch_target != 0) && taken) {
+          // no prediction for this entry so far, so allocate one
+          auto repl_entry = get_lru_entry(set_index(ip));
+          repl_entry->ip_tag = ip;
+          repl_entry->target = branch_target;
+          repl_entry->always_taken = 1;
+          repl_entry->asid = asid;
+          update_lru(repl_entry);
+        }
+      } else {
+        entry->target = branch_target;
+        if (!taken)
+          entry->always_taken = 0;
+      }
+    }
+
+    update_history(ip, branch_target, taken, branch_type);
+  }
+};
+
+uint64_t ittage::predict_indirect(uint64_t ip)
+{
+  last.ip = ip;
+  last.hit_bank = 0;
+  last.alt_bank = 0;
+  for (std::size_t i = 0; i < num_tables; ++i) {
+    last.index[i] = tagged_index(ip, i);
+    last.tag[i] = tagged_tag(ip, i);
+  }
+
+  // Banks are numbered from 1, and 0 is the base table
+  for (std::size_t i = num_tables; i > 0; --i) {
+    if (tagged[i - 1][last.index[i - 1]].tag == last.tag[i - 1]) {
+      if (last.hit_bank == 0) {
+        last.hit_bank = i;
+      } else {
+        last.alt_bank = i;
+        break;
+      }
+    }
+  }
+
+  const base_entry& base_hit = base[base_index(ip)];
+  const uint64_t base_target = base_hit.asid == asid ? base_hit.target : 0;
+  last.alt_target = last.alt_bank > 0 ? tagged[last.alt_bank - 1][last.index[last.alt_bank - 1]].target : base_target;
+
+  if (last.hit_bank > 0) {
+    const ittage_entry& provider = tagged[last.hit_bank - 1][last.index[last.hit_bank - 1]];
+    last.provider_target = provider.target;
+    // A provider with no confidence yet defers to the alternate, if that has been the better choice
+    last.prediction = (provider.ctr == 0 && use_alt >= 0) ? last.alt_target : provider.target;
+  } else {
+    last.provider_target = base_target;
+    last.prediction = base_target;
+  }
+
+  return last.prediction;
+}
+
+void ittage::update_indirect(uint64_t ip, uint64_t branch_target)
+{
+  // The core looks up each branch just before its update, so the state of the last lookup is this branch's
+  if (ip != last.ip)
+    predict_indirect(ip);
+
+  const std::size_t hit_bank = last.hit_bank;
+  ittage_entry* provider = hit_bank > 0 ? &tagged[hit_bank - 1][last.index[hit_bank - 1]] : nullptr;
+
+  if (provider != nullptr && provider->ctr == 0 && last.provider_target != last.alt_target) {
+    if (last.alt_target == branch_target)
+      use_alt = std::min(use_alt + 1, USE_ALT_MAX);
+    else if (last.provider_target == branch_target)
+      use_alt = std::max(use_alt - 1, -USE_ALT_MAX - 1);
+  }
+
+  if (last.prediction != branch_target && hit_bank < num_tables) {
+    // Allocate one entry in a longer table, sometimes skipping the next one, and age the useful bits when the tables are full
+    std::size_t start = hit_bank + ((next_random() & 127) < 32 ? 2 : 1);
+    int penalty = 0, allocated = 0;
+    for (std::size_t i = start; i <= num_tables; ++i) {
+      ittage_entry& entry = tagged[i - 1][last.index[i - 1]];
+      if (entry.u == 0) {
+        entry.tag = last.tag[i - 1];
+        entry.target = branch_target;
+        entry.ctr = 0;
+        allocated++;
+        break;
+      }
+      penalty++;
+    }
+
+    tick = std::max(tick + penalty - 2 * allocated, 0);
+    if (tick >= U_RESET_PERIOD) {
+      for (auto& table : tagged)
+        for (auto& entry : table)
+          entry.u = 0;
+      tick = 0;
+    }
+  }
+
+  // Train the provider, replacing its target once its confidence is gone
+  auto train = [branch_target](auto& entry) {
+    if (entry.target == branch_target) {
+      if (entry.ctr < ITTAGE_CTR_MAX)
+        entry.ctr++;
+    } else if (entry.ctr > 0) {
+      entry.ctr--;
+    } else {
+      entry.target = branch_target;
+    }
+  };
+
+  if (provider != nullptr) {
+    train(*provider);
+
+    if (last.provider_target != last.alt_target) {
+      if (last.provider_target == branch_target)
+        provider->u = 1;
+      else if (last.alt_target == branch_target)
+        provider->u = 0;
+    }
+  } else if (base_entry& entry = base[base_index(ip)]; entry.asid != asid) {
+    entry = {branch_target, 0, asid};
+  } else {
+    train(entry);
+  }
+}
+
+void ittage::update_history(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type)
+{
+  // Conditional branches add their direction. Indirect branches add bits of a hash of their target, so that the history tells apart the paths
+  // through them.
+  auto push = [this](bool bit) {
+    ghist.push(bit);
+    for (std::size_t i = 0; i < num_tables; ++i) {
+      fold_index[i].update(ghist);
+      fold_tag0[i].update(ghist);
+      fold_tag1[i].update(ghist);
+    }
+  };
+
+  if (branch_type == BRANCH_CONDITIONAL) {
+    push(taken);
+  } else if ((branch_type == BRANCH_INDIRECT) || (branch_type == BRANCH_INDIRECT_CALL)) {
+    uint64_t target_hash = (branch_target * 0x9E3779B97F4A7C15ULL) >> (64 - TARGET_HISTORY_BITS);
+    for (int i = 0; i < TARGET_HISTORY_BITS; ++i)
+      push((target_hash >> i) & 1);
+  }
+
+  if (taken)
+    phist = ((phist << 1) ^ ((ip >> 2) & 1)) & bitmask(PATH_HISTORY_BITS);
+}
+
+champsim::modules::registry<champsim::modules::btb>::add<ittage> registered{"ittage"};
+} // namespace
@@ -20,13 +20,17 @@ def norm_fname(fname):
 # Begin format strings
 ###
 
-cache_fmtstr = 'CACHE {name}("{name}", {frequency}, {fill_level}, {sets}, {ways}, {wq_size}, {rq_size}, {pq_size}, {mshr_size}, {hit_latency}, {fill_latency}, {max_read}, {max_write}, {offset_bits}, {prefetch_as_load:b}, {wq_check_full_addr:b}, {virtual_prefetch:b}, {prefetch_activate_mask}, {lower_level}, CACHE::pref_t::{prefetcher_name}, CACHE::repl_t::{replacement_name});\n'
-ptw_fmtstr = 'PageTableWalker {name}("{name}", {cpu}, {fill_level}, {pscl5_set}, {pscl5_way}, {pscl4_set}, {pscl4_way}, {pscl3_set}, {pscl3_way}, {pscl2_set}, {pscl2_way}, {ptw_rq_size}, {ptw_mshr_size}, {ptw_max_read}, {ptw_max_write}, 0, {lower_level});\n'
+cache_fmtstr = 'CACHE {name}("{name}", {frequency}, {fill_level}, {sets}, {ways}, {wq_size}, {rq_size}, {pq_size}, {mshr_size}, {hit_latency}, {fill_latency}, {max_read}, {max_write}, {offset_bits}, {huge_page_sets}, {prefetch_as_load:b}, {wq_check_full_addr:b}, {virtual_prefetch:b}, {prefetch_activate_mask}, {lower_level}, CACHE::pref_t::{prefetcher_name}, CACHE::repl_t::{replacement_name}, {prefetcher_selection}, {replacement_selection}, {partition_json}, CACHE::inclusion_t::{inclusion_name}, {snoop_filter_json});\n'
+ptw_fmtstr = 'PageTableWalker {name}("{name}", {cpu}, {fill_level}, {pscl5_set}, {pscl5_way}, {pscl4_set}, {pscl4_way}, {pscl3_set}, {pscl3_way}, {pscl2_set}, {pscl2_way}, {ptw_rq_size}, {ptw_pq_size}, {ptw_mshr_size}, {ptw_max_read}, {ptw_max_write}, 0, {lower_level});\n'
 
-cpu_fmtstr = 'O3_CPU {name}({index}, {frequency}, {DIB[sets]}, {DIB[ways]}, {DIB[window_size]}, {ifetch_buffer_size}, {dispatch_buffer_size}, {decode_buffer_size}, {rob_size}, {lq_size}, {sq_size}, {fetch_width}, {decode_width}, {dispatch_width}, {scheduler_size}, {execute_width}, {lq_width}, {sq_width}, {retire_width}, {mispredict_penalty}, {decode_latency}, {dispatch_latency}, {schedule_latency}, {execute_latency}, &{ITLB}, &{DTLB}, &{L1I}, &{L1D}, O3_CPU::bpred_t::{bpred_name}, O3_CPU::btb_t::{btb_name}, O3_CPU::ipref_t::{iprefetcher_name});\n'
+cpu_fmtstr = 'O3_CPU {name}({index}, {frequency}, {DIB[sets]}, {DIB[ways]}, {DIB[window_size]}, {ifetch_buffer_size}, {dispatch_buffer_size}, {decode_buffer_size}, {rob_size}, {lq_size}, {sq_size}, {fetch_width}, {decode_width}, {dispatch_width}, {scheduler_size}, {execute_width}, {lq_width}, {sq_width}, {retire_width}, {mispredict_penalty}, {decode_latency}, {dispatch_latency}, {schedule_latency}, {execute_latency}, {decoupled_frontend:b}, {ftq_size}, &{ITLB}, &{DTLB}, &{L1I}, &{L1D}, O3_CPU::bpred_t::{bpred_name}, O3_CPU::btb_t::{btb_name}, O3_CPU::ipref_t::{iprefetcher_name}, {bpred_selection}, {btb_selection}, {iprefetcher_selection});\n'
 
-pmem_fmtstr = 'MEMORY_CONTROLLER {attrs[name]}({attrs[frequency]});\n'
-vmem_fmtstr = 'VirtualMemory vmem({attrs[size]}, 1 << 12, {attrs[num_levels]}, 1, {attrs[minor_fault_penalty]});\n'
+pmem_fmtstr = 'MEMORY_CONTROLLER {attrs[name]}({attrs[frequency]}, MEMORY_CONTROLLER::sched_t::{scheduler});\n'
+vmem_fmtstr = 'VirtualMemory vmem({attrs[size]}, 1 << 12, {attrs[num_levels]}, 1, {attrs[minor_fault_penalty]}, VirtualMemory::page_size_policy::{policy}, {attrs[huge_page_fraction]});\n'
+
+cache_params_fmtstr = '    {{"{name}", "{lower_name}", {frequency}, {fill_level}, {sets}, {ways}, {wq_size}, {rq_size}, {pq_size}, {mshr_size}, {hit_latency}, {fill_latency}, {max_read}, {max_write}, {offset_bits}, {huge_page_sets}, {prefetch_as_load:b}, {wq_check_full_addr:b}, {virtual_prefetch:b}, {prefetch_activate_mask}, "{prefetcher}", "{replacement}", {prefetcher_params_json}, {replacement_params_json}, {partition_json}, "{inclusion_name}", {snoop_filter_json}}}'
+ptw_params_fmtstr = '    {{"{name}", "{lower_name}", {cpu}, {fill_level}, {pscl5_set}, {pscl5_way}, {pscl4_set}, {pscl4_way}, {pscl3_set}, {pscl3_way}, {pscl2_set}, {pscl2_way}, {ptw_rq_size}, {ptw_pq_size}, {ptw_mshr_size}, {ptw_max_read}, {ptw_max_write}, 0}}'
+cpu_params_fmtstr = '    {{"{name}", {index}, {frequency}, {DIB[sets]}, {DIB[ways]}, {DIB[window_size]}, {ifetch_buffer_size}, {decode_buffer_size}, {dispatch_buffer_size}, {rob_size}, {lq_size}, {sq_size}, {fetch_width}, {decode_width}, {dispatch_width}, {scheduler_size}, {execute_width}, {lq_width}, {sq_width}, {retire_width}, {mispredict_penalty}, {decode_latency}, {dispatch_latency}, {schedule_latency}, {execute_latency}, {decoupled_frontend:b}, {ftq_size}, "{ITLB}", "{DTLB}", "{L1I}", "{L1D}", "{PTW}", "{branch_predictor}", "{btb}", "{iprefetcher}", {branch_predictor_params_json}, {btb_params_json}, {iprefetcher_params_json}}}'
 
 module_make_fmtstr = '{1}/%.o: CFLAGS += -I{1}\n{1}/%.o: CXXFLAGS += -I{1}\n{1}/%.o: CXXFLAGS += {2}\nobj/{0}: $(patsubst %.cc,%.o,$(wildcard {1}/*.cc)) $(patsubst %.c,%.o,$(wildcard {1}/*.c))\n\t@mkdir -p $(dir $@)\n\tar -rcs $@ $^\n\n'
 
@@ -64,7 +68,7 @@ const_names = {
 # Begin default core model definition
 ###
 
-default_root = { 'executable_name': 'bin/champsim', 'block_size': 64, 'page_size': 4096, 'heartbeat_frequency': 10000000, 'num_cores': 1, 'DIB': {}, 'L1I': {}, 'L1D': {}, 'L2C': {}, 'ITLB': {}, 'DTLB': {}, 'STLB': {}, 'LLC': {}, 'physical_memory': {}, 'virtual_memory': {}}
+default_root = { 'executable_name': 'bin/champsim', 'block_size': 64, 'page_size': 4096, 'heartbeat_frequency': 10000000, 'num_cores': 1, 'DIB': {}, 'L1I': {}, 'L1D': {}, 'L2C': {}, 'ITLB': {}, 'DTLB': {}, 'STLB': {}, 'LLC': {}, 'physical_memory': {}, 'virtual_memory': {}, 'runtime_modules': False}
 
 # Read the config file
 if len(sys.argv) >= 2:
@@ -74,18 +78,18 @@ else:
     print("No configuration specified. Building default ChampSim with no prefetching.")
     config_file = ChainMap(default_root)
 
-default_core = { 'frequency' : 4000, 'ifetch_buffer_size': 64, 'decode_buffer_size': 32, 'dispatch_buffer_size': 32, 'rob_size': 352, 'lq_size': 128, 'sq_size': 72, 'fetch_width' : 6, 'decode_width' : 6, 'dispatch_width' : 6, 'execute_width' : 4, 'lq_width' : 2, 'sq_width' : 2, 'retire_width' : 5, 'mispredict_penalty' : 1, 'scheduler_size' : 128, 'decode_latency' : 1, 'dispatch_latency' : 1, 'schedule_latency' : 0, 'execute_latency' : 0, 'branch_predictor': 'bimodal', 'btb': 'basic_btb' }
+default_core = { 'frequency' : 4000, 'ifetch_buffer_size': 64, 'decode_buffer_size': 32, 'dispatch_buffer_size': 32, 'rob_size': 352, 'lq_size': 128, 'sq_size': 72, 'fetch_width' : 6, 'decode_width' : 6, 'dispatch_width' : 6, 'execute_width' : 4, 'lq_width' : 2, 'sq_width' : 2, 'retire_width' : 5, 'mispredict_penalty' : 1, 'scheduler_size' : 128, 'decode_latency' : 1, 'dispatch_latency' : 1, 'schedule_latency' : 0, 'execute_latency' : 0, 'decoupled_frontend': False, 'ftq_size': 24, 'branch_predictor': 'bimodal', 'btb': 'basic_btb' }
 default_dib  = { 'window_size': 16,'sets': 32, 'ways': 8 }
 default_l1i  = { 'sets': 64, 'ways': 8, 'rq_size': 64, 'wq_size': 64, 'pq_size': 32, 'mshr_size': 8, 'latency': 4, 'fill_latency': 1, 'max_read': 2, 'max_write': 2, 'prefetch_as_load': False, 'virtual_prefetch': True, 'wq_check_full_addr': True, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no_instr', 'replacement': 'lru'}
 default_l1d  = { 'sets': 64, 'ways': 12, 'rq_size': 64, 'wq_size': 64, 'pq_size': 8, 'mshr_size': 16, 'latency': 5, 'fill_latency': 1, 'max_read': 2, 'max_write': 2, 'prefetch_as_load': False, 'virtual_prefetch': False, 'wq_check_full_addr': True, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no', 'replacement': 'lru'}
 default_l2c  = { 'sets': 1024, 'ways': 8, 'rq_size': 32, 'wq_size': 32, 'pq_size': 16, 'mshr_size': 32, 'latency': 10, 'fill_latency': 1, 'max_read': 1, 'max_write': 1, 'prefetch_as_load': False, 'virtual_prefetch': False, 'wq_check_full_addr': False, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no', 'replacement': 'lru'}
-default_itlb = { 'sets': 16, 'ways': 4, 'rq_size': 16, 'wq_size': 16, 'pq_size': 0, 'mshr_size': 8, 'latency': 1, 'fill_latency': 1, 'max_read': 2, 'max_write': 2, 'prefetch_as_load': False, 'virtual_prefetch': True, 'wq_check_full_addr': True, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no', 'replacement': 'lru'}
-default_dtlb = { 'sets': 16, 'ways': 4, 'rq_size': 16, 'wq_size': 16, 'pq_size': 0, 'mshr_size': 8, 'latency': 1, 'fill_latency': 1, 'max_read': 2, 'max_write': 2, 'prefetch_as_load': False, 'virtual_prefetch': False, 'wq_check_full_addr': True, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no', 'replacement': 'lru'}
-default_stlb = { 'sets': 128, 'ways': 12, 'rq_size': 32, 'wq_size': 32, 'pq_size': 0, 'mshr_size': 16, 'latency': 8, 'fill_latency': 1, 'max_read': 1, 'max_write': 1, 'prefetch_as_load': False, 'virtual_prefetch': False, 'wq_check_full_addr': False, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no', 'replacement': 'lru'}
+default_itlb = { 'sets': 16, 'ways': 4, 'rq_size': 16, 'wq_size': 16, 'pq_size': 8, 'mshr_size': 8, 'latency': 1, 'fill_latency': 1, 'max_read': 2, 'max_write': 2, 'prefetch_as_load': False, 'virtual_prefetch': True, 'wq_check_full_addr': True, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no', 'replacement': 'lru', 'huge_page_sets': 0}
+default_dtlb = { 'sets': 16, 'ways': 4, 'rq_size': 16, 'wq_size': 16, 'pq_size': 8, 'mshr_size': 8, 'latency': 1, 'fill_latency': 1, 'max_read': 2, 'max_write': 2, 'prefetch_as_load': False, 'virtual_prefetch': False, 'wq_check_full_addr': True, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no', 'replacement': 'lru', 'huge_page_sets': 0}
+default_stlb = { 'sets': 128, 'ways': 12, 'rq_size': 32, 'wq_size': 32, 'pq_size': 16, 'mshr_size': 16, 'latency': 8, 'fill_latency': 1, 'max_read': 1, 'max_write': 1, 'prefetch_as_load': False, 'virtual_prefetch': False, 'wq_check_full_addr': False, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no', 'replacement': 'lru', 'huge_page_sets': 0}
 default_llc  = { 'sets': 2048*config_file['num_cores'], 'ways': 16, 'rq_size': 32*config_file['num_cores'], 'wq_size': 32*config_file['num_cores'], 'pq_size': 32*config_file['num_cores'], 'mshr_size': 64*config_file['num_cores'], 'latency': 20, 'fill_latency': 1, 'max_read': config_file['num_cores'], 'max_write': config_file['num_cores'], 'prefetch_as_load': False, 'virtual_prefetch': False, 'wq_check_full_addr': False, 'prefetch_activate': 'LOAD,PREFETCH', 'prefetcher': 'no', 'replacement': 'lru', 'name': 'LLC', 'lower_level': 'DRAM' }
-default_pmem = { 'name': 'DRAM', 'frequency': 3200, 'channels': 1, 'ranks': 1, 'banks': 8, 'rows': 65536, 'columns': 128, 'lines_per_column': 8, 'channel_width': 8, 'wq_size': 64, 'rq_size': 64, 'tRP': 12.5, 'tRCD': 12.5, 'tCAS': 12.5, 'turn_around_time': 7.5 }
-default_vmem = { 'size': 8589934592, 'num_levels': 5, 'minor_fault_penalty': 200 }
-default_ptw = { 'pscl5_set' : 1, 'pscl5_way' : 2, 'pscl4_set' : 1, 'pscl4_way': 4, 'pscl3_set' : 2, 'pscl3_way' : 4, 'pscl2_set' : 4, 'pscl2_way': 8, 'ptw_rq_size': 16, 'ptw_mshr_size': 5, 'ptw_max_read': 2, 'ptw_max_write': 2}
+default_pmem = { 'name': 'DRAM', 'frequency': 3200, 'channels': 1, 'ranks': 1, 'banks': 8, 'rows': 65536, 'columns': 128, 'lines_per_column': 8, 'channel_width': 8, 'wq_size': 64, 'rq_size': 64, 'tRP': 12.5, 'tRCD': 12.5, 'tCAS': 12.5, 'turn_around_time': 7.5, 'scheduler': 'fcfs' }
+default_vmem = { 'size': 8589934592, 'num_levels': 5, 'minor_fault_penalty': 200, 'huge_pages': 'none', 'huge_page_fraction': 1.0 }
+default_ptw = { 'pscl5_set' : 1, 'pscl5_way' : 2, 'pscl4_set' : 1, 'pscl4_way': 4, 'pscl3_set' : 2, 'pscl3_way' : 4, 'pscl2_set' : 4, 'pscl2_way': 8, 'ptw_rq_size': 16, 'ptw_pq_size': 8, 'ptw_mshr_size': 5, 'ptw_max_read': 2, 'ptw_max_write': 2}
 
 ###
 # Ensure directories are present
@@ -103,6 +107,11 @@ os.makedirs('obj', exist_ok=True)
 config_file['physical_memory'] = ChainMap(config_file['physical_memory'], default_pmem.copy())
 config_file['virtual_memory'] = ChainMap(config_file['virtual_memory'], default_vmem.copy())
 
+huge_page_policies = { 'none': 'base', '2MB': 'huge_2m', '1GB': 'huge_1g', 'guest': 'guest' }
+if config_file['virtual_memory']['huge_pages'] not in huge_page_policies:
+    print('Huge page policy "' + str(config_file['virtual_memory']['huge_pages']) + '" is not one of ' + ', '.join(huge_page_policies) + '. Exiting...')
+    sys.exit(1)
+
 cores = config_file.get('ooo_cpu', [{}])
 
 # Index the cache array by names
@@ -199,11 +208,13 @@ for cpu in cores:
     cache_name = cpu['L1I']
     while cache_name in caches:
         caches[cache_name]['offset_bits'] = 'LOG2_BLOCK_SIZE'
+        caches[cache_name]['huge_page_sets'] = 0
         cache_name = caches[cache_name]['lower_level']
 
     cache_name = cpu['L1D']
     while cache_name in caches:
         caches[cache_name]['offset_bits'] = 'LOG2_BLOCK_SIZE'
+        caches[cache_name]['huge_page_sets'] = 0
         cache_name = caches[cache_name]['lower_level']
 
 ###
@@ -213,116 +224,127 @@ for cpu in cores:
 # Associate modules with paths
 libfilenames = {}
 
-for cache in caches.values():
-    # Resolve cache replacment function names
-    if cache['replacement'] is not None:
-        fname = os.path.join('replacement', cache['replacement'])
-        if not os.path.exists(fname):
-            fname = norm_fname(cache['replacement'])
-        if not os.path.exists(fname):
-            print('Path "' + fname + '" does not exist. Exiting...')
-            sys.exit(1)
-
-        cache['replacement_name'] = 'r' + fname.translate(fname_translation_table)
-        cache['replacement_initialize'] = 'repl_' + cache['replacement_name'] + '_initialize'
-        cache['replacement_find_victim'] = 'repl_' + cache['replacement_name'] + '_victim'
-        cache['replacement_update_replacement_state'] = 'repl_' + cache['replacement_name'] + '_update'
-        cache['replacement_replacement_final_stats'] = 'repl_' + cache['replacement_name'] + '_final_stats'
-
-        opts = ''
-        opts += ' -Dinitialize_replacement=' + cache['replacement_initialize']
-        opts += ' -Dfind_victim=' + cache['replacement_find_victim']
-        opts += ' -Dupdate_replacement_state=' + cache['replacement_update_replacement_state']
-        opts += ' -Dreplacement_final_stats=' + cache['replacement_replacement_final_stats']
-        libfilenames['repl_' + cache['replacement_name'] + '.a'] = (fname, opts)
-
-    # Resolve prefetcher function names
-    if cache['prefetcher'] is not None:
-        fname = os.path.join('prefetcher', cache['prefetcher'])
-        if not os.path.exists(fname):
-            fname = norm_fname(cache['prefetcher'])
-        if not os.path.exists(fname):
-            print('Path "' + fname + '" does not exist. Exiting...')
-            sys.exit(1)
-
-        cache['prefetcher_name'] = 'p' + fname.translate(fname_translation_table)
-        cache['prefetcher_initialize'] = 'pref_' + cache['prefetcher_name'] + '_initialize'
-        cache['prefetcher_cache_operate'] = 'pref_' + cache['prefetcher_name'] + '_cache_operate'
-        cache['prefetcher_cache_fill'] = 'pref_' + cache['prefetcher_name'] + '_cache_fill'
-        cache['prefetcher_cycle_operate'] = 'pref_' + cache['prefetcher_name'] + '_cycle_operate'
-        cache['prefetcher_final_stats'] = 'pref_' + cache['prefetcher_name'] + '_final_stats'
-
-        opts = ''
-        # These function names should be used in future designs
-        opts += ' -Dprefetcher_initialize=' + cache['prefetcher_initialize']
-        opts += ' -Dprefetcher_cache_operate=' + cache['prefetcher_cache_operate']
-        opts += ' -Dprefetcher_cache_fill=' + cache['prefetcher_cache_fill']
-        opts += ' -Dprefetcher_cycle_operate=' + cache['prefetcher_cycle_operate']
-        opts += ' -Dprefetcher_final_stats=' + cache['prefetcher_final_stats']
-        # These function names are deprecated, but we still permit them
-        opts += ' -Dl1d_prefetcher_initialize=' + cache['prefetcher_initialize']
-        opts += ' -Dl2c_prefetcher_initialize=' + cache['prefetcher_initialize']
-        opts += ' -Dllc_prefetcher_initialize=' + cache['prefetcher_initialize']
-        opts += ' -Dl1d_prefetcher_operate=' + cache['prefetcher_cache_operate']
-        opts += ' -Dl2c_prefetcher_operate=' + cache['prefetcher_cache_operate']
-        opts += ' -Dllc_prefetcher_operate=' + cache['prefetcher_cache_operate']
-        opts += ' -Dl1d_prefetcher_cache_fill=' + cache['prefetcher_cache_fill']
-        opts += ' -Dl2c_prefetcher_cache_fill=' + cache['prefetcher_cache_fill']
-        opts += ' -Dllc_prefetcher_cache_fill=' + cache['prefetcher_cache_fill']
-        opts += ' -Dl1d_prefetcher_final_stats=' + cache['prefetcher_final_stats']
-        opts += ' -Dl2c_prefetcher_final_stats=' + cache['prefetcher_final_stats']
-        opts += ' -Dllc_prefetcher_final_stats=' + cache['prefetcher_final_stats']
-        libfilenames['pref_' + cache['prefetcher_name'] + '.a'] = (fname, opts)
-
-for cpu in cores:
-    # Resolve branch predictor function names
-    if cpu['branch_predictor'] is not None:
-        fname = os.path.join('branch', cpu['branch_predictor'])
-        if not os.path.exists(fname):
-            fname = norm_fname(cpu['branch_predictor'])
-        if not os.path.exists(fname):
-            print('Path "' + fname + '" does not exist. Exiting...')
-            sys.exit(1)
-
-        cpu['bpred_name'] = 'b' + fname.translate(fname_translation_table)
-        cpu['bpred_initialize'] = 'bpred_' + cpu['bpred_name'] + '_initialize'
-        cpu['bpred_last_result'] = 'bpred_' + cpu['bpred_name'] + '_last_result'
-        cpu['bpred_predict'] = 'bpred_' + cpu['bpred_name'] + '_predict'
-
-        opts = ''
-        opts += ' -Dinitialize_branch_predictor=' + cpu['bpred_initialize']
-        opts += ' -Dlast_branch_result=' + cpu['bpred_last_result']
-        opts += ' -Dpredict_branch=' + cpu['bpred_predict']
-        libfilenames['bpred_' + cpu['bpred_name'] + '.a'] = (fname, opts)
-
-    # Resolve BTB function names
-    if cpu['btb'] is not None:
-        fname = os.path.join('btb', cpu['btb'])
-        if not os.path.exists(fname):
-            fname = norm_fname(cpu['btb'])
-        if not os.path.exists(fname):
-            print('Path "' + fname + '" does not exist. Exiting...')
-            sys.exit(1)
-
-        cpu['btb_name'] = 'b' + fname.translate(fname_translation_table)
-        cpu['btb_initialize'] = 'btb_' + cpu['btb_name'] + '_initialize'
-        cpu['btb_update'] = 'btb_' + cpu['btb_name'] + '_update'
-        cpu['btb_predict'] = 'btb_' + cpu['btb_name'] + '_predict'
-
-        opts = ''
-        opts += ' -Dinitialize_btb=' + cpu['btb_initialize']
-        opts += ' -Dupdate_btb=' + cpu['btb_update']
-        opts += ' -Dbtb_prediction=' + cpu['btb_predict']
-        libfilenames['btb_' + cpu['btb_name'] + '.a'] = (fname, opts)
-
-
-    # Resolve instruction prefetching function names
-    fname = os.path.join('prefetcher', caches[cpu['L1I']]['prefetcher'])
+def find_module_path(kind, name):
+    fname = os.path.join(kind, name)
     if not os.path.exists(fname):
-        fname = norm_fname(caches[cpu['L1I']]['prefetcher'])
+        fname = norm_fname(name)
     if not os.path.exists(fname):
         print('Path "' + fname + '" does not exist. Exiting...')
         sys.exit(1)
+    return fname
+
+# Modules written as classes register themselves, and are built into one library each, without renaming
+def is_instance_module(fname):
+    for src in os.listdir(fname):
+        if os.path.splitext(src)[1] not in ('.c', '.cc', '.h'):
+            continue
+        with open(os.path.join(fname, src)) as rfp:
+            if 'champsim::modules::registry' in rfp.read():
+                return True
+    return False
+
+def resolve_instance(fname):
+    libfilenames['mod_' + fname.translate(fname_translation_table) + '.a'] = (fname, '')
+    return 'instance'
+
+def is_legacy(elem, key):
+    return key in elem and elem[key] not in ('instance', 'CPU_REDIRECT_instance_')
+
+def resolve_replacement(cache):
+    fname = find_module_path('replacement', cache['replacement'])
+    if is_instance_module(fname):
+        cache['replacement_name'] = resolve_instance(fname)
+        return
+
+    cache['replacement_name'] = 'r' + fname.translate(fname_translation_table)
+    cache['replacement_initialize'] = 'repl_' + cache['replacement_name'] + '_initialize'
+    cache['replacement_find_victim'] = 'repl_' + cache['replacement_name'] + '_victim'
+    cache['replacement_update_replacement_state'] = 'repl_' + cache['replacement_name'] + '_update'
+    cache['replacement_replacement_final_stats'] = 'repl_' + cache['replacement_name'] + '_final_stats'
+
+    opts = ''
+    opts += ' -Dinitialize_replacement=' + cache['replacement_initialize']
+    opts += ' -Dfind_victim=' + cache['replacement_find_victim']
+    opts += ' -Dupdate_replacement_state=' + cache['replacement_update_replacement_state']
+    opts += ' -Dreplacement_final_stats=' + cache['replacement_replacement_final_stats']
+    libfilenames['repl_' + cache['replacement_name'] + '.a'] = (fname, opts)
+
+def resolve_prefetcher(cache):
+    fname = find_module_path('prefetcher', cache['prefetcher'])
+    if is_instance_module(fname):
+        cache['prefetcher_name'] = resolve_instance(fname)
+        return
+
+    cache['prefetcher_name'] = 'p' + fname.translate(fname_translation_table)
+    cache['prefetcher_initialize'] = 'pref_' + cache['prefetcher_name'] + '_initialize'
+    cache['prefetcher_cache_operate'] = 'pref_' + cache['prefetcher_name'] + '_cache_operate'
+    cache['prefetcher_cache_fill'] = 'pref_' + cache['prefetcher_name'] + '_cache_fill'
+    cache['prefetcher_cycle_operate'] = 'pref_' + cache['prefetcher_name'] + '_cycle_operate'
+    cache['prefetcher_final_stats'] = 'pref_' + cache['prefetcher_name'] + '_final_stats'
+
+    opts = ''
+    # These function names should be used in future designs
+    opts += ' -Dprefetcher_initialize=' + cache['prefetcher_initialize']
+    opts += ' -Dprefetcher_cache_operate=' + cache['prefetcher_cache_operate']
+    opts += ' -Dprefetcher_cache_fill=' + cache['prefetcher_cache_fill']
+    opts += ' -Dprefetcher_cycle_operate=' + cache['prefetcher_cycle_operate']
+    opts += ' -Dprefetcher_final_stats=' + cache['prefetcher_final_stats']
+    # These function names are deprecated, but we still permit them
+    opts += ' -Dl1d_prefetcher_initialize=' + cache['prefetcher_initialize']
+    opts += ' -Dl2c_prefetcher_initialize=' + cache['prefetcher_initialize']
+    opts += ' -Dllc_prefetcher_initialize=' + cache['prefetcher_initialize']
+    opts += ' -Dl1d_prefetcher_operate=' + cache['prefetcher_cache_operate']
+    opts += ' -Dl2c_prefetcher_operate=' + cache['prefetcher_cache_operate']
+    opts += ' -Dllc_prefetcher_operate=' + cache['prefetcher_cache_operate']
+    opts += ' -Dl1d_prefetcher_cache_fill=' + cache['prefetcher_cache_fill']
+    opts += ' -Dl2c_prefetcher_cache_fill=' + cache['prefetcher_cache_fill']
+    opts += ' -Dllc_prefetcher_cache_fill=' + cache['prefetcher_cache_fill']
+    opts += ' -Dl1d_prefetcher_final_stats=' + cache['prefetcher_final_stats']
+    opts += ' -Dl2c_prefetcher_final_stats=' + cache['prefetcher_final_stats']
+    opts += ' -Dllc_prefetcher_final_stats=' + cache['prefetcher_final_stats']
+    libfilenames['pref_' + cache['prefetcher_name'] + '.a'] = (fname, opts)
+
+def resolve_branch_predictor(cpu):
+    fname = find_module_path('branch', cpu['branch_predictor'])
+    if is_instance_module(fname):
+        cpu['bpred_name'] = resolve_instance(fname)
+        return
+
+    cpu['bpred_name'] = 'b' + fname.translate(fname_translation_table)
+    cpu['bpred_initialize'] = 'bpred_' + cpu['bpred_name'] + '_initialize'
+    cpu['bpred_last_result'] = 'bpred_' + cpu['bpred_name'] + '_last_result'
+    cpu['bpred_predict'] = 'bpred_' + cpu['bpred_name'] + '_predict'
+
+    opts = ''
+    opts += ' -Dinitialize_branch_predictor=' + cpu['bpred_initialize']
+    opts += ' -Dlast_branch_result=' + cpu['bpred_last_result']
+    opts += ' -Dpredict_branch=' + cpu['bpred_predict']
+    libfilenames['bpred_' + cpu['bpred_name'] + '.a'] = (fname, opts)
+
+def resolve_btb(cpu):
+    fname = find_module_path('btb', cpu['btb'])
+    if is_instance_module(fname):
+        cpu['btb_name'] = resolve_instance(fname)
+        return
+
+    cpu['btb_name'] = 'b' + fname.translate(fname_translation_table)
+    cpu['btb_initialize'] = 'btb_' + cpu['btb_name'] + '_initialize'
+    cpu['btb_update'] = 'btb_' + cpu['btb_name'] + '_update'
+    cpu['btb_predict'] = 'btb_' + cpu['btb_name'] + '_predict'
+
+    opts = ''
+    opts += ' -Dinitialize_btb=' + cpu['btb_initialize']
+    opts += ' -Dupdate_btb=' + cpu['btb_update']
+    opts += ' -Dbtb_prediction=' + cpu['btb_predict']
+    libfilenames['btb_' + cpu['btb_name'] + '.a'] = (fname, opts)
+
+def resolve_iprefetcher(cpu, l1i):
+    fname = find_module_path('prefetcher', l1i['prefetcher'])
+    cpu['iprefetcher'] = l1i['prefetcher']
+    if is_instance_module(fname):
+        cpu['iprefetcher_name'] = resolve_instance(fname)
+        l1i['prefetcher_name'] = 'CPU_REDIRECT_instance_'
+        return
 
     cpu['iprefetcher_name'] = 'p' + fname.translate(fname_translation_table)
     cpu['iprefetcher_initialize'] = 'pref_' + cpu['iprefetcher_name'] + '_initialize'
@@ -350,12 +372,74 @@ for cpu in cores:
     libfilenames['pref_' + cpu['iprefetcher_name'] + '.a'] = (fname, opts)
 
     # Override instruction prefetcher function names in the cache
-    caches[cpu['L1I']]['prefetcher_name'] = 'CPU_REDIRECT_'+cpu['iprefetcher_name']+'_'
-    caches[cpu['L1I']]['prefetcher_initialize'] = cpu['iprefetcher_initialize']
-    caches[cpu['L1I']]['prefetcher_cache_operate'] = cpu['iprefetcher_cache_operate']
-    caches[cpu['L1I']]['prefetcher_cache_fill'] = cpu['iprefetcher_cache_fill']
-    caches[cpu['L1I']]['prefetcher_cycle_operate'] = cpu['iprefetcher_cycle_operate']
-    caches[cpu['L1I']]['prefetcher_final_stats'] = cpu['iprefetcher_final_stats']
+    l1i['prefetcher_name'] = 'CPU_REDIRECT_'+cpu['iprefetcher_name']+'_'
+    l1i['prefetcher_initialize'] = cpu['iprefetcher_initialize']
+    l1i['prefetcher_cache_operate'] = cpu['iprefetcher_cache_operate']
+    l1i['prefetcher_cache_fill'] = cpu['iprefetcher_cache_fill']
+    l1i['prefetcher_cycle_operate'] = cpu['iprefetcher_cycle_operate']
+    l1i['prefetcher_final_stats'] = cpu['iprefetcher_final_stats']
+
+def is_instruction_prefetcher(fname):
+    for src in os.listdir(fname):
+        if os.path.splitext(src)[1] not in ('.c', '.cc', '.h'):
+            continue
+        with open(os.path.join(fname, src)) as rfp:
+            text = rfp.read()
+        if 'l1i_prefetcher' in text or 'prefetcher_branch_operate' in text or 'champsim::modules::instruction_prefetcher' in text:
+            return True
+    return False
+
+for cache in caches.values():
+    # Resolve cache replacment function names
+    if cache['replacement'] is not None:
+        resolve_replacement(cache)
+
+    # Resolve prefetcher function names
+    if cache['prefetcher'] is not None:
+        resolve_prefetcher(cache)
+
+for cpu in cores:
+    # Resolve branch predictor function names
+    if cpu['branch_predictor'] is not None:
+        resolve_branch_predictor(cpu)
+
+    # Resolve BTB function names
+    if cpu['btb'] is not None:
+        resolve_btb(cpu)
+
+    # Resolve instruction prefetching function names
+    resolve_iprefetcher(cpu, caches[cpu['L1I']])
+
+# Link additional modules, so that the runtime configuration may select them
+# "runtime_modules" is either true, to link every module in the tree, or a list of module names
+# Each of these stands in for a core or cache that selects the module
+module_cores = list(cores)
+module_caches = list(caches.values())
+def runtime_module_dir(kind):
+    if config_file['runtime_modules'] is True:
+        return sorted(os.listdir(kind))
+    return sorted(name for name in os.listdir(kind) if name in config_file['runtime_modules'])
+
+if config_file['runtime_modules']:
+    for name in runtime_module_dir('branch'):
+        module_cores.append({'branch_predictor': name})
+        resolve_branch_predictor(module_cores[-1])
+
+    for name in runtime_module_dir('btb'):
+        module_cores.append({'btb': name})
+        resolve_btb(module_cores[-1])
+
+    for name in runtime_module_dir('replacement'):
+        module_caches.append({'replacement': name})
+        resolve_replacement(module_caches[-1])
+
+    for name in runtime_module_dir('prefetcher'):
+        module_caches.append({'prefetcher': name})
+        if is_instruction_prefetcher(os.path.join('prefetcher', name)):
+            module_cores.append({})
+            resolve_iprefetcher(module_cores[-1], module_caches[-1])
+        else:
+            resolve_prefetcher(module_caches[-1])
 
 # Check cache of previous configuration
 if os.path.exists(config_cache_name):
@@ -410,6 +494,40 @@ for elem in memory_system:
     if elem['lower_level'] is not None:
         elem['lower_level'] = '&'+elem['lower_level'] # append address operator for C++
 
+# Modules written as classes are built with their parameters, given in the configuration file as JSON
+def module_params(elem, key):
+    return 'champsim::json_value::parse({})'.format(json.dumps(json.dumps(elem.get(key, {}))))
+
+def module_selection(elem, name_key, module_key, params_elem, params_key):
+    if elem.get(name_key) != 'instance':
+        return '{}'
+    # Modules register themselves under the name of their directory
+    name = os.path.basename(os.path.normpath(elem[module_key]))
+    return 'champsim::modules::selection{{"{}", {}}}'.format(name, module_params(params_elem, params_key))
+
+inclusion_policies = ('non_inclusive', 'inclusive', 'exclusive')
+for elem in memory_system:
+    if 'pscl5_set' not in elem:
+        elem['prefetcher_selection'] = module_selection(elem, 'prefetcher_name', 'prefetcher', elem, 'prefetcher_params')
+        elem['replacement_selection'] = module_selection(elem, 'replacement_name', 'replacement', elem, 'replacement_params')
+        elem['prefetcher_params_json'] = module_params(elem, 'prefetcher_params')
+        elem['replacement_params_json'] = module_params(elem, 'replacement_params')
+        elem['partition_json'] = module_params(elem, 'partition')
+        elem['snoop_filter_json'] = module_params(elem, 'snoop_filter')
+        elem['inclusion_name'] = elem.get('inclusion', 'non_inclusive')
+        if elem['inclusion_name'] not in inclusion_policies:
+            print('Inclusion policy "' + str(elem['inclusion_name']) + '" of cache ' + elem['name'] + ' is not one of ' + ', '.join(inclusion_policies) + '. Exiting...')
+            sys.exit(1)
+
+for cpu in cores:
+    l1i = next(elem for elem in memory_system if elem['name'] == cpu['L1I'])
+    cpu['bpred_selection'] = module_selection(cpu, 'bpred_name', 'branch_predictor', cpu, 'branch_predictor_params')
+    cpu['btb_selection'] = module_selection(cpu, 'btb_name', 'btb', cpu, 'btb_params')
+    cpu['iprefetcher_selection'] = module_selection(cpu, 'iprefetcher_name', 'iprefetcher', l1i, 'prefetcher_params')
+    cpu['branch_predictor_params_json'] = module_params(cpu, 'branch_predictor_params')
+    cpu['btb_params_json'] = module_params(cpu, 'btb_params')
+    cpu['iprefetcher_params_json'] = module_params(l1i, 'prefetcher_params')
+
 ###
 # Begin file writing
 ###
@@ -424,13 +542,16 @@ with open(instantiation_file_name, 'wt') as wfp:
     wfp.write('#include "ptw.h"\n')
     wfp.write('#include "vmem.h"\n')
     wfp.write('#include "operable.h"\n')
+    wfp.write('#include "runtime_config.h"\n')
     wfp.write('#include "' + os.path.basename(constants_header_name) + '"\n')
     wfp.write('#include <array>\n')
+    wfp.write('#include <map>\n')
+    wfp.write('#include <string>\n')
     wfp.write('#include <vector>\n')
 
-    wfp.write(vmem_fmtstr.format(attrs=config_file['virtual_memory']))
+    wfp.write(vmem_fmtstr.format(attrs=config_file['virtual_memory'], policy=huge_page_policies[config_file['virtual_memory']['huge_pages']]))
     wfp.write('\n')
-    wfp.write(pmem_fmtstr.format(attrs=config_file['physical_memory']))
+    wfp.write(pmem_fmtstr.format(attrs=config_file['physical_memory'], scheduler=config_file['physical_memory']['scheduler'].upper()))
     for elem in memory_system:
         if 'pscl5_set' in elem:
             wfp.write(ptw_fmtstr.format(**elem))
@@ -452,75 +573,114 @@ with open(instantiation_file_name, 'wt') as wfp:
     wfp.write(', '.join('&{name}'.format(**elem) for elem in itertools.chain(cores, memory_system, (config_file['physical_memory'],))))
     wfp.write('\n};\n')
 
+    # Parameters and modules available to the runtime configuration
+    wfp.write('\nconst std::vector<champsim::cache_params> champsim::compiled_caches = {\n')
+    wfp.write(',\n'.join(cache_params_fmtstr.format(**elem, lower_name=elem['lower_level'].lstrip('&')) for elem in memory_system if 'pscl5_set' not in elem))
+    wfp.write('\n};\n')
+
+    wfp.write('const std::vector<champsim::ptw_params> champsim::compiled_ptws = {\n')
+    wfp.write(',\n'.join(ptw_params_fmtstr.format(**elem, lower_name=elem['lower_level'].lstrip('&')) for elem in memory_system if 'pscl5_set' in elem))
+    wfp.write('\n};\n')
+
+    wfp.write('const std::vector<champsim::cpu_params> champsim::compiled_cores = {\n')
+    wfp.write(',\n'.join(cpu_params_fmtstr.format(**cpu) for cpu in cores))
+    wfp.write('\n};\n\n')
+
+    wfp.write('const std::map<std::string, O3_CPU::bpred_t> champsim::branch_predictor_modules = {\n')
+    wfp.write(',\n'.join('    {{"{}", O3_CPU::bpred_t::{}}}'.format(*b) for b in sorted({(c['branch_predictor'], c['bpred_name']) for c in module_cores if is_legacy(c, 'bpred_name')})))
+    wfp.write('\n};\n')
+
+    wfp.write('const std::map<std::string, O3_CPU::btb_t> champsim::btb_modules = {\n')
+    wfp.write(',\n'.join('    {{"{}", O3_CPU::btb_t::{}}}'.format(*b) for b in sorted({(c['btb'], c['btb_name']) for c in module_cores if is_legacy(c, 'btb_name')})))
+    wfp.write('\n};\n')
+
+    wfp.write('const std::map<std::string, std::pair<O3_CPU::ipref_t, CACHE::pref_t>> champsim::instruction_prefetcher_modules = {\n')
+    wfp.write(',\n'.join('    {{"{0}", {{O3_CPU::ipref_t::{1}, CACHE::pref_t::CPU_REDIRECT_{1}_}}}}'.format(*p) for p in sorted({(c['iprefetcher'], c['iprefetcher_name']) for c in module_cores if is_legacy(c, 'iprefetcher_name')})))
+    wfp.write('\n};\n')
+
+    wfp.write('const std::map<std::string, CACHE::pref_t> champsim::data_prefetcher_modules = {\n')
+    wfp.write(',\n'.join('    {{"{}", CACHE::pref_t::{}}}'.format(*p) for p in sorted({(c['prefetcher'], c['prefetcher_name']) for c in module_caches if is_legacy(c, 'prefetcher_name') and not c['prefetcher_name'].startswith('CPU_REDIRECT')})))
+    wfp.write('\n};\n')
+
+    wfp.write('const std::map<std::string, CACHE::repl_t> champsim::replacement_modules = {\n')
+    wfp.write(',\n'.join('    {{"{}", CACHE::repl_t::{}}}'.format(*r) for r in sorted({(c['replacement'], c['replacement_name']) for c in module_caches if is_legacy(c, 'replacement_name')})))
+    wfp.write('\n};\n')
+
 # Core modules file
-bpred_names        = {c['bpred_name'] for c in cores}
-bpred_inits        = {(c['bpred_name'], c['bpred_initialize']) for c in cores}
-bpred_last_results = {(c['bpred_name'], c['bpred_last_result']) for c in cores}
-bpred_predicts     = {(c['bpred_name'], c['bpred_predict']) for c in cores}
-btb_names          = {c['btb_name'] for c in cores}
-btb_inits          = {(c['btb_name'], c['btb_initialize']) for c in cores}
-btb_updates        = {(c['btb_name'], c['btb_update']) for c in cores}
-btb_predicts       = {(c['btb_name'], c['btb_predict']) for c in cores}
-ipref_names        = {c['iprefetcher_name'] for c in cores}
-ipref_inits        = {(c['iprefetcher_name'], c['iprefetcher_initialize']) for c in cores}
-ipref_branch_ops   = {(c['iprefetcher_name'], c['iprefetcher_branch_operate']) for c in cores}
-ipref_cache_ops    = {(c['iprefetcher_name'], c['iprefetcher_cache_operate']) for c in cores}
-ipref_cycle_ops    = {(c['iprefetcher_name'], c['iprefetcher_cycle_operate']) for c in cores}
-ipref_fill         = {(c['iprefetcher_name'], c['iprefetcher_cache_fill']) for c in cores}
-ipref_finals       = {(c['iprefetcher_name'], c['iprefetcher_final_stats']) for c in cores}
+bpred_names        = {c['bpred_name'] for c in module_cores if is_legacy(c, 'bpred_name')}
+bpred_inits        = {(c['bpred_name'], c['bpred_initialize']) for c in module_cores if is_legacy(c, 'bpred_name')}
+bpred_last_results = {(c['bpred_name'], c['bpred_last_result']) for c in module_cores if is_legacy(c, 'bpred_name')}
+bpred_predicts     = {(c['bpred_name'], c['bpred_predict']) for c in module_cores if is_legacy(c, 'bpred_name')}
+btb_names          = {c['btb_name'] for c in module_cores if is_legacy(c, 'btb_name')}
+btb_inits          = {(c['btb_name'], c['btb_initialize']) for c in module_cores if is_legacy(c, 'btb_name')}
+btb_updates        = {(c['btb_name'], c['btb_update']) for c in module_cores if is_legacy(c, 'btb_name')}
+btb_predicts       = {(c['btb_name'], c['btb_predict']) for c in module_cores if is_legacy(c, 'btb_name')}
+ipref_names        = {c['iprefetcher_name'] for c in module_cores if is_legacy(c, 'iprefetcher_name')}
+ipref_inits        = {(c['iprefetcher_name'], c['iprefetcher_initialize']) for c in module_cores if is_legacy(c, 'iprefetcher_name')}
+ipref_branch_ops   = {(c['iprefetcher_name'], c['iprefetcher_branch_operate']) for c in module_cores if is_legacy(c, 'iprefetcher_name')}
+ipref_cache_ops    = {(c['iprefetcher_name'], c['iprefetcher_cache_operate']) for c in module_cores if is_legacy(c, 'iprefetcher_name')}
+ipref_cycle_ops    = {(c['iprefetcher_name'], c['iprefetcher_cycle_operate']) for c in module_cores if is_legacy(c, 'iprefetcher_name')}
+ipref_fill         = {(c['iprefetcher_name'], c['iprefetcher_cache_fill']) for c in module_cores if is_legacy(c, 'iprefetcher_name')}
+ipref_finals       = {(c['iprefetcher_name'], c['iprefetcher_final_stats']) for c in module_cores if is_legacy(c, 'iprefetcher_name')}
 with open('inc/ooo_cpu_modules.inc', 'wt') as wfp:
     wfp.write('enum class bpred_t\n{\n    ')
-    wfp.write(',\n    '.join(bpred_names))
+    wfp.write(',\n    '.join(['instance', *bpred_names]))
     wfp.write('\n};\n\n')
 
     wfp.write('\n'.join('void {1}();'.format(*b) for b in bpred_inits))
     wfp.write('\nvoid impl_branch_predictor_initialize()\n{\n    ')
+    wfp.write('if (bpred_type == bpred_t::instance) return champsim::modules::initialize(bpred_module, bpred_selection, this);\n    ')
     wfp.write('\n    '.join('if (bpred_type == bpred_t::{}) return {}();'.format(*b) for b in bpred_inits))
     wfp.write('\n    throw std::invalid_argument("Branch predictor module not found");')
     wfp.write('\n}\n')
     wfp.write('\n')
 
     wfp.write('\n'.join('void {1}(uint64_t, uint64_t, uint8_t, uint8_t);'.format(*b) for b in bpred_last_results))
-    wfp.write('\nvoid impl_last_branch_result(uint64_t ip, uint64_t target, uint8_t taken, uint8_t branch_type)\n{\n    ')
+    wfp.write('\nvoid impl_last_branch_result(uint64_t ip, uint64_t target, uint8_t taken, uint8_t branch_type, const champsim::modules::branch_context& context)\n{\n    ')
+    wfp.write('if (bpred_type == bpred_t::instance) return bpred_module->last_result(ip, target, taken, branch_type, context);\n    ')
     wfp.write('\n    '.join('if (bpred_type == bpred_t::{}) return {}(ip, target, taken, branch_type);'.format(*b) for b in bpred_last_results))
     wfp.write('\n    throw std::invalid_argument("Branch predictor module not found");')
     wfp.write('\n}\n')
     wfp.write('\n')
 
     wfp.write('\n'.join('uint8_t {1}(uint64_t, uint64_t, uint8_t, uint8_t);'.format(*b) for b in bpred_predicts))
-    wfp.write('\nuint8_t impl_predict_branch(uint64_t ip, uint64_t predicted_target, uint8_t always_taken, uint8_t branch_type)\n{\n    ')
+    wfp.write('\nuint8_t impl_predict_branch(uint64_t ip, uint64_t predicted_target, uint8_t always_taken, uint8_t branch_type, const champsim::modules::branch_context& context)\n{\n    ')
+    wfp.write('if (bpred_type == bpred_t::instance) return bpred_module->predict(ip, predicted_target, always_taken, branch_type, context);\n    ')
     wfp.write('\n    '.join('if (bpred_type == bpred_t::{}) return {}(ip, predicted_target, always_taken, branch_type);'.format(*b) for b in bpred_predicts))
     wfp.write('\n    throw std::invalid_argument("Branch predictor module not found");')
     wfp.write('\n    return 0;\n}\n\n')
 
     wfp.write('enum class btb_t\n{\n    ')
-    wfp.write(',\n    '.join(btb_names))
+    wfp.write(',\n    '.join(['instance', *btb_names]))
     wfp.write('\n};\n')
     wfp.write('\n')
 
     wfp.write('\n'.join('void {1}();'.format(*b) for b in btb_inits))
     wfp.write('\nvoid impl_btb_initialize()\n{\n    ')
+    wfp.write('if (btb_type == btb_t::instance) return champsim::modules::initialize(btb_module, btb_selection, this);\n    ')
     wfp.write('\n    '.join('if (btb_type == btb_t::{}) return {}();'.format(*b) for b in btb_inits))
     wfp.write('\n    throw std::invalid_argument("Branch target buffer module not found");')
     wfp.write('\n}\n')
     wfp.write('\n')
 
     wfp.write('\n'.join('void {1}(uint64_t, uint64_t, uint8_t, uint8_t);'.format(*b) for b in btb_updates))
-    wfp.write('\nvoid impl_update_btb(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type)\n{\n    ')
+    wfp.write('\nvoid impl_update_btb(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type, const champsim::modules::branch_context& context)\n{\n    ')
+    wfp.write('if (btb_type == btb_t::instance) return btb_module->update(ip, branch_target, taken, branch_type, context);\n    ')
     wfp.write('\n    '.join('if (btb_type == btb_t::{}) return {}(ip, branch_target, taken, branch_type);'.format(*b) for b in btb_updates))
     wfp.write('\n    throw std::invalid_argument("Branch target buffer module not found");')
     wfp.write('\n}\n')
     wfp.write('\n')
 
     wfp.write('\n'.join('std::pair<uint64_t, uint8_t> {1}(uint64_t, uint8_t);'.format(*b) for b in btb_predicts))
-    wfp.write('\nstd::pair<uint64_t, uint8_t> impl_btb_prediction(uint64_t ip, uint8_t branch_type)\n{\n    ')
+    wfp.write('\nstd::pair<uint64_t, uint8_t> impl_btb_prediction(uint64_t ip, uint8_t branch_type, const champsim::modules::branch_context& context)\n{\n    ')
+    wfp.write('if (btb_type == btb_t::instance) return btb_module->prediction(ip, branch_type, context);\n    ')
     wfp.write('\n    '.join('if (btb_type == btb_t::{}) return {}(ip, branch_type);'.format(*b) for b in btb_predicts))
     wfp.write('\n    throw std::invalid_argument("Branch target buffer module not found");')
     wfp.write('\n}\n')
     wfp.write('\n')
 
     wfp.write('enum class ipref_t\n{\n    ')
-    wfp.write(',\n    '.join(ipref_names))
+    wfp.write(',\n    '.join(['instance', *ipref_names]))
     wfp.write('\n};\n')
     wfp.write('\n')
 
@@ -533,6 +693,7 @@ with open('inc/ooo_cpu_modules.inc', 'wt') as wfp:
 
     wfp.write('\n'.join('void {1}(uint64_t, uint8_t, uint64_t);'.format(*i) for i in ipref_branch_ops))
     wfp.write('\nvoid impl_prefetcher_branch_operate(uint64_t ip, uint8_t branch_type, uint64_t branch_target)\n{\n    ')
+    wfp.write('if (ipref_type == ipref_t::instance) return ipref_module->branch_operate(ip, branch_type, branch_target);\n    ')
     wfp.write('\n    '.join('if (ipref_type == ipref_t::{}) return {}(ip, branch_type, branch_target);'.format(*i) for i in ipref_branch_ops))
     wfp.write('\n    throw std::invalid_argument("Instruction prefetcher module not found");')
     wfp.write('\n}\n')
@@ -547,6 +708,7 @@ with open('inc/ooo_cpu_modules.inc', 'wt') as wfp:
 
     wfp.write('\n'.join('void {1}();'.format(*i) for i in ipref_cycle_ops))
     wfp.write('\nvoid impl_prefetcher_cycle_operate()\n{\n    ')
+    wfp.write('if (ipref_type == ipref_t::instance) return ipref_module->cycle_operate();\n    ')
     wfp.write('\n    '.join('if (ipref_type == ipref_t::{}) return {}();'.format(*i) for i in ipref_cycle_ops))
     wfp.write('\n    throw std::invalid_argument("Instruction prefetcher module not found");')
     wfp.write('\n}\n')
@@ -567,25 +729,26 @@ with open('inc/ooo_cpu_modules.inc', 'wt') as wfp:
     wfp.write('\n')
 
 # Cache modules file
-repl_names   = {c['replacement_name'] for c in caches.values()}
-repl_inits   = {(c['replacement_name'], c['replacement_initialize']) for c in caches.values()}
-repl_victims = {(c['replacement_name'], c['replacement_find_victim']) for c in caches.values()}
-repl_updates = {(c['replacement_name'], c['replacement_update_replacement_state']) for c in caches.values()}
-repl_finals  = {(c['replacement_name'], c['replacement_replacement_final_stats']) for c in caches.values()}
-pref_names   = {c['prefetcher_name'] for c in caches.values()}
-pref_inits   = {(c['prefetcher_name'], c['prefetcher_initialize']) for c in caches.values()}
-pref_ops     = {(c['prefetcher_name'], c['prefetcher_cache_operate']) for c in caches.values()}
-pref_fill    = {(c['prefetcher_name'], c['prefetcher_cache_fill']) for c in caches.values()}
-pref_cycles  = {(c['prefetcher_name'], c['prefetcher_cycle_operate']) for c in caches.values()}
-pref_finals  = {(c['prefetcher_name'], c['prefetcher_final_stats']) for c in caches.values()}
+repl_names   = {c['replacement_name'] for c in module_caches if is_legacy(c, 'replacement_name')}
+repl_inits   = {(c['replacement_name'], c['replacement_initialize']) for c in module_caches if is_legacy(c, 'replacement_name')}
+repl_victims = {(c['replacement_name'], c['replacement_find_victim']) for c in module_caches if is_legacy(c, 'replacement_name')}
+repl_updates = {(c['replacement_name'], c['replacement_update_replacement_state']) for c in module_caches if is_legacy(c, 'replacement_name')}
+repl_finals  = {(c['replacement_name'], c['replacement_replacement_final_stats']) for c in module_caches if is_legacy(c, 'replacement_name')}
+pref_names   = {c['prefetcher_name'] for c in module_caches if is_legacy(c, 'prefetcher_name')}
+pref_inits   = {(c['prefetcher_name'], c['prefetcher_initialize']) for c in module_caches if is_legacy(c, 'prefetcher_name')}
+pref_ops     = {(c['prefetcher_name'], c['prefetcher_cache_operate']) for c in module_caches if is_legacy(c, 'prefetcher_name')}
+pref_fill    = {(c['prefetcher_name'], c['prefetcher_cache_fill']) for c in module_caches if is_legacy(c, 'prefetcher_name')}
+pref_cycles  = {(c['prefetcher_name'], c['prefetcher_cycle_operate']) for c in module_caches if is_legacy(c, 'prefetcher_name')}
+pref_finals  = {(c['prefetcher_name'], c['prefetcher_final_stats']) for c in module_caches if is_legacy(c, 'prefetcher_name')}
 with open('inc/cache_modules.inc', 'wt') as wfp:
     wfp.write('enum class repl_t\n{\n    ')
-    wfp.write(',\n    '.join(repl_names))
+    wfp.write(',\n    '.join(['instance', *repl_names]))
     wfp.write('\n};\n')
     wfp.write('\n')
 
     wfp.write('\n'.join('void {1}();'.format(*r) for r in repl_inits))
     wfp.write('\nvoid impl_replacement_initialize()\n{\n    ')
+    wfp.write('if (repl_type == repl_t::instance) return champsim::modules::initialize(repl_module, repl_selection, this);\n    ')
     wfp.write('\n    '.join('if (repl_type == repl_t::{}) return {}();'.format(*r) for r in repl_inits))
     wfp.write('\n    throw std::invalid_argument("Replacement policy module not found");')
     wfp.write('\n}\n')
@@ -593,6 +756,7 @@ with open('inc/cache_modules.inc', 'wt') as wfp:
 
     wfp.write('\n'.join('uint32_t {1}(uint32_t, uint64_t, uint32_t, const BLOCK*, uint64_t, uint64_t, uint32_t);'.format(*r) for r in repl_victims))
     wfp.write('\nuint32_t impl_replacement_find_victim(uint32_t cpu, uint64_t instr_id, uint32_t set, const BLOCK* current_set, uint64_t ip, uint64_t full_addr, uint32_t type)\n{\n    ')
+    wfp.write('if (repl_type == repl_t::instance) return repl_module->victim(cpu, instr_id, set, current_set, ip, full_addr, type);\n    ')
     wfp.write('\n    '.join('if (repl_type == repl_t::{}) return {}(cpu, instr_id, set, current_set, ip, full_addr, type);'.format(*r) for r in repl_victims))
     wfp.write('\n    throw std::invalid_argument("Replacement policy module not found");')
     wfp.write('\n}\n')
@@ -600,6 +764,7 @@ with open('inc/cache_modules.inc', 'wt') as wfp:
 
     wfp.write('\n'.join('void {1}(uint32_t, uint32_t, uint32_t, uint64_t, uint64_t, uint64_t, uint32_t, uint8_t);'.format(*r) for r in repl_updates))
     wfp.write('\nvoid impl_replacement_update_state(uint32_t cpu, uint32_t set, uint32_t way, uint64_t full_addr, uint64_t ip, uint64_t victim_addr, uint32_t type, uint8_t hit)\n{\n    ')
+    wfp.write('if (repl_type == repl_t::instance) return repl_module->update_state(cpu, set, way, full_addr, ip, victim_addr, type, hit);\n    ')
     wfp.write('\n    '.join('if (repl_type == repl_t::{}) return {}(cpu, set, way, full_addr, ip, victim_addr, type, hit);'.format(*r) for r in repl_updates))
     wfp.write('\n    throw std::invalid_argument("Replacement policy module not found");')
     wfp.write('\n}\n')
@@ -607,18 +772,20 @@ with open('inc/cache_modules.inc', 'wt') as wfp:
 
     wfp.write('\n'.join('void {1}();'.format(*r) for r in repl_finals))
     wfp.write('\nvoid impl_replacement_final_stats()\n{\n    ')
+    wfp.write('if (repl_type == repl_t::instance) return repl_module->final_stats();\n    ')
     wfp.write('\n    '.join('if (repl_type == repl_t::{}) return {}();'.format(*r) for r in repl_finals))
     wfp.write('\n    throw std::invalid_argument("Replacement policy module not found");')
     wfp.write('\n}\n')
     wfp.write('\n')
 
     wfp.write('enum class pref_t\n{\n    ')
-    wfp.write(',\n    '.join(pref_names))
+    wfp.write(',\n    '.join(['instance', 'CPU_REDIRECT_instance_', *pref_names]))
     wfp.write('\n};\n')
     wfp.write('\n')
 
     wfp.write('\n'.join('void {1}();'.format(*p) for p in pref_inits if not p[0].startswith('CPU_REDIRECT')))
     wfp.write('\nvoid impl_prefetcher_initialize()\n{\n    ')
+    wfp.write('if (pref_type == pref_t::instance) return champsim::modules::initialize(pref_module, pref_selection, this);\n    if (pref_type == pref_t::CPU_REDIRECT_instance_) return; // built and initialized by the core\n    ')
     pref_inits = { (n, ('ooo_cpu[cpu]->' if n.startswith('CPU_REDIRECT') else '') + f) for n,f in pref_inits } ## prepend redirect
     wfp.write('\n    '.join('if (pref_type == pref_t::{}) return {}();'.format(*p) for p in pref_inits))
     wfp.write('\n    throw std::invalid_argument("Data prefetcher module not found");')
@@ -627,6 +794,7 @@ with open('inc/cache_modules.inc', 'wt') as wfp:
 
     wfp.write('\n'.join('uint32_t {1}(uint64_t, uint64_t, uint8_t, uint8_t, uint32_t);'.format(*p) for p in pref_ops if not p[0].startswith('CPU_REDIRECT')))
     wfp.write('\nuint32_t impl_prefetcher_cache_operate(uint64_t addr, uint64_t ip, uint8_t cache_hit, uint8_t type, uint32_t metadata_in)\n{\n    ')
+    wfp.write('if (pref_type == pref_t::instance) return pref_module->cache_operate(addr, ip, cache_hit, type, metadata_in);\n    if (pref_type == pref_t::CPU_REDIRECT_instance_) return ooo_cpu[cpu]->ipref_module->cache_operate(addr, cache_hit, (type == PREFETCH), metadata_in);\n    ')
     pref_ops = { (n, ('ooo_cpu[cpu]->{}(addr, cache_hit, (type == PREFETCH), metadata_in)' if n.startswith('CPU_REDIRECT') else '{}(addr, ip, cache_hit, type, metadata_in)').format(f)) for n,f in pref_ops } ## modify signature for redirect
     wfp.write('\n    '.join('if (pref_type == pref_t::{}) return {};'.format(*p) for p in pref_ops))
     wfp.write('\n    throw std::invalid_argument("Data prefetcher module not found");')
@@ -635,6 +803,7 @@ with open('inc/cache_modules.inc', 'wt') as wfp:
 
     wfp.write('\n'.join('uint32_t {1}(uint64_t, uint32_t, uint32_t, uint8_t, uint64_t, uint32_t);'.format(*p) for p in pref_fill if not p[0].startswith('CPU_REDIRECT')))
     wfp.write('\nuint32_t impl_prefetcher_cache_fill(uint64_t addr, uint32_t set, uint32_t way, uint8_t prefetch, uint64_t evicted_addr, uint32_t metadata_in)\n{\n    ')
+    wfp.write('if (pref_type == pref_t::instance) return pref_module->cache_fill(addr, set, way, prefetch, evicted_addr, metadata_in);\n    if (pref_type == pref_t::CPU_REDIRECT_instance_) return ooo_cpu[cpu]->ipref_module->cache_fill(addr, set, way, prefetch, evicted_addr, metadata_in);\n    ')
     pref_fill = { (n, ('ooo_cpu[cpu]->' if n.startswith('CPU_REDIRECT') else '') + f) for n,f in pref_fill } ## prepend redirect
     wfp.write('\n    '.join('if (pref_type == pref_t::{}) return {}(addr, set, way, prefetch, evicted_addr, metadata_in);'.format(*p) for p in pref_fill))
     wfp.write('\n    throw std::invalid_argument("Data prefetcher module not found");')
@@ -643,6 +812,7 @@ with open('inc/cache_modules.inc', 'wt') as wfp:
 
     wfp.write('\n'.join('void {1}();'.format(*p) for p in pref_cycles if not p[0].startswith('CPU_REDIRECT')))
     wfp.write('\nvoid impl_prefetcher_cycle_operate()\n{\n    ')
+    wfp.write('if (pref_type == pref_t::instance) return pref_module->cycle_operate();\n    if (pref_type == pref_t::CPU_REDIRECT_instance_) return ooo_cpu[cpu]->ipref_module->cycle_operate();\n    ')
     pref_cycles = { (n, ('ooo_cpu[cpu]->' if n.startswith('CPU_REDIRECT') else '') + f) for n,f in pref_cycles } ## prepend redirect
     wfp.write('\n    '.join('if (pref_type == pref_t::{}) return {}();'.format(*p) for p in pref_cycles))
     wfp.write('\n    throw std::invalid_argument("Data prefetcher module not found");')
@@ -651,6 +821,7 @@ with open('inc/cache_modules.inc', 'wt') as wfp:
 
     wfp.write('\n'.join('void {1}();'.format(*p) for p in pref_finals if not p[0].startswith('CPU_REDIRECT')))
     wfp.write('\nvoid impl_prefetcher_final_stats()\n{\n    ')
+    wfp.write('if (pref_type == pref_t::instance) return pref_module->final_stats();\n    if (pref_type == pref_t::CPU_REDIRECT_instance_) return ooo_cpu[cpu]->ipref_module->final_stats();\n    ')
     pref_finals = { (n, ('ooo_cpu[cpu]->' if n.startswith('CPU_REDIRECT') else '') + f) for n,f in pref_finals } ## prepend redirect
     wfp.write('\n    '.join('if (pref_type == pref_t::{}) return {}();'.format(*p) for p in pref_finals))
     wfp.write('\n    throw std::invalid_argument("Data prefetcher module not found");')
@@ -690,8 +861,9 @@ with open('Makefile', 'wt') as wfp:
     wfp.write('LDFLAGS := ' + config_file.get('LDFLAGS', '') + '\n')
     wfp.write('LDLIBS := ' + config_file.get('LDLIBS', '') + '\n')
     wfp.write('\n')
-    wfp.write('.phony: all clean\n\n')
+    wfp.write('.phony: all clean tools\n\n')
     wfp.write('all: ' + config_file['executable_name'] + '\n\n')
+    wfp.write('tools: bin/mrc_profiler\n\n')
     wfp.write('clean: \n')
     wfp.write('\t$(RM) ' + constants_header_name + '\n')
     wfp.write('\t$(RM) ' + instantiation_file_name + '\n')
@@ -702,12 +874,16 @@ with open('Makefile', 'wt') as wfp:
         wfp.write('\t find {0} -name \*.o -delete\n\t find {0} -name \*.d -delete\n'.format(*v))
     wfp.write('\n')
     wfp.write(config_file['executable_name'] + ': $(patsubst %.cc,%.o,$(wildcard src/*.cc)) ' + ' '.join('obj/' + k for k in libfilenames) + '\n')
+    wfp.write('\t$(CXX) $(LDFLAGS) -o $@ $(filter-out obj/mod_%,$^) -Wl,--whole-archive $(filter obj/mod_%,$^) -Wl,--no-whole-archive $(LDLIBS)\n\n')
+    wfp.write('bin/mrc_profiler: tools/mrc_profiler.o src/tracereader.o\n')
+    wfp.write('\t@mkdir -p $(dir $@)\n')
     wfp.write('\t$(CXX) $(LDFLAGS) -o $@ $^ $(LDLIBS)\n\n')
 
     for k,v in libfilenames.items():
         wfp.write(module_make_fmtstr.format(k, *v))
 
     wfp.write('-include $(wildcard src/*.d)\n')
+    wfp.write('-include $(wildcard tools/*.d)\n')
     for v in libfilenames.values():
         wfp.write('-include $(wildcard {0}/*.d)\n'.format(*v))
     wfp.write('\n')
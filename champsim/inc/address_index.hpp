@@ -0,0 +1,76 @@
+#ifndef ADDRESS_INDEX_HPP
+#define ADDRESS_INDEX_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "util.h"
+
+namespace champsim
+{
+/*
+ * A multimap from nonzero addresses to (instr_id, value) pairs, kept in one flat, open-addressed table with linear
+ * probing. It holds at most "capacity" pairs at a time and is sized for a load factor of a half or less, so that it
+ * never grows and a lookup touches a few adjacent slots. Erasing shifts the rest of the probe run back, so no
+ * tombstones build up.
+ */
+template <typename T>
+class address_index
+{
+  struct slot {
+    uint64_t address = 0; // 0 marks a free slot
+    uint64_t instr_id = 0;
+    T value = {};
+  };
+
+  std::vector<slot> slots;
+  const unsigned hash_bits;
+
+  std::size_t home(uint64_t address) const { return (address * 0x9e3779b97f4a7c15ull) >> (64 - hash_bits); }
+  std::size_t next(std::size_t i) const { return (i + 1) & (std::size(slots) - 1); }
+
+public:
+  explicit address_index(std::size_t capacity) : slots(std::size_t{4} << lg2(capacity)), hash_bits(lg2(std::size(slots))) {}
+
+  void insert(uint64_t address, uint64_t instr_id, T value)
+  {
+    assert(address != 0);
+    auto i = home(address);
+    while (slots[i].address != 0)
+      i = next(i);
+    slots[i] = {address, instr_id, value};
+  }
+
+  void erase(uint64_t address, uint64_t instr_id)
+  {
+    auto i = home(address);
+    while (slots[i].address != address || slots[i].instr_id != instr_id) {
+      assert(slots[i].address != 0);
+      i = next(i);
+    }
+
+    // Move back each later pair of the run that may sit in the freed slot
+    for (auto j = next(i); slots[j].address != 0; j = next(j)) {
+      auto k = home(slots[j].address);
+      if (((j - k) & (std::size(slots) - 1)) >= ((j - i) & (std::size(slots) - 1))) {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+    slots[i] = {};
+  }
+
+  // The value of the youngest pair for the address that is older than instr_id, or "none"
+  T youngest_before(uint64_t address, uint64_t instr_id, T none) const
+  {
+    const slot* found = nullptr;
+    for (auto i = home(address); slots[i].address != 0; i = next(i))
+      if (slots[i].address == address && slots[i].instr_id < instr_id && (found == nullptr || slots[i].instr_id > found->instr_id))
+        found = &slots[i];
+    return found == nullptr ? none : found->value;
+  }
+};
+} // namespace champsim
+
+#endif
@@ -15,7 +15,10 @@ class LSQ_ENTRY;
 class PACKET
 {
 public:
-  bool scheduled = false;
+  bool scheduled = false, is_kernel = false;
+
+  // Whether the line carried is dirty, for writebacks and for the lines that an exclusive cache gives up
+  bool dirty = false;
 
   uint8_t asid[2] = {std::numeric_limits<uint8_t>::max(), std::numeric_limits<uint8_t>::max()}, type = 0, fill_level = 0, pf_origin_level = 0;
 
@@ -54,6 +57,7 @@ struct LSQ_ENTRY {
   champsim::circular_buffer<ooo_model_instr>::iterator rob_index;
 
   uint8_t translated = 0, fetched = 0, asid[2] = {std::numeric_limits<uint8_t>::max(), std::numeric_limits<uint8_t>::max()};
+  bool is_kernel = false;
 };
 
 template <>
@@ -3,28 +3,43 @@
 
 #include <functional>
 #include <list>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "cache_partition.h"
 #include "champsim.h"
 #include "delay_queue.hpp"
 #include "memory_class.h"
+#include "modules.h"
 #include "ooo_cpu.h"
 #include "operable.h"
+#include "snoop_filter.h"
 
 // virtual address space prefetching
 #define VA_PREFETCH_TRANSLATION_LATENCY 2
 
+// cycles between two samples of the lines held in a cache and those above it
+#define CAPACITY_SAMPLE_INTERVAL 100000
+
 extern std::array<O3_CPU*, NUM_CPUS> ooo_cpu;
 
 class CACHE : public champsim::operable, public MemoryRequestConsumer, public MemoryRequestProducer
 {
 public:
-  uint32_t cpu;
+  // Whether the lines of the caches above are also kept in this one: always, never, or as it happens
+  enum class inclusion_t { non_inclusive, inclusive, exclusive };
+
+  uint32_t cpu = 0;
   const std::string NAME;
   const uint32_t NUM_SET, NUM_WAY, WQ_SIZE, RQ_SIZE, PQ_SIZE, MSHR_SIZE;
   const uint32_t HIT_LATENCY, FILL_LATENCY, OFFSET_BITS;
-  std::vector<BLOCK> block{NUM_SET * NUM_WAY};
+
+  // A TLB holds translations of each page size that virtual memory maps. Huge pages are kept in this many sets of their own after the others,
+  // or if there are none, share the sets of base pages.
+  const uint32_t HUGE_PAGE_SETS;
+  std::vector<BLOCK> block{(NUM_SET + HUGE_PAGE_SETS) * NUM_WAY};
   const uint32_t MAX_READ, MAX_WRITE;
   uint32_t reads_available_this_cycle, writes_available_this_cycle;
   const bool prefetch_as_load;
@@ -33,8 +48,8 @@ public:
   bool ever_seen_data = false;
   const unsigned pref_activate_mask = (1 << static_cast<int>(LOAD)) | (1 << static_cast<int>(PREFETCH));
 
-  // prefetch stats
-  uint64_t pf_requested = 0, pf_issued = 0, pf_useful = 0, pf_useless = 0, pf_fill = 0;
+  // prefetch stats, of which pf_late counts the useful prefetches that a demand request found still in flight
+  uint64_t pf_requested = 0, pf_issued = 0, pf_useful = 0, pf_useless = 0, pf_fill = 0, pf_late = 0;
 
   // queues
   champsim::delay_queue<PACKET> RQ{RQ_SIZE, HIT_LATENCY}, // read queue
@@ -52,6 +67,13 @@ public:
 
   uint64_t total_miss_latency = 0;
 
+  // The lines dropped above when this cache evicted them or replaced their snoop filter entry, those of them that were dirty,
+  // and the clean lines written into this cache by the caches above
+  uint64_t back_invalidations = 0, back_invalidations_dirty = 0, clean_victims = 0;
+
+  // The lines held in this cache and the caches above it, and those held more than once, summed over the samples
+  uint64_t capacity_samples = 0, unique_line_samples = 0, duplicate_line_samples = 0, next_capacity_sample = 0;
+
   // functions
   int add_rq(PACKET* packet) override;
   int add_wq(PACKET* packet) override;
@@ -66,9 +88,26 @@ public:
   uint32_t get_size(uint8_t queue_type, uint64_t address) override;
 
   uint32_t get_set(uint64_t address);
+  uint32_t get_set(uint64_t address, uint64_t page_bits);
   uint32_t get_way(uint64_t address, uint32_t set);
+  std::pair<uint32_t, uint32_t> find_block(uint64_t address);
+  uint64_t fill_ways(const PACKET& packet) const;
+  uint32_t first_invalid_way(uint32_t set, uint64_t allowed_ways);
+  uint32_t find_victim_in(uint32_t set, uint64_t allowed_ways, const PACKET& packet);
+  void partition_access(uint32_t set, const PACKET& packet, bool hit);
+  bool holds_translations() const;
+  bool holds_huge_pages() const;
 
   int invalidate_entry(uint64_t inval_addr);
+  bool holds_above(uint64_t address);
+  bool dirty_above(uint64_t address);
+  void back_invalidate(uint64_t address, uint64_t uppers);
+  void note_fill(uint64_t address);
+  void note_eviction(uint64_t address);
+  std::size_t upper_index(const CACHE* upper) const;
+  uint64_t upper_mask(const std::vector<MemoryRequestProducer*>& producers) const;
+  void collect_lines(std::vector<uint64_t>& lines) const;
+  void sample_capacity();
   int prefetch_line(uint64_t pf_addr, bool fill_this_level, uint32_t prefetch_metadata);
   int prefetch_line(uint64_t ip, uint64_t base_addr, uint64_t pf_addr, bool fill_this_level, uint32_t prefetch_metadata); // deprecated
 
@@ -93,15 +132,42 @@ public:
   const repl_t repl_type;
   const pref_t pref_type;
 
+  // Modules written as classes, built from the registry when the cache is initialized
+  const champsim::modules::selection pref_selection, repl_selection;
+  std::unique_ptr<champsim::modules::prefetcher> pref_module;
+  std::unique_ptr<champsim::modules::replacement> repl_module;
+
+  // The ways that each partition may fill, if "partition" is given in the configuration of this cache
+  std::unique_ptr<champsim::cache_partitioner> partitioner;
+
+  const inclusion_t inclusion;
+
+  // The caches directly above and the cache directly below, linked before the simulation begins
+  std::vector<CACHE*> upper_levels;
+  CACHE* lower_cache = nullptr;
+  bool snoop_filter_below = false; // whether any cache below keeps a snoop filter
+
+  // The lines held above, if "snoop_filter" is given in the configuration of this cache
+  std::unique_ptr<champsim::snoop_filter> snoop_filter;
+  std::list<PACKET> snoop_filter_writebacks;
+
   // constructor
   CACHE(std::string v1, double freq_scale, unsigned fill_level, uint32_t v2, int v3, uint32_t v5, uint32_t v6, uint32_t v7, uint32_t v8, uint32_t hit_lat,
-        uint32_t fill_lat, uint32_t max_read, uint32_t max_write, std::size_t offset_bits, bool pref_load, bool wq_full_addr, bool va_pref,
-        unsigned pref_act_mask, MemoryRequestConsumer* ll, pref_t pref, repl_t repl)
+        uint32_t fill_lat, uint32_t max_read, uint32_t max_write, std::size_t offset_bits, uint32_t huge_page_sets, bool pref_load, bool wq_full_addr, bool va_pref,
+        unsigned pref_act_mask, MemoryRequestConsumer* ll, pref_t pref, repl_t repl, champsim::modules::selection pref_sel = {},
+        champsim::modules::selection repl_sel = {}, const champsim::json_value& partition = {}, inclusion_t incl = inclusion_t::non_inclusive,
+        const champsim::json_value& snoop_filter_params = {})
       : champsim::operable(freq_scale), MemoryRequestConsumer(fill_level), MemoryRequestProducer(ll), NAME(v1), NUM_SET(v2), NUM_WAY(v3), WQ_SIZE(v5),
-        RQ_SIZE(v6), PQ_SIZE(v7), MSHR_SIZE(v8), HIT_LATENCY(hit_lat), FILL_LATENCY(fill_lat), OFFSET_BITS(offset_bits), MAX_READ(max_read),
+        RQ_SIZE(v6), PQ_SIZE(v7), MSHR_SIZE(v8), HIT_LATENCY(hit_lat), FILL_LATENCY(fill_lat), OFFSET_BITS(offset_bits), HUGE_PAGE_SETS(huge_page_sets), MAX_READ(max_read),
         MAX_WRITE(max_write), prefetch_as_load(pref_load), match_offset_bits(wq_full_addr), virtual_prefetch(va_pref), pref_activate_mask(pref_act_mask),
-        repl_type(repl), pref_type(pref)
+        repl_type(repl), pref_type(pref), pref_selection(pref_sel), repl_selection(repl_sel), inclusion(incl)
   {
+    if (partition.size() > 0)
+      partitioner = std::make_unique<champsim::cache_partitioner>(partition, NUM_SET, NUM_WAY);
+    if (snoop_filter_params.size() > 0 && inclusion == inclusion_t::inclusive)
+      throw std::invalid_argument("Cache " + NAME + " is inclusive, and keeps the lines above in its own tags rather than a snoop filter");
+    if (snoop_filter_params.size() > 0)
+      snoop_filter = std::make_unique<champsim::snoop_filter>(snoop_filter_params, OFFSET_BITS);
   }
 };
 
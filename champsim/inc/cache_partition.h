@@ -0,0 +1,101 @@
+#ifndef CACHE_PARTITION_H
+#define CACHE_PARTITION_H
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+
+namespace champsim
+{
+
+/*
+ * Way partitioning of a cache, as Intel CAT does it: the lines of a partition are filled only into
+ * the ways of its mask, and hit in any way. Selected with "partition" in the configuration of a cache:
+ *
+ *     "LLC": { "partition": { "key": "cpu", "way_masks": ["0x00ff", "0xff00"] } }
+ *
+ *     "key"             "cpu", a partition per core, or "asid_class", the partitions kernel, user, and
+ *                       function, the last for the user code of the ASIDs in "function_asids"
+ *     "way_masks"       the ways of each partition, as numbers or strings such as "0x0f", all ways if missing
+ *     "policy"          "static", the masks above, or "ucp", which divides the ways between the partitions
+ *                       by the utility of each way to each, as Qureshi and Patt, "Utility-Based Cache
+ *                       Partitioning," MICRO 2006
+ *     "interval"        cycles between two divisions of the ways by "ucp" (5000000)
+ *     "sampled_sets"    sets with shadow tags, whose hits at each recency position give the utility (32)
+ *     "min_ways"        ways that "ucp" leaves each partition (1)
+ *
+ * The masks of "ucp" are contiguous and do not overlap. Lines are not moved or flushed when the masks change.
+ */
+class cache_partitioner
+{
+public:
+  enum class key_type { cpu, asid_class };
+  enum class policy_type { fixed, ucp };
+
+  struct partition_stats {
+    uint64_t hits = 0, misses = 0, line_cycles = 0, total_miss_latency = 0, latency_samples = 0;
+    std::map<uint64_t, uint64_t> miss_latency; // demand misses by their latency in cycles, for the tail
+  };
+
+private:
+  const uint32_t NUM_SET, NUM_WAY;
+  key_type key = key_type::cpu;
+  policy_type policy = policy_type::fixed;
+  std::vector<uint16_t> function_asids;
+
+  uint64_t interval = 5000000, next_repartition = 0;
+  uint32_t sampled_sets = 32, min_ways = 1;
+
+  std::vector<uint64_t> masks;
+
+  // The shadow tags of each partition in the sampled sets, the most recently used first, and the hits at each position
+  std::vector<std::vector<uint64_t>> shadow_tags;
+  std::vector<std::vector<uint64_t>> way_hits;
+
+  uint32_t sample_stride() const { return std::max<uint32_t>(1, NUM_SET / sampled_sets); }
+  uint32_t sets_sampled() const { return (NUM_SET + sample_stride() - 1) / sample_stride(); }
+  void repartition();
+
+public:
+  std::vector<uint64_t> lines;
+  std::vector<partition_stats> stats;
+  uint64_t cycles = 0, repartitions = 0;
+
+  cache_partitioner(const json_value& params, uint32_t sets, uint32_t ways);
+
+  std::size_t size() const { return std::size(masks); }
+  std::string name(std::size_t partition) const;
+  std::size_t partition_of(uint32_t cpu, uint16_t asid, bool is_kernel) const;
+
+  // The partition of a request, or of a line filled by one
+  template <typename T>
+  std::size_t partition_of(const T& x) const
+  {
+    return partition_of(x.cpu, x.asid[0] | (x.asid[1] << 8), x.is_kernel);
+  }
+
+  uint64_t way_mask(std::size_t partition) const { return masks.at(partition); }
+
+  // A read that hit or missed in a set of the cache
+  void access(std::size_t partition, uint32_t set, uint64_t line_addr, bool hit, bool warm);
+
+  // Lines of a partition filled into and evicted or invalidated from the cache
+  void insert(std::size_t partition) { lines.at(partition)++; }
+  void remove(std::size_t partition) { lines.at(partition)--; }
+
+  // A demand miss of a partition, when its line is filled
+  void miss_latency(std::size_t partition, uint64_t latency, bool warm);
+
+  void operate(uint64_t cycle, bool warm);
+
+  // The demand miss latency that this fraction of the misses of a partition do not exceed
+  uint64_t latency_percentile(std::size_t partition, double fraction) const;
+};
+
+} // namespace champsim
+
+#endif
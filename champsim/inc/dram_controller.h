@@ -4,6 +4,10 @@
 #include <array>
 #include <cmath>
 #include <limits>
+#include <list>
+#include <queue>
+#include <unordered_map>
+#include <vector>
 
 #include "champsim_constants.h"
 #include "memory_class.h"
@@ -24,6 +28,18 @@ constexpr int32_t ceil(float num)
 }
 } // namespace detail
 
+// BLISS parameters: a core is blacklisted after this many consecutive requests are served for it,
+// and the blacklist is cleared periodically
+constexpr unsigned BLISS_BLACKLIST_THRESHOLD = 4;
+constexpr uint64_t BLISS_CLEARING_INTERVAL = 10000;
+
+// An unscheduled packet waiting for its bank
+struct BANK_QUEUE_ENTRY {
+  std::vector<PACKET>::iterator pkt;
+  uint32_t row = 0;
+  uint64_t order = 0; // queueing order within the channel
+};
+
 struct BANK_REQUEST {
   bool valid = false, row_buffer_hit = false;
 
@@ -32,11 +48,34 @@ struct BANK_REQUEST {
   uint64_t event_cycle = 0;
 
   std::vector<PACKET>::iterator pkt;
+
+  bool is_write = false;
+};
+
+// A read or write queue. Packets are stored in fixed slots, and each unscheduled packet is also
+// linked into the queue of the (rank, bank) it maps to, oldest first. Occupancy and the block
+// address index are maintained as packets come and go, so nothing here is searched linearly.
+struct DRAM_QUEUE {
+  std::vector<PACKET> entries;
+  std::priority_queue<std::vector<PACKET>::iterator, std::vector<std::vector<PACKET>::iterator>, std::greater<std::vector<PACKET>::iterator>> free_slots;
+  std::unordered_map<uint64_t, std::vector<PACKET>::iterator> addr_index;
+  std::array<std::list<BANK_QUEUE_ENTRY>, DRAM_RANKS * DRAM_BANKS> bank_queue;
+  std::size_t occupancy = 0;
+
+  explicit DRAM_QUEUE(std::size_t size);
+
+  std::size_t size() const { return entries.size(); }
+  bool full() const { return free_slots.empty(); }
+
+  std::vector<PACKET>::iterator find(uint64_t address);
+  std::vector<PACKET>::iterator insert(const PACKET& packet);
+  void enqueue(std::size_t bank_idx, std::vector<PACKET>::iterator pkt, uint32_t row, uint64_t order);
+  void release(std::vector<PACKET>::iterator pkt);
 };
 
 struct DRAM_CHANNEL {
-  std::vector<PACKET> WQ{DRAM_WQ_SIZE};
-  std::vector<PACKET> RQ{DRAM_RQ_SIZE};
+  DRAM_QUEUE WQ{DRAM_WQ_SIZE};
+  DRAM_QUEUE RQ{DRAM_RQ_SIZE};
 
   std::array<BANK_REQUEST, DRAM_RANKS* DRAM_BANKS> bank_request = {};
   std::array<BANK_REQUEST, DRAM_RANKS* DRAM_BANKS>::iterator active_request = std::end(bank_request);
@@ -45,6 +84,13 @@ struct DRAM_CHANNEL {
 
   bool write_mode = false;
 
+  uint64_t next_order = 0;
+
+  // BLISS state
+  std::array<bool, NUM_CPUS> blacklisted = {};
+  uint32_t last_served_cpu = NUM_CPUS;
+  unsigned served_streak = 0;
+
   unsigned WQ_ROW_BUFFER_HIT = 0, WQ_ROW_BUFFER_MISS = 0, RQ_ROW_BUFFER_HIT = 0, RQ_ROW_BUFFER_MISS = 0, WQ_FULL = 0;
 };
 
@@ -58,9 +104,20 @@ public:
   const static uint64_t DRAM_DBUS_TURN_AROUND_TIME = detail::ceil(1.0 * DBUS_TURN_AROUND_NANOSECONDS * DRAM_IO_FREQ / 1000);
   const static uint64_t DRAM_DBUS_RETURN_TIME = detail::ceil(1.0 * BLOCK_SIZE / DRAM_CHANNEL_WIDTH);
 
+  // Request scheduling policies
+  //   FCFS:   strictly the oldest request; nothing is scheduled while its bank is busy
+  //   FRFCFS: row buffer hits first, then the oldest request
+  //   BLISS:  FR-FCFS, but requests from blacklisted cores go last
+  enum class sched_t { FCFS, FRFCFS, BLISS };
+
   std::array<DRAM_CHANNEL, DRAM_CHANNELS> channels;
 
-  MEMORY_CONTROLLER(double freq_scale) : champsim::operable(freq_scale), MemoryRequestConsumer(std::numeric_limits<unsigned>::max()) {}
+  sched_t sched_type;
+
+  MEMORY_CONTROLLER(double freq_scale, sched_t sched_type = sched_t::FCFS)
+      : champsim::operable(freq_scale), MemoryRequestConsumer(std::numeric_limits<unsigned>::max()), sched_type(sched_type)
+  {
+  }
 
   int add_rq(PACKET* packet) override;
   int add_wq(PACKET* packet) override;
@@ -71,6 +128,9 @@ public:
   uint32_t get_occupancy(uint8_t queue_type, uint64_t address) override;
   uint32_t get_size(uint8_t queue_type, uint64_t address) override;
 
+  void schedule_request(DRAM_CHANNEL& channel);
+  void issue_request(DRAM_CHANNEL& channel, std::size_t bank_idx, std::list<BANK_QUEUE_ENTRY>::iterator entry);
+
   uint32_t dram_get_channel(uint64_t address);
   uint32_t dram_get_rank(uint64_t address);
   uint32_t dram_get_bank(uint64_t address);
@@ -0,0 +1,60 @@
+#ifndef FOLDED_HISTORY_H
+#define FOLDED_HISTORY_H
+
+#include <cstdint>
+#include <vector>
+
+#include "util.h"
+
+namespace champsim
+{
+// A long history of branch outcomes, kept as a circular buffer of bits. Bit 0 is the newest.
+class global_history
+{
+  std::vector<uint8_t> bits;
+  std::size_t head = 0;
+
+public:
+  // Holds at least the newest "length" bits, and the one before them that a folded history of that length drops
+  explicit global_history(std::size_t length) : bits(std::size_t{1} << (lg2(length) + 1)) {}
+
+  void push(bool bit)
+  {
+    head = (head + std::size(bits) - 1) & (std::size(bits) - 1);
+    bits[head] = bit;
+  }
+
+  bool operator[](std::size_t i) const { return bits[(head + i) & (std::size(bits) - 1)]; }
+};
+
+/*
+ * The newest "length" bits of a global history, folded by XOR into "width" bits, as in Seznec's
+ * TAGE. Each push to the history costs one shift and two XORs here, whatever the length, so a
+ * predictor with many long histories pays O(tables) per branch rather than O(history).
+ *
+ * Call update() once after each push to the history it follows.
+ */
+class folded_history
+{
+  uint64_t comp = 0;
+  unsigned length, width, outpoint;
+
+public:
+  folded_history(unsigned length, unsigned width) : length(length), width(width), outpoint(width == 0 ? 0 : length % width) {}
+
+  void update(const global_history& history)
+  {
+    if (width == 0)
+      return;
+
+    comp = (comp << 1) | history[0];
+    comp ^= uint64_t{history[length]} << outpoint;
+    comp ^= comp >> width;
+    comp &= bitmask(width);
+  }
+
+  uint64_t value() const { return comp; }
+};
+} // namespace champsim
+
+#endif
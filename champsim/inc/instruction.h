@@ -26,6 +26,20 @@
 #define BRANCH_RETURN 6
 #define BRANCH_OTHER 7
 
+// A function invocation that ends or begins just before an instruction, from the markers or the lifecycle events of a QEMU trace
+struct invocation_boundary {
+  bool ends = false, begins = false;
+  uint64_t function_id = 0; // of the invocation that begins
+};
+
+// A huge page the guest mapped, from a QEMU trace, of 2^log2_size bytes. An instruction carries those read with it.
+struct guest_mapping {
+  uint64_t vaddr = 0;
+  uint8_t log2_size = 0;
+};
+
+#define GUEST_MAPPINGS_PER_INSTR 2
+
 struct ooo_model_instr {
   uint64_t instr_id = 0, ip = 0, event_cycle = 0;
 
@@ -38,6 +52,8 @@ struct ooo_model_instr {
   // End
 
   uint8_t asid[2] = {std::numeric_limits<uint8_t>::max(), std::numeric_limits<uint8_t>::max()};
+  invocation_boundary invocation;
+  std::array<guest_mapping, GUEST_MAPPINGS_PER_INSTR> guest_mappings = {};
 
   uint8_t branch_type = NOT_BRANCH;
   uint64_t branch_target = 0;
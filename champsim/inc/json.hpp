@@ -0,0 +1,221 @@
+#ifndef JSON_HPP
+#define JSON_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <istream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace champsim
+{
+
+/*
+ * A small JSON document model, enough to read configuration files at runtime.
+ *
+ * To use:
+ *     std::ifstream ifs{fname};
+ *     auto config = champsim::json_value::parse(ifs);
+ *     if (config.contains("num_cores"))
+ *       auto n = config.at("num_cores").as_number();
+ */
+class json_value
+{
+public:
+  enum class kind { null, boolean, number, string, array, object };
+
+  kind type = kind::null;
+  bool boolean_value = false;
+  double number_value = 0;
+  std::string string_value;
+  std::vector<json_value> array_value;
+  std::map<std::string, json_value> object_value;
+
+  bool is_object() const { return type == kind::object; }
+  bool is_array() const { return type == kind::array; }
+  bool is_string() const { return type == kind::string; }
+
+  bool contains(const std::string& key) const { return is_object() && object_value.count(key) > 0; }
+  const json_value& at(const std::string& key) const { return object_value.at(key); }
+  const json_value& at(std::size_t idx) const { return array_value.at(idx); }
+  std::size_t size() const { return is_object() ? std::size(object_value) : std::size(array_value); }
+
+  double as_number() const
+  {
+    if (type == kind::boolean)
+      return boolean_value;
+    if (type != kind::number)
+      throw std::invalid_argument("JSON value is not a number");
+    return number_value;
+  }
+
+  bool as_bool() const { return as_number() != 0; }
+
+  const std::string& as_string() const
+  {
+    if (type != kind::string)
+      throw std::invalid_argument("JSON value is not a string");
+    return string_value;
+  }
+
+  static json_value parse(std::istream& is)
+  {
+    std::string text{std::istreambuf_iterator<char>{is}, std::istreambuf_iterator<char>{}};
+    auto it = std::cbegin(text);
+    auto result = parse_value(it, std::cend(text));
+    skip_space(it, std::cend(text));
+    if (it != std::cend(text))
+      throw std::invalid_argument("Trailing characters after JSON document");
+    return result;
+  }
+
+  static json_value parse(const std::string& text)
+  {
+    std::istringstream is{text};
+    return parse(is);
+  }
+
+private:
+  using iter_t = std::string::const_iterator;
+
+  static void skip_space(iter_t& it, iter_t end)
+  {
+    while (it != end && std::isspace(static_cast<unsigned char>(*it)))
+      ++it;
+  }
+
+  static bool starts_with(iter_t it, iter_t end, const std::string& word)
+  {
+    return std::distance(it, end) >= static_cast<std::ptrdiff_t>(std::size(word)) && std::equal(std::begin(word), std::end(word), it);
+  }
+
+  static void expect(iter_t& it, iter_t end, char c)
+  {
+    skip_space(it, end);
+    if (it == end || *it != c)
+      throw std::invalid_argument(std::string{"Malformed JSON: expected '"} + c + "'");
+    ++it;
+  }
+
+  static std::string parse_string(iter_t& it, iter_t end)
+  {
+    expect(it, end, '"');
+    std::string result;
+    while (it != end && *it != '"') {
+      if (*it == '\\') {
+        if (++it == end)
+          break;
+        switch (*it) {
+        case 'n':
+          result.push_back('\n');
+          break;
+        case 't':
+          result.push_back('\t');
+          break;
+        case 'r':
+          result.push_back('\r');
+          break;
+        case 'b':
+          result.push_back('\b');
+          break;
+        case 'f':
+          result.push_back('\f');
+          break;
+        case 'u':
+          // Configuration files are plain ASCII, keep the escape as written
+          result.append("\\u");
+          break;
+        default:
+          result.push_back(*it);
+        }
+      } else {
+        result.push_back(*it);
+      }
+      ++it;
+    }
+    if (it == end)
+      throw std::invalid_argument("Malformed JSON: unterminated string");
+    ++it;
+    return result;
+  }
+
+  static json_value parse_value(iter_t& it, iter_t end)
+  {
+    skip_space(it, end);
+    if (it == end)
+      throw std::invalid_argument("Malformed JSON: unexpected end of input");
+
+    json_value result;
+    if (*it == '{') {
+      result.type = kind::object;
+      ++it;
+      skip_space(it, end);
+      if (it != end && *it == '}') {
+        ++it;
+        return result;
+      }
+      while (true) {
+        auto key = parse_string(it, end);
+        expect(it, end, ':');
+        result.object_value[key] = parse_value(it, end);
+        skip_space(it, end);
+        if (it != end && *it == ',') {
+          ++it;
+          skip_space(it, end);
+          continue;
+        }
+        expect(it, end, '}');
+        return result;
+      }
+    } else if (*it == '[') {
+      result.type = kind::array;
+      ++it;
+      skip_space(it, end);
+      if (it != end && *it == ']') {
+        ++it;
+        return result;
+      }
+      while (true) {
+        result.array_value.push_back(parse_value(it, end));
+        skip_space(it, end);
+        if (it != end && *it == ',') {
+          ++it;
+          continue;
+        }
+        expect(it, end, ']');
+        return result;
+      }
+    } else if (*it == '"') {
+      result.type = kind::string;
+      result.string_value = parse_string(it, end);
+    } else if (starts_with(it, end, "true")) {
+      result.type = kind::boolean;
+      result.boolean_value = true;
+      it += 4;
+    } else if (starts_with(it, end, "false")) {
+      result.type = kind::boolean;
+      it += 5;
+    } else if (starts_with(it, end, "null")) {
+      it += 4;
+    } else {
+      std::string num_text;
+      while (it != end && (std::isdigit(static_cast<unsigned char>(*it)) || *it == '-' || *it == '+' || *it == '.' || *it == 'e' || *it == 'E'))
+        num_text.push_back(*it++);
+      if (num_text.empty())
+        throw std::invalid_argument("Malformed JSON: unexpected character");
+      result.type = kind::number;
+      result.number_value = std::strtod(num_text.c_str(), nullptr);
+    }
+
+    return result;
+  }
+};
+
+} // namespace champsim
+
+#endif
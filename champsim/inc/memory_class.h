@@ -17,10 +17,16 @@
 class BLOCK
 {
 public:
-  bool valid = false, prefetch = false, dirty = false;
+  bool valid = false, prefetch = false, dirty = false, is_kernel = false;
 
   uint64_t address = 0, v_address = 0, tag = 0, data = 0, ip = 0, cpu = 0, instr_id = 0;
 
+  // the address space of the request that filled the line, kept for its writeback
+  uint8_t asid[2] = {std::numeric_limits<uint8_t>::max(), std::numeric_limits<uint8_t>::max()};
+
+  // in a TLB, the log2 size of the page translated
+  uint32_t page_bits = 0;
+
   // replacement state
   uint32_t lru = std::numeric_limits<uint32_t>::max() >> 1;
 };
@@ -0,0 +1,285 @@
+#ifndef MODULES_H
+#define MODULES_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "json.hpp"
+
+class BLOCK;
+class CACHE;
+class O3_CPU;
+
+namespace champsim::modules
+{
+
+/*
+ * Modules written as classes keep their state in the object, rather than in globals indexed by
+ * the core or the cache. Each core or cache that selects one builds its own instance, with the
+ * parameters given to it in the configuration file, so that a module may be used by several
+ * caches with different parameters, or by several simulated systems in one process.
+ *
+ * To write one, derive from one of the classes below, take the owner and the parameters in the
+ * constructor, and register the class under the name it is selected by:
+ *
+ *     namespace
+ *     {
+ *     class next_line : public champsim::modules::prefetcher
+ *     {
+ *       ...
+ *     };
+ *     champsim::modules::registry<champsim::modules::prefetcher>::add<next_line> registered{"next_line"};
+ *     } // namespace
+ *
+ * and select it in the configuration file, with its parameters, if any:
+ *
+ *     "L2C": { "prefetcher": "next_line", "prefetcher_params": { "degree": 2 } }
+ *
+ * The parameters are "branch_predictor_params" and "btb_params" for the core, and
+ * "prefetcher_params" and "replacement_params" for each cache. The instruction prefetcher is
+ * owned by the core, and takes the parameters of the L1I.
+ *
+ * Modules written as member functions of CACHE or O3_CPU, such as
+ * CACHE::prefetcher_cache_operate(), are still renamed and dispatched by config.sh.
+ */
+
+// The address space and the privilege level of the branch being predicted or resolved
+struct branch_context {
+  uint16_t asid = 0;
+  bool is_kernel = false;
+};
+
+class branch_predictor
+{
+public:
+  using owner_type = O3_CPU;
+  O3_CPU* const intern_;
+
+  explicit branch_predictor(O3_CPU* cpu) : intern_(cpu) {}
+  virtual ~branch_predictor() = default;
+
+  virtual void initialize() {}
+  virtual uint8_t predict(uint64_t ip, uint64_t predicted_target, uint8_t always_taken, uint8_t branch_type, const branch_context& context) = 0;
+  virtual void last_result(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type, const branch_context& context) = 0;
+};
+
+class btb
+{
+public:
+  using owner_type = O3_CPU;
+  O3_CPU* const intern_;
+
+  explicit btb(O3_CPU* cpu) : intern_(cpu) {}
+  virtual ~btb() = default;
+
+  virtual void initialize() {}
+  virtual std::pair<uint64_t, uint8_t> prediction(uint64_t ip, uint8_t branch_type, const branch_context& context) = 0;
+  virtual void update(uint64_t ip, uint64_t branch_target, uint8_t taken, uint8_t branch_type, const branch_context& context) = 0;
+};
+
+// Instruction prefetchers are driven by the core, and issue prefetches with O3_CPU::prefetch_code_line()
+class instruction_prefetcher
+{
+public:
+  using owner_type = O3_CPU;
+  O3_CPU* const intern_;
+
+  explicit instruction_prefetcher(O3_CPU* cpu) : intern_(cpu) {}
+  virtual ~instruction_prefetcher() = default;
+
+  virtual void initialize() {}
+  virtual void branch_operate(uint64_t ip, uint8_t branch_type, uint64_t branch_target) {}
+  virtual uint32_t cache_operate(uint64_t v_addr, uint8_t cache_hit, uint8_t prefetch_hit, uint32_t metadata_in) { return metadata_in; }
+  virtual uint32_t cache_fill(uint64_t v_addr, uint32_t set, uint32_t way, uint8_t prefetch, uint64_t evicted_v_addr, uint32_t metadata_in)
+  {
+    return metadata_in;
+  }
+  virtual void cycle_operate() {}
+  virtual void final_stats() {}
+
+  // Function invocations, as delimited in QEMU traces, when their first instruction is fetched
+  virtual void invocation_begin(uint64_t function_id) {}
+  virtual void invocation_end() {}
+};
+
+class prefetcher
+{
+public:
+  using owner_type = CACHE;
+  CACHE* const intern_;
+
+  explicit prefetcher(CACHE* cache) : intern_(cache) {}
+  virtual ~prefetcher() = default;
+
+  virtual void initialize() {}
+  virtual uint32_t cache_operate(uint64_t addr, uint64_t ip, uint8_t cache_hit, uint8_t type, uint32_t metadata_in) { return metadata_in; }
+  virtual uint32_t cache_fill(uint64_t addr, uint32_t set, uint32_t way, uint8_t prefetch, uint64_t evicted_addr, uint32_t metadata_in)
+  {
+    return metadata_in;
+  }
+  virtual void cycle_operate() {}
+  virtual void final_stats() {}
+};
+
+class replacement
+{
+public:
+  using owner_type = CACHE;
+  CACHE* const intern_;
+
+  explicit replacement(CACHE* cache) : intern_(cache) {}
+  virtual ~replacement() = default;
+
+  virtual void initialize() {}
+  virtual uint32_t victim(uint32_t cpu, uint64_t instr_id, uint32_t set, const BLOCK* current_set, uint64_t ip, uint64_t full_addr, uint32_t type) = 0;
+  virtual void update_state(uint32_t cpu, uint32_t set, uint32_t way, uint64_t full_addr, uint64_t ip, uint64_t victim_addr, uint32_t type,
+                            uint8_t hit) = 0;
+  virtual void final_stats() {}
+};
+
+/*
+ * The modules of one kind that are linked into this binary, by name.
+ * Modules add themselves during static initialization, so the registry is only read once main() has begun.
+ */
+template <typename Module>
+class registry
+{
+public:
+  using owner_type = typename Module::owner_type;
+  using factory_type = std::function<std::unique_ptr<Module>(owner_type*, const json_value&)>;
+
+  template <typename T>
+  struct add {
+    explicit add(const std::string& name)
+    {
+      auto [it, inserted] = factories().emplace(name, [](owner_type* owner, const json_value& params) { return std::unique_ptr<Module>{new T(owner, params)}; });
+      if (!inserted)
+        throw std::invalid_argument("Module \"" + name + "\" is registered twice");
+    }
+  };
+
+  static bool contains(const std::string& name) { return factories().count(name) > 0; }
+
+  static std::unique_ptr<Module> create(const std::string& name, owner_type* owner, const json_value& params)
+  {
+    auto found = factories().find(name);
+    if (found == std::end(factories()))
+      throw std::invalid_argument("Module \"" + name + "\" is not linked into this binary");
+    return found->second(owner, params);
+  }
+
+private:
+  static std::map<std::string, factory_type>& factories()
+  {
+    static std::map<std::string, factory_type> instance;
+    return instance;
+  }
+};
+
+// A module selected by name, with the parameters given to it in the configuration file
+struct selection {
+  std::string name;
+  json_value params;
+};
+
+// Build the selected module for its owner, and initialize it
+template <typename Module>
+void initialize(std::unique_ptr<Module>& module, const selection& selected, typename Module::owner_type* owner)
+{
+  module = registry<Module>::create(selected.name, owner, selected.params);
+  module->initialize();
+}
+
+// A numeric parameter of a module, or the default if the configuration file does not give it
+template <typename T>
+T param(const json_value& params, const std::string& key, T fallback)
+{
+  return params.contains(key) ? static_cast<T>(params.at(key).as_number()) : fallback;
+}
+
+/*
+ * What becomes of the state of a branch predictor or a BTB when the core switches address space,
+ * selected with "context_switch" in its parameters:
+ *
+ *     "share"      all address spaces train and read the same state (the default)
+ *     "flush"      the state is discarded on every switch, as a barrier such as IBPB would
+ *     "partition"  each address space has a private copy, kept while it is switched out
+ *
+ * A partitioned module keeps at most "saved_contexts" copies of switched-out address spaces (16 by default). To make
+ * room, it drops the copy of the address space that was switched out the longest ago, which starts afresh when it
+ * comes back.
+ *
+ * A switch discards or swaps the whole module, so a module needs no code of its own to support these.
+ */
+enum class context_policy { share, flush, partition };
+
+inline context_policy context_switch_policy(const json_value& params)
+{
+  if (!params.contains("context_switch"))
+    return context_policy::share;
+
+  const auto& name = params.at("context_switch").as_string();
+  if (name == "share")
+    return context_policy::share;
+  if (name == "flush")
+    return context_policy::flush;
+  if (name == "partition")
+    return context_policy::partition;
+  throw std::invalid_argument("Unknown context switch policy \"" + name + "\"");
+}
+
+template <typename Module>
+class context_switcher
+{
+  struct saved_copy {
+    uint64_t switched_out_at;
+    std::unique_ptr<Module> module;
+  };
+
+  context_policy policy_;
+  std::size_t max_saved_;
+  uint64_t switches_ = 0;
+  std::map<uint16_t, saved_copy> switched_out;
+
+public:
+  explicit context_switcher(const selection& selected)
+      : policy_(context_switch_policy(selected.params)), max_saved_(param<std::size_t>(selected.params, "saved_contexts", 16))
+  {
+  }
+
+  context_policy policy() const { return policy_; }
+
+  // Modules built here are not initialized again, to keep the output free of their banners
+  void operator()(std::unique_ptr<Module>& module, const selection& selected, typename Module::owner_type* owner, uint16_t from, uint16_t to)
+  {
+    if (policy_ == context_policy::flush) {
+      module = registry<Module>::create(selected.name, owner, selected.params);
+    } else if (policy_ == context_policy::partition) {
+      std::unique_ptr<Module> incoming;
+      if (auto found = switched_out.find(to); found != std::end(switched_out)) {
+        incoming = std::move(found->second.module);
+        switched_out.erase(found);
+      }
+
+      if (max_saved_ > 0) {
+        if (std::size(switched_out) >= max_saved_) {
+          auto oldest = std::min_element(std::begin(switched_out), std::end(switched_out),
+                                         [](const auto& x, const auto& y) { return x.second.switched_out_at < y.second.switched_out_at; });
+          switched_out.erase(oldest);
+        }
+        switched_out[from] = {switches_++, std::move(module)};
+      }
+      module = incoming ? std::move(incoming) : registry<Module>::create(selected.name, owner, selected.params);
+    }
+  }
+};
+
+} // namespace champsim::modules
+
+#endif
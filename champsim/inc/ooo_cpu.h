@@ -2,14 +2,19 @@
 #define OOO_CPU_H
 
 #include <array>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
 #include <queue>
 
+#include "address_index.hpp"
 #include "block.h"
 #include "champsim.h"
 #include "delay_queue.hpp"
 #include "instruction.h"
 #include "memory_class.h"
+#include "modules.h"
 #include "operable.h"
 
 using namespace std;
@@ -60,15 +65,34 @@ public:
 
   // reorder buffer, load/store queue, register file
   champsim::circular_buffer<ooo_model_instr> IFETCH_BUFFER;
+
+  // Decoupled front end: the branch prediction unit reads ahead of fetch, one fetch block per cycle, into a fetch target queue of
+  // FTQ_SIZE blocks, and prefetches the cache lines of the blocks it predicts into the L1I (FDIP)
+  std::deque<ooo_model_instr> FTQ;
+  std::deque<std::size_t> ftq_block_sizes;
+  std::deque<uint64_t> fdip_pending;
+  uint64_t fdip_last_line = 0, fdip_issued = 0, btb_miss_redirects = 0;
   champsim::delay_queue<ooo_model_instr> DISPATCH_BUFFER;
   champsim::delay_queue<ooo_model_instr> DECODE_BUFFER;
   champsim::circular_buffer<ooo_model_instr> ROB;
   std::vector<LSQ_ENTRY> LQ;
   std::vector<LSQ_ENTRY> SQ;
 
+  // Unoccupied load/store queue slots, so that allocation does not scan the queues.
+  // The lowest free slot is handed out first, as the linear search did.
+  using lsq_free_list_t = std::priority_queue<std::vector<LSQ_ENTRY>::iterator, std::vector<std::vector<LSQ_ENTRY>::iterator>,
+                                              std::greater<std::vector<LSQ_ENTRY>::iterator>>;
+  lsq_free_list_t LQ_free, SQ_free;
+
+  // Stores in the ROB that have not yet written back, keyed by virtual address.
+  // Loads use this to find their youngest older producer without walking the ROB.
+  champsim::address_index<champsim::circular_buffer<ooo_model_instr>::iterator> inflight_stores;
+
   // Constants
   const unsigned FETCH_WIDTH, DECODE_WIDTH, DISPATCH_WIDTH, SCHEDULER_SIZE, EXEC_WIDTH, LQ_WIDTH, SQ_WIDTH, RETIRE_WIDTH;
   const unsigned BRANCH_MISPREDICT_PENALTY, SCHEDULING_LATENCY, EXEC_LATENCY;
+  const bool DECOUPLED_FRONTEND;
+  const std::size_t FTQ_SIZE;
 
   // store array, this structure is required to properly handle store
   // instructions
@@ -91,6 +115,18 @@ public:
 
   uint64_t total_branch_types[8] = {};
   uint64_t branch_type_misses[8] = {};
+  uint64_t branch_type_target_misses[8] = {}; // correctly predicted taken, but to the wrong target
+
+  // Branch statistics of each address space, by the ASID taken from cr3 in the trace. A misprediction is cold when it
+  // falls in the first COLD_INSTRUCTIONS instructions of an invocation, that is, since its address space was switched in.
+  static constexpr uint64_t COLD_INSTRUCTIONS = 10000;
+  struct asid_branch_stats {
+    uint64_t invocations = 0, instrs = 0, branches = 0, mispredictions = 0, cold_mispredictions = 0;
+  };
+  std::map<uint16_t, asid_branch_stats> asid_stats;
+  uint64_t context_switches = 0, invocation_instrs = 0;
+  uint16_t current_asid = 0;
+  bool address_space_known = false;
 
   CacheBus ITLB_bus, DTLB_bus, L1I_bus, L1D_bus;
 
@@ -98,6 +134,9 @@ public:
 
   // functions
   void init_instruction(ooo_model_instr instr);
+  void start_fetch_block();
+  void fill_ifetch_buffer();
+  void issue_fdip_prefetches();
   void check_dib();
   void translate_fetch();
   void fetch_instruction();
@@ -118,8 +157,11 @@ public:
   void operate_lsq();
   void do_complete_execution(champsim::circular_buffer<ooo_model_instr>::iterator rob_it);
   void do_sq_forward_to_lq(LSQ_ENTRY& sq_entry, LSQ_ENTRY& lq_entry);
+  void release_lq_entry(std::vector<LSQ_ENTRY>::iterator lq_it);
+  void release_sq_entry(std::vector<LSQ_ENTRY>::iterator sq_it);
 
   void initialize_core();
+  void switch_address_space(uint16_t asid);
   void add_load_queue(champsim::circular_buffer<ooo_model_instr>::iterator rob_index, uint32_t data_index);
   void add_store_queue(champsim::circular_buffer<ooo_model_instr>::iterator rob_index, uint32_t data_index);
   void execute_store(std::vector<LSQ_ENTRY>::iterator sq_it);
@@ -150,19 +192,35 @@ public:
   const btb_t btb_type;
   const ipref_t ipref_type;
 
+  // Modules written as classes, built from the registry when the core is initialized
+  const champsim::modules::selection bpred_selection, btb_selection, ipref_selection;
+  std::unique_ptr<champsim::modules::branch_predictor> bpred_module;
+  std::unique_ptr<champsim::modules::btb> btb_module;
+  std::unique_ptr<champsim::modules::instruction_prefetcher> ipref_module;
+
+  // What becomes of the branch predictor and the BTB when the address space changes, from "context_switch" in their parameters
+  champsim::modules::context_switcher<champsim::modules::branch_predictor> bpred_switcher;
+  champsim::modules::context_switcher<champsim::modules::btb> btb_switcher;
+
   O3_CPU(uint32_t cpu, double freq_scale, std::size_t dib_set, std::size_t dib_way, std::size_t dib_window, std::size_t ifetch_buffer_size,
          std::size_t decode_buffer_size, std::size_t dispatch_buffer_size, std::size_t rob_size, std::size_t lq_size, std::size_t sq_size, unsigned fetch_width,
          unsigned decode_width, unsigned dispatch_width, unsigned schedule_width, unsigned execute_width, unsigned lq_width, unsigned sq_width,
          unsigned retire_width, unsigned mispredict_penalty, unsigned decode_latency, unsigned dispatch_latency, unsigned schedule_latency,
-         unsigned execute_latency, MemoryRequestConsumer* itlb, MemoryRequestConsumer* dtlb, MemoryRequestConsumer* l1i, MemoryRequestConsumer* l1d,
-         bpred_t bpred_type, btb_t btb_type, ipref_t ipref_type)
+         unsigned execute_latency, bool decoupled_frontend, std::size_t ftq_size, MemoryRequestConsumer* itlb, MemoryRequestConsumer* dtlb, MemoryRequestConsumer* l1i, MemoryRequestConsumer* l1d,
+         bpred_t bpred_type, btb_t btb_type, ipref_t ipref_type, champsim::modules::selection bpred_selection = {},
+         champsim::modules::selection btb_selection = {}, champsim::modules::selection ipref_selection = {})
       : champsim::operable(freq_scale), cpu(cpu), dib_set(dib_set), dib_way(dib_way), dib_window(dib_window), IFETCH_BUFFER(ifetch_buffer_size),
-        DISPATCH_BUFFER(dispatch_buffer_size, dispatch_latency), DECODE_BUFFER(decode_buffer_size, decode_latency), ROB(rob_size), LQ(lq_size), SQ(sq_size),
+        DISPATCH_BUFFER(dispatch_buffer_size, dispatch_latency), DECODE_BUFFER(decode_buffer_size, decode_latency), ROB(rob_size), LQ(lq_size), SQ(sq_size), inflight_stores(rob_size * NUM_INSTR_DESTINATIONS_SPARC),
         FETCH_WIDTH(fetch_width), DECODE_WIDTH(decode_width), DISPATCH_WIDTH(dispatch_width), SCHEDULER_SIZE(schedule_width), EXEC_WIDTH(execute_width),
         LQ_WIDTH(lq_width), SQ_WIDTH(sq_width), RETIRE_WIDTH(retire_width), BRANCH_MISPREDICT_PENALTY(mispredict_penalty), SCHEDULING_LATENCY(schedule_latency),
-        EXEC_LATENCY(execute_latency), ITLB_bus(rob_size, itlb), DTLB_bus(rob_size, dtlb), L1I_bus(rob_size, l1i), L1D_bus(rob_size, l1d),
-        bpred_type(bpred_type), btb_type(btb_type), ipref_type(ipref_type)
+        EXEC_LATENCY(execute_latency), DECOUPLED_FRONTEND(decoupled_frontend), FTQ_SIZE(ftq_size), ITLB_bus(rob_size, itlb), DTLB_bus(rob_size, dtlb), L1I_bus(rob_size, l1i), L1D_bus(rob_size, l1d),
+        bpred_type(bpred_type), btb_type(btb_type), ipref_type(ipref_type), bpred_selection(bpred_selection), btb_selection(btb_selection),
+        ipref_selection(ipref_selection), bpred_switcher(bpred_selection), btb_switcher(btb_selection)
   {
+    for (auto it = std::begin(LQ); it != std::end(LQ); ++it)
+      LQ_free.push(it);
+    for (auto it = std::begin(SQ); it != std::end(SQ); ++it)
+      SQ_free.push(it);
   }
 };
 
@@ -25,6 +25,10 @@ class PagingStructureCache
 
 public:
   const std::size_t level;
+
+  // Lookups and hits, of demand walks [0] and of prefetch walks [1]
+  uint64_t sim_access[2] = {}, sim_hit[2] = {};
+
   PagingStructureCache(std::string v1, uint8_t v2, uint32_t v3, uint32_t v4) : NAME(v1), NUM_SET(v3), NUM_WAY(v4), level(v2) {}
 
   std::optional<uint64_t> check_hit(uint64_t address);
@@ -40,9 +44,13 @@ public:
 
   champsim::delay_queue<PACKET> RQ;
 
+  // Prefetches of translations from the TLBs, walked with what bandwidth the demand walks leave
+  champsim::delay_queue<PACKET> PQ;
+
   std::list<PACKET> MSHR;
 
   uint64_t total_miss_latency = 0;
+  uint64_t prefetch_walks = 0, prefetch_merged = 0;
 
   PagingStructureCache PSCL5, PSCL4, PSCL3, PSCL2;
 
@@ -50,17 +58,18 @@ public:
   std::map<std::pair<uint64_t, std::size_t>, uint64_t> page_table;
 
   PageTableWalker(std::string v1, uint32_t cpu, unsigned fill_level, uint32_t v2, uint32_t v3, uint32_t v4, uint32_t v5, uint32_t v6, uint32_t v7, uint32_t v8,
-                  uint32_t v9, uint32_t v10, uint32_t v11, uint32_t v12, uint32_t v13, unsigned latency, MemoryRequestConsumer* ll);
+                  uint32_t v9, uint32_t v10, uint32_t pq_size, uint32_t v11, uint32_t v12, uint32_t v13, unsigned latency, MemoryRequestConsumer* ll);
 
   // functions
   int add_rq(PACKET* packet) override;
   int add_wq(PACKET* packet) override { assert(0); }
-  int add_pq(PACKET* packet) override { assert(0); }
+  int add_pq(PACKET* packet) override;
 
   void return_data(PACKET* packet) override;
   void operate() override;
 
   void handle_read();
+  bool start_walk(PACKET& handle_pkt);
   void handle_fill();
 
   uint32_t get_occupancy(uint8_t queue_type, uint64_t address) override;
@@ -21,6 +21,11 @@
 #define EVENT_ID_INSN 63
 #define EVENT_ID_DATA 64
 #define EVENT_ID_NOP 65
+#define EVENT_ID_REGS 68
+#define EVENT_ID_LIFECYCLE 69
+#define EVENT_ID_MAPPING 70
+
+#define QEMU_RECORD_TYPE_MAPPING 0
 
 struct QEMU_tracefile_header {
     uint64_t header_event_id;
@@ -62,6 +67,27 @@ struct QEMU_trace_nop {
     uint64_t byte2;
 };
 
+// Register operands of the instruction at paddr, traced when it is translated:
+// the source registers in bytes 0-3 of regs, and the destination registers in bytes 4-5
+struct QEMU_trace_regs {
+    uint64_t paddr;
+    uint64_t regs;
+};
+
+// A function entered a phase of its invocation, written to the PQII device:
+// 0 invoke, 1 function start, 2 function end, 3 respond
+struct QEMU_trace_lifecycle {
+    uint64_t icount;
+    uint64_t function_id;
+    uint64_t phase;
+};
+
+// The guest mapped the page at vaddr with a huge page of size bytes, traced when QEMU fills its TLB with it
+struct QEMU_trace_mapping {
+    uint64_t vaddr;
+    uint64_t size;
+};
+
 // Added by Kaifeng Xu
 // branch types from x86 QEMU trace
 typedef enum {
@@ -0,0 +1,79 @@
+#ifndef RUNTIME_CONFIG_H
+#define RUNTIME_CONFIG_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cache.h"
+#include "json.hpp"
+#include "ooo_cpu.h"
+
+namespace champsim
+{
+
+// Parameters of the components instantiated in this binary, as resolved by config.sh
+struct cache_params {
+  std::string name, lower_level;
+  double freq_scale;
+  unsigned fill_level;
+  uint32_t sets, ways, wq_size, rq_size, pq_size, mshr_size, hit_latency, fill_latency, max_read, max_write;
+  std::size_t offset_bits;
+  uint32_t huge_page_sets;
+  bool prefetch_as_load, wq_check_full_addr, virtual_prefetch;
+  unsigned prefetch_activate_mask;
+  std::string prefetcher, replacement;
+  json_value prefetcher_params, replacement_params, partition;
+  std::string inclusion;
+  json_value snoop_filter;
+};
+
+struct ptw_params {
+  std::string name, lower_level;
+  uint32_t cpu;
+  unsigned fill_level;
+  uint32_t pscl5_set, pscl5_way, pscl4_set, pscl4_way, pscl3_set, pscl3_way, pscl2_set, pscl2_way;
+  uint32_t rq_size, pq_size, mshr_size, max_read, max_write;
+  unsigned latency;
+};
+
+struct cpu_params {
+  std::string name;
+  uint32_t index;
+  double freq_scale;
+  std::size_t dib_sets, dib_ways, dib_window, ifetch_buffer_size, decode_buffer_size, dispatch_buffer_size, rob_size, lq_size, sq_size;
+  unsigned fetch_width, decode_width, dispatch_width, scheduler_size, execute_width, lq_width, sq_width, retire_width;
+  unsigned mispredict_penalty, decode_latency, dispatch_latency, schedule_latency, execute_latency;
+  bool decoupled_frontend;
+  std::size_t ftq_size;
+  std::string ITLB, DTLB, L1I, L1D, PTW;
+  std::string branch_predictor, btb, iprefetcher;
+  json_value branch_predictor_params, btb_params, iprefetcher_params;
+};
+
+extern const std::vector<cache_params> compiled_caches;
+extern const std::vector<ptw_params> compiled_ptws;
+extern const std::vector<cpu_params> compiled_cores;
+
+// Modules linked into this binary, by the name they are given in the configuration file.
+// Configure with "runtime_modules": true to link every module in the tree.
+// Modules written as classes are not listed here, but in their champsim::modules::registry.
+extern const std::map<std::string, O3_CPU::bpred_t> branch_predictor_modules;
+extern const std::map<std::string, O3_CPU::btb_t> btb_modules;
+extern const std::map<std::string, std::pair<O3_CPU::ipref_t, CACHE::pref_t>> instruction_prefetcher_modules;
+extern const std::map<std::string, CACHE::pref_t> data_prefetcher_modules;
+extern const std::map<std::string, CACHE::repl_t> replacement_modules;
+
+/*
+ * Rebuild the cores, caches, and page table walkers from a JSON configuration file, in the same
+ * format that config.sh reads. Parameters missing from the file keep their compiled values.
+ *
+ * The topology (number of cores and which caches they share) and the values in
+ * champsim_constants.h are fixed when the binary is built, and the file must agree with them.
+ */
+void configure_from_file(const std::string& fname);
+
+} // namespace champsim
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef SNOOP_FILTER_H
+#define SNOOP_FILTER_H
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "json.hpp"
+
+namespace champsim
+{
+
+/*
+ * The snoop filter, or sparse directory, of a cache that does not include the caches above it: a set-associative
+ * table of the lines they hold, with a bit for each cache directly above that holds the line itself or in a cache
+ * above it. Selected with "snoop_filter" in the configuration of a non-inclusive or exclusive cache:
+ *
+ *     "LLC": { "inclusion": "non_inclusive", "snoop_filter": { "sets": 2048, "ways": 16 } }
+ *
+ * A line whose entry is replaced is invalidated above, so that the table stays complete.
+ */
+class snoop_filter
+{
+public:
+  struct entry {
+    bool valid = false;
+    uint64_t address = 0, holders = 0, lru = 0;
+  };
+
+private:
+  const uint32_t NUM_SET, NUM_WAY;
+  const std::size_t OFFSET_BITS;
+  std::vector<entry> entries{NUM_SET * NUM_WAY};
+  uint64_t access_count = 0;
+
+  std::vector<entry>::iterator set_begin(uint64_t address);
+  std::vector<entry>::iterator find(uint64_t address);
+
+public:
+  // Misses of the cache on lines from above that were looked up, those held by another cache above, and the entries replaced
+  uint64_t lookups = 0, hits = 0, evictions = 0;
+
+  snoop_filter(const json_value& params, std::size_t offset_bits);
+
+  // The caches directly above that hold the line, as a bit for each
+  uint64_t holders(uint64_t address);
+
+  // Record that a cache directly above holds the line, and give back the entry that was replaced for it, if any
+  std::optional<entry> insert(std::size_t upper, uint64_t address);
+  void remove(std::size_t upper, uint64_t address);
+};
+
+} // namespace champsim
+
+#endif
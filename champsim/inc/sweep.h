@@ -0,0 +1,29 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <string>
+#include <vector>
+
+#include "tracereader.h"
+
+namespace champsim
+{
+
+/*
+ * Simulate several configurations of the same trace in one pass.
+ *
+ * Each configuration runs in its own process, so that every system has its own
+ * memory hierarchy, modules, and statistics. This process reads and decodes the
+ * trace once, and fans the decoded instructions out to every system over a pipe.
+ * A system that falls behind stalls the reader, so the read-ahead is bounded by
+ * the pipe capacity.
+ *
+ * Returns only in the simulating processes, with a reader for the decoded
+ * instructions. The statistics of each system are written to the base name of
+ * its configuration file, with the extension .out.
+ */
+tracereader* fork_sweep(const std::vector<std::string>& config_files, tracereader* source);
+
+} // namespace champsim
+
+#endif
@@ -1,5 +1,10 @@
+#ifndef TRACEREADER_H
+#define TRACEREADER_H
+
 #include <cstdio>
+#include <deque>
 #include <string>
+#include <unordered_map>
 
 #include "instruction.h"
 
@@ -11,6 +16,21 @@ protected:
   std::string cmd_fmtstr;
   std::string decomp_program;
   std::string trace_string;
+  uint64_t passes = 0;
+
+  // QEMU traces: the IDs of the guest events, given by the trace header, and the register operands by paddr
+  uint64_t event_insn = EVENT_ID_INSN, event_data = EVENT_ID_DATA, event_nop = EVENT_ID_NOP, event_regs = EVENT_ID_REGS,
+           event_lifecycle = EVENT_ID_LIFECYCLE, event_mapping = EVENT_ID_MAPPING;
+  std::unordered_map<uint64_t, uint64_t> qemu_regs;
+  invocation_boundary pending_invocation; // read since the last instruction record, for the next one
+  std::deque<guest_mapping> pending_mappings; // read and not yet given to an instruction
+
+  explicit tracereader(uint8_t cpu) : cpu(cpu) {}
+
+  bool consume_qemu_event(const QEMU_event_header& header);
+  void note_marker(const QEMU_trace_nop& trace_nop);
+  void attach_guest_mappings(ooo_model_instr& instr);
+  bool read_qemu_event_header(QEMU_event_header& header);
 
 public:
   tracereader(const tracereader& other) = delete;
@@ -22,7 +42,12 @@ public:
   template <typename T>
   ooo_model_instr read_single_instr();
 
+  // The number of times the trace has been read to the end and reopened
+  uint64_t completed_passes() const { return passes; }
+
   virtual ooo_model_instr get() = 0;
 };
 
 tracereader* get_tracereader(std::string fname, uint8_t cpu, bool is_cloudsuite);
+
+#endif
@@ -1,36 +1,82 @@
 #ifndef VMEM_H
 #define VMEM_H
 
+#include <array>
 #include <cstdint>
 #include <deque>
 #include <map>
+#include <optional>
+#include <set>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 // reserve 1MB of space
 #define VMEM_RESERVE_CAPACITY 1048576
 
 #define PTE_BYTES 8
 
+// Mappings end at a leaf entry of this page table level or below: 0 for base pages, 1 and 2 for huge pages (2 MiB and 1 GiB with 4 KiB PTE pages)
+#define VMEM_MAX_LEAF_LEVEL 2
+
 class VirtualMemory
 {
+public:
+  // How the size of a new mapping is chosen: always base pages, huge pages of one size where they fit, or the size the guest mapped in a QEMU trace
+  enum class page_size_policy { base, huge_2m, huge_1g, guest };
+
 private:
-  std::map<std::pair<uint32_t, uint64_t>, uint64_t> vpage_to_ppage_map;
+  // The mappings of each size, by the level of their leaf entry, from the virtual to the physical page number shifted back to an address
+  std::array<std::map<std::pair<uint32_t, uint64_t>, uint64_t>, VMEM_MAX_LEAF_LEVEL + 1> page_map;
   std::map<std::tuple<uint32_t, uint64_t, uint32_t>, uint64_t> page_table;
 
+  // The regions the guest mapped with huge pages, by (cpu, level, virtual page number at that level)
+  std::set<std::tuple<uint32_t, uint32_t, uint64_t>> guest_huge_pages;
+
+  // Physical memory in frames of the smallest huge page: the base pages given out from each, and whether a huge page took it
+  std::vector<uint32_t> base_pages_in_frame;
+  std::vector<bool> huge_frame_taken;
+  std::array<std::size_t, VMEM_MAX_LEAF_LEVEL + 1> huge_frame_cursor = {};
+
   uint64_t next_pte_page;
 
+  uint64_t frame_of(uint64_t paddr) const { return paddr >> shamt(1); }
+  bool in_huge_frame(uint64_t paddr) const { return frame_of(paddr) < std::size(huge_frame_taken) && huge_frame_taken[frame_of(paddr)]; }
+  uint64_t take_base_page();
+  std::optional<std::size_t> find_huge_frame(uint32_t level);
+  bool region_is_unmapped(uint32_t cpu_num, uint64_t vaddr, uint32_t level) const;
+  std::pair<uint32_t, uint32_t> choose_leaf_level(uint32_t cpu_num, uint64_t vaddr);
+
 public:
   const uint64_t minor_fault_penalty;
   const uint32_t pt_levels;
   const uint32_t page_size; // Size of a PTE page
+  const page_size_policy huge_page_policy;
+  const double huge_page_fraction;
+  const uint32_t max_leaf_level;
   std::deque<uint64_t> ppage_free_list;
 
+  std::array<uint64_t, VMEM_MAX_LEAF_LEVEL + 1> mappings = {};
+  uint64_t huge_page_fallbacks = 0;
+
   // capacity and pg_size are measured in bytes, and capacity must be a multiple
-  // of pg_size
-  VirtualMemory(uint64_t capacity, uint64_t pg_size, uint32_t page_table_levels, uint64_t random_seed, uint64_t minor_fault_penalty);
+  // of pg_size. Huge pages are given to huge_page_fraction of the regions the policy selects.
+  VirtualMemory(uint64_t capacity, uint64_t pg_size, uint32_t page_table_levels, uint64_t random_seed, uint64_t minor_fault_penalty,
+                page_size_policy policy = page_size_policy::base, double huge_page_fraction = 1.0);
   uint64_t shamt(uint32_t level) const;
   uint64_t get_offset(uint64_t vaddr, uint32_t level) const;
   std::pair<uint64_t, bool> va_to_pa(uint32_t cpu_num, uint64_t vaddr);
   std::pair<uint64_t, bool> get_pte_pa(uint32_t cpu_num, uint64_t vaddr, uint32_t level);
+
+  // The level of the leaf entry that translates vaddr, choosing the size of its mapping if it is not yet mapped
+  uint32_t leaf_level(uint32_t cpu_num, uint64_t vaddr);
+  uint64_t page_bits(uint32_t cpu_num, uint64_t vaddr) { return shamt(leaf_level(cpu_num, vaddr)); }
+
+  // Whether a walk of vaddr would fault, because its page or a page of the table above it is not yet mapped
+  bool walk_faults(uint32_t cpu_num, uint64_t vaddr) const;
+
+  // The guest mapped the page at vaddr with a page of 2^log2_size bytes
+  void guest_page_size(uint32_t cpu_num, uint64_t vaddr, unsigned log2_size);
 };
 
 #endif
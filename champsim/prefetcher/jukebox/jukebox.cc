@@ -0,0 +1,201 @@
+/*
+ * This file implements a record-and-replay instruction prefetcher for
+ * serverless functions, after Schall et al., "Lukewarm Serverless Functions:
+ * Characterization and Optimization," ISCA 2022 (Jukebox).
+ *
+ * While a function is invoked, the L1I demand misses are recorded in the
+ * order they first occur, as entries of a code region and a bitmap of the
+ * blocks that missed in it. A miss to a region that one of the last few
+ * entries holds only sets a bit, which keeps the record compact. When the
+ * invocation ends, the record becomes the metadata of its function, and the
+ * next invocation of the function replays it through prefetch_code_line().
+ * The replay is kept a window of blocks ahead of fetch, and moves on as
+ * fetch reaches the blocks it prefetched.
+ *
+ * Invocations are delimited by the markers or the lifecycle events of a
+ * QEMU trace. The parameters are "region_blocks" (16, at most 64),
+ * "metadata_entries" per function (2048), "lookahead" in blocks (64), and
+ * "degree" in prefetches per cycle (2).
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "modules.h"
+#include "ooo_cpu.h"
+
+namespace
+{
+constexpr std::size_t COALESCE_WINDOW = 8;
+constexpr unsigned VIRTUAL_ADDRESS_BITS = 48;
+
+struct region_entry {
+  uint64_t region = 0;
+  uint64_t blocks = 0;
+};
+
+class jukebox : public champsim::modules::instruction_prefetcher
+{
+  const unsigned log2_region_blocks;
+  const std::size_t metadata_entries, lookahead, degree;
+
+  // The metadata of each function, from its last recorded invocation
+  std::unordered_map<uint64_t, std::vector<region_entry>> metadata;
+
+  bool recording = false;
+  uint64_t recording_function = 0;
+  std::vector<region_entry> record;
+
+  // The blocks of the metadata being replayed, in order, and how far prefetch and fetch have gone through them
+  std::vector<uint64_t> replay;
+  std::vector<bool> replay_used;
+  std::unordered_map<uint64_t, std::size_t> replay_position;
+  std::size_t issued = 0, consumed = 0;
+
+  struct {
+    uint64_t invocations = 0, replayed_invocations = 0, issued = 0, useful = 0, uncovered = 0, recorded_entries = 0;
+  } stats;
+
+  uint64_t region_of(uint64_t block) const { return block >> log2_region_blocks; }
+  uint64_t block_in_region(uint64_t block) const { return block & bitmask(log2_region_blocks); }
+
+  // The bits of one entry of metadata: the tag of a code region, and the bitmap of its blocks
+  uint64_t entry_bits() const { return VIRTUAL_ADDRESS_BITS - LOG2_BLOCK_SIZE - log2_region_blocks + (1u << log2_region_blocks); }
+
+  void record_miss(uint64_t block);
+  void start_replay(const std::vector<region_entry>& entries);
+
+public:
+  jukebox(O3_CPU* cpu, const champsim::json_value& params)
+      : instruction_prefetcher(cpu), log2_region_blocks(lg2(champsim::modules::param<std::size_t>(params, "region_blocks", 16))),
+        metadata_entries(champsim::modules::param<std::size_t>(params, "metadata_entries", 2048)),
+        lookahead(champsim::modules::param<std::size_t>(params, "lookahead", 64)), degree(champsim::modules::param<std::size_t>(params, "degree", 2))
+  {
+  }
+
+  void initialize() override
+  {
+    std::cout << "CPU " << intern_->cpu << " Jukebox instruction prefetcher, regions of " << (1u << log2_region_blocks) << " blocks, " << metadata_entries
+              << " entries (" << (metadata_entries * entry_bits() + 7) / 8 << " bytes) per function, lookahead " << lookahead << std::endl;
+  }
+
+  void invocation_begin(uint64_t function_id) override;
+  void invocation_end() override;
+  uint32_t cache_operate(uint64_t v_addr, uint8_t cache_hit, uint8_t prefetch_hit, uint32_t metadata_in) override;
+  void cycle_operate() override;
+  void final_stats() override;
+};
+
+void jukebox::invocation_begin(uint64_t function_id)
+{
+  // A begin without an end, as at the start of each pass through a trace, ends the invocation before it
+  invocation_end();
+
+  recording = true;
+  recording_function = function_id;
+  record.clear();
+  stats.invocations++;
+
+  auto found = metadata.find(function_id);
+  if (found != std::end(metadata)) {
+    start_replay(found->second);
+    stats.replayed_invocations++;
+  }
+}
+
+void jukebox::invocation_end()
+{
+  if (recording && !std::empty(record)) {
+    stats.recorded_entries += std::size(record);
+    metadata[recording_function] = record;
+  }
+
+  recording = false;
+  replay.clear();
+  replay_used.clear();
+  replay_position.clear();
+  issued = consumed = 0;
+}
+
+void jukebox::start_replay(const std::vector<region_entry>& entries)
+{
+  for (const auto& entry : entries) {
+    for (uint64_t i = 0; i < (1u << log2_region_blocks); ++i) {
+      if ((entry.blocks >> i) & 1) {
+        replay_position.emplace((entry.region << log2_region_blocks) | i, std::size(replay));
+        replay.push_back((entry.region << log2_region_blocks) | i);
+      }
+    }
+  }
+  replay_used.assign(std::size(replay), false);
+}
+
+void jukebox::record_miss(uint64_t block)
+{
+  auto window_begin = std::size(record) > COALESCE_WINDOW ? std::prev(std::end(record), COALESCE_WINDOW) : std::begin(record);
+  auto found = std::find_if(window_begin, std::end(record), [region = region_of(block)](const region_entry& x) { return x.region == region; });
+
+  if (found != std::end(record))
+    found->blocks |= uint64_t{1} << block_in_region(block);
+  else if (std::size(record) < metadata_entries)
+    record.push_back({region_of(block), uint64_t{1} << block_in_region(block)});
+}
+
+uint32_t jukebox::cache_operate(uint64_t v_addr, uint8_t cache_hit, uint8_t prefetch_hit, uint32_t metadata_in)
+{
+  if (prefetch_hit)
+    return metadata_in;
+
+  uint64_t block = v_addr >> LOG2_BLOCK_SIZE;
+
+  // A block the replay has prefetched counts as a miss it covered, and is recorded again so that the next invocation prefetches it too
+  bool covered = false;
+  auto found = replay_position.find(block);
+  if (found != std::end(replay_position) && found->second < issued) {
+    covered = true;
+    consumed = std::max(consumed, found->second + 1);
+    if (!replay_used[found->second] && warmup_complete[intern_->cpu])
+      stats.useful++;
+    replay_used[found->second] = true;
+  }
+
+  if (!cache_hit && !covered && !std::empty(replay) && warmup_complete[intern_->cpu])
+    stats.uncovered++;
+
+  if (recording && (!cache_hit || covered))
+    record_miss(block);
+
+  return metadata_in;
+}
+
+void jukebox::cycle_operate()
+{
+  for (std::size_t i = 0; i < degree && issued < std::size(replay) && issued < consumed + lookahead; ++i) {
+    if (!intern_->prefetch_code_line(replay[issued] << LOG2_BLOCK_SIZE))
+      break;
+
+    issued++;
+    if (warmup_complete[intern_->cpu])
+      stats.issued++;
+  }
+}
+
+void jukebox::final_stats()
+{
+  std::size_t stored_entries = 0;
+  for (const auto& [function_id, entries] : metadata)
+    stored_entries += std::size(entries);
+
+  std::cout << std::endl << "CPU " << intern_->cpu << " Jukebox final stats" << std::endl;
+  std::cout << "INVOCATIONS: " << stats.invocations << " REPLAYED: " << stats.replayed_invocations << " FUNCTIONS: " << std::size(metadata) << std::endl;
+  std::cout << "PREFETCH ISSUED: " << stats.issued << " USEFUL: " << stats.useful << " UNCOVERED MISSES: " << stats.uncovered << std::endl;
+  std::cout << "COVERAGE: " << (stats.useful + stats.uncovered == 0 ? 0 : 100.0 * stats.useful / (stats.useful + stats.uncovered)) << "%";
+  std::cout << " ACCURACY: " << (stats.issued == 0 ? 0 : 100.0 * stats.useful / stats.issued) << "%" << std::endl;
+  std::cout << "METADATA ENTRIES: " << stored_entries << " BYTES: " << (stored_entries * entry_bits() + 7) / 8;
+  std::cout << " AVERAGE ENTRIES RECORDED PER INVOCATION: " << (stats.invocations == 0 ? 0 : 1.0 * stats.recorded_entries / stats.invocations) << std::endl;
+}
+
+champsim::modules::registry<champsim::modules::instruction_prefetcher>::add<jukebox> registered{"jukebox"};
+} // namespace
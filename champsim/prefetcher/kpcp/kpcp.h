@@ -0,0 +1,110 @@
+#ifndef KPCP_H
+#define KPCP_H
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// L2 SPP
+//#define L2_PF_DEBUG_PRINT
+#ifdef L2_PF_DEBUG_PRINT
+#define L2_PF_DEBUG(x) x
+#else
+#define L2_PF_DEBUG(x)
+#endif
+
+#define L2_ST_TAG_BIT 16
+#define L2_ST_TAG_MASK ((1 << L2_ST_TAG_BIT) - 1)
+#define L2_PT_SET 512
+#define L2_PT_WAY 4
+#define L2_PT_PRIME 509
+#define CDELTA_MAX 16
+#define CSIG_MAX 16
+#define L2_GHR_TRACK 8
+//#define L2_GHR_ON
+#define SIG_SHIFT 3
+#define SIG_LENGTH 12
+#define SIG_MASK ((1 << SIG_LENGTH) - 1)
+
+#define BLOCKS_PER_PAGE 64
+
+namespace kpcp
+{
+unsigned int get_new_signature(unsigned int old_signature, int curr_delta);
+
+// One tracked page. The per-block prefetched and demanded state is kept in bitmaps.
+struct st_entry {
+  bool valid = false, first_hit = false;
+  uint16_t tag = 0, signature = 0;
+  uint8_t last_block = 0;
+  uint64_t l2_pf = 0, used = 0;
+  uint64_t age = 0;
+  std::array<uint8_t, BLOCKS_PER_PAGE> depth = {};
+
+  bool prefetched(int block) const { return (l2_pf >> block) & 1; }
+  bool demanded(int block) const { return (used >> block) & 1; }
+};
+
+struct pt_entry {
+  int delta = 0, c_delta = 0;
+};
+
+struct ghr_entry {
+  int signature = 0, path_conf = 0, last_block = 0, oop_delta = 0;
+  uint64_t age = 0;
+};
+
+struct table_stats {
+  uint64_t access = 0, hit = 0, invalid = 0, miss = 0;
+};
+
+// Set-associative signature table, indexed by a hash of the page number. Replacement is LRU by age stamp.
+// One set of 256 ways is the fully associative table of the original prefetcher.
+class signature_table
+{
+  const std::size_t sets, ways;
+  std::vector<st_entry> entries;
+  uint64_t clock = 0;
+
+  std::size_t set_index(uint64_t page) const;
+
+public:
+  table_stats stats;
+
+  signature_table(std::size_t sets, std::size_t ways) : sets(sets), ways(ways), entries(sets * ways) {}
+
+  std::size_t num_sets() const { return sets; }
+  std::size_t num_ways() const { return ways; }
+
+  st_entry* find(uint64_t page);
+  st_entry* victim(uint64_t page);
+  void touch(st_entry& entry) { entry.age = ++clock; }
+};
+
+class pattern_table
+{
+  std::array<std::array<pt_entry, L2_PT_WAY>, L2_PT_SET> entries = {};
+  std::array<int, L2_PT_SET> c_sig = {};
+
+public:
+  table_stats stats;
+
+  void update(int signature, int delta);
+  const std::array<pt_entry, L2_PT_WAY>& ways(int signature) const { return entries[signature % L2_PT_PRIME]; }
+  int sig_count(int signature) const { return c_sig[signature % L2_PT_PRIME]; }
+};
+
+// Prefetches that would have crossed the page, to speculatively start the signature of the next page
+class global_history_register
+{
+  std::array<ghr_entry, L2_GHR_TRACK> entries = {};
+  uint64_t clock = 0;
+
+public:
+  void update(int signature, int path_conf, int last_block, int oop_delta);
+  const ghr_entry* match(int curr_block) const;
+};
+} // namespace kpcp
+
+#endif
@@ -1,21 +1,29 @@
 #include <iostream>
 
 #include "cache.h"
+#include "modules.h"
 
-void CACHE::prefetcher_initialize() { std::cout << NAME << " next line prefetcher" << std::endl; }
-
-uint32_t CACHE::prefetcher_cache_operate(uint64_t addr, uint64_t ip, uint8_t cache_hit, uint8_t type, uint32_t metadata_in)
+namespace
 {
-  uint64_t pf_addr = addr + (1 << LOG2_BLOCK_SIZE);
-  prefetch_line(ip, addr, pf_addr, true, 0);
-  return metadata_in;
-}
-
-uint32_t CACHE::prefetcher_cache_fill(uint64_t addr, uint32_t set, uint32_t way, uint8_t prefetch, uint64_t evicted_addr, uint32_t metadata_in)
+// Prefetches the "degree" lines after each access, 1 by default
+class next_line : public champsim::modules::prefetcher
 {
-  return metadata_in;
-}
+  const unsigned degree;
+
+public:
+  next_line(CACHE* cache, const champsim::json_value& params) : prefetcher(cache), degree(champsim::modules::param<unsigned>(params, "degree", 1)) {}
+
+  void initialize() override { std::cout << intern_->NAME << " next line prefetcher, degree " << degree << std::endl; }
 
-void CACHE::prefetcher_cycle_operate() {}
+  uint32_t cache_operate(uint64_t addr, uint64_t ip, uint8_t cache_hit, uint8_t type, uint32_t metadata_in) override
+  {
+    for (unsigned i = 1; i <= degree; ++i) {
+      uint64_t pf_addr = addr + (uint64_t{i} << LOG2_BLOCK_SIZE);
+      intern_->prefetch_line(ip, addr, pf_addr, true, 0);
+    }
+    return metadata_in;
+  }
+};
 
-void CACHE::prefetcher_final_stats() {}
+champsim::modules::registry<champsim::modules::prefetcher>::add<next_line> registered{"next_line"};
+} // namespace
@@ -1,23 +1,24 @@
 #include <iostream>
 
+#include "modules.h"
 #include "ooo_cpu.h"
 
-void O3_CPU::prefetcher_initialize() { std::cout << "CPU " << cpu << " next line instruction prefetcher" << endl; }
-
-void O3_CPU::prefetcher_branch_operate(uint64_t ip, uint8_t branch_type, uint64_t branch_target) {}
-
-uint32_t O3_CPU::prefetcher_cache_operate(uint64_t v_addr, uint8_t cache_hit, uint8_t prefetch_hit, uint32_t metadata_in)
+namespace
 {
-  uint64_t pf_addr = v_addr + (1 << LOG2_BLOCK_SIZE);
-  prefetch_code_line(pf_addr);
-  return metadata_in;
-}
+class next_line_instr : public champsim::modules::instruction_prefetcher
+{
+public:
+  next_line_instr(O3_CPU* cpu, const champsim::json_value& params) : instruction_prefetcher(cpu) {}
 
-void O3_CPU::prefetcher_cycle_operate() {}
+  void initialize() override { std::cout << "CPU " << intern_->cpu << " next line instruction prefetcher" << std::endl; }
 
-uint32_t O3_CPU::prefetcher_cache_fill(uint64_t v_addr, uint32_t set, uint32_t way, uint8_t prefetch, uint64_t evicted_v_addr, uint32_t metadata_in)
-{
-  return metadata_in;
-}
+  uint32_t cache_operate(uint64_t v_addr, uint8_t cache_hit, uint8_t prefetch_hit, uint32_t metadata_in) override
+  {
+    uint64_t pf_addr = v_addr + (1 << LOG2_BLOCK_SIZE);
+    intern_->prefetch_code_line(pf_addr);
+    return metadata_in;
+  }
+};
 
-void O3_CPU::l1i_prefetcher_final_stats() {}
+champsim::modules::registry<champsim::modules::instruction_prefetcher>::add<next_line_instr> registered{"next_line_instr"};
+} // namespace
@@ -1,6 +1,5 @@
-#include "spp_dev.h"
-
 #include "cache.h"
+#include "spp_dev.h"
 
 SIGNATURE_TABLE ST;
 PATTERN_TABLE PT;
@@ -0,0 +1,143 @@
+/*
+ * This file implements a translation prefetcher for address spaces that are
+ * switched in and out, as the sandboxes of serverless functions are.
+ *
+ * Each address space keeps a footprint: the pages of the first misses of its
+ * TLB, in order, from the last time it ran. When the core switches to an
+ * address space, its footprint is prefetched, so that a function that runs
+ * again does not walk the page table for each page it touched before. The
+ * pages of the address space that runs are also prefetched sequentially
+ * after each miss.
+ *
+ * The address space is the ASID that the core takes from cr3 in QEMU traces.
+ * The core switches when it reads the first instruction of the new address
+ * space, a little ahead of its first translation.
+ *
+ * The parameters are "contexts", the address spaces with a footprint (16),
+ * "footprint_pages" per address space (128), "degree" in prefetches of the
+ * footprint per cycle (2), and "next_pages" prefetched after each miss (1).
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <unordered_set>
+#include <vector>
+
+#include "cache.h"
+#include "modules.h"
+
+namespace
+{
+struct footprint {
+  std::vector<uint64_t> pages;
+  uint64_t last_run = 0;
+};
+
+class tlb_asid : public champsim::modules::prefetcher
+{
+  const std::size_t contexts, footprint_pages, degree, next_pages;
+
+  std::map<uint16_t, footprint> footprints;
+  uint16_t running_asid = 0;
+  uint64_t runs = 0;
+
+  // The footprint of the address space that runs, as it is recorded
+  std::vector<uint64_t> record;
+  std::unordered_set<uint64_t> recorded;
+
+  // The footprint being prefetched, and how far the prefetches have gone through it
+  std::vector<uint64_t> replay;
+  std::size_t replayed = 0;
+
+  struct {
+    uint64_t switches = 0, replays = 0, replay_issued = 0, next_issued = 0;
+  } stats;
+
+  void switch_to(uint16_t asid);
+
+public:
+  tlb_asid(CACHE* cache, const champsim::json_value& params)
+      : prefetcher(cache), contexts(champsim::modules::param<std::size_t>(params, "contexts", 16)),
+        footprint_pages(champsim::modules::param<std::size_t>(params, "footprint_pages", 128)),
+        degree(champsim::modules::param<std::size_t>(params, "degree", 2)), next_pages(champsim::modules::param<std::size_t>(params, "next_pages", 1))
+  {
+  }
+
+  void initialize() override
+  {
+    std::cout << intern_->NAME << " ASID-aware TLB prefetcher, " << contexts << " address spaces of " << footprint_pages << " pages" << std::endl;
+  }
+
+  uint32_t cache_operate(uint64_t addr, uint64_t ip, uint8_t cache_hit, uint8_t type, uint32_t metadata_in) override;
+  void cycle_operate() override;
+  void final_stats() override;
+};
+
+void tlb_asid::switch_to(uint16_t asid)
+{
+  if (!std::empty(record)) {
+    footprints[running_asid] = {record, ++runs};
+
+    // keep the address spaces that ran most recently
+    if (std::size(footprints) > contexts) {
+      auto oldest = std::min_element(std::begin(footprints), std::end(footprints),
+                                     [](const auto& x, const auto& y) { return x.second.last_run < y.second.last_run; });
+      footprints.erase(oldest);
+    }
+  }
+
+  running_asid = asid;
+  record.clear();
+  recorded.clear();
+  replay.clear();
+  replayed = 0;
+
+  if (auto found = footprints.find(asid); found != std::end(footprints)) {
+    replay = found->second.pages;
+    if (warmup_complete[intern_->cpu])
+      stats.replays++;
+  }
+
+  if (warmup_complete[intern_->cpu])
+    stats.switches++;
+}
+
+uint32_t tlb_asid::cache_operate(uint64_t addr, uint64_t ip, uint8_t cache_hit, uint8_t type, uint32_t metadata_in)
+{
+  if (cache_hit || type == PREFETCH)
+    return metadata_in;
+
+  uint64_t page = addr >> LOG2_PAGE_SIZE;
+  if (std::size(record) < footprint_pages && recorded.insert(page).second)
+    record.push_back(page);
+
+  for (std::size_t i = 1; i <= next_pages; ++i)
+    if (intern_->prefetch_line((page + i) << LOG2_PAGE_SIZE, true, 0) && warmup_complete[intern_->cpu])
+      stats.next_issued++;
+
+  return metadata_in;
+}
+
+void tlb_asid::cycle_operate()
+{
+  if (ooo_cpu[intern_->cpu]->current_asid != running_asid)
+    switch_to(ooo_cpu[intern_->cpu]->current_asid);
+
+  // The TLB drops the pages whose walk would fault, and the replay moves on past them
+  for (std::size_t i = 0; i < degree && replayed < std::size(replay) && intern_->get_occupancy(3, 0) < intern_->get_size(3, 0); ++i) {
+    if (intern_->prefetch_line(replay[replayed] << LOG2_PAGE_SIZE, true, 0) && warmup_complete[intern_->cpu])
+      stats.replay_issued++;
+    replayed++;
+  }
+}
+
+void tlb_asid::final_stats()
+{
+  std::cout << std::endl << intern_->NAME << " ASID-aware TLB prefetcher final stats" << std::endl;
+  std::cout << "SWITCHES: " << stats.switches << " FOOTPRINTS REPLAYED: " << stats.replays << " ADDRESS SPACES: " << std::size(footprints) << std::endl;
+  std::cout << "PREFETCH ISSUED FROM FOOTPRINTS: " << stats.replay_issued << " AFTER MISSES: " << stats.next_issued << std::endl;
+}
+
+champsim::modules::registry<champsim::modules::prefetcher>::add<tlb_asid> registered{"tlb_asid"};
+} // namespace
@@ -0,0 +1,117 @@
+/*
+ * This file implements distance prefetching of translations, after Kandiraju
+ * and Sivasubramaniam, "Going the Distance for TLB Prefetching: An
+ * Application-driven Study," ISCA 2002.
+ *
+ * The prefetcher trains on the misses of its TLB. The distance between the
+ * pages of two consecutive misses indexes a table, whose entry holds the
+ * distances that followed it most recently. On each miss, the distances that
+ * followed its own distance are added to its page and prefetched. A stride
+ * takes one entry, and a pattern of a few strides takes a few, however many
+ * pages it covers.
+ *
+ * The parameters are "table_entries" (64), fully associative and replaced
+ * LRU, and "predictions" per entry (2).
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <tuple>
+#include <vector>
+
+#include "cache.h"
+#include "modules.h"
+
+namespace
+{
+struct distance_entry {
+  bool valid = false;
+  int64_t distance = 0;
+  std::vector<int64_t> next; // the distances that followed this one, the most recent first
+  uint64_t lru = 0;
+};
+
+class tlb_distance : public champsim::modules::prefetcher
+{
+  const std::size_t predictions;
+  std::vector<distance_entry> table;
+  uint64_t access_count = 0;
+
+  bool history_valid = false, distance_valid = false;
+  uint64_t last_page = 0;
+  int64_t last_distance = 0;
+
+  distance_entry* find(int64_t distance);
+  distance_entry& find_or_replace(int64_t distance);
+
+public:
+  tlb_distance(CACHE* cache, const champsim::json_value& params)
+      : prefetcher(cache), predictions(champsim::modules::param<std::size_t>(params, "predictions", 2)),
+        table(champsim::modules::param<std::size_t>(params, "table_entries", 64))
+  {
+  }
+
+  void initialize() override
+  {
+    std::cout << intern_->NAME << " distance TLB prefetcher, " << std::size(table) << " entries of " << predictions << " distances" << std::endl;
+  }
+
+  uint32_t cache_operate(uint64_t addr, uint64_t ip, uint8_t cache_hit, uint8_t type, uint32_t metadata_in) override;
+};
+
+distance_entry* tlb_distance::find(int64_t distance)
+{
+  auto found = std::find_if(std::begin(table), std::end(table), [distance](const distance_entry& x) { return x.valid && x.distance == distance; });
+  if (found == std::end(table))
+    return nullptr;
+
+  found->lru = ++access_count;
+  return &(*found);
+}
+
+distance_entry& tlb_distance::find_or_replace(int64_t distance)
+{
+  if (auto found = find(distance); found != nullptr)
+    return *found;
+
+  auto victim = std::min_element(std::begin(table), std::end(table), [](const distance_entry& x, const distance_entry& y) {
+    return std::tie(x.valid, x.lru) < std::tie(y.valid, y.lru);
+  });
+  *victim = {true, distance, {}, ++access_count};
+  return *victim;
+}
+
+uint32_t tlb_distance::cache_operate(uint64_t addr, uint64_t ip, uint8_t cache_hit, uint8_t type, uint32_t metadata_in)
+{
+  if (cache_hit || type == PREFETCH || std::empty(table))
+    return metadata_in;
+
+  uint64_t page = addr >> LOG2_PAGE_SIZE;
+  if (history_valid) {
+    int64_t distance = static_cast<int64_t>(page - last_page);
+
+    // train: this distance followed the last one
+    if (distance_valid) {
+      auto& next = find_or_replace(last_distance).next;
+      next.erase(std::remove(std::begin(next), std::end(next), distance), std::end(next));
+      next.insert(std::begin(next), distance);
+      if (std::size(next) > predictions)
+        next.resize(predictions);
+    }
+
+    // predict: the distances that followed this one before
+    if (auto entry = find(distance); entry != nullptr)
+      for (auto predicted : entry->next)
+        intern_->prefetch_line((page + predicted) << LOG2_PAGE_SIZE, true, 0);
+
+    last_distance = distance;
+    distance_valid = true;
+  }
+
+  last_page = page;
+  history_valid = true;
+  return metadata_in;
+}
+
+champsim::modules::registry<champsim::modules::prefetcher>::add<tlb_distance> registered{"tlb_distance"};
+} // namespace
@@ -0,0 +1,34 @@
+#include <iostream>
+
+#include "cache.h"
+#include "modules.h"
+
+namespace
+{
+// For a TLB: prefetches the translations of the "degree" pages after each page accessed, 1 by default
+class tlb_sequential : public champsim::modules::prefetcher
+{
+  const unsigned degree;
+  uint64_t last_page = 0;
+
+public:
+  tlb_sequential(CACHE* cache, const champsim::json_value& params) : prefetcher(cache), degree(champsim::modules::param<unsigned>(params, "degree", 1)) {}
+
+  void initialize() override { std::cout << intern_->NAME << " sequential TLB prefetcher, degree " << degree << std::endl; }
+
+  uint32_t cache_operate(uint64_t addr, uint64_t ip, uint8_t cache_hit, uint8_t type, uint32_t metadata_in) override
+  {
+    // Consecutive accesses to one page ask for the same prefetches
+    uint64_t page = addr >> LOG2_PAGE_SIZE;
+    if (type == PREFETCH || page == last_page)
+      return metadata_in;
+
+    last_page = page;
+    for (unsigned i = 1; i <= degree; ++i)
+      intern_->prefetch_line((page + i) << LOG2_PAGE_SIZE, true, 0);
+    return metadata_in;
+  }
+};
+
+champsim::modules::registry<champsim::modules::prefetcher>::add<tlb_sequential> registered{"tlb_sequential"};
+} // namespace
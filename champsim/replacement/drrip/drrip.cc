@@ -13,12 +13,18 @@
 #define PSEL_MAX ((1 << PSEL_WIDTH) - 1)
 #define PSEL_THRS PSEL_MAX / 2
 
+namespace
+{
 std::map<CACHE*, unsigned> bip_counter;
 std::map<CACHE*, std::vector<std::size_t>> rand_sets;
 std::map<std::pair<CACHE*, std::size_t>, unsigned> PSEL;
+} // namespace
 
 void CACHE::initialize_replacement()
 {
+  for (auto& blk : block)
+    blk.lru = maxRRPV;
+
   // randomly selected sampler sets
   std::size_t rand_seed = 1103515245 + 12345;
   for (std::size_t i = 0; i < TOTAL_SDM_SETS; i++) {
@@ -72,7 +78,7 @@ void CACHE::update_replacement_state(uint32_t cpu, uint32_t set, uint32_t way, u
     {
       block[set * NUM_WAY + way].lru = maxRRPV - 1;
     }
-  } else if (leader == begin) // leader 0: BIP
+  } else if (std::distance(begin, leader) < SDM_SIZE) // leader sets of BIP
   {
     if (PSEL[std::make_pair(this, cpu)] > 0)
       PSEL[std::make_pair(this, cpu)]--;
@@ -83,7 +89,7 @@ void CACHE::update_replacement_state(uint32_t cpu, uint32_t set, uint32_t way, u
       bip_counter[this] = 0;
     if (bip_counter[this] == 0)
       block[set * NUM_WAY + way].lru = maxRRPV - 1;
-  } else if (leader == std::next(begin)) // leader 1: SRRIP
+  } else // leader sets of SRRIP
   {
     if (PSEL[std::make_pair(this, cpu)] < PSEL_MAX)
       PSEL[std::make_pair(this, cpu)]++;
@@ -1,6 +1,7 @@
 #include "cache.h"
 
 #include <algorithm>
+#include <array>
 #include <iterator>
 
 #include "champsim.h"
@@ -14,6 +15,7 @@
 
 extern VirtualMemory vmem;
 extern uint8_t warmup_complete[NUM_CPUS];
+extern uint8_t all_warmup_complete;
 
 void CACHE::handle_fill()
 {
@@ -23,28 +25,46 @@ void CACHE::handle_fill()
       return;
 
     // find victim
-    uint32_t set = get_set(fill_mshr->address);
+    uint32_t page_bits = holds_huge_pages() ? vmem.page_bits(fill_mshr->cpu, fill_mshr->address) : 0;
+    uint32_t set = holds_huge_pages() ? get_set(fill_mshr->address, page_bits) : get_set(fill_mshr->address);
 
     auto set_begin = std::next(std::begin(block), set * NUM_WAY);
     auto set_end = std::next(set_begin, NUM_WAY);
-    auto first_inv = std::find_if_not(set_begin, set_end, is_valid<BLOCK>());
+    uint64_t allowed_ways = fill_ways(*fill_mshr);
+    auto first_inv = std::next(set_begin, first_invalid_way(set, allowed_ways));
+
+    // An exclusive cache passes the lines filled for the caches above on to them, without a copy of its own
+    bool pass_up = (inclusion == inclusion_t::exclusive && fill_mshr->fill_level < fill_level);
+    if (page_bits > OFFSET_BITS) {
+      // the walks of two base pages in one huge page fill the same translation
+      auto same_page = std::find_if(set_begin, set_end, [addr = fill_mshr->address, page_bits](const BLOCK& x) {
+        return x.valid && x.page_bits == page_bits && (x.address >> page_bits) == (addr >> page_bits);
+      });
+      if (same_page != set_end)
+        first_inv = same_page;
+    }
     uint32_t way = std::distance(set_begin, first_inv);
-    if (way == NUM_WAY)
-      way = impl_replacement_find_victim(fill_mshr->cpu, fill_mshr->instr_id, set, &block.data()[set * NUM_WAY], fill_mshr->ip, fill_mshr->address,
-                                         fill_mshr->type);
+    if (pass_up)
+      way = NUM_WAY;
+    else if (way == NUM_WAY && set >= NUM_SET)
+      way = std::distance(set_begin, std::max_element(set_begin, set_end, lru_comparator<BLOCK, BLOCK>()));
+    else if (way == NUM_WAY)
+      way = find_victim_in(set, allowed_ways, *fill_mshr);
 
     bool success = filllike_miss(set, way, *fill_mshr);
     if (!success)
       return;
 
     if (way != NUM_WAY) {
+      block[set * NUM_WAY + way].page_bits = page_bits;
+
       // update processed packets
       fill_mshr->data = block[set * NUM_WAY + way].data;
-
-      for (auto ret : fill_mshr->to_return)
-        ret->return_data(&(*fill_mshr));
     }
 
+    for (auto ret : fill_mshr->to_return)
+      ret->return_data(&(*fill_mshr));
+
     MSHR.erase(fill_mshr);
     writes_available_this_cycle--;
   }
@@ -58,6 +78,7 @@ void CACHE::handle_writeback()
 
     // handle the oldest entry
     PACKET& handle_pkt = WQ.front();
+    bool clean_victim = (handle_pkt.type == WRITEBACK && !handle_pkt.dirty);
 
     // access cache
     uint32_t set = get_set(handle_pkt.address);
@@ -73,8 +94,9 @@ void CACHE::handle_writeback()
       sim_hit[handle_pkt.cpu][handle_pkt.type]++;
       sim_access[handle_pkt.cpu][handle_pkt.type]++;
 
-      // mark dirty
-      fill_block.dirty = 1;
+      // mark dirty, unless a cache above wrote back a clean line
+      if (handle_pkt.type != WRITEBACK || handle_pkt.dirty)
+        fill_block.dirty = 1;
     } else // MISS
     {
       bool success;
@@ -82,13 +104,10 @@ void CACHE::handle_writeback()
         success = readlike_miss(handle_pkt);
       } else {
         // find victim
-        auto set_begin = std::next(std::begin(block), set * NUM_WAY);
-        auto set_end = std::next(set_begin, NUM_WAY);
-        auto first_inv = std::find_if_not(set_begin, set_end, is_valid<BLOCK>());
-        way = std::distance(set_begin, first_inv);
+        uint64_t allowed_ways = fill_ways(handle_pkt);
+        way = first_invalid_way(set, allowed_ways);
         if (way == NUM_WAY)
-          way = impl_replacement_find_victim(handle_pkt.cpu, handle_pkt.instr_id, set, &block.data()[set * NUM_WAY], handle_pkt.ip, handle_pkt.address,
-                                             handle_pkt.type);
+          way = find_victim_in(set, allowed_ways, handle_pkt);
 
         success = filllike_miss(set, way, handle_pkt);
       }
@@ -97,6 +116,9 @@ void CACHE::handle_writeback()
         return;
     }
 
+    if (clean_victim && warmup_complete[handle_pkt.cpu])
+      clean_victims++;
+
     // remove this entry from WQ
     writes_available_this_cycle--;
     WQ.pop_front();
@@ -117,8 +139,7 @@ void CACHE::handle_read()
     // vaddr to the prefetcher
     ever_seen_data |= (handle_pkt.v_address != handle_pkt.ip);
 
-    uint32_t set = get_set(handle_pkt.address);
-    uint32_t way = get_way(handle_pkt.address, set);
+    auto [set, way] = find_block(handle_pkt.address);
 
     if (way < NUM_WAY) // HIT
     {
@@ -128,6 +149,7 @@ void CACHE::handle_read()
       if (!success)
         return;
     }
+    partition_access(set, handle_pkt, way < NUM_WAY);
 
     // remove this entry from RQ
     RQ.pop_front();
@@ -144,8 +166,7 @@ void CACHE::handle_prefetch()
     // handle the oldest entry
     PACKET& handle_pkt = PQ.front();
 
-    uint32_t set = get_set(handle_pkt.address);
-    uint32_t way = get_way(handle_pkt.address, set);
+    auto [set, way] = find_block(handle_pkt.address);
 
     if (way < NUM_WAY) // HIT
     {
@@ -155,6 +176,7 @@ void CACHE::handle_prefetch()
       if (!success)
         return;
     }
+    partition_access(set, handle_pkt, way < NUM_WAY);
 
     // remove this entry from PQ
     PQ.pop_front();
@@ -175,7 +197,14 @@ void CACHE::readlike_hit(std::size_t set, std::size_t way, PACKET& handle_pkt)
 
   BLOCK& hit_block = block[set * NUM_WAY + way];
 
+  // An exclusive cache gives the line, and its dirtiness, to the cache above that fills it
+  bool move_up = (inclusion == inclusion_t::exclusive && handle_pkt.fill_level < fill_level);
+  if (move_up)
+    handle_pkt.dirty = hit_block.dirty;
+
   handle_pkt.data = hit_block.data;
+  if (hit_block.page_bits > OFFSET_BITS)
+    handle_pkt.data = splice_bits(hit_block.data, handle_pkt.address, hit_block.page_bits);
 
   // update prefetcher on load instruction
   if (should_activate_prefetcher(handle_pkt.type) && handle_pkt.pf_origin_level < fill_level) {
@@ -185,7 +214,12 @@ void CACHE::readlike_hit(std::size_t set, std::size_t way, PACKET& handle_pkt)
   }
 
   // update replacement policy
-  impl_replacement_update_state(handle_pkt.cpu, set, way, hit_block.address, handle_pkt.ip, 0, handle_pkt.type, 1);
+  if (set < NUM_SET) {
+    impl_replacement_update_state(handle_pkt.cpu, set, way, hit_block.address, handle_pkt.ip, 0, handle_pkt.type, 1);
+  } else {
+    auto set_begin = std::next(std::begin(block), set * NUM_WAY);
+    std::for_each(set_begin, std::next(set_begin, NUM_WAY), lru_updater<BLOCK>(std::next(set_begin, way)));
+  }
 
   // COLLECT STATS
   sim_hit[handle_pkt.cpu][handle_pkt.type]++;
@@ -194,11 +228,14 @@ void CACHE::readlike_hit(std::size_t set, std::size_t way, PACKET& handle_pkt)
   for (auto ret : handle_pkt.to_return)
     ret->return_data(&handle_pkt);
 
-  // update prefetch stats and reset prefetch bit
-  if (hit_block.prefetch) {
+  // update prefetch stats and reset prefetch bit, unless this is another prefetch of this level
+  if (hit_block.prefetch && !(handle_pkt.type == PREFETCH && handle_pkt.pf_origin_level == fill_level)) {
     pf_useful++;
     hit_block.prefetch = 0;
   }
+
+  if (move_up)
+    invalidate_entry(hit_block.address);
 }
 
 bool CACHE::readlike_miss(PACKET& handle_pkt)
@@ -212,6 +249,8 @@ bool CACHE::readlike_miss(PACKET& handle_pkt)
     std::cout << " cycle: " << current_cycle << std::endl;
   });
 
+  uint64_t requesters = upper_mask(handle_pkt.to_return);
+
   // check mshr
   auto mshr_entry = std::find_if(MSHR.begin(), MSHR.end(), eq_addr<PACKET>(handle_pkt.address, OFFSET_BITS));
   bool mshr_full = (MSHR.size() == MSHR_SIZE);
@@ -227,15 +266,19 @@ bool CACHE::readlike_miss(PACKET& handle_pkt)
     packet_dep_merge(mshr_entry->to_return, handle_pkt.to_return);
 
     if (mshr_entry->type == PREFETCH && handle_pkt.type != PREFETCH) {
-      // Mark the prefetch as useful
-      if (mshr_entry->pf_origin_level == fill_level)
+      // Mark the prefetch as useful, if late
+      if (mshr_entry->pf_origin_level == fill_level) {
         pf_useful++;
+        pf_late++;
+      }
 
       uint64_t prior_event_cycle = mshr_entry->event_cycle;
+      bool prior_dirty = mshr_entry->dirty;
       *mshr_entry = handle_pkt;
 
       // in case request is already returned, we should keep event_cycle
       mshr_entry->event_cycle = prior_event_cycle;
+      mshr_entry->dirty = prior_dirty;
     }
   } else {
     if (mshr_full)  // not enough MSHR resource
@@ -274,6 +317,13 @@ bool CACHE::readlike_miss(PACKET& handle_pkt)
     handle_pkt.pf_metadata = impl_prefetcher_cache_operate(pf_base_addr, handle_pkt.ip, 0, handle_pkt.type, handle_pkt.pf_metadata);
   }
 
+  // A snoop filter is looked up for the misses from above, and snoops the other caches above that hold the line
+  if (snoop_filter && handle_pkt.fill_level < fill_level && warmup_complete[handle_pkt.cpu]) {
+    snoop_filter->lookups++;
+    if ((snoop_filter->holders(handle_pkt.address) & ~requesters) != 0)
+      snoop_filter->hits++;
+  }
+
   return true;
 }
 
@@ -290,16 +340,22 @@ bool CACHE::filllike_miss(std::size_t set, std::size_t way, PACKET& handle_pkt)
 
   bool bypass = (way == NUM_WAY);
 #ifndef LLC_BYPASS
-  assert(!bypass);
+  assert(!bypass || inclusion == inclusion_t::exclusive);
 #endif
   assert(handle_pkt.type != WRITEBACK || !bypass);
 
   BLOCK& fill_block = block[set * NUM_WAY + way];
-  bool evicting_dirty = !bypass && (lower_level != NULL) && fill_block.dirty;
+  bool evicting_valid = !bypass && fill_block.valid;
+  uint64_t evicted_line = bypass ? 0 : fill_block.address;
+
+  // An inclusive cache writes back the dirty copies above of the line it evicts, and an exclusive cache below takes every line evicted
+  bool evicting_dirty = !bypass && (lower_level != NULL)
+                        && (fill_block.dirty || (evicting_valid && inclusion == inclusion_t::inclusive && dirty_above(fill_block.address)));
+  bool evicting_clean = evicting_valid && !evicting_dirty && lower_cache != nullptr && lower_cache->inclusion == inclusion_t::exclusive;
   uint64_t evicting_address = 0;
 
   if (!bypass) {
-    if (evicting_dirty) {
+    if (evicting_dirty || evicting_clean) {
       PACKET writeback_packet;
 
       writeback_packet.fill_level = lower_level->fill_level;
@@ -309,12 +365,18 @@ bool CACHE::filllike_miss(std::size_t set, std::size_t way, PACKET& handle_pkt)
       writeback_packet.instr_id = handle_pkt.instr_id;
       writeback_packet.ip = 0;
       writeback_packet.type = WRITEBACK;
+      writeback_packet.dirty = evicting_dirty;
+      std::copy(std::begin(fill_block.asid), std::end(fill_block.asid), std::begin(writeback_packet.asid));
+      writeback_packet.is_kernel = fill_block.is_kernel;
 
       auto result = lower_level->add_wq(&writeback_packet);
       if (result == -2)
         return false;
     }
 
+    if (evicting_valid && inclusion == inclusion_t::inclusive)
+      back_invalidate(fill_block.address, bitmask(upper_levels.size()));
+
     if (ever_seen_data)
       evicting_address = fill_block.address & ~bitmask(match_offset_bits ? 0 : OFFSET_BITS);
     else
@@ -326,20 +388,38 @@ bool CACHE::filllike_miss(std::size_t set, std::size_t way, PACKET& handle_pkt)
     if (handle_pkt.type == PREFETCH)
       pf_fill++;
 
+    if (partitioner) {
+      if (fill_block.valid)
+        partitioner->remove(partitioner->partition_of(fill_block));
+      partitioner->insert(partitioner->partition_of(handle_pkt));
+    }
+
     fill_block.valid = true;
     fill_block.prefetch = (handle_pkt.type == PREFETCH && handle_pkt.pf_origin_level == fill_level);
-    fill_block.dirty = (handle_pkt.type == WRITEBACK || (handle_pkt.type == RFO && handle_pkt.to_return.empty()));
+    fill_block.dirty = (handle_pkt.dirty || (handle_pkt.type == RFO && handle_pkt.to_return.empty()));
     fill_block.address = handle_pkt.address;
     fill_block.v_address = handle_pkt.v_address;
     fill_block.data = handle_pkt.data;
     fill_block.ip = handle_pkt.ip;
     fill_block.cpu = handle_pkt.cpu;
     fill_block.instr_id = handle_pkt.instr_id;
+    std::copy(std::begin(handle_pkt.asid), std::end(handle_pkt.asid), std::begin(fill_block.asid));
+    fill_block.is_kernel = handle_pkt.is_kernel;
+
+    // The line is dirty in this cache only, and not in those above that it returns to
+    handle_pkt.dirty = false;
+
+    if (evicting_valid)
+      note_eviction(evicted_line);
+    note_fill(handle_pkt.address);
   }
 
   if (warmup_complete[handle_pkt.cpu] && (handle_pkt.cycle_enqueued != 0))
     total_miss_latency += current_cycle - handle_pkt.cycle_enqueued;
 
+  if (partitioner && handle_pkt.cycle_enqueued != 0 && handle_pkt.type != PREFETCH && handle_pkt.type != WRITEBACK)
+    partitioner->miss_latency(partitioner->partition_of(handle_pkt), current_cycle - handle_pkt.cycle_enqueued, warmup_complete[handle_pkt.cpu]);
+
   // update prefetcher
   cpu = handle_pkt.cpu;
   handle_pkt.pf_metadata =
@@ -347,7 +427,12 @@ bool CACHE::filllike_miss(std::size_t set, std::size_t way, PACKET& handle_pkt)
                                  handle_pkt.type == PREFETCH, evicting_address, handle_pkt.pf_metadata);
 
   // update replacement policy
-  impl_replacement_update_state(handle_pkt.cpu, set, way, handle_pkt.address, handle_pkt.ip, 0, handle_pkt.type, 0);
+  if (set < NUM_SET && !bypass) {
+    impl_replacement_update_state(handle_pkt.cpu, set, way, handle_pkt.address, handle_pkt.ip, 0, handle_pkt.type, 0);
+  } else if (!bypass) {
+    auto set_begin = std::next(std::begin(block), set * NUM_WAY);
+    std::for_each(set_begin, std::next(set_begin, NUM_WAY), lru_updater<BLOCK>(std::next(set_begin, way)));
+  }
 
   // COLLECT STATS
   sim_miss[handle_pkt.cpu][handle_pkt.type]++;
@@ -362,6 +447,18 @@ void CACHE::operate()
   operate_reads();
 
   impl_prefetcher_cycle_operate();
+
+  if (partitioner)
+    partitioner->operate(current_cycle, all_warmup_complete > NUM_CPUS);
+
+  // The dirty lines dropped above for the snoop filter are written into this cache
+  while (!snoop_filter_writebacks.empty() && add_wq(&snoop_filter_writebacks.front()) != -2)
+    snoop_filter_writebacks.pop_front();
+
+  if (!upper_levels.empty() && all_warmup_complete > NUM_CPUS && current_cycle >= next_capacity_sample) {
+    sample_capacity();
+    next_capacity_sample = current_cycle + CAPACITY_SAMPLE_INTERVAL;
+  }
 }
 
 void CACHE::operate_writes()
@@ -389,6 +486,96 @@ void CACHE::operate_reads()
 
 uint32_t CACHE::get_set(uint64_t address) { return ((address >> OFFSET_BITS) & bitmask(lg2(NUM_SET))); }
 
+uint32_t CACHE::get_set(uint64_t address, uint64_t page_bits)
+{
+  if (page_bits > OFFSET_BITS && HUGE_PAGE_SETS > 0)
+    return NUM_SET + ((address >> page_bits) & bitmask(lg2(HUGE_PAGE_SETS)));
+
+  return ((address >> page_bits) & bitmask(lg2(NUM_SET)));
+}
+
+// A TLB is a cache of translations, addressed by virtual page
+bool CACHE::holds_translations() const { return OFFSET_BITS == LOG2_PAGE_SIZE; }
+
+bool CACHE::holds_huge_pages() const { return holds_translations() && vmem.max_leaf_level > 0; }
+
+// The set and way that hold the address, or NUM_WAY. A TLB looks up each page size in parallel.
+std::pair<uint32_t, uint32_t> CACHE::find_block(uint64_t address)
+{
+  uint32_t set = get_set(address);
+  uint32_t way = get_way(address, set);
+  if (way < NUM_WAY || !holds_huge_pages())
+    return {set, way};
+
+  for (uint32_t level = 1; level <= vmem.max_leaf_level; ++level) {
+    uint64_t page_bits = vmem.shamt(level);
+    uint32_t huge_set = get_set(address, page_bits);
+    auto begin = std::next(std::begin(block), huge_set * NUM_WAY);
+    auto end = std::next(begin, NUM_WAY);
+    auto found = std::find_if(begin, end, [address, page_bits](const BLOCK& x) {
+      return x.valid && x.page_bits == page_bits && (x.address >> page_bits) == (address >> page_bits);
+    });
+    if (found != end)
+      return {huge_set, std::distance(begin, found)};
+  }
+
+  return {set, NUM_WAY};
+}
+
+// The ways that the partition of the packet may fill, or all of them
+uint64_t CACHE::fill_ways(const PACKET& packet) const
+{
+  if (!partitioner)
+    return std::numeric_limits<uint64_t>::max();
+  return partitioner->way_mask(partitioner->partition_of(packet));
+}
+
+uint32_t CACHE::first_invalid_way(uint32_t set, uint64_t allowed_ways)
+{
+  for (uint32_t way = 0; way < NUM_WAY; ++way)
+    if (!block[set * NUM_WAY + way].valid && ((allowed_ways >> way) & 1))
+      return way;
+  return NUM_WAY;
+}
+
+// The replacement policies rank the ways of a set by their lru field, the highest first. The ways outside the mask
+// are given the lowest rank while the policy searches the set, and their own ranks back afterwards, so that it neither
+// picks nor ages them. A victim outside the mask, as on a tie, gives way to the highest ranked way inside it.
+uint32_t CACHE::find_victim_in(uint32_t set, uint64_t allowed_ways, const PACKET& packet)
+{
+  if (!partitioner)
+    return impl_replacement_find_victim(packet.cpu, packet.instr_id, set, &block.data()[set * NUM_WAY], packet.ip, packet.address, packet.type);
+
+  auto set_begin = std::next(std::begin(block), set * NUM_WAY);
+  std::array<uint32_t, 64> hidden_lru; // the partitioner allows fewer than 64 ways
+  for (uint32_t candidate = 0; candidate < NUM_WAY; ++candidate) {
+    if (((allowed_ways >> candidate) & 1) == 0) {
+      hidden_lru[candidate] = set_begin[candidate].lru;
+      set_begin[candidate].lru = 0;
+    }
+  }
+
+  uint32_t way = impl_replacement_find_victim(packet.cpu, packet.instr_id, set, &block.data()[set * NUM_WAY], packet.ip, packet.address, packet.type);
+
+  for (uint32_t candidate = 0; candidate < NUM_WAY; ++candidate)
+    if (((allowed_ways >> candidate) & 1) == 0)
+      set_begin[candidate].lru = hidden_lru[candidate];
+
+  if (way == NUM_WAY || ((allowed_ways >> way) & 1))
+    return way;
+
+  for (uint32_t candidate = 0; candidate < NUM_WAY; ++candidate)
+    if (((allowed_ways >> candidate) & 1) && (((allowed_ways >> way) & 1) == 0 || set_begin[candidate].lru > set_begin[way].lru))
+      way = candidate;
+  return way;
+}
+
+void CACHE::partition_access(uint32_t set, const PACKET& packet, bool hit)
+{
+  if (partitioner)
+    partitioner->access(partitioner->partition_of(packet), set, packet.address >> OFFSET_BITS, hit, warmup_complete[packet.cpu]);
+}
+
 uint32_t CACHE::get_way(uint64_t address, uint32_t set)
 {
   auto begin = std::next(block.begin(), set * NUM_WAY);
@@ -401,12 +588,141 @@ int CACHE::invalidate_entry(uint64_t inval_addr)
   uint32_t set = get_set(inval_addr);
   uint32_t way = get_way(inval_addr, set);
 
-  if (way < NUM_WAY)
+  if (way < NUM_WAY) {
+    if (partitioner && block[set * NUM_WAY + way].valid)
+      partitioner->remove(partitioner->partition_of(block[set * NUM_WAY + way]));
     block[set * NUM_WAY + way].valid = 0;
+    block[set * NUM_WAY + way].dirty = 0;
+    note_eviction(inval_addr);
+  }
 
   return way;
 }
 
+// Whether this cache or any cache above it holds the line
+bool CACHE::holds_above(uint64_t address)
+{
+  return get_way(address, get_set(address)) < NUM_WAY
+         || std::any_of(std::begin(upper_levels), std::end(upper_levels), [address](CACHE* x) { return x->holds_above(address); });
+}
+
+// Whether any cache above holds the line dirty
+bool CACHE::dirty_above(uint64_t address)
+{
+  return std::any_of(std::begin(upper_levels), std::end(upper_levels), [address](CACHE* x) {
+    uint32_t set = x->get_set(address);
+    uint32_t way = x->get_way(address, set);
+    return (way < x->NUM_WAY && x->block[set * x->NUM_WAY + way].dirty) || x->dirty_above(address);
+  });
+}
+
+// Invalidate the line in the caches directly above that are given as bits, and in every cache above them
+void CACHE::back_invalidate(uint64_t address, uint64_t uppers)
+{
+  for (std::size_t i = 0; i < upper_levels.size(); ++i) {
+    if (((uppers >> i) & 1) == 0)
+      continue;
+
+    std::vector<CACHE*> above{upper_levels[i]};
+    while (!above.empty()) {
+      CACHE* x = above.back();
+      above.pop_back();
+      above.insert(std::end(above), std::begin(x->upper_levels), std::end(x->upper_levels));
+
+      uint32_t set = x->get_set(address);
+      uint32_t way = x->get_way(address, set);
+      if (way == x->NUM_WAY)
+        continue;
+
+      if (all_warmup_complete > NUM_CPUS) {
+        back_invalidations++;
+        if (x->block[set * x->NUM_WAY + way].dirty)
+          back_invalidations_dirty++;
+      }
+      x->invalidate_entry(address);
+    }
+  }
+}
+
+// Tell the caches below that keep a snoop filter that this cache holds the line
+void CACHE::note_fill(uint64_t address)
+{
+  if (!snoop_filter_below)
+    return;
+
+  for (CACHE *child = this, *parent = lower_cache; parent != nullptr; child = parent, parent = parent->lower_cache) {
+    if (!parent->snoop_filter)
+      continue;
+
+    auto replaced = parent->snoop_filter->insert(parent->upper_index(child), address);
+    if (!replaced.has_value())
+      continue;
+
+    // A line that the filter no longer tracks is dropped above, and if dirty, written into the cache of the filter
+    if (all_warmup_complete > NUM_CPUS)
+      parent->snoop_filter->evictions++;
+
+    if (parent->dirty_above(replaced->address)) {
+      PACKET& writeback_packet = parent->snoop_filter_writebacks.emplace_back();
+      writeback_packet.fill_level = parent->fill_level;
+      writeback_packet.cpu = cpu;
+      writeback_packet.address = replaced->address;
+      writeback_packet.type = WRITEBACK;
+      writeback_packet.dirty = true;
+    }
+    parent->back_invalidate(replaced->address, replaced->holders);
+  }
+}
+
+// Tell the caches below that keep a snoop filter that this cache dropped the line, unless a cache above it still holds it
+void CACHE::note_eviction(uint64_t address)
+{
+  if (!snoop_filter_below)
+    return;
+
+  for (CACHE *child = this, *parent = lower_cache; parent != nullptr && !child->holds_above(address); child = parent, parent = parent->lower_cache) {
+    if (parent->snoop_filter)
+      parent->snoop_filter->remove(parent->upper_index(child), address);
+  }
+}
+
+std::size_t CACHE::upper_index(const CACHE* upper) const
+{
+  return std::distance(std::begin(upper_levels), std::find(std::begin(upper_levels), std::end(upper_levels), upper));
+}
+
+// The caches directly above among those that a request returns to, as a bit for each
+uint64_t CACHE::upper_mask(const std::vector<MemoryRequestProducer*>& producers) const
+{
+  uint64_t mask = 0;
+  for (std::size_t i = 0; i < upper_levels.size(); ++i)
+    if (std::find(std::begin(producers), std::end(producers), upper_levels[i]) != std::end(producers))
+      mask |= (1ull << i);
+  return mask;
+}
+
+void CACHE::collect_lines(std::vector<uint64_t>& lines) const
+{
+  for (const BLOCK& x : block)
+    if (x.valid)
+      lines.push_back(x.address >> OFFSET_BITS);
+  for (CACHE* x : upper_levels)
+    x->collect_lines(lines);
+}
+
+// The capacity that this cache and those above it give together is that of the distinct lines they hold
+void CACHE::sample_capacity()
+{
+  std::vector<uint64_t> lines;
+  collect_lines(lines);
+  std::sort(std::begin(lines), std::end(lines));
+  auto unique_end = std::unique(std::begin(lines), std::end(lines));
+
+  capacity_samples++;
+  unique_line_samples += std::distance(std::begin(lines), unique_end);
+  duplicate_line_samples += std::distance(unique_end, std::end(lines));
+}
+
 int CACHE::add_rq(PACKET* packet)
 {
   assert(packet->address != 0);
@@ -526,7 +842,20 @@ int CACHE::prefetch_line(uint64_t pf_addr, bool fill_this_level, uint32_t prefet
   pf_packet.address = pf_addr;
   pf_packet.v_address = virtual_prefetch ? pf_addr : 0;
 
-  if (virtual_prefetch) {
+  // A TLB prefetches the translation of a virtual page, through the page table walker.
+  // Pages whose walk would fault are dropped, so that prefetching maps no memory.
+  if (holds_translations()) {
+    if (vmem.walk_faults(cpu, pf_addr))
+      return 0;
+
+    pf_packet.v_address = pf_addr;
+    int result = add_pq(&pf_packet);
+    if (result != -2) {
+      if (result > 0)
+        pf_issued++;
+      return 1;
+    }
+  } else if (virtual_prefetch) {
     if (!VAPQ.full()) {
       VAPQ.push_back(pf_packet);
       return 1;
@@ -655,6 +984,7 @@ void CACHE::return_data(PACKET* packet)
   // MSHR holds the most updated information about this request
   mshr_entry->data = packet->data;
   mshr_entry->pf_metadata = packet->pf_metadata;
+  mshr_entry->dirty = packet->dirty;
   mshr_entry->event_cycle = current_cycle + (warmup_complete[cpu] ? FILL_LATENCY : 0);
 
   DP(if (warmup_complete[packet->cpu]) {
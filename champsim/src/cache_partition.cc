@@ -0,0 +1,214 @@
+#include "cache_partition.h"
+
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+
+#include "champsim_constants.h"
+#include "modules.h"
+#include "util.h"
+
+namespace
+{
+// Masks and ASIDs are given as numbers, or as strings in any base that C++ reads, such as "0x00ff"
+uint64_t as_integer(const champsim::json_value& value)
+{
+  if (value.is_string())
+    return std::stoull(value.as_string(), nullptr, 0);
+  return static_cast<uint64_t>(value.as_number());
+}
+} // namespace
+
+champsim::cache_partitioner::cache_partitioner(const json_value& params, uint32_t sets, uint32_t ways) : NUM_SET(sets), NUM_WAY(ways)
+{
+  if (NUM_WAY >= 64)
+    throw std::invalid_argument("Cache partitioning takes at most 63 ways");
+
+  if (params.contains("key")) {
+    const auto& name = params.at("key").as_string();
+    if (name == "cpu")
+      key = key_type::cpu;
+    else if (name == "asid_class")
+      key = key_type::asid_class;
+    else
+      throw std::invalid_argument("Unknown cache partition key \"" + name + "\"");
+  }
+
+  if (params.contains("policy")) {
+    const auto& name = params.at("policy").as_string();
+    if (name == "static")
+      policy = policy_type::fixed;
+    else if (name == "ucp")
+      policy = policy_type::ucp;
+    else
+      throw std::invalid_argument("Unknown cache partition policy \"" + name + "\"");
+  }
+
+  if (params.contains("function_asids"))
+    for (std::size_t i = 0; i < params.at("function_asids").size(); ++i)
+      function_asids.push_back(static_cast<uint16_t>(as_integer(params.at("function_asids").at(i))));
+
+  interval = modules::param<uint64_t>(params, "interval", interval);
+  sampled_sets = modules::param<uint32_t>(params, "sampled_sets", sampled_sets);
+  min_ways = modules::param<uint32_t>(params, "min_ways", min_ways);
+  if (interval == 0 || sampled_sets == 0)
+    throw std::invalid_argument("Cache partitioning needs a nonzero interval and sampled sets");
+
+  std::size_t count = (key == key_type::cpu) ? NUM_CPUS : 3;
+  masks.assign(count, bitmask(NUM_WAY));
+  lines.assign(count, 0);
+  stats.resize(count);
+
+  if (params.contains("way_masks")) {
+    if (params.at("way_masks").size() != count)
+      throw std::invalid_argument("Cache partitioning needs a way mask for each of its " + std::to_string(count) + " partitions");
+    for (std::size_t i = 0; i < count; ++i) {
+      masks[i] = as_integer(params.at("way_masks").at(i)) & bitmask(NUM_WAY);
+      if (masks[i] == 0)
+        throw std::invalid_argument("The way mask of cache partition " + name(i) + " is empty");
+    }
+  }
+
+  if (policy == policy_type::ucp) {
+    if (count * min_ways > NUM_WAY)
+      throw std::invalid_argument("Cache partitioning cannot leave " + std::to_string(min_ways) + " ways to each of its partitions");
+
+    // Until the first division, the ways are split evenly
+    uint32_t first = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+      uint32_t share = NUM_WAY / count + (i < NUM_WAY % count);
+      masks[i] = bitmask(first + share, first);
+      first += share;
+    }
+
+    shadow_tags.resize(count * sets_sampled());
+    way_hits.assign(count, std::vector<uint64_t>(NUM_WAY));
+    next_repartition = interval;
+  }
+}
+
+std::string champsim::cache_partitioner::name(std::size_t partition) const
+{
+  if (key == key_type::cpu)
+    return "CPU" + std::to_string(partition);
+
+  const std::string names[] = {"KERNEL", "USER", "FUNCTION"};
+  return names[partition];
+}
+
+// Prefetches carry no address space, and are user requests
+std::size_t champsim::cache_partitioner::partition_of(uint32_t cpu, uint16_t asid, bool is_kernel) const
+{
+  if (key == key_type::cpu)
+    return cpu;
+  if (is_kernel)
+    return 0;
+  if (std::find(std::begin(function_asids), std::end(function_asids), asid) != std::end(function_asids))
+    return 2;
+  return 1;
+}
+
+void champsim::cache_partitioner::access(std::size_t partition, uint32_t set, uint64_t line_addr, bool hit, bool warm)
+{
+  if (warm) {
+    if (hit)
+      stats.at(partition).hits++;
+    else
+      stats.at(partition).misses++;
+  }
+
+  if (policy != policy_type::ucp || set % sample_stride() != 0)
+    return;
+
+  // The shadow tags are what the partition would hold with every way to itself, so a hit at a recency position
+  // is a hit that the partition would have with at least that many ways
+  auto& tags = shadow_tags.at(partition * sets_sampled() + set / sample_stride());
+  auto found = std::find(std::begin(tags), std::end(tags), line_addr);
+  if (found != std::end(tags)) {
+    way_hits[partition][std::distance(std::begin(tags), found)]++;
+    tags.erase(found);
+  } else if (std::size(tags) == NUM_WAY) {
+    tags.pop_back();
+  }
+  tags.insert(std::begin(tags), line_addr);
+}
+
+void champsim::cache_partitioner::miss_latency(std::size_t partition, uint64_t latency, bool warm)
+{
+  if (!warm)
+    return;
+
+  auto& partition_stats = stats.at(partition);
+  partition_stats.total_miss_latency += latency;
+  partition_stats.latency_samples++;
+  partition_stats.miss_latency[latency]++;
+}
+
+void champsim::cache_partitioner::operate(uint64_t cycle, bool warm)
+{
+  if (warm) {
+    cycles++;
+    for (std::size_t i = 0; i < size(); ++i)
+      stats[i].line_cycles += lines[i];
+  }
+
+  if (policy == policy_type::ucp && cycle >= next_repartition) {
+    repartition();
+    next_repartition = cycle + interval;
+  }
+}
+
+// The lookahead allocation of UCP: each step gives the partition with the most hits to gain per way the ways that gain them,
+// so that a partition whose hits come only with several more ways is not passed over one way at a time
+void champsim::cache_partitioner::repartition()
+{
+  std::vector<uint32_t> alloc(size(), min_ways);
+  uint32_t balance = NUM_WAY - size() * min_ways;
+
+  while (balance > 0) {
+    double best_gain = -1;
+    std::size_t winner = 0;
+    uint32_t winner_ways = 1;
+    for (std::size_t i = 0; i < size(); ++i) {
+      for (uint32_t extra = 1; extra <= balance; ++extra) {
+        auto first = std::next(std::begin(way_hits[i]), alloc[i]);
+        double gain = static_cast<double>(std::accumulate(first, std::next(first, extra), uint64_t{0})) / extra;
+
+        // Ties go to the partition with fewer ways
+        if (gain > best_gain || (gain == best_gain && alloc[i] < alloc[winner])) {
+          best_gain = gain;
+          winner = i;
+          winner_ways = extra;
+        }
+      }
+    }
+
+    alloc[winner] += winner_ways;
+    balance -= winner_ways;
+  }
+
+  uint32_t first = 0;
+  for (std::size_t i = 0; i < size(); ++i) {
+    masks[i] = bitmask(first + alloc[i], first);
+    first += alloc[i];
+  }
+
+  // Age the utility, so that it follows the phases of each partition
+  for (auto& hits : way_hits)
+    for (auto& x : hits)
+      x /= 2;
+
+  repartitions++;
+}
+
+uint64_t champsim::cache_partitioner::latency_percentile(std::size_t partition, double fraction) const
+{
+  const auto& partition_stats = stats.at(partition);
+  uint64_t seen = 0;
+  for (auto [latency, count] : partition_stats.miss_latency) {
+    seen += count;
+    if (seen >= fraction * partition_stats.latency_samples)
+      return latency;
+  }
+  return 0;
+}
@@ -1,21 +1,61 @@
 #include "dram_controller.h"
 
 #include <algorithm>
+#include <cassert>
+#include <tuple>
 
 #include "champsim_constants.h"
 #include "util.h"
 
 extern uint8_t all_warmup_complete;
 
-struct is_unscheduled {
-  bool operator()(const PACKET& lhs) { return !lhs.scheduled; }
-};
+DRAM_QUEUE::DRAM_QUEUE(std::size_t size) : entries(size)
+{
+  for (auto it = std::begin(entries); it != std::end(entries); ++it)
+    free_slots.push(it);
+}
+
+std::vector<PACKET>::iterator DRAM_QUEUE::find(uint64_t address)
+{
+  auto found = addr_index.find(address >> LOG2_BLOCK_SIZE);
+  if (found == std::end(addr_index))
+    return std::end(entries);
+  return found->second;
+}
 
-struct next_schedule : public invalid_is_maximal<PACKET, min_event_cycle<PACKET>, PACKET, is_unscheduled, is_unscheduled> {
-};
+std::vector<PACKET>::iterator DRAM_QUEUE::insert(const PACKET& packet)
+{
+  assert(!full());
+  auto slot = free_slots.top();
+  free_slots.pop();
+
+  *slot = packet;
+  addr_index[packet.address >> LOG2_BLOCK_SIZE] = slot;
+  occupancy++;
+
+  return slot;
+}
+
+void DRAM_QUEUE::enqueue(std::size_t bank_idx, std::vector<PACKET>::iterator pkt, uint32_t row, uint64_t order)
+{
+  bank_queue[bank_idx].push_back({pkt, row, order});
+}
+
+void DRAM_QUEUE::release(std::vector<PACKET>::iterator pkt)
+{
+  addr_index.erase(pkt->address >> LOG2_BLOCK_SIZE);
+  *pkt = {};
+  free_slots.push(pkt);
+  occupancy--;
+}
 
 void MEMORY_CONTROLLER::operate()
 {
+  if (sched_type == sched_t::BLISS && current_cycle % BLISS_CLEARING_INTERVAL == 0) {
+    for (auto& channel : channels)
+      channel.blacklisted.fill(false);
+  }
+
   for (auto& channel : channels) {
     // Finish request
     if (channel.active_request != std::end(channel.bank_request) && channel.active_request->event_cycle <= current_cycle) {
@@ -24,13 +64,16 @@ void MEMORY_CONTROLLER::operate()
 
       channel.active_request->valid = false;
 
-      *channel.active_request->pkt = {};
+      if (channel.active_request->is_write)
+        channel.WQ.release(channel.active_request->pkt);
+      else
+        channel.RQ.release(channel.active_request->pkt);
       channel.active_request = std::end(channel.bank_request);
     }
 
     // Check queue occupancy
-    std::size_t wq_occu = std::count_if(std::begin(channel.WQ), std::end(channel.WQ), is_valid<PACKET>());
-    std::size_t rq_occu = std::count_if(std::begin(channel.RQ), std::end(channel.RQ), is_valid<PACKET>());
+    std::size_t wq_occu = channel.WQ.occupancy;
+    std::size_t rq_occu = channel.RQ.occupancy;
 
     // Change modes if the queues are unbalanced
     if ((!channel.write_mode && (wq_occu >= DRAM_WRITE_HIGH_WM || (rq_occu == 0 && wq_occu > 0)))
@@ -47,6 +90,10 @@ void MEMORY_CONTROLLER::operate()
           it->valid = false;
           it->pkt->scheduled = false;
           it->pkt->event_cycle = current_cycle;
+
+          // Put the packet back in line for its bank, as if it had just arrived
+          auto& queue = it->is_write ? channel.WQ : channel.RQ;
+          queue.enqueue(std::distance(std::begin(channel.bank_request), it), it->pkt, dram_get_row(it->pkt->address), channel.next_order++);
         }
       }
 
@@ -89,27 +136,115 @@ void MEMORY_CONTROLLER::operate()
     }
 
     // Look for queued packets that have not been scheduled
-    std::vector<PACKET>::iterator iter_next_schedule;
-    if (channel.write_mode)
-      iter_next_schedule = std::min_element(std::begin(channel.WQ), std::end(channel.WQ), next_schedule());
-    else
-      iter_next_schedule = std::min_element(std::begin(channel.RQ), std::end(channel.RQ), next_schedule());
+    schedule_request(channel);
+  }
+}
 
-    if (is_valid<PACKET>()(*iter_next_schedule) && iter_next_schedule->event_cycle <= current_cycle) {
-      uint32_t op_rank = dram_get_rank(iter_next_schedule->address), op_bank = dram_get_bank(iter_next_schedule->address),
-               op_row = dram_get_row(iter_next_schedule->address);
+void MEMORY_CONTROLLER::schedule_request(DRAM_CHANNEL& channel)
+{
+  auto& queue = channel.write_mode ? channel.WQ : channel.RQ;
+
+  if (sched_type == sched_t::FCFS) {
+    // The oldest packet in the queue is at the head of one of the bank queues. Packets that
+    // arrived in the same cycle are taken in slot order.
+    auto oldest = std::end(queue.bank_queue);
+    for (auto it = std::begin(queue.bank_queue); it != std::end(queue.bank_queue); ++it) {
+      if (!it->empty()
+          && (oldest == std::end(queue.bank_queue)
+              || std::tie(it->front().pkt->event_cycle, it->front().pkt) < std::tie(oldest->front().pkt->event_cycle, oldest->front().pkt)))
+        oldest = it;
+    }
 
-      auto op_idx = op_rank * DRAM_BANKS + op_bank;
+    if (oldest == std::end(queue.bank_queue) || oldest->front().pkt->event_cycle > current_cycle)
+      return;
 
-      if (!channel.bank_request[op_idx].valid) {
-        bool row_buffer_hit = (channel.bank_request[op_idx].open_row == op_row);
+    auto bank_idx = std::distance(std::begin(queue.bank_queue), oldest);
+    if (!channel.bank_request[bank_idx].valid)
+      issue_request(channel, bank_idx, std::begin(*oldest));
+    return;
+  }
 
-        // this bank is now busy
-        channel.bank_request[op_idx] = {true, row_buffer_hit, op_row, current_cycle + tCAS + (row_buffer_hit ? 0 : tRP + tRCD), iter_next_schedule};
+  // Only idle banks can take a request, so each bank offers at most one candidate
+  struct candidate {
+    std::size_t bank_idx;
+    std::list<BANK_QUEUE_ENTRY>::iterator entry;
+    bool row_buffer_hit, blacklisted;
+  };
+
+  bool found = false;
+  candidate best{};
+  for (std::size_t bank_idx = 0; bank_idx < std::size(channel.bank_request); ++bank_idx) {
+    auto& bank_queue = queue.bank_queue[bank_idx];
+    if (channel.bank_request[bank_idx].valid || bank_queue.empty())
+      continue;
+
+    auto open_row = channel.bank_request[bank_idx].open_row;
+    auto is_ready = [cycle = current_cycle](const BANK_QUEUE_ENTRY& x) { return x.pkt->event_cycle <= cycle; };
+
+    // Prefer the oldest row buffer hit in this bank
+    auto entry = std::find_if(std::begin(bank_queue), std::end(bank_queue), is_ready);
+    auto hit = std::find_if(entry, std::end(bank_queue), [&](const BANK_QUEUE_ENTRY& x) { return is_ready(x) && x.row == open_row; });
+    if (hit != std::end(bank_queue))
+      entry = hit;
+
+    if (entry == std::end(bank_queue))
+      continue;
+
+    candidate test{bank_idx, entry, entry->row == open_row, entry->pkt->cpu < NUM_CPUS && channel.blacklisted[entry->pkt->cpu]};
+    if (!found) {
+      best = test;
+      found = true;
+      continue;
+    }
 
-        iter_next_schedule->scheduled = true;
-        iter_next_schedule->event_cycle = std::numeric_limits<uint64_t>::max();
+    bool better;
+    switch (sched_type) {
+    case sched_t::BLISS:
+      if (test.blacklisted != best.blacklisted) {
+        better = best.blacklisted;
+        break;
       }
+      [[fallthrough]];
+    case sched_t::FRFCFS:
+      if (test.row_buffer_hit != best.row_buffer_hit) {
+        better = test.row_buffer_hit;
+        break;
+      }
+      [[fallthrough]];
+    default:
+      better = test.entry->order < best.entry->order;
+    }
+
+    if (better)
+      best = test;
+  }
+
+  if (found)
+    issue_request(channel, best.bank_idx, best.entry);
+}
+
+void MEMORY_CONTROLLER::issue_request(DRAM_CHANNEL& channel, std::size_t bank_idx, std::list<BANK_QUEUE_ENTRY>::iterator entry)
+{
+  auto& queue = channel.write_mode ? channel.WQ : channel.RQ;
+  auto pkt = entry->pkt;
+  auto op_row = entry->row;
+  queue.bank_queue[bank_idx].erase(entry);
+
+  // this bank is now busy
+  bool row_buffer_hit = (channel.bank_request[bank_idx].open_row == op_row);
+  channel.bank_request[bank_idx] = {true, row_buffer_hit, op_row, current_cycle + tCAS + (row_buffer_hit ? 0 : tRP + tRCD), pkt, channel.write_mode};
+
+  pkt->scheduled = true;
+  pkt->event_cycle = std::numeric_limits<uint64_t>::max();
+
+  // Blacklist cores that are served too many times in a row
+  if (sched_type == sched_t::BLISS && pkt->cpu < NUM_CPUS) {
+    if (pkt->cpu == channel.last_served_cpu) {
+      if (++channel.served_streak >= BLISS_BLACKLIST_THRESHOLD)
+        channel.blacklisted[pkt->cpu] = true;
+    } else {
+      channel.last_served_cpu = pkt->cpu;
+      channel.served_streak = 1;
     }
   }
 }
@@ -126,8 +261,8 @@ int MEMORY_CONTROLLER::add_rq(PACKET* packet)
   auto& channel = channels[dram_get_channel(packet->address)];
 
   // Check for forwarding
-  auto wq_it = std::find_if(std::begin(channel.WQ), std::end(channel.WQ), eq_addr<PACKET>(packet->address, LOG2_BLOCK_SIZE));
-  if (wq_it != std::end(channel.WQ)) {
+  auto wq_it = channel.WQ.find(packet->address);
+  if (wq_it != std::end(channel.WQ.entries)) {
     packet->data = wq_it->data;
     for (auto ret : packet->to_return)
       ret->return_data(packet);
@@ -136,24 +271,24 @@ int MEMORY_CONTROLLER::add_rq(PACKET* packet)
   }
 
   // Check for duplicates
-  auto rq_it = std::find_if(std::begin(channel.RQ), std::end(channel.RQ), eq_addr<PACKET>(packet->address, LOG2_BLOCK_SIZE));
-  if (rq_it != std::end(channel.RQ)) {
+  auto rq_it = channel.RQ.find(packet->address);
+  if (rq_it != std::end(channel.RQ.entries)) {
     packet_dep_merge(rq_it->lq_index_depend_on_me, packet->lq_index_depend_on_me);
     packet_dep_merge(rq_it->sq_index_depend_on_me, packet->sq_index_depend_on_me);
     packet_dep_merge(rq_it->instr_depend_on_me, packet->instr_depend_on_me);
     packet_dep_merge(rq_it->to_return, packet->to_return);
 
-    return std::distance(std::begin(channel.RQ), rq_it); // merged index
+    return std::distance(std::begin(channel.RQ.entries), rq_it); // merged index
   }
 
   // Find empty slot
-  rq_it = std::find_if_not(std::begin(channel.RQ), std::end(channel.RQ), is_valid<PACKET>());
-  if (rq_it == std::end(channel.RQ)) {
+  if (channel.RQ.full()) {
     return 0;
   }
 
-  *rq_it = *packet;
+  rq_it = channel.RQ.insert(*packet);
   rq_it->event_cycle = current_cycle;
+  channel.RQ.enqueue(dram_get_rank(packet->address) * DRAM_BANKS + dram_get_bank(packet->address), rq_it, dram_get_row(packet->address), channel.next_order++);
 
   return get_occupancy(1, packet->address);
 }
@@ -166,19 +301,19 @@ int MEMORY_CONTROLLER::add_wq(PACKET* packet)
   auto& channel = channels[dram_get_channel(packet->address)];
 
   // Check for duplicates
-  auto wq_it = std::find_if(std::begin(channel.WQ), std::end(channel.WQ), eq_addr<PACKET>(packet->address, LOG2_BLOCK_SIZE));
-  if (wq_it != std::end(channel.WQ))
+  auto wq_it = channel.WQ.find(packet->address);
+  if (wq_it != std::end(channel.WQ.entries))
     return 0;
 
   // search for the empty index
-  wq_it = std::find_if_not(std::begin(channel.WQ), std::end(channel.WQ), is_valid<PACKET>());
-  if (wq_it == std::end(channel.WQ)) {
+  if (channel.WQ.full()) {
     channel.WQ_FULL++;
     return -2;
   }
 
-  *wq_it = *packet;
+  wq_it = channel.WQ.insert(*packet);
   wq_it->event_cycle = current_cycle;
+  channel.WQ.enqueue(dram_get_rank(packet->address) * DRAM_BANKS + dram_get_bank(packet->address), wq_it, dram_get_row(packet->address), channel.next_order++);
 
   return get_occupancy(2, packet->address);
 }
@@ -224,9 +359,9 @@ uint32_t MEMORY_CONTROLLER::get_occupancy(uint8_t queue_type, uint64_t address)
 {
   uint32_t channel = dram_get_channel(address);
   if (queue_type == 1)
-    return std::count_if(std::begin(channels[channel].RQ), std::end(channels[channel].RQ), is_valid<PACKET>());
+    return channels[channel].RQ.occupancy;
   else if (queue_type == 2)
-    return std::count_if(std::begin(channels[channel].WQ), std::end(channels[channel].WQ), is_valid<PACKET>());
+    return channels[channel].WQ.occupancy;
   else if (queue_type == 3)
     return get_occupancy(1, address);
 
@@ -14,6 +14,9 @@
 #include "dram_controller.h"
 #include "ooo_cpu.h"
 #include "operable.h"
+#include "ptw.h"
+#include "runtime_config.h"
+#include "sweep.h"
 #include "tracereader.h"
 #include "vmem.h"
 
@@ -95,7 +98,7 @@ void print_roi_stats(uint32_t cpu, CACHE* cache)
 
     cout << cache->NAME;
     cout << " PREFETCH  REQUESTED: " << setw(10) << cache->pf_requested << "  ISSUED: " << setw(10) << cache->pf_issued;
-    cout << "  USEFUL: " << setw(10) << cache->pf_useful << "  USELESS: " << setw(10) << cache->pf_useless << endl;
+    cout << "  USEFUL: " << setw(10) << cache->pf_useful << "  USELESS: " << setw(10) << cache->pf_useless << "  LATE: " << setw(10) << cache->pf_late << endl;
 
     cout << cache->NAME;
     cout << " AVERAGE MISS LATENCY: " << (1.0 * (cache->total_miss_latency)) / TOTAL_MISS << " cycles" << endl;
@@ -188,6 +191,29 @@ void print_branch_stats()
     cout << "BRANCH_DIRECT_CALL: " << (1000.0 * ooo_cpu[i]->branch_type_misses[4] / (ooo_cpu[i]->num_retired - ooo_cpu[i]->begin_sim_instr)) << endl;
     cout << "BRANCH_INDIRECT_CALL: " << (1000.0 * ooo_cpu[i]->branch_type_misses[5] / (ooo_cpu[i]->num_retired - ooo_cpu[i]->begin_sim_instr)) << endl;
     cout << "BRANCH_RETURN: " << (1000.0 * ooo_cpu[i]->branch_type_misses[6] / (ooo_cpu[i]->num_retired - ooo_cpu[i]->begin_sim_instr)) << endl << endl;
+
+    cout << "Branch type target misses" << endl;
+    cout << "BRANCH_DIRECT_JUMP TARGET MISSES: " << ooo_cpu[i]->branch_type_target_misses[1] << endl;
+    cout << "BRANCH_INDIRECT TARGET MISSES: " << ooo_cpu[i]->branch_type_target_misses[2] << endl;
+    cout << "BRANCH_CONDITIONAL TARGET MISSES: " << ooo_cpu[i]->branch_type_target_misses[3] << endl;
+    cout << "BRANCH_DIRECT_CALL TARGET MISSES: " << ooo_cpu[i]->branch_type_target_misses[4] << endl;
+    cout << "BRANCH_INDIRECT_CALL TARGET MISSES: " << ooo_cpu[i]->branch_type_target_misses[5] << endl;
+    cout << "BRANCH_RETURN TARGET MISSES: " << ooo_cpu[i]->branch_type_target_misses[6] << endl << endl;
+
+    if (ooo_cpu[i]->DECOUPLED_FRONTEND) {
+      cout << "Decoupled front end FTQ size: " << ooo_cpu[i]->FTQ_SIZE << " FDIP prefetches issued: " << ooo_cpu[i]->fdip_issued;
+      cout << " BTB miss redirects: " << ooo_cpu[i]->btb_miss_redirects << endl << endl;
+    }
+
+    cout << "Branch mispredictions by address space (context switches: " << ooo_cpu[i]->context_switches << ")" << endl;
+    for (const auto& [asid, stats] : ooo_cpu[i]->asid_stats) {
+      if (stats.instrs == 0)
+        continue;
+      cout << "ASID " << hex << asid << dec << " invocations: " << stats.invocations << " instructions: " << stats.instrs << " branches: " << stats.branches;
+      cout << " mispredictions: " << stats.mispredictions << " cold: " << stats.cold_mispredictions << " warm: " << (stats.mispredictions - stats.cold_mispredictions);
+      cout << " MPKI: " << (stats.instrs == 0 ? 0 : 1000.0 * stats.mispredictions / stats.instrs) << endl;
+    }
+    cout << endl;
   }
 }
 
@@ -235,6 +261,52 @@ void print_dram_stats()
   }
 }
 
+void print_ptw_stats(PageTableWalker* ptw)
+{
+  cout << ptw->NAME << " PREFETCH  WALKS: " << setw(10) << ptw->prefetch_walks << "  MERGED: " << setw(10) << ptw->prefetch_merged << endl;
+
+  for (auto pscl : {&ptw->PSCL5, &ptw->PSCL4, &ptw->PSCL3, &ptw->PSCL2}) {
+    cout << ptw->NAME << " PSCL" << pscl->level + 1;
+    cout << " DEMAND    ACCESS: " << setw(10) << pscl->sim_access[0] << "  HIT: " << setw(10) << pscl->sim_hit[0];
+    cout << "  PREFETCH  ACCESS: " << setw(10) << pscl->sim_access[1] << "  HIT: " << setw(10) << pscl->sim_hit[1] << endl;
+  }
+}
+
+void print_partition_stats(CACHE* cache)
+{
+  const auto& partitioner = *cache->partitioner;
+  cout << cache->NAME << " PARTITIONS: " << partitioner.size() << "  REPARTITIONS: " << partitioner.repartitions << endl;
+
+  for (std::size_t i = 0; i < partitioner.size(); ++i) {
+    const auto& stats = partitioner.stats[i];
+    cout << cache->NAME << " PARTITION " << partitioner.name(i) << " WAYS: 0x" << hex << partitioner.way_mask(i) << dec;
+    cout << "  HIT: " << setw(10) << stats.hits << "  MISS: " << setw(10) << stats.misses;
+    cout << "  AVERAGE LINES: " << (partitioner.cycles == 0 ? 0 : 1.0 * stats.line_cycles / partitioner.cycles) << endl;
+    cout << cache->NAME << " PARTITION " << partitioner.name(i);
+    cout << " AVERAGE MISS LATENCY: " << (stats.latency_samples == 0 ? 0 : 1.0 * stats.total_miss_latency / stats.latency_samples) << " cycles";
+    cout << "  P99: " << partitioner.latency_percentile(i, 0.99) << " cycles  P99.9: " << partitioner.latency_percentile(i, 0.999) << " cycles" << endl;
+  }
+}
+
+void print_inclusion_stats(CACHE* cache)
+{
+  const std::string names[] = {"NON_INCLUSIVE", "INCLUSIVE", "EXCLUSIVE"};
+  cout << cache->NAME << " " << names[static_cast<int>(cache->inclusion)];
+  cout << "  BACK-INVALIDATIONS: " << setw(10) << cache->back_invalidations << "  DIRTY: " << setw(10) << cache->back_invalidations_dirty;
+  cout << "  CLEAN VICTIMS: " << setw(10) << cache->clean_victims << endl;
+
+  if (cache->snoop_filter) {
+    cout << cache->NAME << " SNOOP FILTER LOOKUPS: " << setw(10) << cache->snoop_filter->lookups << "  HIT: " << setw(10) << cache->snoop_filter->hits;
+    cout << "  EVICTIONS: " << setw(10) << cache->snoop_filter->evictions << endl;
+  }
+
+  double unique_lines = cache->capacity_samples == 0 ? 0 : 1.0 * cache->unique_line_samples / cache->capacity_samples;
+  double duplicate_lines = cache->capacity_samples == 0 ? 0 : 1.0 * cache->duplicate_line_samples / cache->capacity_samples;
+  cout << cache->NAME << " EFFECTIVE CAPACITY WITH THE CACHES ABOVE: " << unique_lines << " lines";
+  cout << " (" << unique_lines * (1ull << cache->OFFSET_BITS) / 1024 << " KiB)";
+  cout << "  DUPLICATED: " << duplicate_lines << " lines" << endl;
+}
+
 void reset_cache_stats(uint32_t cpu, CACHE* cache)
 {
   for (uint32_t i = 0; i < NUM_TYPES; i++) {
@@ -248,6 +320,7 @@ void reset_cache_stats(uint32_t cpu, CACHE* cache)
   cache->pf_useful = 0;
   cache->pf_useless = 0;
   cache->pf_fill = 0;
+  cache->pf_late = 0;
 
   cache->total_miss_latency = 0;
 
@@ -292,7 +365,16 @@ void finish_warmup()
     for (uint32_t j = 0; j < 8; j++) {
       ooo_cpu[i]->total_branch_types[j] = 0;
       ooo_cpu[i]->branch_type_misses[j] = 0;
+      ooo_cpu[i]->branch_type_target_misses[j] = 0;
     }
+    ooo_cpu[i]->context_switches = 0;
+    ooo_cpu[i]->fdip_issued = 0;
+    ooo_cpu[i]->btb_miss_redirects = 0;
+    for (auto& [asid, stats] : ooo_cpu[i]->asid_stats)
+      stats = {};
+    // The invocation in progress goes on into the region of interest
+    if (ooo_cpu[i]->address_space_known)
+      ooo_cpu[i]->asid_stats[ooo_cpu[i]->current_asid].invocations = 1;
 
     for (auto it = caches.rbegin(); it != caches.rend(); ++it)
       reset_cache_stats(i, *it);
@@ -335,11 +417,13 @@ int main(int argc, char** argv)
                                          {"hide_heartbeat", no_argument, 0, 'h'},
                                          {"cloudsuite", no_argument, 0, 'c'},
                                          {"bp_states", required_argument, 0, 's'},
+                                         {"config", required_argument, 0, 'f'},
                                          {"traces", no_argument, &traces_encountered, 1},
                                          {0, 0, 0, 0}};
 
+  std::vector<std::string> config_files;
   int c;
-  while ((c = getopt_long_only(argc, argv, "w:i:hcs:", long_options, NULL)) != -1 && !traces_encountered) {
+  while ((c = getopt_long_only(argc, argv, "w:i:hcs:f:", long_options, NULL)) != -1 && !traces_encountered) {
     switch (c) {
     case 'w':
       warmup_instructions = atol(optarg);
@@ -358,6 +442,9 @@ int main(int argc, char** argv)
       strcpy(bp_states_init_fname, optarg);
       printf("BP: %s\n", bp_states_init_fname);
       break;
+    case 'f':
+      config_files.push_back(optarg);
+      break;
     case 0:
       break;
     default:
@@ -365,6 +452,12 @@ int main(int argc, char** argv)
     }
   }
 
+  // One configuration replaces the compiled parameters, several are simulated side by side
+  if (std::size(config_files) == 1) {
+    champsim::configure_from_file(config_files.front());
+    std::cout << "Configuration: " << config_files.front() << std::endl;
+  }
+
   cout << "Warmup Instructions: " << warmup_instructions << endl;
   cout << "Simulation Instructions: " << simulation_instructions << endl;
   cout << "Number of CPUs: " << NUM_CPUS << endl;
@@ -380,7 +473,8 @@ int main(int argc, char** argv)
   std::cout << std::endl;
   std::cout << "VirtualMemory physical capacity: " << std::size(vmem.ppage_free_list) * vmem.page_size;
   std::cout << " num_ppages: " << std::size(vmem.ppage_free_list) << std::endl;
-  std::cout << "VirtualMemory page size: " << PAGE_SIZE << " log2_page_size: " << LOG2_PAGE_SIZE << std::endl;
+  std::cout << "VirtualMemory page size: " << PAGE_SIZE << " log2_page_size: " << LOG2_PAGE_SIZE;
+  std::cout << " largest page size: " << (1ull << vmem.shamt(vmem.max_leaf_level)) << std::endl;
 
   std::cout << std::endl;
   for (int i = optind; i < argc; i++) {
@@ -398,6 +492,9 @@ int main(int argc, char** argv)
     printf("\n*** Not enough traces for the configured number of cores ***\n\n");
     assert(0);
   }
+
+  if (std::size(config_files) > 1)
+    traces.front() = champsim::fork_sweep(config_files, traces.front());
   // end trace file setup
 
   // SHARED CACHE
@@ -405,6 +502,18 @@ int main(int argc, char** argv)
     cpu->initialize_core();
   }
 
+  // Link each cache to those directly above it, which its inclusion policy and snoop filter follow. The TLBs hold
+  // translations rather than lines, so they are left out.
+  for (CACHE* cache : caches) {
+    if (auto lower = dynamic_cast<CACHE*>(cache->lower_level); lower != nullptr && !cache->holds_translations()) {
+      cache->lower_cache = lower;
+      lower->upper_levels.push_back(cache);
+    }
+  }
+  for (CACHE* cache : caches)
+    for (CACHE* lower = cache->lower_cache; lower != nullptr; lower = lower->lower_cache)
+      cache->snoop_filter_below = cache->snoop_filter_below || lower->snoop_filter;
+
   for (auto it = caches.rbegin(); it != caches.rend(); ++it) {
     (*it)->impl_prefetcher_initialize();
     (*it)->impl_replacement_initialize();
@@ -534,12 +643,32 @@ int main(int argc, char** argv)
       print_roi_stats(i, *it);
   }
 
+  cout << endl;
+  for (auto op : operables)
+    if (auto ptw = dynamic_cast<PageTableWalker*>(op); ptw != nullptr)
+      print_ptw_stats(ptw);
+
+  for (auto it = caches.rbegin(); it != caches.rend(); ++it)
+    if ((*it)->partitioner)
+      print_partition_stats(*it);
+
+  for (auto it = caches.rbegin(); it != caches.rend(); ++it)
+    if (!(*it)->upper_levels.empty())
+      print_inclusion_stats(*it);
+
   for (auto it = caches.rbegin(); it != caches.rend(); ++it)
     (*it)->impl_prefetcher_final_stats();
 
   for (auto it = caches.rbegin(); it != caches.rend(); ++it)
     (*it)->impl_replacement_final_stats();
 
+  if (vmem.max_leaf_level > 0) {
+    std::cout << std::endl << "VirtualMemory pages mapped";
+    for (uint32_t level = 0; level <= vmem.max_leaf_level; ++level)
+      std::cout << " " << (1ull << (vmem.shamt(level) - 10)) << " KiB: " << vmem.mappings[level];
+    std::cout << " huge page fallbacks: " << vmem.huge_page_fallbacks << std::endl;
+  }
+
 #ifndef CRC2_COMPILE
   print_dram_stats();
   print_branch_stats();
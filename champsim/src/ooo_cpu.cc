@@ -6,15 +6,20 @@
 #include "cache.h"
 #include "champsim.h"
 #include "instruction.h"
+#include "vmem.h"
 
 #define DEADLOCK_CYCLE 1000000
 
+extern VirtualMemory vmem;
 extern uint8_t warmup_complete[NUM_CPUS];
 extern uint8_t MAX_INSTR_DESTINATIONS;
 
 void O3_CPU::operate()
 {
-  instrs_to_read_this_cycle = std::min((std::size_t)FETCH_WIDTH, IFETCH_BUFFER.size() - IFETCH_BUFFER.occupancy());
+  if (DECOUPLED_FRONTEND)
+    start_fetch_block();
+  else
+    instrs_to_read_this_cycle = std::min((std::size_t)FETCH_WIDTH, IFETCH_BUFFER.size() - IFETCH_BUFFER.occupancy());
 
   retire_rob();                    // retire
   complete_inflight_instruction(); // finalize execution
@@ -27,6 +32,10 @@ void O3_CPU::operate()
   dispatch_instruction();        // dispatch
   decode_instruction();          // decode
   promote_to_decode();
+  if (DECOUPLED_FRONTEND) {
+    fill_ifetch_buffer();
+    issue_fdip_prefetches();
+  }
   fetch_instruction(); // fetch
   translate_fetch();
   check_dib();
@@ -40,12 +49,52 @@ void O3_CPU::initialize_core()
   // BRANCH PREDICTOR & BTB
   impl_branch_predictor_initialize();
   impl_btb_initialize();
+
+  // Instruction prefetchers written as classes belong to the core, the others are initialized by the L1I
+  if (ipref_type == ipref_t::instance)
+    champsim::modules::initialize(ipref_module, ipref_selection, this);
+}
+
+// The kernel runs in the address space of the process that entered it, so only user code switches address space
+void O3_CPU::switch_address_space(uint16_t asid)
+{
+  if (address_space_known) {
+    if (bpred_type == bpred_t::instance)
+      bpred_switcher(bpred_module, bpred_selection, this, current_asid, asid);
+    if (btb_type == btb_t::instance)
+      btb_switcher(btb_module, btb_selection, this, current_asid, asid);
+    context_switches++;
+  }
+
+  current_asid = asid;
+  address_space_known = true;
+  asid_stats[asid].invocations++;
+  invocation_instrs = 0;
 }
 
 void O3_CPU::init_instruction(ooo_model_instr arch_instr)
 {
   instrs_to_read_this_cycle--;
 
+  uint16_t asid = arch_instr.asid[0] | (arch_instr.asid[1] << 8);
+  if (!address_space_known || (!arch_instr.is_kernel && asid != current_asid))
+    switch_address_space(asid);
+  champsim::modules::branch_context context{current_asid, arch_instr.is_kernel};
+  auto& address_space = asid_stats[current_asid];
+  address_space.instrs++;
+  invocation_instrs++;
+
+  if (ipref_type == ipref_t::instance) {
+    if (arch_instr.invocation.ends)
+      ipref_module->invocation_end();
+    if (arch_instr.invocation.begins)
+      ipref_module->invocation_begin(arch_instr.invocation.function_id);
+  }
+
+  for (const auto& mapping : arch_instr.guest_mappings)
+    if (mapping.log2_size > 0)
+      vmem.guest_page_size(cpu, mapping.vaddr, mapping.log2_size);
+
   arch_instr.instr_id = instr_unique_id;
 
   bool reads_sp = false;
@@ -206,15 +255,12 @@ void O3_CPU::init_instruction(ooo_model_instr arch_instr)
 
     num_branch++;
 
-    std::pair<uint64_t, uint8_t> btb_result = impl_btb_prediction(arch_instr.ip, arch_instr.branch_type);
+    address_space.branches++;
+
+    std::pair<uint64_t, uint8_t> btb_result = impl_btb_prediction(arch_instr.ip, arch_instr.branch_type, context);
     uint64_t predicted_branch_target = btb_result.first;
     uint8_t always_taken = btb_result.second;
-    // Changed by Kaifeng Xu
-    // uint8_t branch_prediction = impl_predict_branch(arch_instr.ip, predicted_branch_target, always_taken, arch_instr.branch_type);
-    uint64_t asid = arch_instr.asid[0] | (arch_instr.asid[1] << 8);
-    uint8_t branch_prediction = impl_predict_branch(arch_instr.ip, predicted_branch_target, always_taken, arch_instr.branch_type);
-    // printf("asid: %d\n", asid);
-    // End: Kaifeng Xu
+    uint8_t branch_prediction = impl_predict_branch(arch_instr.ip, predicted_branch_target, always_taken, arch_instr.branch_type, context);
     if ((branch_prediction == 0) && (always_taken == 0)) {
       predicted_branch_target = 0;
     }
@@ -222,6 +268,10 @@ void O3_CPU::init_instruction(ooo_model_instr arch_instr)
     // call code prefetcher every time the branch predictor is used
     impl_prefetcher_branch_operate(arch_instr.ip, arch_instr.branch_type, predicted_branch_target);
 
+    // Only direction mispredictions redirect the fetch. Target mispredictions are counted, to compare BTBs.
+    if (arch_instr.branch_taken && branch_prediction == arch_instr.branch_taken && predicted_branch_target != arch_instr.branch_target)
+      branch_type_target_misses[arch_instr.branch_type]++;
+
     // Changed by Kaifeng Xu
     // if (predicted_branch_target != arch_instr.branch_target) {
     if (branch_prediction != arch_instr.branch_taken) {
@@ -232,11 +282,24 @@ void O3_CPU::init_instruction(ooo_model_instr arch_instr)
       branch_mispredictions++;
       total_rob_occupancy_at_branch_mispredict += ROB.occupancy();
       branch_type_misses[arch_instr.branch_type]++;
+      address_space.mispredictions++;
+      if (invocation_instrs <= COLD_INSTRUCTIONS)
+        address_space.cold_mispredictions++;
       if (warmup_complete[cpu]) {
         fetch_stall = 1;
         instrs_to_read_this_cycle = 0;
         arch_instr.branch_mispredicted = 1;
       }
+    } else if (DECOUPLED_FRONTEND && arch_instr.branch_taken && predicted_branch_target != arch_instr.branch_target) {
+      // A decoupled front end follows the BTB, so a taken branch without the right target sends it down the wrong path until decode or
+      // execute redirects it
+      btb_miss_redirects++;
+      if (warmup_complete[cpu]) {
+        fetch_stall = 1;
+        instrs_to_read_this_cycle = 0;
+        arch_instr.branch_mispredicted = 1;
+        arch_instr.is_btb_miss = 1;
+      }
     } else {
       // if correctly predicted taken, then we can't fetch anymore instructions
       // this cycle
@@ -245,8 +308,8 @@ void O3_CPU::init_instruction(ooo_model_instr arch_instr)
       }
     }
 
-    impl_update_btb(arch_instr.ip, arch_instr.branch_target, arch_instr.branch_taken, arch_instr.branch_type);
-    impl_last_branch_result(arch_instr.ip, arch_instr.branch_target, arch_instr.branch_taken, arch_instr.branch_type);
+    impl_update_btb(arch_instr.ip, arch_instr.branch_target, arch_instr.branch_taken, arch_instr.branch_type, context);
+    impl_last_branch_result(arch_instr.ip, arch_instr.branch_target, arch_instr.branch_taken, arch_instr.branch_type, context);
   }
 
   arch_instr.event_cycle = current_cycle;
@@ -263,12 +326,57 @@ void O3_CPU::init_instruction(ooo_model_instr arch_instr)
     arch_instr.num_reg_ops = 0;
   }
 
-  // Add to IFETCH_BUFFER
-  IFETCH_BUFFER.push_back(arch_instr);
+  if (DECOUPLED_FRONTEND) {
+    // Add to the fetch block being predicted, and prefetch each cache line it enters
+    uint64_t line = arch_instr.ip >> LOG2_BLOCK_SIZE;
+    if (line != fdip_last_line && std::size(fdip_pending) < FTQ_SIZE)
+      fdip_pending.push_back(line << LOG2_BLOCK_SIZE);
+    fdip_last_line = line;
+
+    FTQ.push_back(arch_instr);
+    ftq_block_sizes.back()++;
+  } else {
+    // Add to IFETCH_BUFFER
+    IFETCH_BUFFER.push_back(arch_instr);
+  }
 
   instr_unique_id++;
 }
 
+// The branch prediction unit predicts one fetch block per cycle, while the fetch target queue has room for it.
+// The block ends at the first branch predicted taken, or after FETCH_WIDTH instructions.
+void O3_CPU::start_fetch_block()
+{
+  if (!std::empty(ftq_block_sizes) && ftq_block_sizes.back() == 0)
+    ftq_block_sizes.pop_back();
+
+  instrs_to_read_this_cycle = 0;
+  if (std::size(ftq_block_sizes) < FTQ_SIZE) {
+    ftq_block_sizes.push_back(0);
+    instrs_to_read_this_cycle = FETCH_WIDTH;
+  }
+}
+
+void O3_CPU::fill_ifetch_buffer()
+{
+  for (unsigned i = 0; i < FETCH_WIDTH && !std::empty(FTQ) && !IFETCH_BUFFER.full(); ++i) {
+    IFETCH_BUFFER.push_back(FTQ.front());
+    FTQ.pop_front();
+
+    if (--ftq_block_sizes.front() == 0)
+      ftq_block_sizes.pop_front();
+  }
+}
+
+void O3_CPU::issue_fdip_prefetches()
+{
+  while (!std::empty(fdip_pending) && prefetch_code_line(fdip_pending.front())) {
+    fdip_pending.pop_front();
+    if (warmup_complete[cpu])
+      fdip_issued++;
+  }
+}
+
 void O3_CPU::check_dib()
 {
   // scan through IFETCH_BUFFER to find instructions that hit in the decoded
@@ -328,8 +436,9 @@ void O3_CPU::do_translate_fetch(champsim::circular_buffer<ooo_model_instr>::iter
   trace_packet.instr_id = begin->instr_id;
   trace_packet.ip = begin->ip;
   trace_packet.type = LOAD;
-  trace_packet.asid[0] = 0;
-  trace_packet.asid[1] = 0;
+  trace_packet.asid[0] = begin->asid[0];
+  trace_packet.asid[1] = begin->asid[1];
+  trace_packet.is_kernel = begin->is_kernel;
   trace_packet.to_return = {&ITLB_bus};
   for (; begin != end; ++begin)
     trace_packet.instr_depend_on_me.push_back(begin);
@@ -382,8 +491,9 @@ void O3_CPU::do_fetch_instruction(champsim::circular_buffer<ooo_model_instr>::it
   fetch_packet.instr_id = begin->instr_id;
   fetch_packet.ip = begin->ip;
   fetch_packet.type = LOAD;
-  fetch_packet.asid[0] = 0;
-  fetch_packet.asid[1] = 0;
+  fetch_packet.asid[0] = begin->asid[0];
+  fetch_packet.asid[1] = begin->asid[1];
+  fetch_packet.is_kernel = begin->is_kernel;
   fetch_packet.to_return = {&L1I_bus};
   for (; begin != end; ++begin)
     fetch_packet.instr_depend_on_me.push_back(begin);
@@ -429,8 +539,9 @@ void O3_CPU::decode_instruction()
 
     // Resume fetch
     if (db_entry.branch_mispredicted) {
-      // These branches detect the misprediction at decode
-      if ((db_entry.branch_type == BRANCH_DIRECT_JUMP) || (db_entry.branch_type == BRANCH_DIRECT_CALL)) {
+      // These branches detect the misprediction at decode, as do conditional branches that were predicted taken but missed in the BTB
+      if ((db_entry.branch_type == BRANCH_DIRECT_JUMP) || (db_entry.branch_type == BRANCH_DIRECT_CALL)
+          || (db_entry.is_btb_miss && db_entry.branch_type == BRANCH_CONDITIONAL)) {
         // clear the branch_mispredicted bit so we don't attempt to resume fetch
         // again at execute
         db_entry.branch_mispredicted = 0;
@@ -491,6 +602,13 @@ void O3_CPU::dispatch_instruction()
     // Add to ROB
     ROB.push_back(DISPATCH_BUFFER.front());
     DISPATCH_BUFFER.pop_front();
+
+    // Index the stores so that later loads can find them
+    auto rob_it = std::prev(std::end(ROB));
+    for (uint32_t i = 0; i < MAX_INSTR_DESTINATIONS; i++) {
+      if (rob_it->destination_memory[i])
+        inflight_stores.insert(rob_it->destination_memory[i], rob_it->instr_id, rob_it);
+    }
     available_dispatch_bandwidth--;
   }
 
@@ -610,13 +728,13 @@ void O3_CPU::do_memory_scheduling(champsim::circular_buffer<ooo_model_instr>::it
       num_mem_ops++;
       if (rob_it->source_added[i])
         num_added++;
-      else if (!std::all_of(std::begin(LQ), std::end(LQ), is_valid<LSQ_ENTRY>())) {
+      else if (!LQ_free.empty()) {
         add_load_queue(rob_it, i);
         num_added++;
       } else {
         DP(if (warmup_complete[cpu]) {
           cout << "[LQ] " << __func__ << " instr_id: " << rob_it->instr_id;
-          cout << " cannot be added in the load queue occupancy: " << std::count_if(std::begin(LQ), std::end(LQ), is_valid<LSQ_ENTRY>())
+          cout << " cannot be added in the load queue occupancy: " << std::size(LQ) - LQ_free.size()
                << " cycle: " << current_cycle << endl;
         });
       }
@@ -629,7 +747,7 @@ void O3_CPU::do_memory_scheduling(champsim::circular_buffer<ooo_model_instr>::it
       num_mem_ops++;
       if (rob_it->destination_added[i])
         num_added++;
-      else if (!std::all_of(std::begin(SQ), std::end(SQ), is_valid<LSQ_ENTRY>())) {
+      else if (!SQ_free.empty()) {
         if (STA.front() == rob_it->instr_id) {
           add_store_queue(rob_it, i);
           num_added++;
@@ -637,7 +755,7 @@ void O3_CPU::do_memory_scheduling(champsim::circular_buffer<ooo_model_instr>::it
       } else {
         DP(if (warmup_complete[cpu]) {
           cout << "[SQ] " << __func__ << " instr_id: " << rob_it->instr_id;
-          cout << " cannot be added in the store queue occupancy: " << std::count_if(std::begin(SQ), std::end(SQ), is_valid<LSQ_ENTRY>())
+          cout << " cannot be added in the store queue occupancy: " << std::size(SQ) - SQ_free.size()
                << " cycle: " << current_cycle << endl;
         });
       }
@@ -677,35 +795,35 @@ void O3_CPU::do_sq_forward_to_lq(LSQ_ENTRY& sq_entry, LSQ_ENTRY& lq_entry)
     cout << sq_entry.instr_id << " remain_num_ops: " << lq_entry.rob_index->num_mem_ops << " cycle: " << current_cycle << endl;
   });
 
+  release_lq_entry(std::next(std::begin(LQ), std::distance(LQ.data(), &lq_entry)));
+}
+
+void O3_CPU::release_lq_entry(std::vector<LSQ_ENTRY>::iterator lq_it)
+{
+  if (!is_valid<LSQ_ENTRY>{}(*lq_it))
+    return;
+
   LSQ_ENTRY empty_entry;
-  lq_entry = empty_entry;
+  *lq_it = empty_entry;
+  LQ_free.push(lq_it);
 }
 
-struct instr_mem_will_produce {
-  const uint64_t match_mem;
-  explicit instr_mem_will_produce(uint64_t mem) : match_mem(mem) {}
-  bool operator()(const ooo_model_instr& test) const
-  {
-    auto dmem_begin = std::begin(test.destination_memory);
-    auto dmem_end = std::end(test.destination_memory);
-    return std::find(dmem_begin, dmem_end, match_mem) != dmem_end;
-  }
-};
+void O3_CPU::release_sq_entry(std::vector<LSQ_ENTRY>::iterator sq_it)
+{
+  if (!is_valid<LSQ_ENTRY>{}(*sq_it))
+    return;
 
-struct sq_will_forward {
-  const uint64_t match_id, match_addr;
-  sq_will_forward(uint64_t id, uint64_t addr) : match_id(id), match_addr(addr) {}
-  bool operator()(const LSQ_ENTRY& sq_test) const
-  {
-    return sq_test.fetched == COMPLETED && sq_test.instr_id == match_id && sq_test.virtual_address == match_addr;
-  }
-};
+  LSQ_ENTRY empty_entry;
+  *sq_it = empty_entry;
+  SQ_free.push(sq_it);
+}
 
 void O3_CPU::add_load_queue(champsim::circular_buffer<ooo_model_instr>::iterator rob_it, uint32_t data_index)
 {
-  // search for an empty slot
-  auto lq_it = std::find_if_not(std::begin(LQ), std::end(LQ), is_valid<LSQ_ENTRY>());
-  assert(lq_it != std::end(LQ));
+  // take an empty slot
+  assert(!LQ_free.empty());
+  auto lq_it = LQ_free.top();
+  LQ_free.pop();
 
   // add it to the load queue
   rob_it->lq_index[data_index] = lq_it;
@@ -716,22 +834,29 @@ void O3_CPU::add_load_queue(champsim::circular_buffer<ooo_model_instr>::iterator
   lq_it->rob_index = rob_it;
   lq_it->asid[0] = rob_it->asid[0];
   lq_it->asid[1] = rob_it->asid[1];
+  lq_it->is_kernel = rob_it->is_kernel;
   lq_it->event_cycle = current_cycle + SCHEDULING_LATENCY;
 
   // Mark RAW in the ROB since the producer might not be added in the store
-  // queue yet
-  champsim::circular_buffer<ooo_model_instr>::reverse_iterator prior_it{rob_it};
-  prior_it = std::find_if(prior_it, ROB.rend(), instr_mem_will_produce(lq_it->virtual_address));
-  if (prior_it != ROB.rend()) {
+  // queue yet. The youngest older store to this address is the producer.
+  auto prior_it = inflight_stores.youngest_before(lq_it->virtual_address, rob_it->instr_id, std::end(ROB));
+
+  if (prior_it != std::end(ROB)) {
     // this load cannot be executed until the prior store gets executed
     prior_it->memory_instrs_depend_on_me.push_back(rob_it);
     lq_it->producer_id = prior_it->instr_id;
     lq_it->translated = INFLIGHT;
 
     // Is this already in the SQ?
-    auto sq_it = std::find_if(std::begin(SQ), std::end(SQ), sq_will_forward(prior_it->instr_id, lq_it->virtual_address));
-    if (sq_it != std::end(SQ))
-      do_sq_forward_to_lq(*sq_it, *lq_it);
+    for (uint32_t i = 0; i < MAX_INSTR_DESTINATIONS; i++) {
+      if (prior_it->destination_memory[i] == lq_it->virtual_address && prior_it->destination_added[i]) {
+        auto sq_it = prior_it->sq_index[i];
+        if (sq_it->fetched == COMPLETED) {
+          do_sq_forward_to_lq(*sq_it, *lq_it);
+          break;
+        }
+      }
+    }
   } else {
     // If this entry is not waiting on RAW
     RTL0.push(lq_it);
@@ -740,7 +865,9 @@ void O3_CPU::add_load_queue(champsim::circular_buffer<ooo_model_instr>::iterator
 
 void O3_CPU::add_store_queue(champsim::circular_buffer<ooo_model_instr>::iterator rob_it, uint32_t data_index)
 {
-  auto sq_it = std::find_if_not(std::begin(SQ), std::end(SQ), is_valid<LSQ_ENTRY>());
+  assert(!SQ_free.empty());
+  auto sq_it = SQ_free.top();
+  SQ_free.pop();
   assert(sq_it->virtual_address == 0);
 
   // add it to the store queue
@@ -751,6 +878,7 @@ void O3_CPU::add_store_queue(champsim::circular_buffer<ooo_model_instr>::iterato
   sq_it->rob_index = rob_it;
   sq_it->asid[0] = rob_it->asid[0];
   sq_it->asid[1] = rob_it->asid[1];
+  sq_it->is_kernel = rob_it->is_kernel;
   sq_it->event_cycle = current_cycle + SCHEDULING_LATENCY;
 
   // succesfully added to the store queue
@@ -827,6 +955,7 @@ int O3_CPU::do_translate_store(std::vector<LSQ_ENTRY>::iterator sq_it)
   data_packet.type = RFO;
   data_packet.asid[0] = sq_it->asid[0];
   data_packet.asid[1] = sq_it->asid[1];
+  data_packet.is_kernel = sq_it->is_kernel;
   data_packet.to_return = {&DTLB_bus};
   data_packet.sq_index_depend_on_me = {sq_it};
 
@@ -890,6 +1019,7 @@ int O3_CPU::do_translate_load(std::vector<LSQ_ENTRY>::iterator lq_it)
   data_packet.type = LOAD;
   data_packet.asid[0] = lq_it->asid[0];
   data_packet.asid[1] = lq_it->asid[1];
+  data_packet.is_kernel = lq_it->is_kernel;
   data_packet.to_return = {&DTLB_bus};
   data_packet.lq_index_depend_on_me = {lq_it};
 
@@ -918,6 +1048,7 @@ int O3_CPU::execute_load(std::vector<LSQ_ENTRY>::iterator lq_it)
   data_packet.type = LOAD;
   data_packet.asid[0] = lq_it->asid[0];
   data_packet.asid[1] = lq_it->asid[1];
+  data_packet.is_kernel = lq_it->is_kernel;
   data_packet.to_return = {&L1D_bus};
   data_packet.lq_index_depend_on_me = {lq_it};
 
@@ -1093,8 +1224,7 @@ void O3_CPU::handle_memory_return()
       if (merged->rob_index->num_mem_ops == 0)
         inflight_mem_executions++;
 
-      LSQ_ENTRY empty_entry;
-      *merged = empty_entry;
+      release_lq_entry(merged);
     }
 
     // remove this entry
@@ -1126,12 +1256,14 @@ void O3_CPU::retire_rob()
         data_packet.type = RFO;
         data_packet.asid[0] = sq_it->asid[0];
         data_packet.asid[1] = sq_it->asid[1];
+        data_packet.is_kernel = sq_it->is_kernel;
 
         auto result = L1D_bus.lower_level->add_wq(&data_packet);
         if (result != -2) {
+          inflight_stores.erase(ROB.front().destination_memory[i], ROB.front().instr_id);
+
           ROB.front().destination_memory[i] = 0;
-          LSQ_ENTRY empty;
-          *sq_it = empty;
+          release_sq_entry(sq_it);
         } else {
           return;
         }
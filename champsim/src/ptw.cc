@@ -8,9 +8,10 @@ extern VirtualMemory vmem;
 extern uint8_t warmup_complete[NUM_CPUS];
 
 PageTableWalker::PageTableWalker(string v1, uint32_t cpu, unsigned fill_level, uint32_t v2, uint32_t v3, uint32_t v4, uint32_t v5, uint32_t v6, uint32_t v7,
-                                 uint32_t v8, uint32_t v9, uint32_t v10, uint32_t v11, uint32_t v12, uint32_t v13, unsigned latency, MemoryRequestConsumer* ll)
+                                 uint32_t v8, uint32_t v9, uint32_t v10, uint32_t pq_size, uint32_t v11, uint32_t v12, uint32_t v13, unsigned latency,
+                                 MemoryRequestConsumer* ll)
     : champsim::operable(1), MemoryRequestConsumer(fill_level), MemoryRequestProducer(ll), NAME(v1), cpu(cpu), MSHR_SIZE(v11), MAX_READ(v12),
-      MAX_FILL(v13), RQ{v10, latency}, PSCL5{"PSCL5", 4, v2, v3}, // Translation from L5->L4
+      MAX_FILL(v13), RQ{v10, latency}, PQ{pq_size, latency}, PSCL5{"PSCL5", 4, v2, v3}, // Translation from L5->L4
       PSCL4{"PSCL4", 3, v4, v5},                                  // Translation from L5->L3
       PSCL3{"PSCL3", 2, v6, v7},                                  // Translation from L5->L2
       PSCL2{"PSCL2", 1, v8, v9},                                  // Translation from L5->L1
@@ -22,60 +23,86 @@ void PageTableWalker::handle_read()
 {
   int reads_this_cycle = MAX_READ;
 
-  while (reads_this_cycle > 0 && RQ.has_ready() && std::size(MSHR) != MSHR_SIZE) {
-    PACKET& handle_pkt = RQ.front();
-
-    DP(if (warmup_complete[packet->cpu]) {
-      std::cout << "[" << NAME << "] " << __func__ << " instr_id: " << handle_pkt.instr_id;
-      std::cout << " address: " << std::hex << (handle_pkt.address >> LOG2_PAGE_SIZE) << " full_addr: " << handle_pkt.address;
-      std::cout << " full_v_addr: " << handle_pkt.v_address;
-      std::cout << " data: " << handle_pkt.data << std::dec;
-      std::cout << " translation_level: " << +handle_pkt.translation_level;
-      std::cout << " event: " << handle_pkt.event_cycle << " current: " << current_cycle << std::endl;
-    });
-
-    auto ptw_addr = splice_bits(CR3_addr, vmem.get_offset(handle_pkt.address, vmem.pt_levels - 1) * PTE_BYTES, LOG2_PAGE_SIZE);
-    auto ptw_level = vmem.pt_levels - 1;
-    for (auto pscl : {&PSCL5, &PSCL4, &PSCL3, &PSCL2}) {
-      if (auto check_addr = pscl->check_hit(handle_pkt.address); check_addr.has_value()) {
-        ptw_addr = check_addr.value();
-        ptw_level = pscl->level - 1;
-      }
-    }
-
-    PACKET packet = handle_pkt;
-    packet.fill_level = lower_level->fill_level; // This packet will be sent from L1 to PTW.
-    packet.address = ptw_addr;
-    packet.v_address = handle_pkt.address;
-    packet.cpu = cpu;
-    packet.type = TRANSLATION;
-    packet.init_translation_level = ptw_level;
-    packet.translation_level = packet.init_translation_level;
-    packet.to_return = {this};
-
-    int rq_index = lower_level->add_rq(&packet);
-    if (rq_index == -2)
+  // Walks start in the order they were asked for, and demand walks first among those asked for in one cycle.
+  // A demand request may be waiting on a prefetch walk of its page, merged into the prefetch in the TLB above.
+  while (reads_this_cycle > 0 && (RQ.has_ready() || PQ.has_ready()) && std::size(MSHR) != MSHR_SIZE) {
+    bool prefetch = !RQ.has_ready() || (PQ.has_ready() && PQ.front().cycle_enqueued < RQ.front().cycle_enqueued);
+    auto& queue = prefetch ? PQ : RQ;
+    if (!start_walk(queue.front()))
       return;
 
-    packet.to_return = handle_pkt.to_return; // Set the return for MSHR packet same as read packet.
-    packet.type = handle_pkt.type;
-
-    auto it = MSHR.insert(std::end(MSHR), packet);
-    it->cycle_enqueued = current_cycle;
-    it->event_cycle = std::numeric_limits<uint64_t>::max();
+    if (prefetch && warmup_complete[cpu])
+      prefetch_walks++;
 
-    RQ.pop_front();
+    queue.pop_front();
     reads_this_cycle--;
   }
 }
 
+// Issues the first read of the walk of handle_pkt, and returns false if the lower level cannot take it
+bool PageTableWalker::start_walk(PACKET& handle_pkt)
+{
+  DP(if (warmup_complete[packet->cpu]) {
+    std::cout << "[" << NAME << "] " << __func__ << " instr_id: " << handle_pkt.instr_id;
+    std::cout << " address: " << std::hex << (handle_pkt.address >> LOG2_PAGE_SIZE) << " full_addr: " << handle_pkt.address;
+    std::cout << " full_v_addr: " << handle_pkt.v_address;
+    std::cout << " data: " << handle_pkt.data << std::dec;
+    std::cout << " translation_level: " << +handle_pkt.translation_level;
+    std::cout << " event: " << handle_pkt.event_cycle << " current: " << current_cycle << std::endl;
+  });
+
+  auto ptw_addr = splice_bits(CR3_addr, vmem.get_offset(handle_pkt.address, vmem.pt_levels - 1) * PTE_BYTES, LOG2_PAGE_SIZE);
+  auto ptw_level = vmem.pt_levels - 1;
+  auto leaf_level = vmem.leaf_level(cpu, handle_pkt.address);
+  bool is_prefetch = (handle_pkt.type == PREFETCH);
+  for (auto pscl : {&PSCL5, &PSCL4, &PSCL3, &PSCL2}) {
+    // The walk of a huge page ends at a higher level, so the caches of the levels below it do not apply
+    if (pscl->level <= leaf_level)
+      continue;
+
+    auto check_addr = pscl->check_hit(handle_pkt.address);
+    if (warmup_complete[cpu]) {
+      pscl->sim_access[is_prefetch]++;
+      pscl->sim_hit[is_prefetch] += check_addr.has_value();
+    }
+
+    if (check_addr.has_value()) {
+      ptw_addr = check_addr.value();
+      ptw_level = pscl->level - 1;
+    }
+  }
+
+  PACKET packet = handle_pkt;
+  packet.fill_level = lower_level->fill_level; // This packet will be sent from L1 to PTW.
+  packet.address = ptw_addr;
+  packet.v_address = handle_pkt.address;
+  packet.cpu = cpu;
+  packet.type = TRANSLATION;
+  packet.init_translation_level = ptw_level;
+  packet.translation_level = packet.init_translation_level;
+  packet.to_return = {this};
+
+  int rq_index = lower_level->add_rq(&packet);
+  if (rq_index == -2)
+    return false;
+
+  packet.to_return = handle_pkt.to_return; // Set the return for MSHR packet same as read packet.
+  packet.type = handle_pkt.type;
+
+  auto it = MSHR.insert(std::end(MSHR), packet);
+  it->cycle_enqueued = current_cycle;
+  it->event_cycle = std::numeric_limits<uint64_t>::max();
+
+  return true;
+}
+
 void PageTableWalker::handle_fill()
 {
   int fill_this_cycle = MAX_FILL;
 
   while (fill_this_cycle > 0 && !std::empty(MSHR) && MSHR.front().event_cycle <= current_cycle) {
     auto fill_mshr = MSHR.begin();
-    if (fill_mshr->translation_level == 0) // If translation complete
+    if (fill_mshr->translation_level <= vmem.leaf_level(cpu, fill_mshr->v_address)) // If translation complete
     {
       // Return the translated physical address to STLB. Does not contain last
       // 12 bits
@@ -115,7 +142,7 @@ void PageTableWalker::handle_fill()
           PSCL5.fill_cache(addr, fill_mshr->v_address);
         if (fill_mshr->translation_level == PSCL4.level)
           PSCL4.fill_cache(addr, fill_mshr->v_address);
-        if (fill_mshr->translation_level == PSCL2.level)
+        if (fill_mshr->translation_level == PSCL3.level)
           PSCL3.fill_cache(addr, fill_mshr->v_address);
         if (fill_mshr->translation_level == PSCL2.level)
           PSCL2.fill_cache(addr, fill_mshr->v_address);
@@ -157,6 +184,7 @@ void PageTableWalker::operate()
   handle_fill();
   handle_read();
   RQ.operate();
+  PQ.operate();
 }
 
 int PageTableWalker::add_rq(PACKET* packet)
@@ -174,10 +202,34 @@ int PageTableWalker::add_rq(PACKET* packet)
 
   // if there is no duplicate, add it to RQ
   RQ.push_back(*packet);
+  RQ.back().cycle_enqueued = current_cycle;
 
   return RQ.occupancy();
 }
 
+int PageTableWalker::add_pq(PACKET* packet)
+{
+  assert(packet->address != 0);
+
+  // Prefetches reach here only for pages that are mapped, so that their walks do not fault.
+  // A prefetch of a page already waiting to be walked is merged into it.
+  auto found = std::find_if(PQ.begin(), PQ.end(), eq_addr<PACKET>(packet->address, LOG2_PAGE_SIZE));
+  if (found != PQ.end()) {
+    packet_dep_merge(found->to_return, packet->to_return);
+    if (warmup_complete[cpu])
+      prefetch_merged++;
+    return 0;
+  }
+
+  if (PQ.full())
+    return -2;
+
+  PQ.push_back(*packet);
+  PQ.back().cycle_enqueued = current_cycle;
+
+  return PQ.occupancy();
+}
+
 void PageTableWalker::return_data(PACKET* packet)
 {
   for (auto& mshr_entry : MSHR) {
@@ -205,6 +257,8 @@ uint32_t PageTableWalker::get_occupancy(uint8_t queue_type, uint64_t address)
     return std::count_if(MSHR.begin(), MSHR.end(), is_valid<PACKET>());
   else if (queue_type == 1)
     return RQ.occupancy();
+  else if (queue_type == 3)
+    return PQ.occupancy();
   return 0;
 }
 
@@ -214,6 +268,8 @@ uint32_t PageTableWalker::get_size(uint8_t queue_type, uint64_t address)
     return MSHR_SIZE;
   else if (queue_type == 1)
     return RQ.size();
+  else if (queue_type == 3)
+    return PQ.size();
   return 0;
 }
 
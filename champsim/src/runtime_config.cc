@@ -0,0 +1,356 @@
+#include "runtime_config.h"
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+
+#include "champsim_constants.h"
+#include "dram_controller.h"
+#include "json.hpp"
+#include "modules.h"
+#include "ptw.h"
+
+extern MEMORY_CONTROLLER DRAM;
+extern std::array<O3_CPU*, NUM_CPUS> ooo_cpu;
+extern std::array<CACHE*, NUM_CACHES> caches;
+extern std::array<champsim::operable*, NUM_OPERABLES> operables;
+
+namespace
+{
+// The components built from the last configuration file. The compiled ones that they replace are static, and stay idle.
+std::vector<std::unique_ptr<O3_CPU>> built_cores;
+std::vector<std::unique_ptr<CACHE>> built_caches;
+std::vector<std::unique_ptr<PageTableWalker>> built_ptws;
+
+template <typename T>
+void override_number(const champsim::json_value& layer, const std::string& key, T& field)
+{
+  if (layer.contains(key))
+    field = static_cast<T>(layer.at(key).as_number());
+}
+
+void override_bool(const champsim::json_value& layer, const std::string& key, bool& field)
+{
+  if (layer.contains(key))
+    field = layer.at(key).as_bool();
+}
+
+// Parameters of a module are dropped when another module is selected, unless they are given with it
+void override_module(const champsim::json_value& layer, const std::string& key, std::string& name, champsim::json_value& params)
+{
+  if (layer.contains(key)) {
+    name = layer.at(key).as_string();
+    params = {};
+  }
+  if (layer.contains(key + "_params"))
+    params = layer.at(key + "_params");
+}
+
+unsigned prefetch_activate_mask(const std::string& types)
+{
+  const std::array<std::string, NUM_TYPES> type_names = {"LOAD", "RFO", "PREFETCH", "WRITEBACK", "TRANSLATION"};
+
+  unsigned mask = 0;
+  std::size_t begin = 0;
+  while (begin <= std::size(types)) {
+    auto end = std::min(types.find(',', begin), std::size(types));
+    auto found = std::find(std::begin(type_names), std::end(type_names), types.substr(begin, end - begin));
+    if (found != std::end(type_names))
+      mask |= 1u << std::distance(std::begin(type_names), found);
+    begin = end + 1;
+  }
+
+  return mask;
+}
+
+void apply_cache_layer(const champsim::json_value& layer, champsim::cache_params& params)
+{
+  if (!layer.is_object())
+    return;
+
+  override_number(layer, "sets", params.sets);
+  override_number(layer, "ways", params.ways);
+  override_number(layer, "rq_size", params.rq_size);
+  override_number(layer, "wq_size", params.wq_size);
+  override_number(layer, "pq_size", params.pq_size);
+  override_number(layer, "mshr_size", params.mshr_size);
+  override_number(layer, "fill_latency", params.fill_latency);
+  override_number(layer, "max_read", params.max_read);
+  override_number(layer, "max_write", params.max_write);
+  override_number(layer, "huge_page_sets", params.huge_page_sets);
+  override_bool(layer, "prefetch_as_load", params.prefetch_as_load);
+  override_bool(layer, "virtual_prefetch", params.virtual_prefetch);
+  override_bool(layer, "wq_check_full_addr", params.wq_check_full_addr);
+  override_module(layer, "prefetcher", params.prefetcher, params.prefetcher_params);
+  override_module(layer, "replacement", params.replacement, params.replacement_params);
+  if (layer.contains("partition"))
+    params.partition = layer.at("partition");
+  if (layer.contains("inclusion"))
+    params.inclusion = layer.at("inclusion").as_string();
+  if (layer.contains("snoop_filter"))
+    params.snoop_filter = layer.at("snoop_filter");
+
+  // As in config.sh, the total latency includes the fill latency
+  if (layer.contains("hit_latency"))
+    override_number(layer, "hit_latency", params.hit_latency);
+  else if (layer.contains("latency"))
+    params.hit_latency = static_cast<uint32_t>(layer.at("latency").as_number()) - params.fill_latency;
+
+  if (layer.contains("prefetch_activate"))
+    params.prefetch_activate_mask = prefetch_activate_mask(layer.at("prefetch_activate").as_string());
+}
+
+void apply_cpu_layer(const champsim::json_value& layer, champsim::cpu_params& params)
+{
+  if (!layer.is_object())
+    return;
+
+  override_number(layer, "ifetch_buffer_size", params.ifetch_buffer_size);
+  override_number(layer, "decode_buffer_size", params.decode_buffer_size);
+  override_number(layer, "dispatch_buffer_size", params.dispatch_buffer_size);
+  override_number(layer, "rob_size", params.rob_size);
+  override_number(layer, "lq_size", params.lq_size);
+  override_number(layer, "sq_size", params.sq_size);
+  override_number(layer, "fetch_width", params.fetch_width);
+  override_number(layer, "decode_width", params.decode_width);
+  override_number(layer, "dispatch_width", params.dispatch_width);
+  override_number(layer, "scheduler_size", params.scheduler_size);
+  override_number(layer, "execute_width", params.execute_width);
+  override_number(layer, "lq_width", params.lq_width);
+  override_number(layer, "sq_width", params.sq_width);
+  override_number(layer, "retire_width", params.retire_width);
+  override_number(layer, "mispredict_penalty", params.mispredict_penalty);
+  override_number(layer, "decode_latency", params.decode_latency);
+  override_number(layer, "dispatch_latency", params.dispatch_latency);
+  override_number(layer, "schedule_latency", params.schedule_latency);
+  override_number(layer, "execute_latency", params.execute_latency);
+  override_bool(layer, "decoupled_frontend", params.decoupled_frontend);
+  override_number(layer, "ftq_size", params.ftq_size);
+  override_module(layer, "branch_predictor", params.branch_predictor, params.branch_predictor_params);
+  override_module(layer, "btb", params.btb, params.btb_params);
+
+  if (layer.contains("DIB")) {
+    override_number(layer.at("DIB"), "sets", params.dib_sets);
+    override_number(layer.at("DIB"), "ways", params.dib_ways);
+    override_number(layer.at("DIB"), "window_size", params.dib_window);
+  }
+}
+
+void apply_ptw_layer(const champsim::json_value& layer, champsim::ptw_params& params)
+{
+  if (!layer.is_object())
+    return;
+
+  override_number(layer, "pscl5_set", params.pscl5_set);
+  override_number(layer, "pscl5_way", params.pscl5_way);
+  override_number(layer, "pscl4_set", params.pscl4_set);
+  override_number(layer, "pscl4_way", params.pscl4_way);
+  override_number(layer, "pscl3_set", params.pscl3_set);
+  override_number(layer, "pscl3_way", params.pscl3_way);
+  override_number(layer, "pscl2_set", params.pscl2_set);
+  override_number(layer, "pscl2_way", params.pscl2_way);
+  override_number(layer, "ptw_rq_size", params.rq_size);
+  override_number(layer, "ptw_pq_size", params.pq_size);
+  override_number(layer, "ptw_mshr_size", params.mshr_size);
+  override_number(layer, "ptw_max_read", params.max_read);
+  override_number(layer, "ptw_max_write", params.max_write);
+}
+
+template <typename M>
+auto find_module(const M& registry, const std::string& name, const std::string& kind)
+{
+  auto found = registry.find(name);
+  if (found == std::end(registry))
+    throw std::invalid_argument(kind + " module \"" + name + "\" is not linked into this binary. Configure with \"runtime_modules\": true to link every module.");
+  return found->second;
+}
+
+// Modules written as classes are found in their registry, and the others among those config.sh linked
+template <typename Module, typename M>
+auto select_module(const M& linked, const std::string& name, const champsim::json_value& params, const std::string& kind, typename M::mapped_type instance)
+{
+  if (champsim::modules::registry<Module>::contains(name))
+    return std::pair{instance, champsim::modules::selection{name, params}};
+  return std::pair{find_module(linked, name, kind), champsim::modules::selection{}};
+}
+
+void check_constant(const champsim::json_value& config, const std::string& key, uint64_t compiled)
+{
+  if (config.contains(key) && static_cast<uint64_t>(config.at(key).as_number()) != compiled)
+    throw std::invalid_argument("\"" + key + "\" differs from the value this binary was configured with (" + std::to_string(compiled) + "). Re-run config.sh to change it.");
+}
+} // namespace
+
+void champsim::configure_from_file(const std::string& fname)
+{
+  std::ifstream ifs{fname};
+  if (!ifs.good())
+    throw std::invalid_argument("Could not open configuration file " + fname);
+  auto config = json_value::parse(ifs);
+
+  check_constant(config, "num_cores", NUM_CPUS);
+  check_constant(config, "block_size", BLOCK_SIZE);
+  check_constant(config, "page_size", PAGE_SIZE);
+
+  json_value empty;
+  auto layer = [&empty](const json_value& parent, const std::string& key) -> const json_value& { return parent.contains(key) ? parent.at(key) : empty; };
+
+  const auto& core_layers = layer(config, "ooo_cpu");
+  const auto& cache_layers = layer(config, "cache");
+  auto cache_array_layer = [&](const std::string& name) -> const json_value& {
+    for (const auto& elem : cache_layers.array_value)
+      if (elem.contains("name") && elem.at("name").as_string() == name)
+        return elem;
+    return empty;
+  };
+
+  // Resolve the parameters of each component, from least to most specific
+  std::vector<cache_params> cache_cfg = compiled_caches;
+  std::vector<ptw_params> ptw_cfg = compiled_ptws;
+  std::vector<cpu_params> cpu_cfg = compiled_cores;
+
+  auto find_cache = [&cache_cfg](const std::string& name) {
+    return std::find_if(std::begin(cache_cfg), std::end(cache_cfg), [&name](const cache_params& x) { return x.name == name; });
+  };
+
+  for (const auto& elem : cache_layers.array_value) {
+    if (!elem.contains("name") || find_cache(elem.at("name").as_string()) == std::end(cache_cfg))
+      throw std::invalid_argument("Cache " + (elem.contains("name") ? elem.at("name").as_string() : std::string{"(unnamed)"})
+                                  + " is not part of the compiled topology. Re-run config.sh to change the topology.");
+  }
+
+  for (auto& cpu : cpu_cfg) {
+    const auto& core_layer = core_layers.size() > 0 ? core_layers.at(cpu.index % core_layers.size()) : empty;
+    apply_cpu_layer(config, cpu);
+    apply_cpu_layer(core_layer, cpu);
+
+    auto l2c = find_cache(cpu.L1D)->lower_level;
+    auto stlb = find_cache(cpu.DTLB)->lower_level;
+    for (auto [role, name] : {std::pair{"L1I", cpu.L1I}, {"L1D", cpu.L1D}, {"ITLB", cpu.ITLB}, {"DTLB", cpu.DTLB}, {"L2C", l2c}, {"STLB", stlb}}) {
+      auto cache = find_cache(name);
+      if (cache == std::end(cache_cfg))
+        continue;
+
+      apply_cache_layer(layer(config, role), *cache);
+      apply_cache_layer(cache_array_layer(name), *cache);
+      apply_cache_layer(layer(core_layer, role), *cache);
+    }
+
+    // The L1I prefetcher is driven by the core
+    cpu.iprefetcher = find_cache(cpu.L1I)->prefetcher;
+    cpu.iprefetcher_params = find_cache(cpu.L1I)->prefetcher_params;
+
+    auto ptw = std::find_if(std::begin(ptw_cfg), std::end(ptw_cfg), [&cpu](const ptw_params& x) { return x.name == cpu.PTW; });
+    apply_ptw_layer(layer(config, "PTW"), *ptw);
+    apply_ptw_layer(layer(core_layer, "PTW"), *ptw);
+  }
+
+  if (auto llc = find_cache("LLC"); llc != std::end(cache_cfg)) {
+    apply_cache_layer(layer(config, "LLC"), *llc);
+    apply_cache_layer(cache_array_layer("LLC"), *llc);
+  }
+
+  if (config.contains("physical_memory") && layer(config, "physical_memory").contains("scheduler")) {
+    const std::map<std::string, MEMORY_CONTROLLER::sched_t> schedulers = {
+        {"fcfs", MEMORY_CONTROLLER::sched_t::FCFS}, {"frfcfs", MEMORY_CONTROLLER::sched_t::FRFCFS}, {"bliss", MEMORY_CONTROLLER::sched_t::BLISS}};
+    DRAM.sched_type = find_module(schedulers, config.at("physical_memory").at("scheduler").as_string(), "DRAM scheduler");
+  }
+
+  // Build the memory hierarchy, lower levels first
+  std::map<std::string, MemoryRequestConsumer*> built = {{"DRAM", &DRAM}};
+  std::map<std::string, champsim::operable*> built_operables;
+  std::vector<std::unique_ptr<O3_CPU>> owned_cores;
+  std::vector<std::unique_ptr<CACHE>> owned_caches;
+  std::vector<std::unique_ptr<PageTableWalker>> owned_ptws;
+  std::function<MemoryRequestConsumer*(const std::string&)> build = [&](const std::string& name) -> MemoryRequestConsumer* {
+    if (auto found = built.find(name); found != std::end(built))
+      return found->second;
+
+    if (auto cache = find_cache(name); cache != std::end(cache_cfg)) {
+      auto lower = build(cache->lower_level);
+
+      // Instruction caches get their prefetcher from the core
+      auto is_l1i = std::any_of(std::begin(cpu_cfg), std::end(cpu_cfg), [&name](const cpu_params& x) { return x.L1I == name; });
+      CACHE::pref_t pref;
+      modules::selection pref_selection;
+      if (is_l1i)
+        pref = select_module<modules::instruction_prefetcher>(instruction_prefetcher_modules, cache->prefetcher, cache->prefetcher_params, "Instruction prefetcher",
+                                                              {O3_CPU::ipref_t::instance, CACHE::pref_t::CPU_REDIRECT_instance_})
+                   .first.second;
+      else
+        std::tie(pref, pref_selection) =
+            select_module<modules::prefetcher>(data_prefetcher_modules, cache->prefetcher, cache->prefetcher_params, "Data prefetcher", CACHE::pref_t::instance);
+      auto [repl, repl_selection] =
+          select_module<modules::replacement>(replacement_modules, cache->replacement, cache->replacement_params, "Replacement", CACHE::repl_t::instance);
+
+      const std::map<std::string, CACHE::inclusion_t> inclusion_policies = {
+          {"non_inclusive", CACHE::inclusion_t::non_inclusive}, {"inclusive", CACHE::inclusion_t::inclusive}, {"exclusive", CACHE::inclusion_t::exclusive}};
+      auto inclusion = inclusion_policies.find(cache->inclusion);
+      if (inclusion == std::end(inclusion_policies))
+        throw std::invalid_argument("Inclusion policy \"" + cache->inclusion + "\" of cache " + cache->name
+                                    + " is not one of non_inclusive, inclusive, exclusive");
+
+      auto& result = owned_caches.emplace_back(std::make_unique<CACHE>(
+          cache->name, cache->freq_scale, cache->fill_level, cache->sets, cache->ways, cache->wq_size, cache->rq_size, cache->pq_size, cache->mshr_size,
+          cache->hit_latency, cache->fill_latency, cache->max_read, cache->max_write, cache->offset_bits, cache->huge_page_sets, cache->prefetch_as_load,
+          cache->wq_check_full_addr, cache->virtual_prefetch, cache->prefetch_activate_mask, lower, pref, repl, pref_selection, repl_selection,
+          cache->partition, inclusion->second, cache->snoop_filter));
+      built_operables[name] = result.get();
+      return built[name] = result.get();
+    }
+
+    auto ptw = std::find_if(std::begin(ptw_cfg), std::end(ptw_cfg), [&name](const ptw_params& x) { return x.name == name; });
+    if (ptw == std::end(ptw_cfg))
+      throw std::invalid_argument("Memory element " + name + " is not part of the compiled topology");
+
+    auto lower = build(ptw->lower_level);
+    auto& result = owned_ptws.emplace_back(std::make_unique<PageTableWalker>(
+        ptw->name, ptw->cpu, ptw->fill_level, ptw->pscl5_set, ptw->pscl5_way, ptw->pscl4_set, ptw->pscl4_way, ptw->pscl3_set, ptw->pscl3_way,
+        ptw->pscl2_set, ptw->pscl2_way, ptw->rq_size, ptw->pq_size, ptw->mshr_size, ptw->max_read, ptw->max_write, ptw->latency, lower));
+    built_operables[name] = result.get();
+    return built[name] = result.get();
+  };
+
+  std::array<O3_CPU*, NUM_CPUS> new_cores{};
+  for (const auto& cpu : cpu_cfg) {
+    auto [bpred, bpred_selection] = select_module<modules::branch_predictor>(branch_predictor_modules, cpu.branch_predictor, cpu.branch_predictor_params,
+                                                                             "Branch predictor", O3_CPU::bpred_t::instance);
+    auto [btb, btb_selection] = select_module<modules::btb>(btb_modules, cpu.btb, cpu.btb_params, "Branch target buffer", O3_CPU::btb_t::instance);
+    auto [ipref, ipref_selection] = select_module<modules::instruction_prefetcher>(instruction_prefetcher_modules, cpu.iprefetcher, cpu.iprefetcher_params,
+                                                                                  "Instruction prefetcher",
+                                                                                  {O3_CPU::ipref_t::instance, CACHE::pref_t::CPU_REDIRECT_instance_});
+    new_cores.at(cpu.index) = owned_cores.emplace_back(std::make_unique<O3_CPU>(
+        cpu.index, cpu.freq_scale, cpu.dib_sets, cpu.dib_ways, cpu.dib_window, cpu.ifetch_buffer_size, cpu.decode_buffer_size, cpu.dispatch_buffer_size,
+        cpu.rob_size, cpu.lq_size, cpu.sq_size, cpu.fetch_width, cpu.decode_width, cpu.dispatch_width, cpu.scheduler_size, cpu.execute_width, cpu.lq_width,
+        cpu.sq_width, cpu.retire_width, cpu.mispredict_penalty, cpu.decode_latency, cpu.dispatch_latency, cpu.schedule_latency, cpu.execute_latency,
+        cpu.decoupled_frontend, cpu.ftq_size, build(cpu.ITLB), build(cpu.DTLB), build(cpu.L1I), build(cpu.L1D), bpred, btb, ipref.first, bpred_selection, btb_selection, ipref_selection)).get();
+  }
+
+  for (const auto& cache : cache_cfg)
+    build(cache.name);
+  for (const auto& ptw : ptw_cfg)
+    build(ptw.name);
+
+  // Swap the new components in, keeping the order of the compiled arrays
+  for (auto& op : operables) {
+    if (auto cpu = dynamic_cast<O3_CPU*>(op); cpu != nullptr)
+      op = new_cores.at(cpu->cpu);
+    else if (auto cache = dynamic_cast<CACHE*>(op); cache != nullptr)
+      op = built_operables.at(cache->NAME);
+    else if (auto ptw = dynamic_cast<PageTableWalker*>(op); ptw != nullptr)
+      op = built_operables.at(ptw->NAME);
+  }
+
+  for (auto& cache : caches)
+    cache = static_cast<CACHE*>(built.at(cache->NAME));
+
+  ooo_cpu = new_cores;
+
+  // Release the components of an earlier configuration file, now that nothing refers to them
+  built_cores = std::move(owned_cores);
+  built_caches = std::move(owned_caches);
+  built_ptws = std::move(owned_ptws);
+}
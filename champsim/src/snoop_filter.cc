@@ -0,0 +1,62 @@
+#include "snoop_filter.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include "modules.h"
+#include "util.h"
+
+champsim::snoop_filter::snoop_filter(const json_value& params, std::size_t offset_bits)
+    : NUM_SET(modules::param<uint32_t>(params, "sets", 0)), NUM_WAY(modules::param<uint32_t>(params, "ways", 0)), OFFSET_BITS(offset_bits)
+{
+  if (NUM_SET == 0 || NUM_WAY == 0 || (NUM_SET & (NUM_SET - 1)) != 0)
+    throw std::invalid_argument("A snoop filter needs a power of two of sets and a nonzero number of ways");
+}
+
+std::vector<champsim::snoop_filter::entry>::iterator champsim::snoop_filter::set_begin(uint64_t address)
+{
+  return std::next(std::begin(entries), ((address >> OFFSET_BITS) & bitmask(lg2(NUM_SET))) * NUM_WAY);
+}
+
+std::vector<champsim::snoop_filter::entry>::iterator champsim::snoop_filter::find(uint64_t address)
+{
+  auto begin = set_begin(address);
+  auto end = std::next(begin, NUM_WAY);
+  auto found = std::find_if(begin, end, [this, address](const entry& x) { return x.valid && (x.address >> OFFSET_BITS) == (address >> OFFSET_BITS); });
+  return found == end ? std::end(entries) : found;
+}
+
+uint64_t champsim::snoop_filter::holders(uint64_t address)
+{
+  auto found = find(address);
+  return found == std::end(entries) ? 0 : found->holders;
+}
+
+std::optional<champsim::snoop_filter::entry> champsim::snoop_filter::insert(std::size_t upper, uint64_t address)
+{
+  std::optional<entry> replaced;
+  auto found = find(address);
+  if (found == std::end(entries)) {
+    // An invalid entry has the lowest lru of its set
+    auto begin = set_begin(address);
+    found = std::min_element(begin, std::next(begin, NUM_WAY), [](const entry& lhs, const entry& rhs) { return !lhs.valid || (rhs.valid && lhs.lru < rhs.lru); });
+    if (found->valid)
+      replaced = *found;
+    *found = {true, address, 0, 0};
+  }
+
+  found->holders |= (1ull << upper);
+  found->lru = ++access_count;
+  return replaced;
+}
+
+void champsim::snoop_filter::remove(std::size_t upper, uint64_t address)
+{
+  auto found = find(address);
+  if (found == std::end(entries))
+    return;
+
+  found->holders &= ~(1ull << upper);
+  found->valid = (found->holders != 0);
+}
@@ -0,0 +1,202 @@
+#include "sweep.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "champsim_constants.h"
+#include "runtime_config.h"
+
+namespace
+{
+constexpr std::size_t SWEEP_BATCH_SIZE = 1024;
+constexpr int SWEEP_PIPE_SIZE = 1 << 20;
+
+// The fields of a decoded instruction that the trace determines
+struct sweep_record {
+  uint64_t ip, branch_target;
+  uint64_t destination_memory[NUM_INSTR_DESTINATIONS_SPARC];
+  uint64_t source_memory[NUM_INSTR_SOURCES];
+  uint8_t destination_registers[NUM_INSTR_DESTINATIONS_SPARC];
+  uint8_t source_registers[NUM_INSTR_SOURCES];
+  uint8_t asid[2], branch_type;
+  bool is_branch, branch_taken, is_kernel;
+  invocation_boundary invocation;
+  std::array<guest_mapping, GUEST_MAPPINGS_PER_INSTR> guest_mappings;
+};
+
+sweep_record pack(const ooo_model_instr& instr)
+{
+  sweep_record result;
+  result.ip = instr.ip;
+  result.branch_target = instr.branch_target;
+  std::copy(std::begin(instr.destination_memory), std::end(instr.destination_memory), std::begin(result.destination_memory));
+  std::copy(std::begin(instr.source_memory), std::end(instr.source_memory), std::begin(result.source_memory));
+  std::copy(std::begin(instr.destination_registers), std::end(instr.destination_registers), std::begin(result.destination_registers));
+  std::copy(std::begin(instr.source_registers), std::end(instr.source_registers), std::begin(result.source_registers));
+  std::copy(std::begin(instr.asid), std::end(instr.asid), std::begin(result.asid));
+  result.branch_type = instr.branch_type;
+  result.is_branch = instr.is_branch;
+  result.branch_taken = instr.branch_taken;
+  result.is_kernel = instr.is_kernel;
+  result.invocation = instr.invocation;
+  result.guest_mappings = instr.guest_mappings;
+  return result;
+}
+
+ooo_model_instr unpack(const sweep_record& record)
+{
+  ooo_model_instr result;
+  result.ip = record.ip;
+  result.branch_target = record.branch_target;
+  std::copy(std::begin(record.destination_memory), std::end(record.destination_memory), std::begin(result.destination_memory));
+  std::copy(std::begin(record.source_memory), std::end(record.source_memory), std::begin(result.source_memory));
+  std::copy(std::begin(record.destination_registers), std::end(record.destination_registers), std::begin(result.destination_registers));
+  std::copy(std::begin(record.source_registers), std::end(record.source_registers), std::begin(result.source_registers));
+  std::copy(std::begin(record.asid), std::end(record.asid), std::begin(result.asid));
+  result.branch_type = record.branch_type;
+  result.is_branch = record.is_branch;
+  result.branch_taken = record.branch_taken;
+  result.is_kernel = record.is_kernel;
+  result.invocation = record.invocation;
+  result.guest_mappings = record.guest_mappings;
+  return result;
+}
+
+class sweep_tracereader : public tracereader
+{
+public:
+  sweep_tracereader(uint8_t cpu, int fd) : tracereader(cpu)
+  {
+    trace_string = "(sweep)";
+    trace_file = fdopen(fd, "rb");
+    if (trace_file == NULL) {
+      std::cerr << "*** CANNOT OPEN SWEEP PIPE ***" << std::endl;
+      exit(1);
+    }
+  }
+
+  ooo_model_instr get()
+  {
+    sweep_record record;
+    if (!fread(&record, sizeof(sweep_record), 1, trace_file)) {
+      // the reading process has stopped
+      std::cout << "*** Reached end of trace: " << trace_string << std::endl;
+      exit(1);
+    }
+
+    return unpack(record);
+  }
+};
+
+bool write_all(int fd, const char* data, std::size_t len)
+{
+  while (len > 0) {
+    auto written = write(fd, data, len);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    data += written;
+    len -= written;
+  }
+  return true;
+}
+
+std::string sweep_output_name(const std::string& config_file)
+{
+  auto base = config_file.substr(config_file.find_last_of('/') + 1);
+  return base.substr(0, base.find_last_of('.')) + ".out";
+}
+} // namespace
+
+tracereader* champsim::fork_sweep(const std::vector<std::string>& config_files, tracereader* source)
+{
+  if (NUM_CPUS != 1)
+    throw std::invalid_argument("Sweeping several configurations requires a single-core build");
+
+  std::set<std::string> output_names;
+  for (const auto& fname : config_files) {
+    if (!output_names.insert(sweep_output_name(fname)).second)
+      throw std::invalid_argument("Configurations in a sweep must have distinct base names: " + fname);
+  }
+
+  std::vector<int> read_fds, write_fds;
+  for (std::size_t i = 0; i < std::size(config_files); ++i) {
+    int fds[2];
+    if (pipe(fds) != 0)
+      throw std::runtime_error("Could not create a pipe for the sweep");
+#ifdef F_SETPIPE_SZ
+    fcntl(fds[1], F_SETPIPE_SZ, SWEEP_PIPE_SIZE);
+#endif
+    read_fds.push_back(fds[0]);
+    write_fds.push_back(fds[1]);
+  }
+
+  std::cout << std::flush;
+  std::vector<pid_t> children;
+  for (std::size_t i = 0; i < std::size(config_files); ++i) {
+    auto pid = fork();
+    if (pid < 0)
+      throw std::runtime_error("Could not fork a process for the sweep");
+
+    if (pid == 0) {
+      for (std::size_t j = 0; j < std::size(config_files); ++j) {
+        close(write_fds[j]);
+        if (j != i)
+          close(read_fds[j]);
+      }
+
+      if (freopen(sweep_output_name(config_files[i]).c_str(), "w", stdout) == NULL) {
+        std::cerr << "*** CANNOT OPEN SWEEP OUTPUT: " << sweep_output_name(config_files[i]) << " ***" << std::endl;
+        exit(1);
+      }
+
+      std::cout << "Configuration: " << config_files[i] << std::endl;
+      configure_from_file(config_files[i]);
+      return new sweep_tracereader(0, read_fds[i]);
+    }
+
+    std::cout << "Sweep: " << config_files[i] << " writes " << sweep_output_name(config_files[i]) << " (pid " << pid << ")" << std::endl;
+    children.push_back(pid);
+  }
+
+  for (auto fd : read_fds)
+    close(fd);
+
+  // A system that finishes closes its pipe, which must not terminate the others
+  signal(SIGPIPE, SIG_IGN);
+
+  std::vector<sweep_record> batch(SWEEP_BATCH_SIZE);
+  auto open_fds = write_fds;
+  while (!std::empty(open_fds)) {
+    for (auto& record : batch)
+      record = pack(source->get());
+
+    auto finished = std::remove_if(std::begin(open_fds), std::end(open_fds), [&batch](int fd) {
+      return !write_all(fd, reinterpret_cast<const char*>(std::data(batch)), std::size(batch) * sizeof(sweep_record));
+    });
+    std::for_each(finished, std::end(open_fds), [](int fd) { close(fd); });
+    open_fds.erase(finished, std::end(open_fds));
+  }
+
+  int exit_status = EXIT_SUCCESS;
+  for (std::size_t i = 0; i < std::size(children); ++i) {
+    int status;
+    waitpid(children[i], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::cout << "Sweep: " << config_files[i] << " did not complete" << std::endl;
+      exit_status = EXIT_FAILURE;
+    }
+  }
+
+  exit(exit_status);
+}
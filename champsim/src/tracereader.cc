@@ -1,11 +1,17 @@
 #include "tracereader.h"
 #include "qemutrace.h"
+#include "util.h"
 
 #include <cassert>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <sys/stat.h>
+#include <utility>
+
+// QEMU traces may be streamed through a FIFO, which is read in large batches
+constexpr std::size_t QEMU_TRACE_BUFFER_SIZE = 1 << 20;
 
 tracereader::tracereader(uint8_t cpu, std::string _ts) : cpu(cpu), trace_string(_ts)
 {
@@ -22,8 +28,13 @@ tracereader::tracereader(uint8_t cpu, std::string _ts) : cpu(cpu), trace_string(
     }
     cmd_fmtstr = "wget -qO- -o /dev/null %2$s | %1$s -dc";
   } else {
-    std::ifstream testfile(trace_string);
-    if (!testfile.good()) {
+    // Opening a FIFO to test it would take the place of its reader, so only check that it exists
+    struct stat st;
+    bool is_fifo = stat(trace_string.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+    std::ifstream testfile;
+    if (!is_fifo)
+      testfile.open(trace_string);
+    if (!is_fifo && !testfile.good()) {
       std::cerr << "TRACE FILE NOT FOUND" << std::endl;
       assert(0);
     }
@@ -58,6 +69,7 @@ ooo_model_instr tracereader::read_single_instr()
     // close the trace file and re-open it
     close();
     open(trace_string);
+    ++passes;
   }
 
   // Added by Kaifeng Xu
@@ -84,28 +96,135 @@ void tracereader::open(std::string trace_string)
     assert(0);
   }
   if (decomp_program == "trace"){
+    setvbuf(trace_file, NULL, _IOFBF, QEMU_TRACE_BUFFER_SIZE);
+
     QEMU_tracefile_header header;
     fread(&header, sizeof(QEMU_tracefile_header), 1, trace_file);
     std::cout << "Trace Header:" << header.header_event_id << "," << header.header_magic << "," << header.header_version << std::endl;
 
-    // Skip trace event mappings in trace file, totally 134046 bytes, remember to change this if trace events changes
-    char event_mappings[134081];
-    fread(&event_mappings, 134081, 1, trace_file);
+    // The trace begins with the name and ID of every trace event
+    uint64_t type;
+    while (fread(&type, sizeof(type), 1, trace_file) && type == QEMU_RECORD_TYPE_MAPPING) {
+      uint64_t id;
+      uint32_t len;
+      fread(&id, sizeof(id), 1, trace_file);
+      fread(&len, sizeof(len), 1, trace_file);
+      std::string name(len, '\0');
+      fread(name.data(), len, 1, trace_file);
+
+      if (name == "guest_trace_mem_access_itlb")
+        event_insn = id;
+      else if (name == "guest_trace_mem_access_tlb")
+        event_data = id;
+      else if (name == "guest_trace_nop")
+        event_nop = id;
+      else if (name == "guest_trace_regs")
+        event_regs = id;
+      else if (name == "guest_trace_lifecycle")
+        event_lifecycle = id;
+      else if (name == "guest_trace_mapping")
+        event_mapping = id;
+    }
+
     // Check first event
     QEMU_event_header event_header;
-    fread(&event_header, sizeof(QEMU_event_header), 1, trace_file);
+    event_header.type = type;
+    fread(&event_header.event, sizeof(QEMU_event_header) - sizeof(event_header.type), 1, trace_file);
+    if (consume_qemu_event(event_header))
+      read_qemu_event_header(event_header);
     QEMU_trace_nop trace_nop;
     fread(&trace_nop, sizeof(QEMU_trace_nop), 1, trace_file);
-    std::cout << "Marker: " << trace_nop.byte0 << " " << trace_nop.byte1 << " " << trace_nop.byte2 << std::endl;
+    note_marker(trace_nop);
     // first event should be begin marker
-    assert((event_header.event == EVENT_ID_NOP) && (trace_nop.byte0 == 0xbe));
+    assert((event_header.event == event_nop) && (trace_nop.byte0 == 0xbe));
     // Follow that begin marker, there should be an instruction event
-    fread(&event_header, sizeof(QEMU_event_header), 1, trace_file);
-    assert(event_header.event == EVENT_ID_INSN);
+    read_qemu_event_header(event_header);
+    assert(event_header.event == event_insn);
   }
   // End Kaifeng Xu
 }
 
+// Reads the arguments of the events that are not instructions or markers, and returns whether it did
+bool tracereader::consume_qemu_event(const QEMU_event_header& header)
+{
+  if (header.event == event_regs) {
+    QEMU_trace_regs trace_regs;
+    if (fread(&trace_regs, sizeof(QEMU_trace_regs), 1, trace_file))
+      qemu_regs[trace_regs.paddr] = trace_regs.regs;
+    return true;
+  }
+
+  if (header.event == event_lifecycle) {
+    QEMU_trace_lifecycle trace_lifecycle;
+    if (fread(&trace_lifecycle, sizeof(QEMU_trace_lifecycle), 1, trace_file)) {
+      // An invocation lasts from its invoke phase to its respond phase
+      if (trace_lifecycle.phase == 0) {
+        pending_invocation.begins = true;
+        pending_invocation.function_id = trace_lifecycle.function_id;
+      } else if (trace_lifecycle.phase == 3) {
+        pending_invocation.ends = true;
+      }
+    }
+    return true;
+  }
+
+  if (header.event == event_mapping) {
+    QEMU_trace_mapping trace_mapping;
+    if (fread(&trace_mapping, sizeof(QEMU_trace_mapping), 1, trace_file))
+      pending_mappings.push_back({trace_mapping.vaddr, static_cast<uint8_t>(lg2(trace_mapping.size))});
+    return true;
+  }
+
+  return false;
+}
+
+// Gives an instruction the huge pages read with it. Any more wait for the instructions after it.
+void tracereader::attach_guest_mappings(ooo_model_instr& instr)
+{
+  for (auto& mapping : instr.guest_mappings) {
+    if (std::empty(pending_mappings))
+      return;
+    mapping = pending_mappings.front();
+    pending_mappings.pop_front();
+  }
+}
+
+// Begin (0xbe) and end (0xed) markers delimit an invocation. A begin marker carries a two byte ID, which stands for the function ID.
+void tracereader::note_marker(const QEMU_trace_nop& trace_nop)
+{
+  std::cout << "Marker: " << trace_nop.byte0 << " " << trace_nop.byte1 << " " << trace_nop.byte2 << std::endl;
+
+  if (trace_nop.byte0 == 0xbe) {
+    pending_invocation.begins = true;
+    pending_invocation.function_id = (trace_nop.byte1 << 8) | trace_nop.byte2;
+  } else if (trace_nop.byte0 == 0xed) {
+    pending_invocation.ends = true;
+  }
+}
+
+// Reads the header of the next instruction, data access, or marker
+bool tracereader::read_qemu_event_header(QEMU_event_header& header)
+{
+  while (fread(&header, sizeof(QEMU_event_header), 1, trace_file)) {
+    if (!consume_qemu_event(header))
+      return true;
+  }
+  return false;
+}
+
+template <std::size_t N>
+void add_register(uint8_t (&registers)[N], uint8_t reg)
+{
+  for (auto& slot : registers) {
+    if (slot == reg)
+      return;
+    if (slot == 0) {
+      slot = reg;
+      return;
+    }
+  }
+}
+
 void tracereader::close()
 {
   if (trace_file != NULL) {
@@ -119,6 +238,19 @@ class qemu_tracereader : public tracereader
   bool initialized = false;
   ooo_model_instr read_single_instr_qemutrace();
 
+  // Join the register operands traced at translation to the instruction
+  void add_registers(ooo_model_instr& instr, uint64_t paddr)
+  {
+    auto found = qemu_regs.find(paddr);
+    if (found == std::end(qemu_regs))
+      return;
+
+    for (std::size_t i = 0; i < NUM_INSTR_SOURCES; ++i)
+      add_register(instr.source_registers, (found->second >> (8 * i)) & 0xff);
+    for (std::size_t i = 0; i < NUM_INSTR_DESTINATIONS_SPARC; ++i)
+      add_register(instr.destination_registers, (found->second >> (8 * (NUM_INSTR_SOURCES + i))) & 0xff);
+  }
+
 public:
   qemu_tracereader(uint8_t cpu, std::string _tn) : tracereader(cpu, _tn) {}
 
@@ -145,55 +277,55 @@ public:
         last_instr.is_branch = 1;
         last_instr.branch_taken = (last_instr.branch_target == trace_read_instr.ip);
         last_instr.branch_type = BRANCH_CONDITIONAL;
-        last_instr.destination_registers[0] = REG_INSTRUCTION_POINTER;
-        last_instr.source_registers[0] = REG_INSTRUCTION_POINTER;
-        last_instr.source_registers[1] = REG_FLAGS;
+        add_register(last_instr.destination_registers, REG_INSTRUCTION_POINTER);
+        add_register(last_instr.source_registers, REG_INSTRUCTION_POINTER);
+        add_register(last_instr.source_registers, REG_FLAGS);
         break;
       case QEMU_OPTYPE_JMP_DIRECT:
         last_instr.is_branch = 1;
         last_instr.branch_taken = 1;
         last_instr.branch_type = BRANCH_DIRECT_JUMP;
-        last_instr.destination_registers[0] = REG_INSTRUCTION_POINTER;
+        add_register(last_instr.destination_registers, REG_INSTRUCTION_POINTER);
         break;
       case QEMU_OPTYPE_JMP_INDIRECT:
         last_instr.is_branch = 1;
         last_instr.branch_taken = 1;
         last_instr.branch_type = BRANCH_INDIRECT;
-        last_instr.destination_registers[0] = REG_INSTRUCTION_POINTER;
-        last_instr.source_registers[0] = 50;
+        add_register(last_instr.destination_registers, REG_INSTRUCTION_POINTER);
+        add_register(last_instr.source_registers, 50);
         break;
       case QEMU_OPTYPE_CALL_DIRECT:
         last_instr.is_branch = 1;
         last_instr.branch_taken = 1;
         last_instr.branch_type = BRANCH_DIRECT_CALL;
-        last_instr.destination_registers[0] = REG_INSTRUCTION_POINTER;
-        last_instr.destination_registers[1] = REG_STACK_POINTER;
-        last_instr.source_registers[0] = REG_INSTRUCTION_POINTER;
-        last_instr.source_registers[1] = REG_STACK_POINTER;
+        add_register(last_instr.destination_registers, REG_INSTRUCTION_POINTER);
+        add_register(last_instr.destination_registers, REG_STACK_POINTER);
+        add_register(last_instr.source_registers, REG_INSTRUCTION_POINTER);
+        add_register(last_instr.source_registers, REG_STACK_POINTER);
         break;
       case QEMU_OPTYPE_CALL_INDIRECT:
         last_instr.is_branch = 1;
         last_instr.branch_taken = 1;
         last_instr.branch_type = BRANCH_INDIRECT_CALL;
-        last_instr.destination_registers[0] = REG_INSTRUCTION_POINTER;
-        last_instr.destination_registers[1] = REG_STACK_POINTER;
-        last_instr.source_registers[0] = REG_INSTRUCTION_POINTER;
-        last_instr.source_registers[1] = REG_STACK_POINTER;
-        last_instr.source_registers[2] = 50;
+        add_register(last_instr.destination_registers, REG_INSTRUCTION_POINTER);
+        add_register(last_instr.destination_registers, REG_STACK_POINTER);
+        add_register(last_instr.source_registers, REG_INSTRUCTION_POINTER);
+        add_register(last_instr.source_registers, REG_STACK_POINTER);
+        add_register(last_instr.source_registers, 50);
         break;
       case QEMU_OPTYPE_RET:
         last_instr.is_branch = 1;
         last_instr.branch_taken = 1;
         last_instr.branch_type = BRANCH_RETURN;
-        last_instr.destination_registers[0] = REG_INSTRUCTION_POINTER;
-        last_instr.destination_registers[1] = REG_STACK_POINTER;
-        last_instr.source_registers[0] = REG_STACK_POINTER;
+        add_register(last_instr.destination_registers, REG_INSTRUCTION_POINTER);
+        add_register(last_instr.destination_registers, REG_STACK_POINTER);
+        add_register(last_instr.source_registers, REG_STACK_POINTER);
         break;
       case QEMU_OPTYPE_OTHERS:
         last_instr.is_branch = 1;
         last_instr.branch_taken = (last_instr.branch_target == trace_read_instr.ip);
         last_instr.branch_type = BRANCH_OTHER;
-        last_instr.destination_registers[0] = REG_INSTRUCTION_POINTER;
+        add_register(last_instr.destination_registers, REG_INSTRUCTION_POINTER);
         break;
       default:
         last_instr.is_branch = 0;
@@ -214,6 +346,9 @@ ooo_model_instr qemu_tracereader::read_single_instr_qemutrace()
   QEMU_event_header header;
   QEMU_trace_insn trace_read_instr;
 
+  // The boundaries read before this record are this instruction's, and those read after it are the next one's
+  invocation_boundary invocation = std::exchange(pending_invocation, {});
+
   if (!fread(&trace_read_instr, sizeof(QEMU_trace_insn), 1, trace_file)) {
     // reached end of file for this trace
     std::cout << "*** Reached end of trace: " << trace_string << std::endl;
@@ -221,14 +356,14 @@ ooo_model_instr qemu_tracereader::read_single_instr_qemutrace()
   }
 
   // Read next line and see if this is a r/w
-  if (!fread(&header, sizeof(QEMU_event_header), 1, trace_file)) {
+  if (!read_qemu_event_header(header)) {
     // reached end of file for this trace
     std::cout << "*** Reached end of trace: " << trace_string << std::endl;
     exit(1);
   }
 
   // if this is a data trace
-  if (header.event == EVENT_ID_DATA) {
+  if (header.event == event_data) {
     QEMU_trace_data trace_data;
     if (!fread(&trace_data, sizeof(QEMU_trace_data), 1, trace_file)) {
       // reached end of file for this trace
@@ -238,28 +373,28 @@ ooo_model_instr qemu_tracereader::read_single_instr_qemutrace()
 
     // Read until next instruction
     while(true){
-      if (!fread(&header, sizeof(QEMU_event_header), 1, trace_file)) {
+      if (!read_qemu_event_header(header)) {
         // reached end of file for this trace
         std::cout << "*** Reached end of trace: " << trace_string << std::endl;
         exit(1);
       }
-      if (header.event == EVENT_ID_INSN) {
+      if (header.event == event_insn) {
           break;
-      } else if (header.event == EVENT_ID_DATA) {
+      } else if (header.event == event_data) {
         QEMU_trace_data trace_data;
         if (!fread(&trace_data, sizeof(QEMU_trace_data), 1, trace_file)) {
           // reached end of file for this trace
           std::cout << "*** Reached end of trace: " << trace_string << std::endl;
           exit(1);
         }
-      } else if (header.event == EVENT_ID_NOP) {
+      } else if (header.event == event_nop) {
         QEMU_trace_nop trace_nop;
         if (!fread(&trace_nop, sizeof(QEMU_trace_nop), 1, trace_file)) {
           // reached end of file for this trace
           std::cout << "*** Reached end of trace: " << trace_string << std::endl;
           exit(1);
         }
-        std::cout << "Marker: " << trace_nop.byte0 << " " << trace_nop.byte1 << " " << trace_nop.byte2 << std::endl;
+        note_marker(trace_nop);
       } else {
         assert(0); // should not reach this
       }
@@ -267,8 +402,11 @@ ooo_model_instr qemu_tracereader::read_single_instr_qemutrace()
 
     // Return
     ooo_model_instr retval(cpu, trace_read_instr, trace_data);
+    add_registers(retval, trace_read_instr.paddr);
+    retval.invocation = invocation;
+    attach_guest_mappings(retval);
     return retval;
-  } else if (header.event == EVENT_ID_NOP) {
+  } else if (header.event == event_nop) {
     // Handle marker instructions
     QEMU_trace_nop trace_nop;
     if (!fread(&trace_nop, sizeof(QEMU_trace_nop), 1, trace_file)) {
@@ -276,20 +414,23 @@ ooo_model_instr qemu_tracereader::read_single_instr_qemutrace()
       std::cout << "*** Reached end of trace: " << trace_string << std::endl;
       exit(1);
     }
-    std::cout << "Marker: " << trace_nop.byte0 << " " << trace_nop.byte1 << " " << trace_nop.byte2 << std::endl;
+    note_marker(trace_nop);
     // See if next trace line is instruction
-    if (!fread(&header, sizeof(QEMU_event_header), 1, trace_file)) {
+    if (!read_qemu_event_header(header)) {
       // reached end of file for this trace
       std::cout << "*** Reached end of trace: " << trace_string << std::endl;
       exit(1);
     }
-    assert(header.event == EVENT_ID_INSN);
+    assert(header.event == event_insn);
   } else {
-    assert(header.event == EVENT_ID_INSN); // should be insn, or bug
+    assert(header.event == event_insn); // should be insn, or bug
   }
 
   // if this is an instruction trace
   ooo_model_instr retval(cpu, trace_read_instr);
+  add_registers(retval, trace_read_instr.paddr);
+  retval.invocation = invocation;
+  attach_guest_mappings(retval);
   return retval;
 
 }
@@ -9,8 +9,12 @@
 #include "champsim.h"
 #include "util.h"
 
-VirtualMemory::VirtualMemory(uint64_t capacity, uint64_t pg_size, uint32_t page_table_levels, uint64_t random_seed, uint64_t minor_fault_penalty)
-    : minor_fault_penalty(minor_fault_penalty), pt_levels(page_table_levels), page_size(pg_size),
+VirtualMemory::VirtualMemory(uint64_t capacity, uint64_t pg_size, uint32_t page_table_levels, uint64_t random_seed, uint64_t minor_fault_penalty,
+                             page_size_policy policy, double huge_page_fraction)
+    : minor_fault_penalty(minor_fault_penalty), pt_levels(page_table_levels), page_size(pg_size), huge_page_policy(policy),
+      huge_page_fraction(huge_page_fraction),
+      max_leaf_level(std::min<uint32_t>(policy == page_size_policy::base ? 0 : (policy == page_size_policy::huge_2m ? 1 : VMEM_MAX_LEAF_LEVEL),
+                                        page_table_levels - 1)),
       ppage_free_list((capacity - VMEM_RESERVE_CAPACITY) / PAGE_SIZE, PAGE_SIZE)
 {
   assert(capacity % PAGE_SIZE == 0);
@@ -23,23 +27,149 @@ VirtualMemory::VirtualMemory(uint64_t capacity, uint64_t pg_size, uint32_t page_
   // then shuffle it
   std::shuffle(std::begin(ppage_free_list), std::end(ppage_free_list), std::mt19937_64{random_seed});
 
-  next_pte_page = ppage_free_list.front();
-  ppage_free_list.pop_front();
+  // the reserved space keeps the first frame from huge pages
+  base_pages_in_frame.resize((capacity + (1ull << shamt(1)) - 1) >> shamt(1));
+  huge_frame_taken.resize(std::size(base_pages_in_frame));
+  base_pages_in_frame.front()++;
+  for (uint32_t level = 1; level <= VMEM_MAX_LEAF_LEVEL; ++level)
+    huge_frame_cursor[level] = std::size(base_pages_in_frame) & ~bitmask(shamt(level) - shamt(1));
+
+  next_pte_page = take_base_page();
 }
 
 uint64_t VirtualMemory::shamt(uint32_t level) const { return LOG2_PAGE_SIZE + lg2(page_size / PTE_BYTES) * (level); }
 
 uint64_t VirtualMemory::get_offset(uint64_t vaddr, uint32_t level) const { return (vaddr >> shamt(level)) & bitmask(lg2(page_size / PTE_BYTES)); }
 
+uint64_t VirtualMemory::take_base_page()
+{
+  // the pages of frames that huge pages took are no longer free
+  while (in_huge_frame(ppage_free_list.front()))
+    ppage_free_list.pop_front();
+
+  uint64_t ppage = ppage_free_list.front();
+  ppage_free_list.pop_front();
+  base_pages_in_frame[frame_of(ppage)]++;
+  return ppage;
+}
+
+std::optional<std::size_t> VirtualMemory::find_huge_frame(uint32_t level)
+{
+  // Huge pages are taken from the top of memory down. A frame that holds a base page never becomes free again, so the search never goes back.
+  std::size_t frames = std::size_t{1} << (shamt(level) - shamt(1));
+  for (auto& cursor = huge_frame_cursor[level]; cursor >= frames; cursor -= frames) {
+    bool free = true;
+    for (std::size_t i = cursor - frames; i < cursor && free; ++i)
+      free = (base_pages_in_frame[i] == 0) && !huge_frame_taken[i];
+
+    if (free)
+      return cursor - frames;
+  }
+
+  return std::nullopt;
+}
+
+bool VirtualMemory::region_is_unmapped(uint32_t cpu_num, uint64_t vaddr, uint32_t level) const
+{
+  for (uint32_t smaller = 0; smaller < level; ++smaller) {
+    auto shift = shamt(level) - shamt(smaller);
+    auto found = page_map[smaller].lower_bound({cpu_num, (vaddr >> shamt(level)) << shift});
+    if (found != std::end(page_map[smaller]) && found->first.first == cpu_num && (found->first.second >> shift) == (vaddr >> shamt(level)))
+      return false;
+  }
+
+  return true;
+}
+
+// Returns the level of a new mapping of vaddr, and the level the policy wanted for it
+std::pair<uint32_t, uint32_t> VirtualMemory::choose_leaf_level(uint32_t cpu_num, uint64_t vaddr)
+{
+  uint32_t preferred = 0;
+  if (huge_page_policy == page_size_policy::guest) {
+    for (uint32_t level = max_leaf_level; level > 0 && preferred == 0; --level)
+      if (guest_huge_pages.count({cpu_num, level, vaddr >> shamt(level)}) > 0)
+        preferred = level;
+  } else if (max_leaf_level > 0) {
+    // hash the region, so that the regions given huge pages are spread over the address space
+    uint64_t hash = (vaddr >> shamt(max_leaf_level)) * 0x9e3779b97f4a7c15ull;
+    if ((hash >> 11) < huge_page_fraction * (1ull << 53))
+      preferred = max_leaf_level;
+  }
+
+  // a huge page needs a free frame, and a region without smaller mappings
+  for (uint32_t level = preferred; level > 0; --level)
+    if (region_is_unmapped(cpu_num, vaddr, level) && find_huge_frame(level).has_value())
+      return {level, preferred};
+
+  return {0, preferred};
+}
+
+uint32_t VirtualMemory::leaf_level(uint32_t cpu_num, uint64_t vaddr)
+{
+  for (uint32_t level = 0; level <= max_leaf_level; ++level)
+    if (page_map[level].count({cpu_num, vaddr >> shamt(level)}) > 0)
+      return level;
+
+  return choose_leaf_level(cpu_num, vaddr).first;
+}
+
+bool VirtualMemory::walk_faults(uint32_t cpu_num, uint64_t vaddr) const
+{
+  for (uint32_t level = 0; level <= max_leaf_level; ++level) {
+    if (page_map[level].count({cpu_num, vaddr >> shamt(level)}) > 0) {
+      // the walk reads the entries of the levels above the leaf
+      for (uint32_t pte_level = level + 1; pte_level < pt_levels; ++pte_level)
+        if (page_table.count({cpu_num, vaddr >> shamt(pte_level + 1), pte_level}) == 0)
+          return true;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void VirtualMemory::guest_page_size(uint32_t cpu_num, uint64_t vaddr, unsigned log2_size)
+{
+  if (huge_page_policy != page_size_policy::guest)
+    return;
+
+  for (uint32_t level = max_leaf_level; level > 0; --level) {
+    if (log2_size >= shamt(level)) {
+      guest_huge_pages.insert({cpu_num, level, vaddr >> shamt(level)});
+      return;
+    }
+  }
+}
+
 std::pair<uint64_t, bool> VirtualMemory::va_to_pa(uint32_t cpu_num, uint64_t vaddr)
 {
-  auto [ppage, fault] = vpage_to_ppage_map.insert({{cpu_num, vaddr >> LOG2_PAGE_SIZE}, ppage_free_list.front()});
+  uint32_t level = 0;
+  while (level <= max_leaf_level && page_map[level].count({cpu_num, vaddr >> shamt(level)}) == 0)
+    ++level;
+
+  bool fault = (level > max_leaf_level);
 
   // this vpage doesn't yet have a ppage mapping
-  if (fault)
-    ppage_free_list.pop_front();
+  if (fault) {
+    auto [chosen, preferred] = choose_leaf_level(cpu_num, vaddr);
+    level = chosen;
 
-  return {splice_bits(ppage->second, vaddr, LOG2_PAGE_SIZE), fault};
+    uint64_t ppage;
+    if (level == 0) {
+      ppage = take_base_page();
+    } else {
+      auto first = find_huge_frame(level).value();
+      std::fill_n(std::next(std::begin(huge_frame_taken), first), std::size_t{1} << (shamt(level) - shamt(1)), true);
+      ppage = first << shamt(1);
+    }
+
+    page_map[level].insert({{cpu_num, vaddr >> shamt(level)}, ppage});
+    mappings[level]++;
+    if (level < preferred)
+      huge_page_fallbacks++;
+  }
+
+  return {splice_bits(page_map[level].at({cpu_num, vaddr >> shamt(level)}), vaddr, shamt(level)), fault};
 }
 
 std::pair<uint64_t, bool> VirtualMemory::get_pte_pa(uint32_t cpu_num, uint64_t vaddr, uint32_t level)
@@ -49,11 +179,12 @@ std::pair<uint64_t, bool> VirtualMemory::get_pte_pa(uint32_t cpu_num, uint64_t v
 
   // this PTE doesn't yet have a mapping
   if (fault) {
+    if (frame_of(ppage->second) < std::size(base_pages_in_frame))
+      base_pages_in_frame[frame_of(ppage->second)]++;
+
     next_pte_page += page_size;
-    if (next_pte_page % PAGE_SIZE) {
-      next_pte_page = ppage_free_list.front();
-      ppage_free_list.pop_front();
-    }
+    if (next_pte_page % PAGE_SIZE || in_huge_frame(next_pte_page))
+      next_pte_page = take_base_page();
   }
 
   return {splice_bits(ppage->second, get_offset(vaddr, level) * PTE_BYTES, lg2(page_size)), fault};
@@ -0,0 +1,291 @@
+/*
+ * Miss ratio curve profiler
+ *
+ * Reads a trace once and computes the LRU stack distance of every instruction
+ * and data access, at block and at page granularity. The curves are split by
+ * privilege level (seg_states) and by address space (cr3), and give the miss
+ * ratio of a fully-associative LRU cache of every size in one pass, for sizing
+ * the L1I, L1D, L2C, LLC, and TLBs before running detailed simulations.
+ *
+ * Stack distances are counted with a Fenwick tree over access times (Bennett
+ * and Kruskal), so each access costs O(log n). Spatially-hashed sampling of
+ * addresses (SHARDS, Waldspurger et al., FAST 2015) reduces the cost further.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "champsim_constants.h"
+#include "tracereader.h"
+
+namespace
+{
+constexpr uint64_t COLD_MISS = std::numeric_limits<uint64_t>::max();
+constexpr std::size_t INITIAL_TREE_SIZE = 1 << 20;
+constexpr unsigned SAMPLE_HASH_BITS = 24;
+constexpr uint64_t MAX_CURVE_ENTRIES = 1ull << 28;
+
+uint64_t splitmix64(uint64_t x)
+{
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// The number of distinct addresses touched since the last access to an address
+class stack_distance_tracker
+{
+  std::unordered_map<uint64_t, uint64_t> last_access;
+  std::vector<uint64_t> tree = std::vector<uint64_t>(INITIAL_TREE_SIZE + 1);
+  uint64_t now = 0;
+
+  void add(uint64_t time, int64_t delta)
+  {
+    for (; time < std::size(tree); time += time & (~time + 1))
+      tree[time] += delta;
+  }
+
+  uint64_t prefix(uint64_t time) const
+  {
+    uint64_t result = 0;
+    for (; time > 0; time -= time & (~time + 1))
+      result += tree[time];
+    return result;
+  }
+
+  // Renumber the live access times from 1, so that the tree stays proportional to the footprint
+  void compact()
+  {
+    std::vector<std::pair<uint64_t, uint64_t>> by_time;
+    for (auto [addr, time] : last_access)
+      by_time.emplace_back(time, addr);
+    std::sort(std::begin(by_time), std::end(by_time));
+
+    tree.assign(std::max<std::size_t>(INITIAL_TREE_SIZE, 2 * std::size(by_time)) + 1, 0);
+    now = 0;
+    for (auto [time, addr] : by_time) {
+      last_access[addr] = ++now;
+      add(now, 1);
+    }
+  }
+
+public:
+  uint64_t access(uint64_t addr)
+  {
+    if (now + 1 == std::size(tree))
+      compact();
+    ++now;
+
+    uint64_t distance = COLD_MISS;
+    auto [it, inserted] = last_access.insert({addr, now});
+    if (!inserted) {
+      distance = std::size(last_access) - prefix(it->second);
+      add(it->second, -1);
+      it->second = now;
+    }
+    add(now, 1);
+
+    return distance;
+  }
+
+  uint64_t footprint() const { return std::size(last_access); }
+};
+
+// Cache sizes, in entries, at which the curve is exact: four steps per power of two
+std::vector<uint64_t> curve_sizes()
+{
+  std::vector<uint64_t> result = {1, 2, 3};
+  for (uint64_t base = 4; base <= MAX_CURVE_ENTRIES; base *= 2) {
+    for (uint64_t step = 0; step < 4; ++step)
+      result.push_back(base + step * base / 4);
+  }
+  return result;
+}
+
+const std::vector<uint64_t> sizes = curve_sizes();
+
+struct miss_ratio_curve {
+  stack_distance_tracker tracker;
+  std::vector<uint64_t> histogram = std::vector<uint64_t>(std::size(sizes) + 1); // histogram[i] counts hits in sizes[i] but not sizes[i-1]
+  uint64_t accesses = 0, cold_misses = 0;
+
+  void access(uint64_t addr, double sample_rate)
+  {
+    ++accesses;
+    auto distance = tracker.access(addr);
+    if (distance == COLD_MISS) {
+      ++cold_misses;
+    } else {
+      auto scaled = static_cast<uint64_t>(distance / sample_rate);
+      histogram[std::distance(std::begin(sizes), std::upper_bound(std::begin(sizes), std::end(sizes), scaled))]++;
+    }
+  }
+};
+
+enum class stream_t { INSTRUCTION, DATA, UNIFIED };
+enum class segment_t { KERNEL, USER, ALL };
+
+constexpr uint32_t ALL_ASIDS = std::numeric_limits<uint32_t>::max();
+
+// segment, address space, stream, log2 of the granularity
+using curve_key = std::tuple<segment_t, uint32_t, stream_t, unsigned>;
+
+const std::array<unsigned, 2> granularities = {LOG2_BLOCK_SIZE, LOG2_PAGE_SIZE};
+
+// The curves of one segment and address space, by stream and granularity, found in the map on their first access
+using curve_refs = std::array<std::array<miss_ratio_curve*, std::size(granularities)>, 3>;
+
+struct profile {
+  std::map<curve_key, miss_ratio_curve> curves;
+  std::unordered_map<uint64_t, curve_refs> spaces; // by segment and address space
+  curve_refs all_spaces = {};
+  double sample_rate = 1;
+  uint64_t sample_threshold = 1ull << SAMPLE_HASH_BITS;
+  uint64_t instructions = 0;
+
+  miss_ratio_curve& curve(curve_refs& refs, segment_t segment, uint32_t asid, stream_t stream, std::size_t granularity)
+  {
+    auto& ref = refs[static_cast<int>(stream)][granularity];
+    if (ref == nullptr)
+      ref = &curves[{segment, asid, stream, granularities[granularity]}];
+    return *ref;
+  }
+
+  void access(curve_refs& space, segment_t segment, uint32_t asid, stream_t stream, uint64_t addr)
+  {
+    for (std::size_t granularity = 0; granularity < std::size(granularities); ++granularity) {
+      auto line = addr >> granularities[granularity];
+      if ((splitmix64(line) >> (64 - SAMPLE_HASH_BITS)) >= sample_threshold)
+        continue;
+
+      for (auto key_stream : {stream, stream_t::UNIFIED}) {
+        curve(space, segment, asid, key_stream, granularity).access(line, sample_rate);
+        curve(all_spaces, segment_t::ALL, ALL_ASIDS, key_stream, granularity).access(line, sample_rate);
+      }
+    }
+  }
+
+  void operate(const ooo_model_instr& instr)
+  {
+    ++instructions;
+    auto segment = instr.is_kernel ? segment_t::KERNEL : segment_t::USER;
+    uint32_t asid = instr.asid[0] | (instr.asid[1] << 8);
+    auto& space = spaces[(uint64_t{static_cast<unsigned>(segment)} << 32) | asid];
+
+    access(space, segment, asid, stream_t::INSTRUCTION, instr.ip);
+    for (auto addr : instr.source_memory)
+      if (addr != 0)
+        access(space, segment, asid, stream_t::DATA, addr);
+    for (auto addr : instr.destination_memory)
+      if (addr != 0)
+        access(space, segment, asid, stream_t::DATA, addr);
+  }
+
+  void print(std::ostream& os) const
+  {
+    const std::array<std::string, 3> stream_names = {"instruction", "data", "unified"};
+    const std::array<std::string, 3> segment_names = {"kernel", "user", "all"};
+
+    os << "segment,asid,stream,granularity,entries,bytes,accesses,misses,miss_ratio" << "\n";
+    for (const auto& [key, curve] : curves) {
+      auto [segment, asid, stream, shamt] = key;
+      auto footprint = static_cast<uint64_t>(curve.tracker.footprint() / sample_rate);
+
+      uint64_t hits = 0;
+      for (std::size_t i = 0; i < std::size(sizes); ++i) {
+        hits += curve.histogram[i];
+        auto misses = curve.accesses - hits;
+
+        os << segment_names[static_cast<int>(segment)] << ",";
+        if (asid == ALL_ASIDS)
+          os << "all,";
+        else
+          os << std::hex << "0x" << asid << std::dec << ",";
+        os << stream_names[static_cast<int>(stream)] << "," << (1ull << shamt) << "," << sizes[i] << "," << (sizes[i] << shamt) << ",";
+        os << static_cast<uint64_t>(curve.accesses / sample_rate) << "," << static_cast<uint64_t>(misses / sample_rate) << ",";
+        os << (curve.accesses > 0 ? 1.0 * misses / curve.accesses : 0) << "\n";
+
+        // Beyond the footprint, only cold misses remain
+        if (sizes[i] >= footprint)
+          break;
+      }
+    }
+  }
+};
+
+profile mrc;
+std::string output_fname;
+
+void print_results()
+{
+  std::cerr << "Profiled " << mrc.instructions << " instructions" << std::endl;
+  if (output_fname.empty()) {
+    mrc.print(std::cout);
+  } else {
+    std::ofstream ofs{output_fname};
+    mrc.print(ofs);
+  }
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+  uint64_t max_instructions = 0;
+  bool knob_cloudsuite = false;
+
+  static struct option long_options[] = {{"instructions", required_argument, 0, 'i'},
+                                         {"sample_rate", required_argument, 0, 'r'},
+                                         {"output", required_argument, 0, 'o'},
+                                         {"cloudsuite", no_argument, 0, 'c'},
+                                         {0, 0, 0, 0}};
+
+  int c;
+  while ((c = getopt_long_only(argc, argv, "i:r:o:c", long_options, NULL)) != -1) {
+    switch (c) {
+    case 'i':
+      max_instructions = atol(optarg);
+      break;
+    case 'r':
+      mrc.sample_rate = atof(optarg);
+      break;
+    case 'o':
+      output_fname = optarg;
+      break;
+    case 'c':
+      knob_cloudsuite = true;
+      break;
+    default:
+      std::cerr << "Usage: " << argv[0] << " [--instructions N] [--sample_rate R] [--output FILE] [--cloudsuite] TRACE" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind + 1 != argc || mrc.sample_rate <= 0 || mrc.sample_rate > 1) {
+    std::cerr << "Usage: " << argv[0] << " [--instructions N] [--sample_rate R] [--output FILE] [--cloudsuite] TRACE" << std::endl;
+    return EXIT_FAILURE;
+  }
+  mrc.sample_threshold = static_cast<uint64_t>(mrc.sample_rate * (1ull << SAMPLE_HASH_BITS));
+
+  // QEMU traces exit when they end, so the curves are written on exit
+  std::atexit(print_results);
+
+  auto trace = get_tracereader(argv[optind], 0, knob_cloudsuite);
+  while (max_instructions == 0 || mrc.instructions < max_instructions) {
+    auto instr = trace->get();
+    if (trace->completed_passes() > 0)
+      break;
+    mrc.operate(instr);
+  }
+
+  return EXIT_SUCCESS;
+}
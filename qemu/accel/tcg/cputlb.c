@@ -42,8 +42,77 @@
 
 // Added by Kaifeng
 #include "hw/pqii.h"
+#include "migration/vmstate.h"
+#include "qemu/timer.h"
 pqii_data_t g_pqii_data;
 
+/*
+ * Plugins may instrument only the TBs translated while tracing is on, so the
+ * TBs translated before the status changed are flushed to be retranslated.
+ */
+void pqii_status_changed(void)
+{
+    CPUState *cpu = current_cpu ? current_cpu : first_cpu;
+
+    if (cpu) {
+        tb_flush(cpu);
+    }
+}
+
+static QEMUTimer *pqii_timer;
+static void (*pqii_timer_cb)(void);
+
+static void pqii_timer_expired(void *opaque)
+{
+    pqii_timer_cb();
+}
+
+/* With -icount shift=0, a nanosecond of virtual time is one instruction */
+void pqii_timer_mod(uint64_t insns, void (*cb)(void))
+{
+    if (!pqii_timer) {
+        pqii_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, pqii_timer_expired, NULL);
+    }
+    pqii_timer_cb = cb;
+    timer_mod(pqii_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + insns);
+}
+
+/*
+ * Snapshots taken while recording or replaying keep the tracing status and
+ * the instruction count, so that replaying from one resumes the count where
+ * it was taken, and tracing windows can be replayed from the nearest one.
+ */
+static int pqii_data_pre_save(void *opaque)
+{
+    info_report("pqii: icount %" PRIu64 ", status %d",
+                g_pqii_data.icount, g_pqii_data.status);
+    return 0;
+}
+
+static int pqii_data_post_load(void *opaque, int version_id)
+{
+    pqii_status_changed();
+    return 0;
+}
+
+static const VMStateDescription vmstate_pqii_data = {
+    .name = "pqii-data",
+    .version_id = 0,
+    .minimum_version_id = 0,
+    .pre_save = pqii_data_pre_save,
+    .post_load = pqii_data_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT8(status, pqii_data_t),
+        VMSTATE_UINT64(icount, pqii_data_t),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+void pqii_vmstate_register(void)
+{
+    vmstate_register(NULL, 0, &vmstate_pqii_data, &g_pqii_data);
+}
+
 /* DEBUG defines, enable DEBUG_TLB_LOG to log to the CPU_LOG_MMU target */
 /* #define DEBUG_TLB */
 /* #define DEBUG_TLB_LOG */
@@ -851,6 +920,11 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     } else {
         tlb_add_large_page(env, mmu_idx, vaddr, size);
         sz = size;
+
+        /* Trace the size of the guest's huge pages, which ChampSim can map alike */
+        if (g_pqii_data.status && !g_pqii_data.quiet) {
+            trace_guest_trace_mapping(vaddr & ~(size - 1), size);
+        }
     }
     vaddr_page = vaddr & TARGET_PAGE_MASK;
     paddr_page = paddr & TARGET_PAGE_MASK;
@@ -1415,6 +1489,9 @@ bool tlb_plugin_lookup(CPUState *cpu, target_ulong addr, int mmu_idx, qemu_plugi
             data->v.ram.paddr = (addr & (~TARGET_PAGE_MASK)) + tlbe->paddr;
             // Add trace event here
             if (g_pqii_data.status) {
+                g_pqii_data.data_accesses++;
+            }
+            if (g_pqii_data.status && !g_pqii_data.quiet) {
                 int mem_size = 1 << (info & TRACE_MEM_SZ_SHIFT_MASK);
                 if (qemu_plugin_hwaddr_is_io(data)){
                     mem_size = 0; // set a abnormal size of memory access
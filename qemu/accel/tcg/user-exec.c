@@ -42,6 +42,27 @@
 #include <sys/ucontext.h>
 #endif
 
+#include "hw/pqii.h"
+pqii_data_t g_pqii_data;
+
+/*
+ * There is no PQII device in user mode, so tracing is only switched by the
+ * markers. As in system mode, the TBs translated before are retranslated.
+ */
+void pqii_status_changed(void)
+{
+    CPUState *cpu = current_cpu ? current_cpu : first_cpu;
+
+    if (cpu) {
+        tb_flush(cpu);
+    }
+}
+
+/* Nor is there a virtual clock to set a timer on */
+void pqii_timer_mod(uint64_t insns, void (*cb)(void))
+{
+}
+
 __thread uintptr_t helper_retaddr;
 
 //#define DEBUG_SIGNAL
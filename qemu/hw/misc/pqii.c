@@ -37,6 +37,11 @@
 // START: Georgios
 #include "qemu/log.h"
 #include "hw/pqii.h"
+#include "sysemu/replay.h"
+#include "sysemu/sysemu.h"
+#include "hw/qdev-properties.h"
+#include "qemu/error-report.h"
+#include "trace-root.h"
 // END: Georgios
 
 // START: Kaifeng
@@ -88,6 +93,14 @@ typedef struct {
     QEMUTimer dma_timer;
     char dma_buf[DMA_SIZE];
     uint64_t dma_mask;
+
+    /* Function lifecycle, from the writes to 0xa8 */
+    GHashTable *phase_stats;    // pqii_phase_stats by the value written
+    pqii_phase_stats *phase;    // the current phase, or NULL
+    uint64_t phase_icount;      // the counters when the current phase began
+    uint64_t phase_data_accesses;
+    char *phase_stats_file;     // written at exit, or logged if unset
+    Notifier exit_notifier;
 } PqiiState;
 
 static bool pqii_msi_enabled(PqiiState *pqii)
@@ -121,6 +134,74 @@ static bool within(uint64_t addr, uint64_t start, uint64_t end)
     return start <= addr && addr < end;
 }
 
+/* Charge the instructions and data accesses since the last call to the current phase */
+static void pqii_phase_account(PqiiState *pqii)
+{
+    if (pqii->phase) {
+        pqii->phase->insns += g_pqii_data.icount - pqii->phase_icount;
+        pqii->phase->data_accesses += g_pqii_data.data_accesses - pqii->phase_data_accesses;
+    }
+    pqii->phase_icount = g_pqii_data.icount;
+    pqii->phase_data_accesses = g_pqii_data.data_accesses;
+}
+
+static void pqii_phase_begin(PqiiState *pqii, uint64_t val)
+{
+    pqii_phase_stats *stats = g_hash_table_lookup(pqii->phase_stats, &val);
+
+    pqii_phase_account(pqii);
+    if (!stats) {
+        stats = g_new0(pqii_phase_stats, 1);
+        stats->val = val;
+        g_hash_table_insert(pqii->phase_stats, &stats->val, stats);
+    }
+    stats->count++;
+    pqii->phase = stats;
+    trace_guest_trace_lifecycle(g_pqii_data.icount, val >> 4, val & 0xf);
+}
+
+static gint pqii_phase_compare(gconstpointer a, gconstpointer b)
+{
+    uint64_t x = ((const pqii_phase_stats *)a)->val, y = ((const pqii_phase_stats *)b)->val;
+    return (x > y) - (x < y);
+}
+
+static void pqii_phase_report(Notifier *notifier, void *data)
+{
+    PqiiState *pqii = container_of(notifier, PqiiState, exit_notifier);
+    GList *phases = g_list_sort(g_hash_table_get_values(pqii->phase_stats), pqii_phase_compare);
+    GList *it;
+    FILE *fp = NULL;
+
+    pqii_phase_account(pqii);
+    if (pqii->phase_stats_file) {
+        fp = fopen(pqii->phase_stats_file, "w");
+        if (!fp) {
+            error_report("pqii: cannot open %s", pqii->phase_stats_file);
+        }
+    }
+    if (fp) {
+        fprintf(fp, "function_id,phase,count,instructions,data_accesses\n");
+    }
+    for (it = phases; it; it = it->next) {
+        pqii_phase_stats *stats = it->data;
+        if (fp) {
+            fprintf(fp, "%" PRIx64 ",%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+                    stats->val >> 4, (int)(stats->val & 0xf),
+                    stats->count, stats->insns, stats->data_accesses);
+        } else {
+            qemu_log("*** pqii phase: function %" PRIx64 " phase %d count %" PRIu64
+                     " instructions %" PRIu64 " data accesses %" PRIu64 "\n",
+                     stats->val >> 4, (int)(stats->val & 0xf),
+                     stats->count, stats->insns, stats->data_accesses);
+        }
+    }
+    if (fp) {
+        fclose(fp);
+    }
+    g_list_free(phases);
+}
+
 static void pqii_check_range(uint64_t addr, uint64_t size1, uint64_t start,
                 uint64_t size2)
 {
@@ -321,7 +402,12 @@ static void pqii_mmio_write(void *opaque, hwaddr addr, uint64_t val,
         int pqii_status;
         pqii_status = g_pqii_data.status;
         g_pqii_data.status = !g_pqii_data.status;
-				g_pqii_data.icount = 0;
+        pqii_phase_account(pqii);
+        g_pqii_data.icount = 0;
+        pqii->phase_icount = 0;
+        if (g_pqii_data.lazy) {
+            pqii_status_changed();
+        }
         // End of temporary code
         qemu_log("*** Georgios: pqii.c:pqii_mmio_write(hwaddr: %lx, val: %lx, size: %u -- pqii status: %d)\n", addr, val, size, pqii_status);
         break; // END: Georgios
@@ -329,7 +415,7 @@ static void pqii_mmio_write(void *opaque, hwaddr addr, uint64_t val,
 		case 0xa8: { 
 				// val[63:4]      Function ID
 				// val[3:0]       Mark the invocation status: 4'd0 invoke, 4'd1 function start, 4'd2 function end, 4'd3 respond
-        qemu_log("*** Kaifeng:,I4,hwaddr,%lx,val,%lx,size,%u\n", addr, val, size);
+        pqii_phase_begin(pqii, val);
 				break;
 				}
     }
@@ -420,6 +506,10 @@ static void pci_pqii_realize(PCIDevice *pdev, Error **errp)
     memory_region_init_io(&pqii->mmio, OBJECT(pqii), &pqii_mmio_ops, pqii,
                     "pqii-mmio", 1 * MiB);
     pci_register_bar(pdev, 0, PCI_BASE_ADDRESS_SPACE_MEMORY, &pqii->mmio);
+
+    pqii->phase_stats = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    pqii->exit_notifier.notify = pqii_phase_report;
+    qemu_add_exit_notifier(&pqii->exit_notifier);
 }
 
 static void pci_pqii_uninit(PCIDevice *pdev)
@@ -437,6 +527,9 @@ static void pci_pqii_uninit(PCIDevice *pdev)
 
     timer_del(&pqii->dma_timer);
     msi_uninit(pdev);
+
+    qemu_remove_exit_notifier(&pqii->exit_notifier);
+    g_hash_table_destroy(pqii->phase_stats);
 }
 
 static void pqii_instance_init(Object *obj)
@@ -467,6 +560,9 @@ static void pqii_pci_config_write(PCIDevice *dev,
 
 static int pqii_post_load(void *opaque, int version_id)
 {
+    if (replay_mode != REPLAY_MODE_NONE) {
+        return 0; // Replay snapshots restore the trace tool with the pqii-data section
+    }
     g_pqii_data.status = 0; // Always disable the trace tool after loadvm
     qemu_log("*** Kaifeng: pqii.c:pqii_post_load, g_pqii_data.status: %d\n", g_pqii_data.status);
 
@@ -484,6 +580,11 @@ static const VMStateDescription vmstate_pqii = {
     }
 };
 
+static Property pqii_properties[] = {
+    DEFINE_PROP_STRING("phase-stats", PqiiState, phase_stats_file),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void pqii_class_init(ObjectClass *class, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(class);
@@ -502,6 +603,7 @@ static void pqii_class_init(ObjectClass *class, void *data)
     k->config_read = pqii_pci_config_read;
     k->config_write = pqii_pci_config_write;
     dc->vmsd = &vmstate_pqii;
+    device_class_set_props(dc, pqii_properties);
     // END: Kaifeng
     set_bit(DEVICE_CATEGORY_MISC, dc->categories);
 
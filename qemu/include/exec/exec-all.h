@@ -581,7 +581,8 @@ static inline tb_page_addr_t get_page_addr_code(CPUArchState *env,
  * Returns @addr.
  *
  * If @hostp is non-NULL, sets *@hostp to the host address where @addr's content
- * is kept.
+ * is kept. If @paddr is non-NULL, sets *@paddr to @addr, as there is no
+ * physical address space in user mode.
  */
 static inline tb_page_addr_t get_page_addr_code_hostp(CPUArchState *env,
                                                       target_ulong addr,
@@ -590,6 +591,9 @@ static inline tb_page_addr_t get_page_addr_code_hostp(CPUArchState *env,
     if (hostp) {
         *hostp = g2h(addr);
     }
+    if (paddr) {
+        *paddr = addr;
+    }
     return addr;
 }
 #else
@@ -4,9 +4,29 @@
 typedef struct pqii_data {
     uint8_t status;
     uint64_t icount;
+    uint8_t quiet;  // set by plugins that model the accesses instead of tracing them
+    uint8_t lazy;   // set by plugins that instrument only the TBs translated while tracing is on
+    uint64_t data_accesses;  // counted while tracing, like icount
 } pqii_data_t;
 
+/* Cost of one phase of one function, as written to 0xa8 of the PQII device */
+typedef struct pqii_phase_stats {
+    uint64_t val;   // function ID << 4 | phase
+    uint64_t count;
+    uint64_t insns;
+    uint64_t data_accesses;
+} pqii_phase_stats;
+
 extern pqii_data_t g_pqii_data;
 
+void pqii_status_changed(void);
+/*
+ * Call cb once, from the main loop, after the given number of instructions
+ * of virtual time. This is exact with -icount shift=0. User mode has no
+ * virtual clock, and never calls it.
+ */
+void pqii_timer_mod(uint64_t insns, void (*cb)(void));
+void pqii_vmstate_register(void);
+
 
 #endif //QEMU_PQII_H
@@ -333,6 +333,8 @@ int qemu_plugin_insn_is_br_jmp(const struct qemu_plugin_insn *insn);
 uint64_t qemu_plugin_insn_target_vaddr(const struct qemu_plugin_insn *insn);
 void qemu_plugin_get_cpuinfo(uint64_t vaddr, uint64_t paddr, int is_br_jmp, uint64_t target_vaddr, uint64_t icount);
 void qemu_plugin_nop(uint8_t *nop_data);
+void qemu_plugin_regs(uint64_t paddr, uint64_t regs);
+void qemu_plugin_get_cpustate(uint64_t *cr3, uint8_t *seg_states);
 
 /*
  * The following additional queries can be run on the hwaddr structure
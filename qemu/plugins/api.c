@@ -42,8 +42,8 @@
 #include "exec/exec-all.h"
 #include "disas/disas.h"
 #include "plugin.h"
-#ifndef CONFIG_USER_ONLY
 #include "qemu/plugin-memory.h"
+#ifndef CONFIG_USER_ONLY
 #include "hw/boards.h"
 #endif
 #include "trace/mem.h"
@@ -51,6 +51,7 @@
 // Kaifeng Xu
 #include "qemu/log.h"
 #include "trace-root.h"
+#include "hw/pqii.h"
 
 /* Uninstall and Reset handlers */
 
@@ -290,10 +291,35 @@ struct qemu_plugin_hwaddr *qemu_plugin_get_hwaddr(qemu_plugin_meminfo_t info,
     return &hwaddr_info;
 }
 #else
+static __thread struct qemu_plugin_hwaddr hwaddr_info;
+
+/*
+ * There is no TLB in user mode, so the data accesses are traced here instead
+ * of in tlb_plugin_lookup, with the guest virtual address as the physical one.
+ */
 struct qemu_plugin_hwaddr *qemu_plugin_get_hwaddr(qemu_plugin_meminfo_t info,
                                                   uint64_t vaddr)
 {
-    return NULL;
+    CPUArchState *env = current_cpu->env_ptr;
+
+    hwaddr_info.is_io = false;
+    hwaddr_info.is_store = info & TRACE_MEM_ST;
+    hwaddr_info.v.ram.hostaddr = (uintptr_t) g2h(vaddr);
+    hwaddr_info.v.ram.paddr = vaddr;
+
+    if (g_pqii_data.status) {
+        g_pqii_data.data_accesses++;
+    }
+    if (g_pqii_data.status && !g_pqii_data.quiet) {
+        trace_guest_trace_mem_access_tlb(g_pqii_data.icount,
+                                         vaddr,
+                                         vaddr,
+                                         hwaddr_info.is_store,
+                                         1 << (info & TRACE_MEM_SZ_SHIFT_MASK),
+                                         (env->segs[1]).selector & 0x3,
+                                         env->cr[3]);
+    }
+    return &hwaddr_info;
 }
 #endif
 
@@ -316,6 +342,18 @@ void qemu_plugin_nop(uint8_t *nop_data)
 {
     trace_guest_trace_nop(nop_data[0], nop_data[1], nop_data[2]);
 }
+
+void qemu_plugin_regs(uint64_t paddr, uint64_t regs)
+{
+    trace_guest_trace_regs(paddr, regs);
+}
+
+void qemu_plugin_get_cpustate(uint64_t *cr3, uint8_t *seg_states)
+{
+    CPUArchState *env = current_cpu->env_ptr;
+    *cr3 = env->cr[3];
+    *seg_states = (env->segs[1]).selector & 0x3;
+}
 /* End Kaifeng Xu*/
 
 bool qemu_plugin_hwaddr_is_io(const struct qemu_plugin_hwaddr *haddr)
@@ -342,6 +380,10 @@ uint64_t qemu_plugin_hwaddr_device_offset(const struct qemu_plugin_hwaddr *haddr
             return haddr->v.io.offset;
         }
     }
+#else
+    if (haddr) {
+        return haddr->v.ram.paddr;
+    }
 #endif
     return 0;
 }
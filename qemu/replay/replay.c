@@ -19,6 +19,7 @@
 #include "qemu/option.h"
 #include "sysemu/cpus.h"
 #include "qemu/error-report.h"
+#include "hw/pqii.h"
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
@@ -329,6 +330,7 @@ void replay_configure(QemuOpts *opts)
 
     replay_snapshot = g_strdup(qemu_opt_get(opts, "rrsnapshot"));
     replay_vmstate_register();
+    pqii_vmstate_register();
     replay_enable(fname, mode);
 
 out:
@@ -28,52 +28,826 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 static bool track_io;
 static bool do_inline;
+static bool lazy;
+static bool start; // trace from the first instruction, as if it followed a begin marker
+static bool exit_when_done; // exit QEMU once the trace=N instructions are traced
+static qemu_plugin_id_t plugin_id;
 #define MAX_UDATA_BUF_SIZE 10000
 uint8_t udata_buf[MAX_UDATA_BUF_SIZE][3];
 int idx_udata_buf = 0;
 
-#define WARMUP_THRESHOLD_1 0000000000
-#define WARMUP_THRESHOLD_2 1000000000
-// Maximum recording of 1B instructions, can be altered
+/*
+ * Tracing windows, in instructions counted while tracing is on
+ *   skip=N    instructions that are not traced
+ *   trace=N   instructions traced after the skipped ones, 0 for no limit
+ *   period=P  with window=W, trace the first W instructions of every P
+ *   budget=N  instructions traced after each begin marker, 0 for no limit
+ *   cr3=X     count only the instructions of the address space X
+ *   priv=user or priv=kernel   count only the instructions of that privilege
+ *   interval=N  length of the intervals of the model and of the simpoints
+ */
+static uint64_t skip_insns = 0;
+static uint64_t trace_insns = 1000000000; // Maximum recording of 1B instructions by default
+static uint64_t period_insns = 0;
+static uint64_t window_insns = 0;
+static uint64_t marker_budget = 0;
+static uint64_t marker_icount = 0;
+static bool filter_cr3 = false;
+static uint64_t cr3_value;
+static int priv_value = -1;
+static uint64_t interval_insns = 10000000;
 
-static void plugin_exit(qemu_plugin_id_t id, void *p){
+static bool sampling = false;
+static bool insn_traced = false;
+
+#define CR3_PCID_MASK 0xfffULL
+
+/*
+ * Functional model, enabled with the model argument. Instead of a trace, the
+ * plugin reports the MPKI of a set-associative LRU cache and TLB hierarchy and
+ * of a gshare predictor, per interval and per invocation, and the footprint of
+ * every address space. The geometry is set with l1i=SETSxWAYS, and likewise
+ * l1d, l2, llc, itlb, dtlb, and stlb; gshare=N sets the log2 of the number of
+ * counters, and out=FILE the output.
+ */
+enum { MODEL_L1I, MODEL_L1D, MODEL_L2, MODEL_LLC, MODEL_ITLB, MODEL_DTLB, MODEL_STLB, MODEL_NUM_CACHES };
+
+typedef struct {
+    const char *name;
+    uint64_t sets, ways;
+    unsigned shift;
+    uint64_t *tags;
+    uint64_t *stamps;
+    uint64_t clock;
+} model_cache;
+
+typedef struct {
+    uint64_t insns;
+    uint64_t misses[MODEL_NUM_CACHES];
+    uint64_t branches;
+    uint64_t mispredicts;
+} model_stats;
+
+typedef struct {
+    GHashTable *blocks[2];
+    GHashTable *pages[2];
+    uint64_t last_block[2]; // already in blocks and pages
+} model_footprint;
+
+/*
+ * An instruction of the model, looked up once when it is translated and passed
+ * to its callback. It is added to the footprint of an address space only the
+ * first time it runs there.
+ */
+typedef struct {
+    uint64_t vaddr, paddr, target_vaddr;
+    int is_br_jmp;
+    uint64_t touched_cr3; // MODEL_NO_CR3 until it runs
+} model_insn_info;
+
+#define MODEL_BLOCK_SHIFT 6
+#define MODEL_PAGE_SHIFT 12
+#define MODEL_BTB_SIZE 4096
+#define MODEL_RAS_SIZE 64
+#define MODEL_MAX_INSN_SIZE 15
+#define MODEL_NO_CR3 1 // not page aligned, so no address space has it
+
+static bool model;
+static model_cache caches[MODEL_NUM_CACHES] = {
+    [MODEL_L1I] = {"l1i", 64, 8, MODEL_BLOCK_SHIFT},
+    [MODEL_L1D] = {"l1d", 64, 12, MODEL_BLOCK_SHIFT},
+    [MODEL_L2] = {"l2", 1024, 8, MODEL_BLOCK_SHIFT},
+    [MODEL_LLC] = {"llc", 2048, 16, MODEL_BLOCK_SHIFT},
+    [MODEL_ITLB] = {"itlb", 16, 4, MODEL_PAGE_SHIFT},
+    [MODEL_DTLB] = {"dtlb", 16, 4, MODEL_PAGE_SHIFT},
+    [MODEL_STLB] = {"stlb", 128, 12, MODEL_PAGE_SHIFT},
+};
+static uint64_t gshare_bits = 14;
+static uint8_t *gshare_counters;
+static uint64_t gshare_history;
+static uint64_t btb_targets[MODEL_BTB_SIZE];
+static uint64_t ras[MODEL_RAS_SIZE];
+static unsigned ras_top;
+static uint64_t pending_branch_ip, pending_branch_target;
+static int pending_branch_type = -1;
+
+static FILE *model_file;
+static model_stats stats, interval_start, invocation_start;
+static uint8_t invocation_id[2];
+static GHashTable *footprints;
+static GHashTable *model_insns;
+static model_footprint *model_fp;
+static uint64_t model_cr3, model_fp_cr3 = MODEL_NO_CR3;
+
+static void model_print(const char *str)
+{
+    if (model_file) {
+        fputs(str, model_file);
+    } else {
+        qemu_plugin_outs(str);
+    }
+}
+
+static guint model_insn_hash(gconstpointer key)
+{
+    const model_insn_info *insn = key;
+    return g_int64_hash(&insn->vaddr) ^ g_int64_hash(&insn->paddr);
+}
+
+static gboolean model_insn_equal(gconstpointer a, gconstpointer b)
+{
+    const model_insn_info *x = a, *y = b;
+    return x->vaddr == y->vaddr && x->paddr == y->paddr;
+}
+
+static model_insn_info *model_insn_lookup(uint64_t vaddr, uint64_t paddr, int is_br_jmp, uint64_t target_vaddr)
+{
+    model_insn_info key = {vaddr, paddr};
+    model_insn_info *insn = g_hash_table_lookup(model_insns, &key);
+
+    if (!insn) {
+        insn = g_new0(model_insn_info, 1);
+        insn->vaddr = vaddr;
+        insn->paddr = paddr;
+        insn->touched_cr3 = MODEL_NO_CR3;
+        g_hash_table_add(model_insns, insn);
+    }
+    insn->is_br_jmp = is_br_jmp;
+    insn->target_vaddr = target_vaddr;
+    return insn;
+}
+
+static void model_init(void)
+{
+    int i;
+
+    for (i = 0; i < MODEL_NUM_CACHES; i++) {
+        caches[i].tags = g_new0(uint64_t, caches[i].sets * caches[i].ways);
+        caches[i].stamps = g_new0(uint64_t, caches[i].sets * caches[i].ways);
+    }
+    gshare_counters = g_malloc(1ULL << gshare_bits);
+    memset(gshare_counters, 2, 1ULL << gshare_bits); // weakly taken
+    footprints = g_hash_table_new(NULL, NULL);
+    model_insns = g_hash_table_new(model_insn_hash, model_insn_equal);
+    model_print("kind,id,instructions,l1i_mpki,l1d_mpki,l2_mpki,llc_mpki,itlb_mpki,dtlb_mpki,stlb_mpki,branch_mpki\n");
+}
+
+/* Returns whether addr hits, and fills it on a miss */
+static bool model_cache_access(model_cache *c, uint64_t addr)
+{
+    uint64_t line = addr >> c->shift;
+    uint64_t *tags = &c->tags[(line % c->sets) * c->ways];
+    uint64_t *stamps = &c->stamps[(line % c->sets) * c->ways];
+    uint64_t way, victim = 0;
+
+    c->clock++;
+    for (way = 0; way < c->ways; way++) {
+        if (stamps[way] && tags[way] == line) {
+            stamps[way] = c->clock;
+            return true;
+        }
+        if (stamps[way] < stamps[victim]) {
+            victim = way;
+        }
+    }
+    tags[victim] = line;
+    stamps[victim] = c->clock;
+    return false;
+}
+
+static void model_access(int l1, int tlb, uint64_t vaddr, uint64_t paddr)
+{
+    if (!model_cache_access(&caches[tlb], vaddr)) {
+        stats.misses[tlb]++;
+        if (!model_cache_access(&caches[MODEL_STLB], vaddr)) {
+            stats.misses[MODEL_STLB]++;
+        }
+    }
+    if (!model_cache_access(&caches[l1], paddr)) {
+        stats.misses[l1]++;
+        if (!model_cache_access(&caches[MODEL_L2], paddr)) {
+            stats.misses[MODEL_L2]++;
+            if (!model_cache_access(&caches[MODEL_LLC], paddr)) {
+                stats.misses[MODEL_LLC]++;
+            }
+        }
+    }
+}
+
+static void model_touch(bool is_data, uint64_t vaddr)
+{
+    model_footprint *fp = model_fp;
+
+    if (model_fp_cr3 != model_cr3) {
+        fp = g_hash_table_lookup(footprints, GSIZE_TO_POINTER(model_cr3));
+        if (!fp) {
+            fp = g_new(model_footprint, 1);
+            fp->blocks[0] = g_hash_table_new(NULL, NULL);
+            fp->blocks[1] = g_hash_table_new(NULL, NULL);
+            fp->pages[0] = g_hash_table_new(NULL, NULL);
+            fp->pages[1] = g_hash_table_new(NULL, NULL);
+            fp->last_block[0] = fp->last_block[1] = UINT64_MAX;
+            g_hash_table_insert(footprints, GSIZE_TO_POINTER(model_cr3), fp);
+        }
+        model_fp = fp;
+        model_fp_cr3 = model_cr3;
+    }
+    if (fp->last_block[is_data] == vaddr >> MODEL_BLOCK_SHIFT) {
+        return;
+    }
+    fp->last_block[is_data] = vaddr >> MODEL_BLOCK_SHIFT;
+    g_hash_table_add(fp->blocks[is_data], GSIZE_TO_POINTER(vaddr >> MODEL_BLOCK_SHIFT));
+    g_hash_table_add(fp->pages[is_data], GSIZE_TO_POINTER(vaddr >> MODEL_PAGE_SHIFT));
+}
+
+/*
+ * The outcome of a branch is known when the next instruction executes. Returns
+ * are predicted by a return address stack of the calls' addresses, which is
+ * correct if the return lands within one instruction of the top.
+ */
+static void model_resolve_branch(uint64_t next_ip)
+{
+    uint64_t mask = (1ULL << gshare_bits) - 1;
+    uint64_t index, predicted;
+    bool taken, correct = true;
+
+    switch (pending_branch_type) {
+    case 1:
+        index = (pending_branch_ip ^ gshare_history) & mask;
+        taken = next_ip == pending_branch_target;
+        correct = (gshare_counters[index] >= 2) == taken;
+        if (taken && gshare_counters[index] < 3) {
+            gshare_counters[index]++;
+        } else if (!taken && gshare_counters[index] > 0) {
+            gshare_counters[index]--;
+        }
+        gshare_history = ((gshare_history << 1) | taken) & mask;
+        break;
+    case 3:
+    case 5:
+        index = pending_branch_ip % MODEL_BTB_SIZE;
+        correct = btb_targets[index] == next_ip;
+        btb_targets[index] = next_ip;
+        break;
+    case 6:
+        predicted = ras[ras_top % MODEL_RAS_SIZE];
+        correct = next_ip > predicted && next_ip - predicted <= MODEL_MAX_INSN_SIZE;
+        ras_top--;
+        break;
+    default:
+        break;
+    }
+    if (pending_branch_type == 4 || pending_branch_type == 5) {
+        ras[++ras_top % MODEL_RAS_SIZE] = pending_branch_ip;
+    }
+
+    stats.branches++;
+    if (!correct) {
+        stats.mispredicts++;
+    }
+    pending_branch_type = -1;
+}
+
+static void model_report(const char *kind, const char *id, const model_stats *start)
+{
+    uint64_t insns = stats.insns - start->insns;
+    GString *line = g_string_new(NULL);
+    int i;
+
+    g_string_printf(line, "%s,%s,%" PRIu64, kind, id, insns);
+    for (i = 0; i < MODEL_NUM_CACHES; i++) {
+        g_string_append_printf(line, ",%.3f", insns ? 1000.0 * (stats.misses[i] - start->misses[i]) / insns : 0.0);
+    }
+    g_string_append_printf(line, ",%.3f\n", insns ? 1000.0 * (stats.mispredicts - start->mispredicts) / insns : 0.0);
+    model_print(line->str);
+    g_string_free(line, true);
+}
+
+static void model_insn(model_insn_info *insn)
+{
+    uint8_t seg_states;
+
+    if (pending_branch_type >= 0) {
+        model_resolve_branch(insn->vaddr);
+    }
+    if (insn->is_br_jmp >= 1 && insn->is_br_jmp <= 6) {
+        pending_branch_ip = insn->vaddr;
+        pending_branch_target = insn->target_vaddr;
+        pending_branch_type = insn->is_br_jmp;
+    }
+
+    qemu_plugin_get_cpustate(&model_cr3, &seg_states);
+    model_cr3 &= ~CR3_PCID_MASK;
+    if (insn->touched_cr3 != model_cr3) {
+        model_touch(false, insn->vaddr);
+        insn->touched_cr3 = model_cr3;
+    }
+    model_access(MODEL_L1I, MODEL_ITLB, insn->vaddr, insn->paddr);
+
+    stats.insns++;
+    if (stats.insns - interval_start.insns >= interval_insns) {
+        char id[32];
+        snprintf(id, sizeof(id), "%" PRIu64, g_pqii_data.icount);
+        model_report("interval", id, &interval_start);
+        interval_start = stats;
+    }
+}
+
+static void model_data(uint64_t vaddr, uint64_t paddr)
+{
+    model_touch(true, vaddr);
+    model_access(MODEL_L1D, MODEL_DTLB, vaddr, paddr);
+}
+
+static void model_marker(const uint8_t *nop_data)
+{
+    char id[32];
+
+    if (nop_data[0] == (uint8_t)0xbe) {
+        invocation_start = stats;
+        invocation_id[0] = nop_data[1];
+        invocation_id[1] = nop_data[2];
+    } else if (nop_data[0] == (uint8_t)0xed && g_pqii_data.status) {
+        snprintf(id, sizeof(id), "%d:%d", invocation_id[0], invocation_id[1]);
+        model_report("invocation", id, &invocation_start);
+    }
+}
+
+static void model_exit(void)
+{
+    static const model_stats zero;
+    GHashTableIter iter;
+    gpointer key, value;
+    GString *line = g_string_new("asid,instruction_blocks,data_blocks,instruction_pages,data_pages\n");
+
+    model_report("total", "all", &zero);
+    g_hash_table_iter_init(&iter, footprints);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        model_footprint *fp = value;
+        g_string_append_printf(line, "%016" PRIx64 ",%u,%u,%u,%u\n", (uint64_t)GPOINTER_TO_SIZE(key),
+                               g_hash_table_size(fp->blocks[0]), g_hash_table_size(fp->blocks[1]),
+                               g_hash_table_size(fp->pages[0]), g_hash_table_size(fp->pages[1]));
+    }
+    model_print(line->str);
+    g_string_free(line, true);
+    if (model_file) {
+        fclose(model_file);
+    }
+}
+
+/* Parses "name=SETSxWAYS", and returns -1 if opt is not one, or 0 if it is malformed */
+static int parse_geometry(const char *opt, model_cache *c)
+{
+    size_t len = strlen(c->name);
+    char *end;
+
+    if (strncmp(opt, c->name, len) != 0 || opt[len] != '=') {
+        return -1;
+    }
+    c->sets = g_ascii_strtoull(opt + len + 1, &end, 0);
+    if (*end != 'x' || c->sets == 0) {
+        return 0;
+    }
+    c->ways = g_ascii_strtoull(end + 1, &end, 0);
+    return *end == '\0' && c->ways > 0;
 }
 
 static void plugin_init(void)
 {
 }
 
+/*
+ * In lazy mode, TBs translated while tracing is off carry no callbacks but the
+ * markers', and TBs translated between windows only count their instructions,
+ * so every change of the status or of the window retranslates the TBs.
+ */
+static void set_trace_status(uint8_t status)
+{
+    if (g_pqii_data.status != status) {
+        g_pqii_data.status = status;
+        if (lazy) {
+            pqii_status_changed();
+        }
+    }
+}
+
+/*
+ * Representative intervals, read from simpoints=FILE. Each line of the file
+ * gives an interval index and its weight. Only the intervals, and the lead=N
+ * instructions before each of them, are traced.
+ */
+typedef struct {
+    uint64_t interval;
+    double weight;
+} simpoint;
+
+static GArray *simpoints;
+static uint64_t lead_insns = 0;
+static bool profile;
+
+static bool in_simpoint(uint64_t icount)
+{
+    guint i;
+
+    for (i = 0; i < simpoints->len; i++) {
+        simpoint *sp = &g_array_index(simpoints, simpoint, i);
+        if (icount + lead_insns > sp->interval * interval_insns && icount <= (sp->interval + 1) * interval_insns) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int load_simpoints(const char *fname, const char *weights_fname)
+{
+    FILE *fp = fopen(fname, "r");
+    FILE *weights;
+    simpoint sp;
+    guint i;
+
+    if (!fp) {
+        fprintf(stderr, "cannot open simpoints: %s\n", fname);
+        return -1;
+    }
+    simpoints = g_array_new(false, false, sizeof(simpoint));
+    while (fscanf(fp, "%" SCNu64 " %lf", &sp.interval, &sp.weight) == 2) {
+        g_array_append_val(simpoints, sp);
+    }
+    fclose(fp);
+
+    if (weights_fname) {
+        weights = fopen(weights_fname, "w");
+        if (!weights) {
+            fprintf(stderr, "cannot open weights: %s\n", weights_fname);
+            return -1;
+        }
+        fprintf(weights, "interval,lead_icount,start_icount,end_icount,weight\n");
+        for (i = 0; i < simpoints->len; i++) {
+            simpoint *p = &g_array_index(simpoints, simpoint, i);
+            uint64_t start = p->interval * interval_insns + 1;
+            fprintf(weights, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%f\n", p->interval,
+                    start > lead_insns ? start - lead_insns : 1, start, start + interval_insns - 1, p->weight);
+        }
+        fclose(weights);
+    }
+    return 0;
+}
+
+static bool in_window(uint64_t icount)
+{
+    if (icount <= skip_insns || profile) {
+        return false;
+    }
+    if (simpoints) {
+        return in_simpoint(icount);
+    }
+    if (period_insns) {
+        return (icount - skip_insns - 1) % period_insns < window_insns;
+    }
+    return true;
+}
+
+static bool filter_match(void)
+{
+    uint64_t cr3;
+    uint8_t seg_states;
+
+    if (!filter_cr3 && priv_value < 0) {
+        return true;
+    }
+    qemu_plugin_get_cpustate(&cr3, &seg_states);
+    if (filter_cr3 && (cr3 & ~CR3_PCID_MASK) != cr3_value) {
+        return false;
+    }
+    return priv_value < 0 || seg_states == priv_value;
+}
+
+static void plugin_done(qemu_plugin_id_t id);
+
+/* Count n instructions, and return whether the last one is traced */
+static bool count_insns(uint64_t n)
+{
+    bool window;
+
+    if (!g_pqii_data.status || !filter_match()) {
+        return false;
+    }
+
+    g_pqii_data.icount += n;
+    marker_icount += n;
+    if (trace_insns && g_pqii_data.icount > skip_insns + trace_insns) {
+        set_trace_status(0);
+        if (exit_when_done) {
+            /* The other vCPUs may still be in the plugin, so QEMU exits once they have all left it */
+            qemu_plugin_uninstall(plugin_id, plugin_done);
+        }
+        return false;
+    }
+    if (marker_budget && marker_icount > marker_budget) {
+        set_trace_status(0);
+        return false;
+    }
+
+    window = in_window(g_pqii_data.icount);
+    if (window != sampling) {
+        sampling = window;
+        if (lazy) {
+            pqii_status_changed();
+        }
+    }
+    return window;
+}
+
+/*
+ * Basic block vectors, collected with profile=FILE. The TBs translated while
+ * tracing is on count their executions, and the instructions they run, with
+ * inline adds instead of calls into the plugin, and nothing is traced. When an
+ * interval ends, the vector is taken from the counts. At exit, the vectors are
+ * reduced to BBV_DIMS dimensions by a random projection and clustered with
+ * k-means into k=N clusters (SimPoint, Sherwood et al., ASPLOS 2002). The
+ * interval closest to the center of each cluster is written to FILE with the
+ * fraction of the intervals in its cluster, ready for simpoints=FILE in a
+ * second run from the same snapshot. bbv=FILE also writes the vectors in the
+ * format of SimPoint; without profile=, only the vectors are written.
+ *
+ * The counts are read by a QEMU timer set to the instructions left in the
+ * interval, which ends it exactly with -icount shift=0, and at the markers. In
+ * user mode, which has no virtual clock, they are also read at each system
+ * call, and an interval ends at the first of these after its last instruction.
+ */
+#define BBV_DIMS 15
+#define BBV_ITERATIONS 100
+
+typedef struct {
+    uint64_t id;
+    uint64_t n_insns;
+    uint64_t execs;      // added to inline by the TB
+    uint64_t last_execs; // at the end of the last interval
+} bb_info;
+
+static char *profile_fname;
+static FILE *bbv_file;
+static uint64_t num_clusters = 10;
+static GHashTable *bbs;
+static GArray *projections;
+static GArray *projection_intervals;
+static uint64_t profile_interval;
+static uint64_t profile_insns;      // added to inline by the TBs
+static uint64_t profile_insns_seen; // already counted in g_pqii_data.icount
+
+static uint64_t bbv_hash(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static void bbv_end_interval(void)
+{
+    double projection[BBV_DIMS] = {0};
+    uint64_t total = 0;
+    GHashTableIter iter;
+    gpointer value;
+    int d;
+
+    g_hash_table_iter_init(&iter, bbs);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        bb_info *bb = value;
+        total += (bb->execs - bb->last_execs) * bb->n_insns;
+    }
+    if (total == 0) {
+        return;
+    }
+
+    if (bbv_file) {
+        fputc('T', bbv_file);
+    }
+    g_hash_table_iter_init(&iter, bbs);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        bb_info *bb = value;
+        uint64_t count = (bb->execs - bb->last_execs) * bb->n_insns;
+        if (count == 0) {
+            continue;
+        }
+        for (d = 0; d < BBV_DIMS; d++) {
+            double r = (bbv_hash(bb->id * BBV_DIMS + d) >> 11) * 0x1.0p-53 * 2 - 1;
+            projection[d] += r * count / total;
+        }
+        if (bbv_file) {
+            fprintf(bbv_file, ":%" PRIu64 ":%" PRIu64 " ", bb->id + 1, count);
+        }
+        bb->last_execs = bb->execs;
+    }
+    if (bbv_file) {
+        fputc('\n', bbv_file);
+    }
+    g_array_append_vals(projections, projection, BBV_DIMS);
+    g_array_append_val(projection_intervals, profile_interval);
+}
+
+/* Count the instructions the TBs ran since the last call, and end the interval if they complete it */
+static void profile_sync(void)
+{
+    uint64_t n = profile_insns - profile_insns_seen;
+
+    profile_insns_seen = profile_insns;
+    if (n) {
+        count_insns(n);
+    }
+    if (g_pqii_data.icount / interval_insns != profile_interval) {
+        bbv_end_interval();
+        profile_interval = g_pqii_data.icount / interval_insns;
+    }
+}
+
+/* While tracing is off, no instructions are counted until a begin marker sets the timer again */
+static void profile_timer(void)
+{
+    profile_sync();
+    pqii_timer_mod(g_pqii_data.status ? (profile_interval + 1) * interval_insns - g_pqii_data.icount : interval_insns,
+                   profile_timer);
+}
+
+static void profile_syscall(qemu_plugin_id_t id, unsigned int vcpu_index, int64_t num, uint64_t a1, uint64_t a2,
+                            uint64_t a3, uint64_t a4, uint64_t a5, uint64_t a6, uint64_t a7, uint64_t a8)
+{
+    profile_sync();
+}
+
+static bb_info *profile_tb(struct qemu_plugin_tb *tb)
+{
+    size_t n = qemu_plugin_tb_n_insns(tb);
+    uint64_t key = qemu_plugin_insn_paddr(qemu_plugin_tb_get_insn(tb, 0)) ^ ((uint64_t)n << 52);
+    bb_info *bb = g_hash_table_lookup(bbs, GSIZE_TO_POINTER(key));
+
+    if (!bb) {
+        bb = g_new0(bb_info, 1);
+        bb->id = g_hash_table_size(bbs);
+        bb->n_insns = n;
+        g_hash_table_insert(bbs, GSIZE_TO_POINTER(key), bb);
+    }
+    return bb;
+}
+
+static double bbv_distance(const double *a, const double *b)
+{
+    double sum = 0;
+    int d;
+
+    for (d = 0; d < BBV_DIMS; d++) {
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    }
+    return sum;
+}
+
+static void profile_exit(void)
+{
+    uint64_t n, k, i, j, iter;
+    double *points, *centers;
+    uint64_t *assignment, *sizes, *closest;
+    FILE *fp;
+
+    profile_sync();
+    bbv_end_interval();
+    if (bbv_file) {
+        fclose(bbv_file);
+    }
+    if (!profile_fname) {
+        return;
+    }
+
+    n = projection_intervals->len;
+    if (n == 0) {
+        return;
+    }
+    k = MIN(num_clusters, n);
+    points = (double *)projections->data;
+    centers = g_new0(double, k * BBV_DIMS);
+    assignment = g_new0(uint64_t, n);
+    sizes = g_new0(uint64_t, k);
+    closest = g_new0(uint64_t, k);
+
+    /* Deterministic farthest-point initialization */
+    for (j = 0; j < k; j++) {
+        uint64_t farthest = 0;
+        double farthest_distance = -1;
+        for (i = 0; i < n && j > 0; i++) {
+            double distance = bbv_distance(&points[i * BBV_DIMS], &centers[0]);
+            for (iter = 1; iter < j; iter++) {
+                distance = MIN(distance, bbv_distance(&points[i * BBV_DIMS], &centers[iter * BBV_DIMS]));
+            }
+            if (distance > farthest_distance) {
+                farthest = i;
+                farthest_distance = distance;
+            }
+        }
+        memcpy(&centers[j * BBV_DIMS], &points[farthest * BBV_DIMS], sizeof(double) * BBV_DIMS);
+    }
+
+    for (iter = 0; iter < BBV_ITERATIONS; iter++) {
+        bool changed = false;
+        for (i = 0; i < n; i++) {
+            uint64_t best = 0;
+            for (j = 1; j < k; j++) {
+                if (bbv_distance(&points[i * BBV_DIMS], &centers[j * BBV_DIMS]) <
+                    bbv_distance(&points[i * BBV_DIMS], &centers[best * BBV_DIMS])) {
+                    best = j;
+                }
+            }
+            changed |= iter == 0 || assignment[i] != best;
+            assignment[i] = best;
+        }
+        if (!changed) {
+            break;
+        }
+        memset(centers, 0, sizeof(double) * k * BBV_DIMS);
+        memset(sizes, 0, sizeof(uint64_t) * k);
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < BBV_DIMS; j++) {
+                centers[assignment[i] * BBV_DIMS + j] += points[i * BBV_DIMS + j];
+            }
+            sizes[assignment[i]]++;
+        }
+        for (j = 0; j < k * BBV_DIMS; j++) {
+            if (sizes[j / BBV_DIMS]) {
+                centers[j] /= sizes[j / BBV_DIMS];
+            }
+        }
+    }
+
+    memset(sizes, 0, sizeof(uint64_t) * k);
+    for (i = 0; i < n; i++) {
+        uint64_t c = assignment[i];
+        if (sizes[c] == 0 || bbv_distance(&points[i * BBV_DIMS], &centers[c * BBV_DIMS]) <
+                             bbv_distance(&points[closest[c] * BBV_DIMS], &centers[c * BBV_DIMS])) {
+            closest[c] = i;
+        }
+        sizes[c]++;
+    }
+
+    fp = fopen(profile_fname, "w");
+    if (!fp) {
+        fprintf(stderr, "cannot open profile: %s\n", profile_fname);
+    } else {
+        for (j = 0; j < k; j++) {
+            if (sizes[j]) {
+                fprintf(fp, "%" PRIu64 " %f\n", g_array_index(projection_intervals, uint64_t, closest[j]),
+                        (double)sizes[j] / n);
+            }
+        }
+        fclose(fp);
+    }
+
+    g_free(centers);
+    g_free(assignment);
+    g_free(sizes);
+    g_free(closest);
+}
+
 static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
                        uint64_t vaddr, void *udata)
 {
-    if(g_pqii_data.status){
-        if((g_pqii_data.icount > WARMUP_THRESHOLD_1) && (g_pqii_data.icount <= WARMUP_THRESHOLD_2)){
-            struct qemu_plugin_hwaddr *hwaddr = qemu_plugin_get_hwaddr(meminfo, vaddr);
-            if (track_io) {
-                if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
-                } else {
-                    // Not decide what to do yet
-                    return;
-                }
+    if(g_pqii_data.status && insn_traced){
+        struct qemu_plugin_hwaddr *hwaddr = qemu_plugin_get_hwaddr(meminfo, vaddr);
+        if (track_io) {
+            if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
             } else {
-                if (hwaddr && !qemu_plugin_hwaddr_is_io(hwaddr)) {
-                } else {
-                    // Not decide what to do yet
-                    return;
-                }
+                // Not decide what to do yet
+                return;
             }
-	    }
+        } else {
+            if (hwaddr && !qemu_plugin_hwaddr_is_io(hwaddr)) {
+            } else {
+                // Not decide what to do yet
+                return;
+            }
+        }
+        if (model) {
+            model_data(vaddr, qemu_plugin_hwaddr_device_offset(hwaddr));
+        }
     }
 }
 
 static void vcpu_insn_exec_before(unsigned int cpu_index, void *udata)
 {
-    qemu_plugin_nop(udata);
     uint8_t *nop_data = (uint8_t *)udata;
+    if (model) {
+        model_marker(nop_data);
+    } else {
+        qemu_plugin_nop(udata);
+    }
+    if (profile) {
+        profile_sync();
+    }
     if (nop_data[0] == (uint8_t)0xbe){
-        g_pqii_data.status = 1;
+        marker_icount = 0;
+        set_trace_status(1);
     } else if (nop_data[0] == (uint8_t)0xed){
-        g_pqii_data.status = 0;
+        set_trace_status(0);
+    }
+    if (profile) {
+        profile_timer();
     }
 }
 
@@ -89,106 +863,364 @@ static void vcpu_insn_get_paddr(unsigned int cpu_index, void *udata)
 	tmp_paddr = (uint64_t) udata;
 }
 
+static void vcpu_insn_exec(int is_br_jmp, uint64_t target_vaddr)
+{
+    insn_traced = count_insns(1);
+    if (insn_traced) {
+        qemu_plugin_get_cpuinfo(tmp_vaddr, tmp_paddr, is_br_jmp, target_vaddr, g_pqii_data.icount);
+    }
+}
+
+static void vcpu_insn_exec_model(unsigned int cpu_index, void *udata)
+{
+    insn_traced = count_insns(1);
+    if (insn_traced) {
+        model_insn(udata);
+    }
+}
+
 static void vcpu_insn_exec_normal(unsigned int cpu_index, void *udata)
 {
-    if(g_pqii_data.status){
-        g_pqii_data.icount ++;
-        if(g_pqii_data.icount <= WARMUP_THRESHOLD_2){
-            if(g_pqii_data.icount > WARMUP_THRESHOLD_1)
-		        qemu_plugin_get_cpuinfo(tmp_vaddr, tmp_paddr, 0, 0, g_pqii_data.icount);
-        } else
-            g_pqii_data.status = false;
-	}
+    vcpu_insn_exec(0, 0);
 }
 
 static void vcpu_insn_exec_br(unsigned int cpu_index, void *udata)
 {
-    if(g_pqii_data.status){
-        g_pqii_data.icount ++;
-        if(g_pqii_data.icount <= WARMUP_THRESHOLD_2){
-            if(g_pqii_data.icount > WARMUP_THRESHOLD_1)
-		        qemu_plugin_get_cpuinfo(tmp_vaddr, tmp_paddr, 1, (uint64_t)udata, g_pqii_data.icount);
-        } else
-            g_pqii_data.status = false;
-	}
+    vcpu_insn_exec(1, (uint64_t)udata);
 }
 
 static void vcpu_insn_exec_dir_jmp(unsigned int cpu_index, void *udata)
 {
-    if(g_pqii_data.status){
-        g_pqii_data.icount ++;
-        if(g_pqii_data.icount <= WARMUP_THRESHOLD_2){
-            if(g_pqii_data.icount > WARMUP_THRESHOLD_1)
-		        qemu_plugin_get_cpuinfo(tmp_vaddr, tmp_paddr, 2, (uint64_t)udata, g_pqii_data.icount);
-        } else
-            g_pqii_data.status = false;
-	}
+    vcpu_insn_exec(2, (uint64_t)udata);
 }
 
 static void vcpu_insn_exec_indir_jmp(unsigned int cpu_index, void *udata)
 {
-    if(g_pqii_data.status){
-        g_pqii_data.icount ++;
-        if(g_pqii_data.icount <= WARMUP_THRESHOLD_2){
-            if(g_pqii_data.icount > WARMUP_THRESHOLD_1)
-		        qemu_plugin_get_cpuinfo(tmp_vaddr, tmp_paddr, 3, (uint64_t)udata, g_pqii_data.icount);
-        } else
-            g_pqii_data.status = false;
-	}
+    vcpu_insn_exec(3, (uint64_t)udata);
 }
 
 static void vcpu_insn_exec_dir_call(unsigned int cpu_index, void *udata)
 {
-    if(g_pqii_data.status){
-        g_pqii_data.icount ++;
-        if(g_pqii_data.icount <= WARMUP_THRESHOLD_2){
-            if(g_pqii_data.icount > WARMUP_THRESHOLD_1)
-		        qemu_plugin_get_cpuinfo(tmp_vaddr, tmp_paddr, 4, (uint64_t)udata, g_pqii_data.icount);
-        } else
-            g_pqii_data.status = false;
-	}
+    vcpu_insn_exec(4, (uint64_t)udata);
 }
 
 static void vcpu_insn_exec_indir_call(unsigned int cpu_index, void *udata)
 {
-    if(g_pqii_data.status){
-        g_pqii_data.icount ++;
-        if(g_pqii_data.icount <= WARMUP_THRESHOLD_2){
-            if(g_pqii_data.icount > WARMUP_THRESHOLD_1)
-		        qemu_plugin_get_cpuinfo(tmp_vaddr, tmp_paddr, 5, (uint64_t)udata, g_pqii_data.icount);
-        } else
-            g_pqii_data.status = false;
-	}
+    vcpu_insn_exec(5, (uint64_t)udata);
 }
 
 static void vcpu_insn_exec_ret(unsigned int cpu_index, void *udata)
 {
-    if(g_pqii_data.status){
-        g_pqii_data.icount ++;
-        if(g_pqii_data.icount <= WARMUP_THRESHOLD_2){
-            if(g_pqii_data.icount > WARMUP_THRESHOLD_1)
-		        qemu_plugin_get_cpuinfo(tmp_vaddr, tmp_paddr, 6, (uint64_t)udata, g_pqii_data.icount);
-        } else
-            g_pqii_data.status = false;
-	}
+    vcpu_insn_exec(6, (uint64_t)udata);
 }
 
 static void vcpu_insn_exec_others(unsigned int cpu_index, void *udata)
 {
-    if(g_pqii_data.status){
-        g_pqii_data.icount ++;
-        if(g_pqii_data.icount <= WARMUP_THRESHOLD_2){
-            if(g_pqii_data.icount > WARMUP_THRESHOLD_1)
-		        qemu_plugin_get_cpuinfo(tmp_vaddr, tmp_paddr, 7, (uint64_t)udata, g_pqii_data.icount);
-        } else
-            g_pqii_data.status = false;
-	}
+    vcpu_insn_exec(7, (uint64_t)udata);
+}
+
+/*
+ * Counts the instructions of TBs translated between windows. The privilege and
+ * the address space do not change within a TB, but a window may begin up to one
+ * TB late.
+ */
+static void vcpu_tb_count(unsigned int cpu_index, void *udata)
+{
+    count_insns((uint64_t)udata);
+}
+
+/*
+ * Register operands, decoded from the AT&T disassembly of each instruction when
+ * it is translated, and traced once per translation keyed by its physical
+ * address. Registers are numbered as in the Pin traces of ChampSim: the
+ * general-purpose registers 3-18, the stack pointer 6, and the flags 25. The
+ * vector registers are numbered from 32. The packed operands hold the source
+ * registers in bytes 0-3 and the destination registers in bytes 4-5.
+ */
+#define REG_STACK_POINTER 6
+#define REG_RDX 8
+#define REG_RAX 10
+#define REG_FLAGS 25
+#define REG_VECTOR_BASE 32
+#define MAX_SRC_REGS 4
+#define MAX_DST_REGS 2
+#define MAX_OPERANDS 4
+
+typedef struct {
+    uint8_t src[MAX_SRC_REGS];
+    uint8_t dst[MAX_DST_REGS];
+} insn_regs;
+
+static const struct {
+    const char *names[5];
+    uint8_t reg;
+} gpr_names[] = {
+    {{"rdi", "edi", "di", "dil", NULL}, 3},
+    {{"rsi", "esi", "si", "sil", NULL}, 4},
+    {{"rbp", "ebp", "bp", "bpl", NULL}, 5},
+    {{"rsp", "esp", "sp", "spl", NULL}, REG_STACK_POINTER},
+    {{"rbx", "ebx", "bx", "bl", "bh"}, 7},
+    {{"rdx", "edx", "dx", "dl", "dh"}, REG_RDX},
+    {{"rcx", "ecx", "cx", "cl", "ch"}, 9},
+    {{"rax", "eax", "ax", "al", "ah"}, REG_RAX},
+};
+
+static const char *const flag_writers[] = {
+    "add", "sub", "adc", "sbb", "and", "or", "xor", "cmp", "test", "inc", "dec", "neg",
+    "shl", "shr", "sal", "sar", "rol", "ror", "rcl", "rcr", "imul", "mul", "bt", "bts",
+    "btr", "btc", "bsf", "bsr", "tzcnt", "lzcnt", "popcnt", "cmpxchg", "xadd",
+    "ucomiss", "ucomisd", "comiss", "comisd", NULL,
+};
+
+static const char *const no_dest[] = {
+    "cmp", "test", "bt", "push", "jmp", "call", "ucomiss", "ucomisd", "comiss", "comisd",
+    "vucomiss", "vucomisd", "vcomiss", "vcomisd", "ptest", "vptest", NULL,
+};
+
+static bool in_list(const char *const *list, const char *mnemonic, bool strip_suffix)
+{
+    size_t len = strlen(mnemonic);
+    int i;
+
+    for (i = 0; list[i]; i++) {
+        if (strcmp(list[i], mnemonic) == 0) {
+            return true;
+        }
+        /* AT&T mnemonics may end with an operand size */
+        if (strip_suffix && len == strlen(list[i]) + 1 && strncmp(list[i], mnemonic, len - 1) == 0 &&
+            strchr("bwlq", mnemonic[len - 1])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint8_t reg_number(const char *name, size_t len)
+{
+    char buf[8];
+    unsigned i, j, n;
+
+    if (len == 0 || len >= sizeof(buf)) {
+        return 0;
+    }
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+
+    for (i = 0; i < ARRAY_SIZE(gpr_names); i++) {
+        for (j = 0; j < 5; j++) {
+            if (gpr_names[i].names[j] && strcmp(buf, gpr_names[i].names[j]) == 0) {
+                return gpr_names[i].reg;
+            }
+        }
+    }
+    if (buf[0] == 'r' && sscanf(buf + 1, "%u", &n) == 1 && n >= 8 && n <= 15) {
+        return 3 + n;
+    }
+    if ((strncmp(buf, "xmm", 3) == 0 || strncmp(buf, "ymm", 3) == 0 || strncmp(buf, "zmm", 3) == 0) &&
+        sscanf(buf + 3, "%u", &n) == 1 && n < 32) {
+        return REG_VECTOR_BASE + n;
+    }
+    return 0;
+}
+
+static void add_reg(uint8_t *regs, int size, uint8_t reg)
+{
+    int i;
+
+    for (i = 0; reg && i < size; i++) {
+        if (regs[i] == reg) {
+            return;
+        }
+        if (regs[i] == 0) {
+            regs[i] = reg;
+            return;
+        }
+    }
+}
+
+/* Adds the registers of an operand to the sources, and returns the register if the operand is one */
+static uint8_t decode_operand(const char *op, size_t len, insn_regs *regs)
+{
+    const char *end = op + len;
+    const char *p;
+    bool memory = memchr(op, '(', len) != NULL;
+
+    for (p = op; p < end; p++) {
+        if (*p == '%') {
+            const char *q = p + 1;
+            while (q < end && g_ascii_isalnum(*q)) {
+                q++;
+            }
+            /* A segment override, as in %fs:0x28, is not an operand */
+            if (q < end && *q == ':') {
+                p = q;
+                continue;
+            }
+            if (memory) {
+                add_reg(regs->src, MAX_SRC_REGS, reg_number(p + 1, q - p - 1));
+            } else {
+                return reg_number(p + 1, q - p - 1);
+            }
+            p = q - 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t decode_regs(const char *disas)
+{
+    static const char *const prefixes[] = {
+        "lock", "rep", "repz", "repnz", "repe", "repne", "data16", "addr32", "notrack", "bnd", NULL,
+    };
+    insn_regs regs = {{0}, {0}};
+    const char *ops[MAX_OPERANDS];
+    size_t op_lens[MAX_OPERANDS];
+    uint8_t op_regs[MAX_OPERANDS];
+    char mnemonic[32];
+    const char *p = disas;
+    int n = 0, depth = 0, i;
+    size_t len;
+    uint64_t packed = 0;
+
+    /* Mnemonic, after any prefixes */
+    do {
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        len = strcspn(p, " \t");
+        if (len >= sizeof(mnemonic)) {
+            return 0;
+        }
+        memcpy(mnemonic, p, len);
+        mnemonic[len] = '\0';
+        p += len;
+    } while (in_list(prefixes, mnemonic, false) && *p);
+
+    /* Operands, separated by commas outside of parentheses */
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    if (*p) {
+        ops[0] = p;
+        for (; *p; p++) {
+            if (*p == '(') {
+                depth++;
+            } else if (*p == ')') {
+                depth--;
+            } else if (*p == ',' && depth == 0) {
+                op_lens[n] = p - ops[n];
+                if (++n == MAX_OPERANDS) {
+                    return 0;
+                }
+                ops[n] = p + 1;
+            }
+        }
+        op_lens[n] = p - ops[n];
+        n++;
+    }
+
+    for (i = 0; i < n; i++) {
+        op_regs[i] = decode_operand(ops[i], op_lens[i], &regs);
+    }
+
+    if (n == 1 && (strncmp(mnemonic, "pop", 3) == 0 || strncmp(mnemonic, "set", 3) == 0)) {
+        add_reg(regs.dst, MAX_DST_REGS, op_regs[0]);
+    } else if (n == 1 && (in_list(no_dest, mnemonic, true) || mnemonic[0] == 'j')) {
+        add_reg(regs.src, MAX_SRC_REGS, op_regs[0]);
+    } else if (n == 1 && (in_list((const char *const[]){"mul", "imul", "div", "idiv", NULL}, mnemonic, true))) {
+        add_reg(regs.src, MAX_SRC_REGS, op_regs[0]);
+        add_reg(regs.src, MAX_SRC_REGS, REG_RAX);
+        add_reg(regs.src, MAX_SRC_REGS, REG_RDX);
+        add_reg(regs.dst, MAX_DST_REGS, REG_RAX);
+        add_reg(regs.dst, MAX_DST_REGS, REG_RDX);
+    } else if (n == 1) {
+        /* inc, dec, neg, not, bswap, ... */
+        add_reg(regs.src, MAX_SRC_REGS, op_regs[0]);
+        add_reg(regs.dst, MAX_DST_REGS, op_regs[0]);
+    } else if (n >= 2) {
+        bool zero_idiom = op_regs[0] && op_regs[0] == op_regs[1] &&
+                          in_list((const char *const[]){"xor", "sub", "pxor", "xorps", "xorpd", NULL}, mnemonic, true);
+        bool write_only = n >= 3 || zero_idiom || strncmp(mnemonic, "mov", 3) == 0 ||
+                          strncmp(mnemonic, "vmov", 4) == 0 || strncmp(mnemonic, "lea", 3) == 0 ||
+                          strncmp(mnemonic, "cvt", 3) == 0 || strncmp(mnemonic, "vcvt", 4) == 0;
+
+        for (i = 0; i < n - 1; i++) {
+            if (!zero_idiom) {
+                add_reg(regs.src, MAX_SRC_REGS, op_regs[i]);
+            }
+        }
+        if (in_list(no_dest, mnemonic, true)) {
+            add_reg(regs.src, MAX_SRC_REGS, op_regs[n - 1]);
+        } else {
+            if (!write_only) {
+                add_reg(regs.src, MAX_SRC_REGS, op_regs[n - 1]);
+            }
+            add_reg(regs.dst, MAX_DST_REGS, op_regs[n - 1]);
+        }
+    }
+
+    /* Implicit operands */
+    if (strncmp(mnemonic, "push", 4) == 0 || strncmp(mnemonic, "pop", 3) == 0 || strncmp(mnemonic, "leave", 5) == 0) {
+        add_reg(regs.src, MAX_SRC_REGS, REG_STACK_POINTER);
+        add_reg(regs.dst, MAX_DST_REGS, REG_STACK_POINTER);
+    }
+    if (in_list((const char *const[]){"cltq", "cwtl", "cltd", "cqto", NULL}, mnemonic, false)) {
+        add_reg(regs.src, MAX_SRC_REGS, REG_RAX);
+        add_reg(regs.dst, MAX_DST_REGS, mnemonic[3] == 'q' || mnemonic[3] == 'l' ? REG_RAX : REG_RDX);
+    }
+    if (strncmp(mnemonic, "cmov", 4) == 0 || strncmp(mnemonic, "set", 3) == 0 ||
+        in_list((const char *const[]){"adc", "sbb", "rcl", "rcr", NULL}, mnemonic, true)) {
+        add_reg(regs.src, MAX_SRC_REGS, REG_FLAGS);
+    }
+    if (in_list(flag_writers, mnemonic, true)) {
+        add_reg(regs.dst, MAX_DST_REGS, REG_FLAGS);
+    }
+
+    for (i = 0; i < MAX_SRC_REGS; i++) {
+        packed |= (uint64_t)regs.src[i] << (8 * i);
+    }
+    for (i = 0; i < MAX_DST_REGS; i++) {
+        packed |= (uint64_t)regs.dst[i] << (8 * (MAX_SRC_REGS + i));
+    }
+    return packed;
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p){
+    if (model) {
+        model_exit();
+    }
+    if (profile) {
+        profile_exit();
+    }
+}
+
+/*
+ * Called with every vCPU stopped outside the plugin, which no longer gets the
+ * atexit callback. The reports are written first, and the trace buffer is
+ * flushed by QEMU at exit.
+ */
+static void plugin_done(qemu_plugin_id_t id)
+{
+    plugin_exit(id, NULL);
+    exit(EXIT_SUCCESS);
 }
 
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     size_t n = qemu_plugin_tb_n_insns(tb);
     size_t i;
+    bool traced = !profile && (!lazy || (g_pqii_data.status && in_window(g_pqii_data.icount + 1)));
+    bool counted = profile || (lazy && g_pqii_data.status && !traced);
+
+    if (profile) {
+        if (g_pqii_data.status) {
+            bb_info *bb = profile_tb(tb);
+            qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64, &bb->execs, 1);
+            qemu_plugin_register_vcpu_tb_exec_inline(tb, QEMU_PLUGIN_INLINE_ADD_U64, &profile_insns, n);
+        }
+    } else if (counted) {
+        qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_count, QEMU_PLUGIN_CB_NO_REGS, (void *)n);
+    }
 
     for (i = 0; i < n; i++) {
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
@@ -205,11 +1237,25 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                 insn, vcpu_insn_exec_before, QEMU_PLUGIN_CB_NO_REGS, (void *)(&udata_buf[idx_udata_buf]) );
             idx_udata_buf++;
             if(idx_udata_buf >= MAX_UDATA_BUF_SIZE) idx_udata_buf = 0;
-        } else {
+            // The TBs are flushed when the marker executes, but the rest of this TB still runs
+            if (insn_data[3] == (guint8)0xbe && !counted) traced = true;
+        } else if (traced && model) {
+            model_insn_info *info = model_insn_lookup(qemu_plugin_insn_vaddr(insn), qemu_plugin_insn_paddr(insn),
+                                                      qemu_plugin_insn_is_br_jmp(insn),
+                                                      qemu_plugin_insn_target_vaddr(insn));
+            qemu_plugin_register_vcpu_insn_exec_cb(
+                insn, vcpu_insn_exec_model, QEMU_PLUGIN_CB_NO_REGS, info);
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_haddr,
+                                         QEMU_PLUGIN_CB_NO_REGS,
+                                         rw, NULL);
+        } else if (traced) {
             uint64_t vaddr = qemu_plugin_insn_vaddr(insn);
             uint64_t paddr = qemu_plugin_insn_paddr(insn);
             int is_br_jmp = qemu_plugin_insn_is_br_jmp(insn);
             uint64_t target_vaddr = qemu_plugin_insn_target_vaddr(insn);
+            char *disas = qemu_plugin_insn_disas(insn);
+            qemu_plugin_regs(paddr, decode_regs(disas));
+            g_free(disas);
             qemu_plugin_register_vcpu_insn_exec_cb(
                 insn, vcpu_insn_get_vaddr, QEMU_PLUGIN_CB_NO_REGS, (void *)vaddr);
             qemu_plugin_register_vcpu_insn_exec_cb(
@@ -259,27 +1305,138 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
     }
 }
 
+/* Parses "name=N", and returns -1 if opt is not one, or 0 if N is malformed */
+static int parse_count(const char *opt, const char *name, uint64_t *value)
+{
+    size_t len = strlen(name);
+    char *end;
+
+    if (strncmp(opt, name, len) != 0 || opt[len] != '=') {
+        return -1;
+    }
+    *value = g_ascii_strtoull(opt + len + 1, &end, 0);
+    return end != opt + len + 1 && *end == '\0';
+}
+
 QEMU_PLUGIN_EXPORT
 int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
                         int argc, char **argv)
 {
     int i;
+    const char *simpoints_fname = NULL, *weights_fname = NULL;
 
+    plugin_id = id;
     for (i = 0; i < argc; i++) {
         char *opt = argv[i];
         if (g_strcmp0(opt, "io") == 0) {
             track_io = true;
         } else if (g_strcmp0(opt, "inline") == 0) {
             do_inline = true;
+        } else if (g_strcmp0(opt, "lazy") == 0) {
+            lazy = true;
+        } else if (g_strcmp0(opt, "start") == 0) {
+            start = true;
+        } else if (g_strcmp0(opt, "exit") == 0) {
+            exit_when_done = true;
+        } else if (g_strcmp0(opt, "priv=user") == 0) {
+            priv_value = 3;
+        } else if (g_strcmp0(opt, "priv=kernel") == 0) {
+            priv_value = 0;
+        } else if (parse_count(opt, "skip", &skip_insns) > 0
+                || parse_count(opt, "trace", &trace_insns) > 0
+                || parse_count(opt, "period", &period_insns) > 0
+                || parse_count(opt, "window", &window_insns) > 0
+                || parse_count(opt, "budget", &marker_budget) > 0) {
+        } else if (g_strcmp0(opt, "model") == 0) {
+            model = true;
+        } else if (parse_count(opt, "interval", &interval_insns) > 0
+                || parse_count(opt, "gshare", &gshare_bits) > 0) {
+        } else if (g_str_has_prefix(opt, "profile=")) {
+            profile = true;
+            profile_fname = g_strdup(opt + 8);
+        } else if (g_str_has_prefix(opt, "bbv=")) {
+            profile = true;
+            bbv_file = fopen(opt + 4, "w");
+            if (!bbv_file) {
+                fprintf(stderr, "cannot open basic block vectors: %s\n", opt + 4);
+                return -1;
+            }
+        } else if (parse_count(opt, "k", &num_clusters) > 0
+                || parse_count(opt, "lead", &lead_insns) > 0) {
+        } else if (g_str_has_prefix(opt, "simpoints=")) {
+            simpoints_fname = opt + 10;
+        } else if (g_str_has_prefix(opt, "weights=")) {
+            weights_fname = opt + 8;
+        } else if (g_str_has_prefix(opt, "out=")) {
+            model_file = fopen(opt + 4, "w");
+            if (!model_file) {
+                fprintf(stderr, "cannot open model output: %s\n", opt + 4);
+                return -1;
+            }
+        } else if (parse_count(opt, "cr3", &cr3_value) > 0) {
+            filter_cr3 = true;
+            cr3_value &= ~CR3_PCID_MASK;
         } else {
-            fprintf(stderr, "option parsing failed: %s\n", opt);
-            return -1;
+            int j, parsed = -1;
+            for (j = 0; j < MODEL_NUM_CACHES && parsed < 0; j++) {
+                parsed = parse_geometry(opt, &caches[j]);
+            }
+            if (parsed <= 0) {
+                fprintf(stderr, "option parsing failed: %s\n", opt);
+                return -1;
+            }
         }
     }
 
+    if (period_insns && (window_insns == 0 || window_insns > period_insns)) {
+        fprintf(stderr, "option parsing failed: window must be between 1 and period\n");
+        return -1;
+    }
+
+    if (gshare_bits == 0 || gshare_bits > 30 || interval_insns == 0) {
+        fprintf(stderr, "option parsing failed: gshare must be between 1 and 30, and interval positive\n");
+        return -1;
+    }
+
+    if (profile && (model || simpoints_fname || filter_cr3 || priv_value >= 0)) {
+        fprintf(stderr, "option parsing failed: profile cannot be combined with model, simpoints, cr3, or priv\n");
+        return -1;
+    }
+    /* The TBs translated while tracing is off do not count, so they are retranslated when it turns on */
+    if (profile) {
+        lazy = true;
+    }
+    if (simpoints_fname && load_simpoints(simpoints_fname, weights_fname) != 0) {
+        return -1;
+    }
+
     plugin_init();
+    g_pqii_data.lazy = lazy;
+    if (profile) {
+        bbs = g_hash_table_new(NULL, NULL);
+        projections = g_array_new(false, false, sizeof(double));
+        projection_intervals = g_array_new(false, false, sizeof(uint64_t));
+    }
+    if (model) {
+        g_pqii_data.quiet = 1;
+        model_init();
+    }
+    if (start) {
+        /* Nothing is translated yet, so the status is set without a flush */
+        static uint8_t begin_marker[3] = {0xbe, 0, 0};
+        if (model) {
+            model_marker(begin_marker);
+        } else {
+            qemu_plugin_nop(begin_marker);
+        }
+        g_pqii_data.status = 1;
+    }
 
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
     qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    if (profile) {
+        qemu_plugin_register_vcpu_syscall_cb(id, profile_syscall);
+        profile_timer();
+    }
     return 0;
 }
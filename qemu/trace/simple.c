@@ -48,6 +48,7 @@ static bool trace_writeout_enabled;
 enum {
     TRACE_BUF_LEN = 4096 * 1024,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
+    TRACE_PIPE_BUF_LEN = 1024 * 1024,
 };
 
 uint8_t trace_buf[TRACE_BUF_LEN];
@@ -433,6 +434,20 @@ bool st_set_trace_file_enabled(bool enable)
          *  compressed backend output.
          */
         assert(trace_fp != NULL);
+
+        /* A trace file that is a FIFO streams to a live reader, such as
+         * ChampSim, so write it in large batches. A full pipe stalls the
+         * writeout thread, and then the vCPUs, until the reader catches up.
+         */
+        {
+            struct stat st;
+            if (fstat(fileno(trace_fp), &st) == 0 && S_ISFIFO(st.st_mode)) {
+                setvbuf(trace_fp, NULL, _IOFBF, TRACE_PIPE_BUF_LEN);
+#ifdef F_SETPIPE_SZ
+                fcntl(fileno(trace_fp), F_SETPIPE_SZ, TRACE_PIPE_BUF_LEN);
+#endif
+            }
+        }
         if (trace_file_name) {
             int trace_file_name_len = strlen(trace_file_name);
             char *trace_file_name_suffix = trace_file_name + trace_file_name_len - 3;
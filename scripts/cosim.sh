@@ -0,0 +1,45 @@
+# Simulate a QEMU trace in ChampSim while QEMU generates it, without writing it to disk.
+#
+# QEMU writes the trace into a FIFO, and ChampSim reads it from the other end.
+# Both run at once on separate cores, and each waits for the other when the
+# pipe is full or empty. Set TEE to also keep a copy of the trace on disk.
+# Run the workload in the guest over SSH, on port 10022. QEMU is stopped when
+# ChampSim has simulated its instructions.
+
+BIN=./champsim/bin/champsim
+DISK=/PATH/TO/my_ubuntu22_image_20230418.qcow2
+PLUGIN=/PATH/TO/qemu/tests/plugin/libcache_test.so,arg=lazy
+EVENTS=`pwd`/scripts/events
+WORK_DIR=`mktemp -d`
+TEE= # PATH/to/copy.trace, empty for no copy
+WARMUP_INSN=000000000
+SIM_INSN=1000000000 # default 1B instructions
+
+# ChampSim recognizes QEMU traces by their extension
+FIFO=${WORK_DIR}/cosim.trace
+mkfifo ${FIFO}
+QEMU_TRACE=${FIFO}
+if [ -n "${TEE}" ]; then
+    QEMU_TRACE=${WORK_DIR}/tee.trace
+    mkfifo ${QEMU_TRACE}
+    tee ${TEE} < ${QEMU_TRACE} > ${FIFO} &
+fi
+
+qemu-system-x86_64 \
+    -cpu qemu64,+pcid \
+    -icount shift=0,align=off \
+    -m 16G \
+    -hda ${DISK} \
+    -trace events=${EVENTS},file=${QEMU_TRACE} \
+    -plugin ${PLUGIN} \
+    -net user,hostfwd=tcp::10022-:22 \
+    -net nic \
+    -display none \
+    < /dev/null &
+QEMU_PID=$!
+
+$BIN --warmup_instructions ${WARMUP_INSN} --simulation_instructions ${SIM_INSN} -c ${FIFO} > log.out
+
+kill -TERM ${QEMU_PID} 2>/dev/null
+wait
+rm -rf ${WORK_DIR}
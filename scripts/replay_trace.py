@@ -0,0 +1,238 @@
+#!/usr/bin/env python3
+"""
+Record a workload once, then trace it many times by replaying it.
+
+Usage:
+  python3 scripts/replay_trace.py record COMMAND
+  python3 scripts/replay_trace.py checkpoint
+  python3 scripts/replay_trace.py trace NAME [PLUGIN_ARG ...]
+  python3 scripts/replay_trace.py concat OUTPUT TRACE ...
+
+record runs COMMAND in the guest over SSH, under QEMU's record/replay and
+without the tracing plugin, from the snapshot LOADVM of DISK. The recording
+and a copy of the disk, which holds the VM snapshots, are kept in REC_DIR.
+
+checkpoint replays the recording once with the plugin only counting
+instructions, and saves a VM snapshot every CHECKPOINT_SECONDS. Each snapshot
+keeps the instruction count of the plugin, which is listed in
+REC_DIR/checkpoints.csv.
+
+trace replays the instructions between each pair of checkpoints in its own
+process, PARALLEL at a time, and concatenates their traces into
+OUT_DIR/NAME.trace. Every replay runs the same guest instructions, so the
+trace can be regenerated with other plugin arguments, such as io or model,
+without running the workload again. The instructions are counted as in
+"Run QEMU to generate traces" of the README, and FILTER_ARGS must be the same
+when checkpointing and tracing. The windows of each process are set by this
+script, so skip, trace, period, and window cannot be given.
+
+concat joins traces of the same QEMU build, as written by trace.
+"""
+
+import csv
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+sys.path.append(os.path.join(REPO, 'qemu', 'python'))
+from qemu.qmp import QEMUMonitorProtocol  # noqa: E402
+
+DISK = '/PATH/TO/my_ubuntu22_image_20230418.qcow2'
+LOADVM = 'openwhisk'  # empty to record from boot
+PLUGIN = '/PATH/TO/qemu/tests/plugin/libcache_test.so'
+FILTER_ARGS = []  # for example ['cr3=0x1234000'] or ['priv=user']
+EVENTS = os.path.join(REPO, 'scripts', 'events')
+REC_DIR = '/PATH/TO/recording'
+OUT_DIR = '/PATH/TO/traces'
+PORT = 10022
+GUEST_USER = 'user'
+CHECKPOINT_SECONDS = 60
+PARALLEL = os.cpu_count()
+
+TRACE_HEADER_SIZE = 24
+TRACE_RECORD_TYPE_MAPPING = 0
+
+
+def qemu_command(mode, snapshot, disk, qmp_socket, plugin_args=None, trace_file=None):
+    """The same machine is given for recording and replaying, which takes its packets from the recording"""
+    cmd = ['qemu-system-x86_64',
+           '-cpu', 'qemu64,+pcid',
+           '-icount', 'shift=0,align=off,rr={},rrfile={},rrsnapshot={}'.format(
+               mode, os.path.join(REC_DIR, 'replay.bin'), snapshot),
+           '-m', '16G',
+           '-drive', 'file={},if=none,id=img-direct'.format(disk),
+           '-drive', 'driver=blkreplay,if=none,image=img-direct,id=img-blkreplay',
+           '-device', 'ide-hd,drive=img-blkreplay',
+           '-netdev', 'user,id=net0' + (',hostfwd=tcp::{}-:22'.format(PORT) if mode == 'record' else ''),
+           '-device', 'e1000,netdev=net0',
+           '-object', 'filter-replay,id=replay,netdev=net0',
+           '-qmp', 'unix:{},server,nowait'.format(qmp_socket),
+           '-display', 'none']
+    if plugin_args is not None:
+        cmd += ['-plugin', ','.join([PLUGIN] + ['arg=' + a for a in plugin_args])]
+    if trace_file:
+        cmd += ['-trace', 'events={},file={}'.format(EVENTS, trace_file)]
+    return cmd
+
+
+def connect(qmp_socket, proc):
+    while proc.poll() is None:
+        try:
+            qmp = QEMUMonitorProtocol(qmp_socket)
+            qmp.connect()
+            return qmp
+        except OSError:
+            time.sleep(1)
+    sys.exit('QEMU exited before its monitor was ready')
+
+
+def record(command):
+    os.makedirs(REC_DIR, exist_ok=True)
+    disk = os.path.join(REC_DIR, 'disk.qcow2')
+    qmp_socket = os.path.join(REC_DIR, 'record.sock')
+    subprocess.check_call(['cp', '--reflink=auto', DISK, disk])
+
+    cmd = qemu_command('record', 'init', disk, qmp_socket)
+    if LOADVM:
+        cmd += ['-loadvm', LOADVM]
+    proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL)
+    qmp = connect(qmp_socket, proc)
+
+    ssh = ['ssh', '-n', '-o', 'StrictHostKeyChecking=no', '-o', 'UserKnownHostsFile=/dev/null',
+           '-o', 'ConnectTimeout=10', '-p', str(PORT), GUEST_USER + '@localhost']
+    while subprocess.call(ssh + ['true'], stderr=subprocess.DEVNULL) != 0:
+        time.sleep(1)
+    status = subprocess.call(ssh + [command])
+
+    # The replay shuts down where the recording was quit
+    qmp.cmd('quit')
+    proc.wait()
+    print('Recorded "{}" in {}, exit status {}'.format(command, REC_DIR, status))
+
+
+def checkpoint():
+    disk = os.path.join(REC_DIR, 'disk.qcow2')
+    qmp_socket = os.path.join(REC_DIR, 'checkpoint.sock')
+    count_args = ['lazy', 'skip={}'.format(2**64 - 1), 'trace=0'] + FILTER_ARGS
+    proc = subprocess.Popen(qemu_command('replay', 'init', disk, qmp_socket, count_args),
+                            stdin=subprocess.DEVNULL)
+    qmp = connect(qmp_socket, proc)
+
+    checkpoints = [('init', 0)]
+    while proc.poll() is None:
+        time.sleep(CHECKPOINT_SECONDS)
+        name = 'ckpt{}'.format(len(checkpoints))
+        # No snapshot can be taken while replay events are pending, so the guest runs a little longer
+        output = ''
+        for _ in range(10):
+            if qmp.cmd('stop') is None:
+                break
+            reply = qmp.cmd('human-monitor-command', {'command-line': 'savevm ' + name})
+            output = reply.get('return', '') if reply else ''
+            if qmp.cmd('cont') is None or 'pqii: icount' in output:
+                break
+            time.sleep(1)
+        if 'pqii: icount' in output:
+            icount = int(output.split('pqii: icount ')[1].split(',')[0])
+            checkpoints.append((name, icount))
+            print('Saved {} at instruction {}'.format(name, icount))
+        elif proc.poll() is None:
+            print('Could not save {}: {}'.format(name, output.strip()))
+    proc.wait()
+
+    with open(os.path.join(REC_DIR, 'checkpoints.csv'), 'w') as f:
+        writer = csv.writer(f)
+        writer.writerow(['name', 'icount'])
+        writer.writerows(checkpoints)
+
+
+def trace_range(name, index, snapshot, start, end, plugin_args):
+    work = os.path.join(OUT_DIR, '{}.{}'.format(name, index))
+    os.makedirs(work, exist_ok=True)
+    disk = os.path.join(work, 'disk.qcow2')
+    trace_file = work + '.trace'
+    subprocess.check_call(['cp', '--reflink=auto', os.path.join(REC_DIR, 'disk.qcow2'), disk])
+
+    # Every range but the first begins while tracing is already on, so it gets its own begin marker
+    args = ['lazy', 'skip={}'.format(start)] + (['start'] if index > 0 else [])
+    args += ['trace={}'.format(end - start), 'exit'] if end is not None else ['trace=0']
+    with open(work + '.log', 'w') as log:
+        subprocess.call(qemu_command('replay', snapshot, disk, os.path.join(work, 'qmp.sock'),
+                                     args + FILTER_ARGS + plugin_args, trace_file),
+                        stdin=subprocess.DEVNULL, stdout=log, stderr=subprocess.STDOUT)
+    shutil.rmtree(work)
+    return trace_file
+
+
+def trace(name, plugin_args):
+    with open(os.path.join(REC_DIR, 'checkpoints.csv')) as f:
+        checkpoints = [(row['name'], int(row['icount'])) for row in csv.DictReader(f)]
+
+    # Checkpoints taken while nothing was counted start the same range as the next one
+    ranges = []
+    for i, (snapshot, start) in enumerate(checkpoints):
+        end = checkpoints[i + 1][1] if i + 1 < len(checkpoints) else None
+        if end is None or end > start:
+            ranges.append((snapshot, start, end))
+
+    os.makedirs(OUT_DIR, exist_ok=True)
+    with ThreadPoolExecutor(max_workers=PARALLEL) as pool:
+        jobs = [pool.submit(trace_range, name, i, snapshot, start, end, plugin_args)
+                for i, (snapshot, start, end) in enumerate(ranges)]
+        traces = [job.result() for job in jobs]
+
+    concat(os.path.join(OUT_DIR, name + '.trace'), traces)
+    for t in traces:
+        os.remove(t)
+
+
+def read_mappings(f):
+    """Reads the header and the event mappings, and returns them with the first event record"""
+    head = f.read(TRACE_HEADER_SIZE)
+    mappings = []
+    while True:
+        record_type = f.read(8)
+        if len(record_type) < 8 or struct.unpack('<Q', record_type)[0] != TRACE_RECORD_TYPE_MAPPING:
+            return head, mappings, record_type
+        event_id, length = struct.unpack('<QI', f.read(12))
+        mappings.append((event_id, f.read(length)))
+
+
+def concat(output, traces):
+    with open(output, 'wb') as out:
+        first_mappings = None
+        for t in traces:
+            with open(t, 'rb') as f:
+                head, mappings, first = read_mappings(f)
+                if first_mappings is None:
+                    first_mappings = mappings
+                    out.write(head)
+                    for event_id, event_name in mappings:
+                        out.write(struct.pack('<QQI', TRACE_RECORD_TYPE_MAPPING, event_id, len(event_name)))
+                        out.write(event_name)
+                elif mappings != first_mappings:
+                    sys.exit('{} was traced by another build of QEMU'.format(t))
+                out.write(first)
+                shutil.copyfileobj(f, out)
+
+
+def main():
+    if len(sys.argv) >= 3 and sys.argv[1] == 'record':
+        record(' '.join(sys.argv[2:]))
+    elif len(sys.argv) == 2 and sys.argv[1] == 'checkpoint':
+        checkpoint()
+    elif len(sys.argv) >= 3 and sys.argv[1] == 'trace':
+        trace(sys.argv[2], sys.argv[3:])
+    elif len(sys.argv) >= 4 and sys.argv[1] == 'concat':
+        concat(sys.argv[2], sys.argv[3:])
+    else:
+        sys.exit(__doc__)
+
+
+if __name__ == '__main__':
+    main()
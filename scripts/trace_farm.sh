@@ -0,0 +1,98 @@
+# Generate traces in parallel from one warmed-up VM.
+#
+# Usage: bash scripts/trace_farm.sh JOBS_FILE
+#
+# Each line of JOBS_FILE is a trace name followed by the command to run in the
+# guest, for example:
+#   chameleon ./bin/wsk action invoke chameleon -p num_of_rows 20 -p num_of_cols 20 --result -i
+#
+# Every job restores the same saved VM state into its own QEMU, on its own
+# copy-on-write overlay of the disk and its own forwarded SSH port, runs its
+# command, and writes OUT_DIR/<name>.trace. OUT_DIR/index.csv lists the jobs.
+#
+# To save the VM state, boot the VM on an overlay of the image, start OpenWhisk
+# and warm it up, then in the QEMU monitor:
+#   (qemu) stop
+#   (qemu) migrate "exec:cat > /PATH/TO/openwhisk.state"
+#   (qemu) quit
+# The overlay then holds the disk at the time of the state, and is given as DISK.
+# It must not be booted again, or the state no longer matches it.
+
+DISK=/PATH/TO/openwhisk-warm.qcow2
+STATE=/PATH/TO/openwhisk.state
+PLUGIN=/PATH/TO/qemu/tests/plugin/libcache_test.so,arg=lazy
+EVENTS=`pwd`/scripts/events
+OUT_DIR=/PATH/TO/traces
+PARALLEL=`nproc`
+BASE_PORT=10022
+GUEST_USER=user
+SSH_TIMEOUT=300
+
+if [ $# -ne 1 ]; then
+    echo "Usage: bash $0 JOBS_FILE"
+    exit 1
+fi
+JOBS_FILE=$1
+
+mkdir -p ${OUT_DIR}/overlays
+[ -f ${OUT_DIR}/index.csv ] || echo "name,port,trace,status,start,end,command" > ${OUT_DIR}/index.csv
+
+SSH="ssh -n -o StrictHostKeyChecking=no -o UserKnownHostsFile=/dev/null -o ConnectTimeout=10"
+
+run_job() {
+    local name=$1 port=$2 cmd=$3
+    local overlay=${OUT_DIR}/overlays/${name}.qcow2
+    local trace=${OUT_DIR}/${name}.trace
+    local start=`date +%s` status=ok
+
+    qemu-img create -q -f qcow2 -F qcow2 -b ${DISK} ${overlay} || return 1
+
+    qemu-system-x86_64 \
+        -cpu qemu64,+pcid \
+        -icount shift=0,align=off \
+        -m 16G \
+        -hda ${overlay} \
+        -trace events=${EVENTS},file=${trace} \
+        -plugin ${PLUGIN} \
+        -net user,hostfwd=tcp::${port}-:22 \
+        -net nic \
+        -display none \
+        -incoming "exec:cat ${STATE}" \
+        < /dev/null > ${OUT_DIR}/${name}.log 2>&1 &
+    local qemu_pid=$!
+
+    # The restored guest is already running, but slirp needs a moment to listen
+    local waited=0
+    until ${SSH} -p ${port} ${GUEST_USER}@localhost true 2>/dev/null; do
+        sleep 1
+        waited=$((waited + 1))
+        if [ ${waited} -ge ${SSH_TIMEOUT} ] || ! kill -0 ${qemu_pid} 2>/dev/null; then
+            status=unreachable
+            break
+        fi
+    done
+
+    if [ ${status} = ok ]; then
+        ${SSH} -p ${port} ${GUEST_USER}@localhost "${cmd}" >> ${OUT_DIR}/${name}.log 2>&1 || status=failed
+    fi
+
+    # QEMU flushes the trace when it is terminated
+    kill -TERM ${qemu_pid} 2>/dev/null
+    wait ${qemu_pid}
+    rm -f ${overlay}
+
+    echo "${name},${port},${trace},${status},${start},`date +%s`,\"${cmd//\"/\"\"}\"" >> ${OUT_DIR}/index.csv
+}
+
+job=0
+while read -r name cmd; do
+    case "${name}" in
+        ""|\#*) continue ;;
+    esac
+    while [ `jobs -rp | wc -l` -ge ${PARALLEL} ]; do
+        wait -n
+    done
+    run_job "${name}" $((BASE_PORT + job)) "${cmd}" &
+    job=$((job + 1))
+done < ${JOBS_FILE}
+wait